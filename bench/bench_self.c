@@ -0,0 +1,231 @@
+/*
+ * Self-benchmarks - zap's own hot paths, measured with zap
+ *
+ * Run: make bench-self            # Compare against bench/baseline
+ *      make bench-self-save       # Record a new bench/baseline
+ *
+ * Covers the statistics pass over a sample array, baseline loading (text
+ * and binary) and lookup, each timer backend's read, and the per-batch
+ * bookkeeping of ZAP_ITER and ZAP_ITER_UNROLLED. `make bench-self` fails
+ * when any of them regresses past --fail-threshold.
+ */
+
+/* Shorter phases: the suite has a dozen sizes to get through */
+#define ZAP_DEFAULT_WARMUP_TIME_NS 200000000ULL       // 200ms
+#define ZAP_DEFAULT_MEASUREMENT_TIME_NS 1000000000ULL  // 1s
+
+#define ZAP_IMPLEMENTATION
+#include "zap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SELF_MAX_NAME 64
+
+/* Deterministic sample values around 100ns, like a real run */
+static void fill_samples(double* samples, size_t n) {
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < n; i++) {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        samples[i] = 100.0 + (double)((x * 0x2545F4914F6CDD1DULL) >> 40) / (double)(1 << 20);
+    }
+}
+
+/* Benchmark: zap_compute_stats over n samples */
+void bench_compute_stats(zap_t* z) {
+    size_t n = *(size_t*)z->param;
+    double* samples = (double*)malloc(n * sizeof(double));
+    if (!samples) return;
+    fill_samples(samples, n);
+    zap_set_throughput_elements(z, n);
+
+    ZAP_ITER(z) {
+        zap_stats_t stats = zap_compute_stats(samples, n);
+        zap_black_box(stats);
+    }
+    free(samples);
+}
+
+/* A baseline with n entries named like grouped, parameterized benchmarks */
+static char* make_names(size_t n) {
+    char* names = (char*)malloc(n * SELF_MAX_NAME);
+    if (!names) return NULL;
+    for (size_t i = 0; i < n; i++) {
+        snprintf(names + i * SELF_MAX_NAME, SELF_MAX_NAME, "group_%zu/bench_%zu/%zu",
+                 i % 37, i, i * 64);
+    }
+    return names;
+}
+
+static void make_baseline(zap_baseline_t* b, const char* names, size_t n) {
+    zap_baseline_init(b);
+    double samples[16];
+    fill_samples(samples, 16);
+    zap_stats_t stats = zap_compute_stats(samples, 16);
+    stats.samples = NULL;  // Summary only, as for most saved entries
+    for (size_t i = 0; i < n; i++) {
+        zap_baseline_add(b, names + i * SELF_MAX_NAME, &stats);
+    }
+}
+
+static void bench_baseline_load(zap_t* z, bool binary) {
+    size_t n = *(size_t*)z->param;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/zap_self_%d_%zu", (int)getpid(), n);
+
+    char* names = make_names(n);
+    if (!names) return;
+    zap_baseline_t b;
+    make_baseline(&b, names, n);
+    bool saved = binary ? zap_baseline_save_binary(&b, path) : zap_baseline_save(&b, path);
+    zap_baseline_free(&b);
+    free(names);
+    if (!saved) return;
+    zap_set_throughput_elements(z, n);
+
+    ZAP_ITER(z) {
+        zap_baseline_t loaded;
+        zap_baseline_init(&loaded);
+        bool ok = zap_baseline_load(&loaded, path);
+        zap_black_box(ok);
+        zap_baseline_free(&loaded);
+    }
+    unlink(path);
+}
+
+/* Benchmark: zap_baseline_load of a text (v1) file with n entries */
+void bench_baseline_load_text(zap_t* z) {
+    bench_baseline_load(z, false);
+}
+
+/* Benchmark: zap_baseline_load of a binary (v2) file with n entries */
+void bench_baseline_load_binary(zap_t* z) {
+    bench_baseline_load(z, true);
+}
+
+/* Benchmark: zap_baseline_find in a baseline with n entries, keys in turn */
+void bench_baseline_find(zap_t* z) {
+    size_t n = *(size_t*)z->param;
+    char* names = make_names(n);
+    if (!names) return;
+    zap_baseline_t b;
+    make_baseline(&b, names, n);
+
+    size_t next = 0;
+    ZAP_ITER(z) {
+        const zap_baseline_entry_t* e = zap_baseline_find(&b, names + next * SELF_MAX_NAME);
+        zap_black_box(e);
+        if (++next == n) next = 0;
+    }
+    zap_baseline_free(&b);
+    free(names);
+}
+
+/* Benchmark: clock backend read (clock_gettime / mach_absolute_time) */
+void bench_timer_clock(zap_t* z) {
+    ZAP_ITER(z) {
+        uint64_t t = zap__clock_ticks();
+        zap_black_box(t);
+    }
+}
+
+#if defined(ZAP_HAS_TSC)
+/* Benchmark: fenced TSC read pair, as used around every batch */
+void bench_timer_tsc(zap_t* z) {
+    ZAP_ITER(z) {
+        uint64_t t0 = zap__tsc_begin();
+        uint64_t t1 = zap__tsc_end();
+        zap_black_box(t0);
+        zap_black_box(t1);
+    }
+}
+#endif
+
+/* Benchmark: zap_timer_read, the backend chosen by --timer */
+void bench_timer_read(zap_t* z) {
+    ZAP_ITER(z) {
+        uint64_t t = zap_timer_read();
+        zap_black_box(t);
+    }
+}
+
+/*
+ * An inner routine already past warmup, so each outer iteration is one batch
+ * of its bookkeeping: the start and end calls ZAP_ITER makes around the body.
+ * Its budget never runs out, and a full sample buffer is reused from the top.
+ */
+static void inner_init(zap_t* inner) {
+    zap_init(inner, "inner");
+    inner->config.measurement_time_ns = ZAP_SECONDS(3600);
+    inner->warmup_complete = true;
+    inner->start_time = zap_timer_read();  // Skips the "Measuring" status line
+}
+
+/* Benchmark: ZAP_ITER per-batch overhead (zap_loop_start + zap_loop_end) */
+void bench_iter_batch(zap_t* z) {
+    zap_t inner;
+    inner_init(&inner);
+
+    ZAP_ITER(z) {
+        if (inner.sample_count == inner.sample_capacity) inner.sample_count = 0;
+        bool more = zap_loop_start(&inner);
+        zap_loop_end(&inner);
+        zap_black_box(more);
+    }
+    zap_cleanup(&inner);
+}
+
+/* Benchmark: ZAP_ITER_UNROLLED per-batch overhead on the inline path */
+void bench_iter_batch_unrolled(zap_t* z) {
+    zap_t inner;
+    inner_init(&inner);
+    inner.unroll = 8;
+    zap_loop_start(&inner);
+    zap_loop_end(&inner);  // Arms the inline path
+
+    ZAP_ITER(z) {
+        if (inner.sample_count == inner.sample_capacity) inner.sample_count = 0;
+        bool more = zap_loop_start_unrolled(&inner, 8);
+        zap_loop_end_unrolled(&inner);
+        zap_black_box(more);
+    }
+    zap_cleanup(&inner);
+}
+
+ZAP_MAIN {
+    static size_t stats_sizes[] = {100, 1000, 10000, 100000, 1000000};
+    static size_t baseline_sizes[] = {1000, 10000, 100000};
+
+    zap_runtime_group_t* stats = zap_benchmark_group("stats");
+    for (size_t i = 0; i < sizeof(stats_sizes) / sizeof(stats_sizes[0]); i++) {
+        zap_bench_with_input(stats, zap_benchmark_id("compute_stats", (int64_t)stats_sizes[i]),
+                             &stats_sizes[i], sizeof(size_t), bench_compute_stats);
+    }
+    zap_group_finish(stats);
+
+    zap_runtime_group_t* baseline = zap_benchmark_group("baseline");
+    for (size_t i = 0; i < sizeof(baseline_sizes) / sizeof(baseline_sizes[0]); i++) {
+        zap_bench_with_input(baseline, zap_benchmark_id("load_text", (int64_t)baseline_sizes[i]),
+                             &baseline_sizes[i], sizeof(size_t), bench_baseline_load_text);
+        zap_bench_with_input(baseline, zap_benchmark_id("load_binary", (int64_t)baseline_sizes[i]),
+                             &baseline_sizes[i], sizeof(size_t), bench_baseline_load_binary);
+        zap_bench_with_input(baseline, zap_benchmark_id("find", (int64_t)baseline_sizes[i]),
+                             &baseline_sizes[i], sizeof(size_t), bench_baseline_find);
+    }
+    zap_group_finish(baseline);
+
+    zap_runtime_group_t* timer = zap_benchmark_group("timer");
+    zap_bench_function(timer, "clock", bench_timer_clock);
+#if defined(ZAP_HAS_TSC)
+    zap_bench_function(timer, "tsc", bench_timer_tsc);
+#endif
+    zap_bench_function(timer, "read", bench_timer_read);
+    zap_group_finish(timer);
+
+    zap_runtime_group_t* loop = zap_benchmark_group("loop");
+    zap_bench_function(loop, "iter_batch", bench_iter_batch);
+    zap_bench_function(loop, "iter_batch_unrolled", bench_iter_batch_unrolled);
+    zap_group_finish(loop);
+}
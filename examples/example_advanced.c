@@ -5,9 +5,12 @@
  * - Parameterized benchmarks
  * - Tags for filtering
  * - Setup/teardown hooks
+ * - Batched per-iteration setup (ZAP_ITER_BATCHED)
+ * - Allocation tracking (ZAP_TRACK_ALLOC)
  */
 
 #define ZAP_IMPLEMENTATION
+#define ZAP_TRACK_ALLOC  /* Report allocations per benchmark (glibc) */
 #include "zap.h"
 
 #include <stdlib.h>
@@ -71,6 +74,23 @@ static void bench_sort(zap_t* z) {
     }
 }
 
+/* Same sort, but the unsorted copy is made outside the timed region */
+static void copy_unsorted(zap_t* z, void* slot, size_t index) {
+    sort_input_t* input = (sort_input_t*)z->param;
+    (void)index;
+    memcpy(slot, input->data, input->size * sizeof(int));
+}
+
+static void bench_sort_batched(zap_t* z) {
+    sort_input_t* input = (sort_input_t*)z->param;
+    int* work;
+
+    ZAP_ITER_BATCHED(z, copy_unsorted, input->size * sizeof(int), work) {
+        bubble_sort(work, input->size);
+        zap_black_box(work);
+    }
+}
+
 /* Memory allocation benchmark */
 static void bench_malloc(zap_t* z) {
     size_t size = z->param ? *(size_t*)z->param : 64;
@@ -134,6 +154,8 @@ static void run_sorting_benchmarks(void) {
 
         zap_bench_with_input(group, zap_benchmark_id("bubble_sort", (int64_t)n),
                              &input, sizeof(input), bench_sort);
+        zap_bench_with_input(group, zap_benchmark_id("bubble_sort_batched", (int64_t)n),
+                             &input, sizeof(input), bench_sort_batched);
 
         free(input.data);
         free(input.work);
@@ -1,7 +1,7 @@
 /*
  * CI/Headless example - optimized for automated testing
  *
- * Compile: gcc -I.. -o ci example_ci.c -lm
+ * Compile: gcc -I.. -o ci example_ci.c -lm -pthread
  * Run: ./ci --json --fail-threshold 5
  */
 
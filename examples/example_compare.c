@@ -5,7 +5,7 @@
  * algorithm across different input sizes. It also demonstrates comparison
  * with previous runs via baseline files.
  *
- * Build: gcc -O3 -o example_compare examples/example_compare.c -lm
+ * Build: gcc -O3 -o example_compare examples/example_compare.c -lm -pthread
  * Run:   ./example_compare
  *        ./example_compare --env
  *        ./example_compare --json
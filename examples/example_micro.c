@@ -1,10 +1,11 @@
 /*
  * Micro-benchmark example - for very fast operations
  *
- * Compile: gcc -I.. -o micro example_micro.c -lm
+ * Compile: gcc -I.. -o micro example_micro.c -lm -pthread
  * Run: ./micro
  *
- * Uses minimum iterations to ensure accurate timing of fast code.
+ * Uses minimum iterations to ensure accurate timing of fast code, and
+ * ZAP_ITER_UNROLLED so the loop counter costs 1/8 as much per operation.
  */
 
 /* Micro-benchmark defaults: ensure enough iterations */
@@ -26,7 +27,7 @@ void bench_noop(zap_t* z) {
 void bench_int_add(zap_t* z) {
     int x = 0;
     zap_black_box(x);
-    ZAP_ITER(z) {
+    ZAP_ITER_UNROLLED(z, 8) {
         x = x + 1;
         zap_black_box(x);
     }
@@ -36,7 +37,7 @@ void bench_int_add(zap_t* z) {
 void bench_int_mul(zap_t* z) {
     int x = 1;
     zap_black_box(x);
-    ZAP_ITER(z) {
+    ZAP_ITER_UNROLLED(z, 8) {
         x = x * 3;
         zap_black_box(x);
     }
@@ -46,7 +47,7 @@ void bench_int_mul(zap_t* z) {
 void bench_int_div(zap_t* z) {
     int x = 1000000;
     zap_black_box(x);
-    ZAP_ITER(z) {
+    ZAP_ITER_UNROLLED(z, 8) {
         x = x / 2;
         if (x == 0) x = 1000000;
         zap_black_box(x);
@@ -57,7 +58,7 @@ void bench_int_div(zap_t* z) {
 void bench_float_mul(zap_t* z) {
     double x = 1.5;
     zap_black_box(x);
-    ZAP_ITER(z) {
+    ZAP_ITER_UNROLLED(z, 8) {
         x = x * 1.000001;
         zap_black_box(x);
     }
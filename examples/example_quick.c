@@ -1,7 +1,7 @@
 /*
  * Quick iteration example - fast feedback during development
  *
- * Compile: gcc -I.. -o quick example_quick.c -lm
+ * Compile: gcc -I.. -o quick example_quick.c -lm -pthread
  * Run: ./quick
  */
 
@@ -0,0 +1,46 @@
+/*
+ * Threaded example - contention and scaling across thread counts
+ *
+ * Compile: gcc -I.. -o threaded example_threaded.c -lm -pthread
+ * Run: ./threaded
+ */
+
+#define ZAP_IMPLEMENTATION
+#include "zap.h"
+
+/* One cache line per shard so threads never share a line */
+typedef struct {
+    uint64_t value;
+    char pad[64 - sizeof(uint64_t)];
+} shard_t;
+
+static uint64_t shared_counter;
+static shard_t shards[ZAP_MAX_THREADS];
+
+/* Every thread hammers the same cache line */
+static void bench_shared_atomic(zap_t* z) {
+    ZAP_ITER(z) {
+        __atomic_fetch_add(&shared_counter, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Each thread owns its shard: should scale with cores */
+static void bench_sharded(zap_t* z) {
+    uint64_t* mine = &shards[z->thread_index].value;
+    ZAP_ITER(z) {
+        __atomic_fetch_add(mine, 1, __ATOMIC_RELAXED);
+    }
+}
+
+ZAP_MAIN {
+    zap_runtime_group_t* g = zap_benchmark_group("counters");
+    zap_group_warmup_time(g, ZAP_MILLIS(200));
+    zap_group_measurement_time(g, ZAP_MILLIS(500));
+    zap_group_pin_threads(g, true);
+
+    const int threads[] = {1, 2, 4};
+    zap_bench_threaded(g, "shared_atomic", bench_shared_atomic, threads, 3);
+    zap_bench_threaded(g, "sharded", bench_sharded, threads, 3);
+
+    zap_group_finish(g);
+}
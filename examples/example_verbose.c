@@ -1,7 +1,7 @@
 /*
  * Verbose output example - shows all details by default
  *
- * Compile: gcc -I.. -o verbose example_verbose.c -lm
+ * Compile: gcc -I.. -o verbose example_verbose.c -lm -pthread
  * Run: ./verbose
  */
 
@@ -1,47 +1,15 @@
 // Baseline storage tests
+#define _DEFAULT_SOURCE  // truncate() under -std=c99
 #include "test.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
 
-// Declarations from zap.h
-typedef struct zap_stats {
-    double mean;
-    double median;
-    double std_dev;
-    double min;
-    double max;
-    double ci_lower;
-    double ci_upper;
-    size_t outliers;
-    size_t sample_count;
-    size_t iterations;
-    double p75, p90, p95, p99;
-    int throughput_type;
-    uint64_t throughput_value;
-} zap_stats_t;
-
-typedef struct zap_baseline_entry {
-    char name[256];
-    double mean;
-    double std_dev;
-    double ci_lower;
-    double ci_upper;
-} zap_baseline_entry_t;
-
-typedef struct zap_baseline {
-    zap_baseline_entry_t* entries;
-    size_t count;
-    size_t capacity;
-} zap_baseline_t;
-
-void zap_baseline_init(zap_baseline_t* b);
-void zap_baseline_free(zap_baseline_t* b);
-void zap_baseline_add(zap_baseline_t* b, const char* name, const zap_stats_t* stats);
-const zap_baseline_entry_t* zap_baseline_find(const zap_baseline_t* b, const char* name);
-bool zap_baseline_save(const zap_baseline_t* b, const char* path);
-bool zap_baseline_load(zap_baseline_t* b, const char* path);
+// Types and declarations from zap.h
+#include "zap.h"
 
 // Helper to create stats
 static zap_stats_t make_stats(double mean, double std_dev) {
@@ -214,6 +182,456 @@ TEST(test_baseline_load_nonexistent) {
     zap_baseline_free(&b);
 }
 
+TEST(test_baseline_metrics_roundtrip) {
+    const char* test_path = "/tmp/zap_test_baseline_metrics.txt";
+
+    zap_baseline_t b1;
+    zap_baseline_init(&b1);
+
+    zap_stats_t stats = make_stats(100.0, 5.0);
+    strcpy(stats.metrics[0].name, "cycles");
+    stats.metrics[0].value = 312.5;
+    strcpy(stats.metrics[1].name, "llc_misses");
+    stats.metrics[1].value = 0.25;
+    stats.metric_count = 2;
+    zap_baseline_add(&b1, "group/bench", &stats);
+    ASSERT(zap_baseline_save(&b1, test_path));
+
+    zap_baseline_t b2;
+    zap_baseline_init(&b2);
+    ASSERT(zap_baseline_load(&b2, test_path));
+
+    const zap_baseline_entry_t* e = zap_baseline_find(&b2, "group/bench");
+    ASSERT(e != NULL);
+    ASSERT_NEAR(e->mean, 100.0, 0.001);
+    ASSERT_EQ(e->metric_count, 2);
+
+    const zap_metric_t* m = zap_find_metric(e->metrics, e->metric_count, "llc_misses");
+    ASSERT(m != NULL);
+    ASSERT_NEAR(m->value, 0.25, 1e-12);
+    ASSERT(zap_find_metric(e->metrics, e->metric_count, "instructions") == NULL);
+
+    zap_baseline_free(&b1);
+    zap_baseline_free(&b2);
+    unlink(test_path);
+}
+
+TEST(test_compare_gated_metric_from_zero) {
+    zap_baseline_t b;
+    zap_baseline_init(&b);
+
+    zap_stats_t old_stats = make_stats(100.0, 5.0);
+    strcpy(old_stats.metrics[0].name, "allocs");
+    old_stats.metrics[0].value = 0.0;
+    old_stats.metric_count = 1;
+    zap_baseline_add(&b, "bench", &old_stats);
+    const zap_baseline_entry_t* e = zap_baseline_find(&b, "bench");
+
+    // Same time, but one allocation per iteration appeared
+    zap_stats_t cur = make_stats(100.0, 5.0);
+    strcpy(cur.metrics[0].name, "allocs");
+    cur.metrics[0].value = 1.0;
+    cur.metrics[0].kind = ZAP_METRIC_MEMORY;
+    cur.metrics[0].flags = ZAP_METRIC_GATED;
+    cur.metric_count = 1;
+
+    zap_comparison_t cmp = zap_compare(e, &cur);
+    ASSERT(cmp.change == ZAP_NO_CHANGE);
+    ASSERT(cmp.metric_regressed);
+    ASSERT(strcmp(cmp.metric_name, "allocs") == 0);
+    ASSERT(isinf(cmp.metric_change_pct));
+
+    // Ungated metrics never regress; tiny jitter stays under the floor
+    cur.metrics[0].flags = 0;
+    ASSERT(!zap_compare(e, &cur).metric_regressed);
+    cur.metrics[0].flags = ZAP_METRIC_GATED;
+    cur.metrics[0].value = 0.001;
+    ASSERT(!zap_compare(e, &cur).metric_regressed);
+
+    zap_baseline_free(&b);
+}
+
+TEST(test_compare_rate_metric_drop) {
+    zap_baseline_t b;
+    zap_baseline_init(&b);
+
+    zap_stats_t old_stats = make_stats(100.0, 5.0);
+    strcpy(old_stats.metrics[0].name, "bytes_out");
+    old_stats.metrics[0].value = 1000.0;
+    old_stats.metrics[0].kind = ZAP_METRIC_USER;
+    old_stats.metrics[0].flags = ZAP_METRIC_RATE | ZAP_METRIC_GATED | ZAP_METRIC_HIGHER;
+    old_stats.metric_count = 1;
+    zap_baseline_add(&b, "bench", &old_stats);
+    const zap_baseline_entry_t* e = zap_baseline_find(&b, "bench");
+
+    // Higher is better: a higher rate is an improvement, a lower one regresses
+    zap_stats_t cur = old_stats;
+    cur.metrics[0].value = 1500.0;
+    ASSERT(!zap_compare(e, &cur).metric_regressed);
+
+    cur.metrics[0].value = 800.0;
+    zap_comparison_t cmp = zap_compare(e, &cur);
+    ASSERT(cmp.metric_regressed);
+    ASSERT_STREQ(cmp.metric_name, "bytes_out");
+    ASSERT_NEAR(cmp.metric_change_pct, 20.0, 1e-9);
+
+    cur.metrics[0].value = 995.0;  // Under 1%
+    ASSERT(!zap_compare(e, &cur).metric_regressed);
+
+    zap_baseline_free(&b);
+}
+
+TEST(test_baseline_many_entries) {
+    zap_baseline_t b;
+    zap_baseline_init(&b);
+
+    // Enough names to grow the entries, the index and the name arena
+    char name[64];
+    for (int i = 0; i < 20000; i++) {
+        snprintf(name, sizeof(name), "group%d/bench_%d", i % 37, i);
+        zap_stats_t stats = make_stats((double)i, 1.0);
+        stats.metrics[0].value = (double)i;
+        strcpy(stats.metrics[0].name, "allocs");
+        stats.metric_count = 1;
+        zap_baseline_add(&b, name, &stats);
+    }
+    ASSERT_EQ(b.count, 20000);
+    ASSERT(b.index_size >= 2 * b.count);
+
+    for (int i = 0; i < 20000; i += 997) {
+        snprintf(name, sizeof(name), "group%d/bench_%d", i % 37, i);
+        const zap_baseline_entry_t* e = zap_baseline_find(&b, name);
+        ASSERT(e != NULL);
+        ASSERT_STREQ(e->name, name);
+        ASSERT_NEAR(e->mean, (double)i, 0.001);
+        // Metrics live in the arena, so they survive the entries moving
+        ASSERT_EQ(e->metric_count, 1);
+        ASSERT_NEAR(e->metrics[0].value, (double)i, 0.0);
+    }
+    ASSERT(zap_baseline_find(&b, "group0/bench_") == NULL);  // Prefix only
+
+    zap_baseline_free(&b);
+    ASSERT(b.index == NULL);
+    ASSERT(b.arena == NULL);
+}
+
+TEST(test_baseline_load_duplicate_keeps_last) {
+    const char* path = "/tmp/zap_test_baseline_dup";
+    FILE* f = fopen(path, "w");
+    ASSERT(f != NULL);
+    fprintf(f, "zap-baseline v1\n");
+    fprintf(f, "g/a|1|0|1|1\n");
+    fprintf(f, "g/b|2|0|2|2\n");
+    fprintf(f, "g/a|3|0|3|3\n");
+    fclose(f);
+
+    zap_baseline_t b;
+    zap_baseline_init(&b);
+    ASSERT(zap_baseline_load(&b, path));
+    ASSERT_EQ(b.count, 2);
+    ASSERT_NEAR(zap_baseline_find(&b, "g/a")->mean, 3.0, 0.001);
+    ASSERT_NEAR(zap_baseline_find(&b, "g/b")->mean, 2.0, 0.001);
+
+    zap_baseline_free(&b);
+    unlink(path);
+}
+
+TEST(test_baseline_text_full_metrics_roundtrip) {
+    const char* path = "/tmp/zap_test_baseline_metrics";
+    zap_baseline_t b;
+    zap_baseline_init(&b);
+
+    // Longest names and 17-digit values: one line is well past 512 bytes
+    zap_stats_t stats = make_stats(123.456, 7.89);
+    for (int i = 0; i < ZAP_MAX_METRICS; i++) {
+        zap_metric_t* m = &stats.metrics[i];
+        snprintf(m->name, sizeof(m->name), "custom_counter_long_name_%02d", i);
+        m->value = 1.0 / 3.0 + 1000.0 * i;
+        m->kind = ZAP_METRIC_USER;
+    }
+    stats.metric_count = ZAP_MAX_METRICS;
+    zap_baseline_add(&b, "group/bench", &stats);
+    ASSERT(zap_baseline_save(&b, path));
+    zap_baseline_free(&b);
+
+    zap_baseline_init(&b);
+    ASSERT(zap_baseline_load(&b, path));
+    const zap_baseline_entry_t* e = zap_baseline_find(&b, "group/bench");
+    ASSERT(e != NULL);
+    ASSERT_EQ(e->metric_count, ZAP_MAX_METRICS);
+    for (int i = 0; i < ZAP_MAX_METRICS; i++) {
+        ASSERT_STREQ(e->metrics[i].name, stats.metrics[i].name);
+        ASSERT(e->metrics[i].value == stats.metrics[i].value);  // %.17g is exact
+    }
+    zap_baseline_free(&b);
+
+    // A line cut off mid-number is dropped rather than read as a wrong value
+    FILE* f = fopen(path, "w");
+    ASSERT(f != NULL);
+    fprintf(f, "zap-baseline v1\n");
+    fprintf(f, "g/a|1|0|1|1|allocs=2\n");
+    fprintf(f, "g/b|2|0|2|2|allocs=12.5");
+    fclose(f);
+    zap_baseline_init(&b);
+    ASSERT(zap_baseline_load(&b, path));
+    ASSERT_EQ(b.count, 1);
+    ASSERT(zap_baseline_find(&b, "g/b") == NULL);
+    zap_baseline_free(&b);
+    unlink(path);
+}
+
+TEST(test_baseline_binary_roundtrip) {
+    const char* path = "/tmp/zap_test_baseline_v2";
+    double samples[] = {10.0, 11.0, 9.5, 10.5};
+
+    zap_baseline_t b1;
+    zap_baseline_init(&b1);
+    zap_stats_t stats = make_stats(10.25, 0.6);
+    stats.samples = samples;
+    stats.sample_count = 4;
+    strcpy(stats.metrics[0].name, "allocs");
+    stats.metrics[0].value = 2.0;
+    stats.metrics[0].kind = ZAP_METRIC_MEMORY;
+    stats.metrics[0].flags = ZAP_METRIC_GATED;
+    stats.metric_count = 1;
+    zap_baseline_add(&b1, "group/with_samples", &stats);
+    samples[0] = -1.0;  // The baseline keeps its own copy
+
+    zap_stats_t plain = make_stats(5.0, 0.1);
+    zap_baseline_add(&b1, "group/summary_only", &plain);
+    ASSERT(zap_baseline_save_binary(&b1, path));
+    zap_baseline_free(&b1);
+
+    zap_baseline_t b2;
+    zap_baseline_init(&b2);
+    ASSERT(zap_baseline_load(&b2, path));
+    ASSERT(b2.format == ZAP_BASELINE_BINARY);
+    ASSERT(b2.map != NULL);
+    ASSERT_EQ(b2.count, 0);  // Records are read on lookup
+    ASSERT_EQ(zap_baseline_size(&b2), 2);
+
+    const zap_baseline_entry_t* e = zap_baseline_find(&b2, "group/with_samples");
+    ASSERT(e != NULL);
+    ASSERT_NEAR(e->mean, 10.25, 1e-12);
+    ASSERT_EQ(e->sample_count, 4);
+    ASSERT_NEAR(e->samples[0], 10.0, 1e-12);
+    ASSERT_NEAR(e->samples[3], 10.5, 1e-12);
+    ASSERT_EQ(e->metric_count, 1);
+    ASSERT_STREQ(e->metrics[0].name, "allocs");
+    ASSERT(e->metrics[0].flags == ZAP_METRIC_GATED);
+    const char* map = (const char*)b2.map;
+    ASSERT((const char*)e->metrics > map && (const char*)e->metrics < map + b2.map_size);
+    ASSERT(e->name > map && e->name < map + b2.map_size);
+    ASSERT_EQ(b2.count, 1);
+
+    e = zap_baseline_find(&b2, "group/summary_only");
+    ASSERT(e != NULL);
+    ASSERT_EQ(e->sample_count, 0);
+    ASSERT(e->samples == NULL);
+
+    // Saving over the mapped file must not disturb the loaded entries
+    ASSERT(zap_baseline_save_binary(&b2, path));
+    ASSERT_NEAR(zap_baseline_find(&b2, "group/with_samples")->samples[1], 11.0, 1e-12);
+
+    zap_baseline_free(&b2);
+    ASSERT(b2.map == NULL);
+    unlink(path);
+}
+
+TEST(test_baseline_binary_lazy_lookup) {
+    const char* path = "/tmp/zap_test_baseline_v2_lazy";
+    zap_baseline_t b;
+    zap_baseline_init(&b);
+    char name[64];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "g/bench_%d", i);
+        zap_stats_t stats = make_stats((double)i, 1.0);
+        zap_baseline_add(&b, name, &stats);
+    }
+    ASSERT(zap_baseline_save_binary(&b, path));
+    zap_baseline_free(&b);
+
+    zap_baseline_init(&b);
+    ASSERT(zap_baseline_load(&b, path));
+    ASSERT_EQ(b.count, 0);
+    ASSERT_EQ(zap_baseline_size(&b), 1000);
+
+    // Each lookup reads one record through the file's hash table
+    const zap_baseline_entry_t* e = zap_baseline_find(&b, "g/bench_731");
+    ASSERT(e != NULL);
+    ASSERT_NEAR(e->mean, 731.0, 0.0);
+    ASSERT(zap_baseline_find(&b, "g/bench_731") == e);
+    ASSERT(zap_baseline_find(&b, "g/bench_") == NULL);
+    ASSERT_EQ(b.count, 1);
+
+    // A new result replaces its record; saving writes every record once
+    zap_stats_t stats = make_stats(-1.0, 1.0);
+    zap_baseline_add(&b, "g/bench_5", &stats);
+    zap_baseline_add(&b, "g/new", &stats);
+    ASSERT_EQ(zap_baseline_size(&b), 1001);
+    ASSERT(zap_baseline_save_binary(&b, path));
+    zap_baseline_free(&b);
+
+    zap_baseline_init(&b);
+    ASSERT(zap_baseline_load(&b, path));
+    ASSERT_EQ(zap_baseline_size(&b), 1001);
+    ASSERT_NEAR(zap_baseline_find(&b, "g/bench_5")->mean, -1.0, 0.0);
+    ASSERT_NEAR(zap_baseline_find(&b, "g/bench_999")->mean, 999.0, 0.0);
+    ASSERT(zap_baseline_find(&b, "g/new") != NULL);
+    zap_baseline_free(&b);
+    unlink(path);
+}
+
+TEST(test_baseline_binary_rejects_truncated) {
+    const char* path = "/tmp/zap_test_baseline_v2_bad";
+    double samples[] = {1.0, 2.0, 3.0};
+    zap_baseline_t b;
+    zap_baseline_init(&b);
+    zap_stats_t stats = make_stats(2.0, 1.0);
+    stats.samples = samples;
+    stats.sample_count = 3;
+    zap_baseline_add(&b, "bench", &stats);
+    ASSERT(zap_baseline_save_binary(&b, path));
+    zap_baseline_free(&b);
+
+    // Chop off the last sample
+    struct stat st;
+    ASSERT(stat(path, &st) == 0);
+    ASSERT(truncate(path, st.st_size - 8) == 0);
+
+    zap_baseline_init(&b);
+    ASSERT(!zap_baseline_load(&b, path));
+    ASSERT_EQ(b.count, 0);
+    zap_baseline_free(&b);
+    unlink(path);
+}
+
+TEST(test_baseline_merge_shards_and_json) {
+    const char* shard = "/tmp/zap_test_merge_shard";
+    const char* json = "/tmp/zap_test_merge.json";
+    FILE* f = fopen(shard, "w");
+    ASSERT(f != NULL);
+    fprintf(f, "zap-baseline v1\n");
+    fprintf(f, "g/a|1|0.1|0.9|1.1\n");
+    fprintf(f, "g/b|2|0.2|1.8|2.2\n");
+    fclose(f);
+
+    f = fopen(json, "w");
+    ASSERT(f != NULL);
+    fprintf(f, "{\"type\":\"environment\",\"cpu\":\"x\"}\n");
+    fprintf(f, "{\"name\":\"b\",\"group\":\"g\",\"samples\":10,\"mean_ns\":5.0,"
+               "\"std_dev_ns\":0.5,\"ci_lower_ns\":4.5,\"ci_upper_ns\":5.5,"
+               "\"metrics\":{\"allocs\":2.000000,\"cycles\":40.000000},"
+               "\"baseline\":{\"old_mean_ns\":2.0}}\n");
+    fprintf(f, "{\"name\":\"c\",\"group\":\"g\",\"error\":\"killed by signal 6\"}\n");
+    fclose(f);
+
+    zap_baseline_t b;
+    zap_baseline_init(&b);
+    ASSERT(zap_baseline_merge_file(&b, shard));
+    ASSERT(zap_baseline_merge_file(&b, json));
+    ASSERT_EQ(b.count, 2);
+    ASSERT_NEAR(zap_baseline_find(&b, "g/a")->mean, 1.0, 0.0);
+
+    const zap_baseline_entry_t* e = zap_baseline_find(&b, "g/b");  // JSON file came later
+    ASSERT(e != NULL);
+    ASSERT_NEAR(e->mean, 5.0, 0.0);
+    ASSERT_NEAR(e->ci_upper, 5.5, 0.0);
+    ASSERT_EQ(e->metric_count, 2);
+    ASSERT_STREQ(e->metrics[1].name, "cycles");
+    ASSERT_NEAR(e->metrics[1].value, 40.0, 0.0);
+    ASSERT(zap_baseline_find(&b, "g/c") == NULL);
+
+    zap_baseline_free(&b);
+    unlink(shard);
+    unlink(json);
+}
+
+TEST(test_history_append_and_series) {
+    const char* path = "/tmp/zap_test_history";
+    unlink(path);
+    zap_env_t env;
+    memset(&env, 0, sizeof(env));
+    strcpy(env.cpu_model, "Test CPU");
+
+    // Three runs; "g/b" is missing from the second
+    double samples[] = {3.0, 1.0, 2.0};
+    for (int run = 0; run < 3; run++) {
+        zap_baseline_t b;
+        zap_baseline_init(&b);
+        zap_stats_t a = make_stats(2.0 + run, 0.5);
+        a.samples = samples;
+        a.sample_count = 3;
+        zap_baseline_add(&b, "g/a", &a);
+        if (run != 1) {
+            zap_stats_t other = make_stats(7.0, 0.1);
+            zap_baseline_add(&b, "g/b", &other);
+        }
+        char commit[16];
+        snprintf(commit, sizeof(commit), "c%d", run);
+        ASSERT(zap_history_append(path, &env, commit, &b));
+        zap_baseline_free(&b);
+    }
+
+    zap_history_t h;
+    ASSERT(zap_history_open(&h, path));
+    ASSERT_EQ(h.run_count, 3);
+    ASSERT_STREQ(h.runs[2].commit, "c2");
+    ASSERT_STREQ(h.runs[0].cpu_model, "Test CPU");
+
+    zap_history_point_t points[4];
+    ASSERT_EQ(zap_history_series(&h, "g/a", points, 4), 3);
+    ASSERT_NEAR(points[2].mean, 4.0, 0.0);
+    ASSERT_NEAR(points[0].median, 2.0, 0.0);  // From the raw samples
+    ASSERT_EQ(points[1].sample_count, 3);
+    ASSERT_NEAR(points[1].samples[0], 3.0, 0.0);
+    ASSERT_EQ(zap_history_series(&h, "g/b", points, 4), 2);
+    ASSERT_EQ(points[1].run, 2);
+    ASSERT_EQ(zap_history_series(&h, "g/none", points, 4), 0);
+    zap_history_close(&h);
+
+    // A torn last run is skipped, then cut off by the next append
+    struct stat st;
+    ASSERT(stat(path, &st) == 0);
+    ASSERT(truncate(path, st.st_size - 8) == 0);
+    ASSERT(zap_history_open(&h, path));
+    ASSERT_EQ(h.run_count, 2);
+    zap_history_close(&h);
+
+    zap_baseline_t b;
+    zap_baseline_init(&b);
+    zap_stats_t a = make_stats(9.0, 0.5);
+    zap_baseline_add(&b, "g/a", &a);
+    ASSERT(zap_history_append(path, &env, "c3", &b));
+    zap_baseline_free(&b);
+    ASSERT(zap_history_open(&h, path));
+    ASSERT_EQ(h.run_count, 3);
+    ASSERT_STREQ(h.runs[2].commit, "c3");
+    ASSERT_EQ(zap_history_series(&h, "g/a", points, 4), 3);
+    ASSERT_NEAR(points[2].median, 9.0, 0.0);  // No samples: the mean stands in
+    zap_history_close(&h);
+    unlink(path);
+}
+
+TEST(test_change_points_find_step) {
+    // Noisy level at 100, then a 10% slowdown from index 12
+    double values[24];
+    for (int i = 0; i < 24; i++) {
+        double noise = (i % 3 - 1) * 0.5;
+        values[i] = (i < 12 ? 100.0 : 110.0) + noise;
+    }
+    zap_change_point_t cps[ZAP_MAX_CHANGE_POINTS];
+    size_t n = zap_change_points(values, 24, cps, ZAP_MAX_CHANGE_POINTS);
+    ASSERT_EQ(n, 1);
+    ASSERT_EQ(cps[0].index, 12);
+    ASSERT_NEAR(cps[0].change_pct, 10.0, 0.5);
+    ASSERT(cps[0].p_value < ZAP_SIGNIFICANCE_ALPHA);
+
+    // Noise alone is not a change
+    for (int i = 0; i < 24; i++) values[i] = 100.0 + (i % 3 - 1) * 0.5;
+    ASSERT_EQ(zap_change_points(values, 24, cps, ZAP_MAX_CHANGE_POINTS), 0);
+}
+
 void test_baseline(void) {
     RUN_TEST(test_baseline_init_free);
     RUN_TEST(test_baseline_add_find);
@@ -223,4 +641,16 @@ void test_baseline(void) {
     RUN_TEST(test_baseline_comparison_api_format);
     RUN_TEST(test_baseline_save_load);
     RUN_TEST(test_baseline_load_nonexistent);
+    RUN_TEST(test_baseline_metrics_roundtrip);
+    RUN_TEST(test_compare_gated_metric_from_zero);
+    RUN_TEST(test_compare_rate_metric_drop);
+    RUN_TEST(test_baseline_many_entries);
+    RUN_TEST(test_baseline_load_duplicate_keeps_last);
+    RUN_TEST(test_baseline_text_full_metrics_roundtrip);
+    RUN_TEST(test_baseline_binary_roundtrip);
+    RUN_TEST(test_baseline_binary_lazy_lookup);
+    RUN_TEST(test_baseline_binary_rejects_truncated);
+    RUN_TEST(test_baseline_merge_shards_and_json);
+    RUN_TEST(test_history_append_and_series);
+    RUN_TEST(test_change_points_find_step);
 }
@@ -0,0 +1,303 @@
+// Baseline comparison tests
+#include "test.h"
+#include "zap.h"
+#include <stdio.h>
+#include <string.h>
+
+// Summary of samples, as a baseline entry and as current stats
+static void summarize(double* samples, size_t n, zap_baseline_entry_t* e, zap_stats_t* s) {
+    double mean = zap_mean(samples, n);
+    double sd = zap_std_dev(samples, n, mean);
+    double lo, hi;
+    zap_confidence_interval(samples, n, mean, sd, &lo, &hi);
+    if (e) {
+        memset(e, 0, sizeof(*e));
+        e->name = "bench";
+        e->mean = mean;
+        e->std_dev = sd;
+        e->ci_lower = lo;
+        e->ci_upper = hi;
+        e->samples = samples;
+        e->sample_count = n;
+    }
+    if (s) {
+        memset(s, 0, sizeof(*s));
+        s->mean = mean;
+        s->std_dev = sd;
+        s->ci_lower = lo;
+        s->ci_upper = hi;
+        s->samples = samples;
+        s->sample_count = n;
+    }
+}
+
+TEST(test_welch_known_p) {
+    double a[] = {1, 2, 3, 4, 5};
+    double b[] = {2, 3, 4, 5, 6};  // t = 1 with 8 degrees of freedom
+    double d;
+    double p = zap_welch_test(a, 5, b, 5, &d);
+    ASSERT_NEAR(p, 0.3466, 0.001);
+    ASSERT_NEAR(d, 1.0 / sqrt(2.5), 1e-9);
+}
+
+TEST(test_mann_whitney_separated) {
+    double a[] = {1, 2, 3};
+    double b[] = {4, 5, 6};
+    double r;
+    double p = zap_mann_whitney_test(a, 3, b, 3, &r);
+    ASSERT_NEAR(r, 1.0, 1e-9);       // Every b is slower
+    ASSERT_NEAR(p, 0.0809, 0.001);   // Normal approximation, continuity corrected
+
+    double same[] = {1, 2, 3};
+    p = zap_mann_whitney_test(a, 3, same, 3, &r);
+    ASSERT_NEAR(r, 0.0, 1e-9);
+    ASSERT_NEAR(p, 1.0, 1e-9);
+}
+
+TEST(test_bootstrap_deterministic) {
+    double a[40], b[40];
+    for (int i = 0; i < 40; i++) {
+        a[i] = 100.0 + (i % 7);
+        b[i] = 120.0 + (i % 5);
+    }
+    double shift1, shift2;
+    double p1 = zap_bootstrap_test(a, 40, b, 40, 500, &shift1);
+    double p2 = zap_bootstrap_test(a, 40, b, 40, 500, &shift2);
+    ASSERT(p1 < 0.01);
+    ASSERT_NEAR(p1, p2, 0.0);
+    ASSERT(shift1 > 15.0 && shift1 < 25.0);
+
+    double q = zap_bootstrap_test(a, 40, a, 40, 500, &shift1);
+    ASSERT(q > 0.5);
+}
+
+TEST(test_welch_finds_shift_ci_misses) {
+    // Wide but symmetric noise: the CIs overlap, the t-test still sees +6%
+    double a[100], b[100];
+    for (int i = 0; i < 100; i++) {
+        a[i] = 100.0 + (i % 2 ? 20.0 : -20.0);
+        b[i] = a[i] + 6.0;
+    }
+    zap_baseline_entry_t base;
+    zap_stats_t cur;
+    summarize(a, 100, &base, NULL);
+    summarize(b, 100, NULL, &cur);
+
+    zap_comparison_t ci = zap_compare_with(&base, &cur, ZAP_TEST_CI);
+    ASSERT(ci.test == ZAP_TEST_CI);
+    ASSERT(!ci.significant);
+    ASSERT(ci.change == ZAP_NO_CHANGE);
+
+    zap_comparison_t w = zap_compare_with(&base, &cur, ZAP_TEST_WELCH);
+    ASSERT(w.test == ZAP_TEST_WELCH);
+    ASSERT(w.significant);
+    ASSERT(w.p_value < 0.05);
+    ASSERT(w.effect_size > 0.0);
+    ASSERT(w.change == ZAP_REGRESSED);
+}
+
+TEST(test_compare_without_samples_uses_ci) {
+    double a[10], b[10];
+    for (int i = 0; i < 10; i++) {
+        a[i] = 100.0 + i;
+        b[i] = 100.0 + i;
+    }
+    zap_baseline_entry_t base;
+    zap_stats_t cur;
+    summarize(a, 10, &base, NULL);
+    summarize(b, 10, NULL, &cur);
+    base.samples = NULL;  // Text baselines carry no samples
+    base.sample_count = 0;
+
+    zap_comparison_t cmp = zap_compare_with(&base, &cur, ZAP_TEST_MWU);
+    ASSERT(cmp.test == ZAP_TEST_CI);
+    ASSERT_NEAR(cmp.p_value, 0.0, 0.0);
+    ASSERT(cmp.change == ZAP_NO_CHANGE);
+}
+
+static void bench_noop(zap_t* z) {
+    volatile uint64_t sink = 0;
+    ZAP_ITER(z) {
+        sink += 1;
+    }
+}
+
+TEST(test_compare_impl_isa_skips_and_grows) {
+    zap_compare_group_t* g = zap_compare_group("isa");
+    g->config.warmup_time_ns = ZAP_MILLIS(1);
+    g->config.measurement_time_ns = ZAP_MILLIS(2);
+    g->config.sample_count = 10;
+
+#if defined(__aarch64__)
+    const zap_isa_t missing = ZAP_ISA_AVX2;
+#else
+    const zap_isa_t missing = ZAP_ISA_NEON;
+#endif
+    zap_compare_ctx_t* ctx = zap_compare_begin(g, zap_benchmark_id("noop", 1), NULL, 0);
+    zap_compare_impl(ctx, "plain", bench_noop);
+    zap_compare_impl_isa(ctx, "missing", missing, bench_noop);
+    zap_compare_impl_isa(ctx, "scalar", ZAP_ISA_SCALAR, bench_noop);
+    char names[10][16];
+    for (int i = 0; i < 10; i++) {  // More than the old fixed limit of 8
+        snprintf(names[i], sizeof(names[i]), "v%d", i);
+        zap_compare_impl(ctx, names[i], bench_noop);
+    }
+
+    ASSERT_EQ(ctx->impl_count, 13);
+    ASSERT(ctx->has_isa);
+    ASSERT(ctx->results[1].skipped);
+    ASSERT(!ctx->results[1].valid);
+    ASSERT(ctx->results[2].valid);
+    ASSERT(ctx->results[2].isa_variant && ctx->results[2].isa == ZAP_ISA_SCALAR);
+    ASSERT(!ctx->results[0].isa_variant);
+    ASSERT(ctx->results[12].valid);
+    ASSERT_STREQ(ctx->results[12].name, "v9");
+
+    zap_compare_end(ctx);
+    zap_compare_group_finish(g);
+    ASSERT(ctx->results == NULL);
+}
+
+// Which implementation ran each measured batch, in order
+static int batch_log[512];
+static size_t batch_log_len;
+
+static void log_batches(zap_t* z, int id) {
+    volatile uint64_t sink = 0;
+    while (zap_loop_start(z)) {
+        if (z->measuring && batch_log_len < 512) batch_log[batch_log_len++] = id;
+        for (uint64_t i = 0; i < z->iterations; i++) sink += 1;
+        zap_loop_end(z);
+    }
+}
+
+static void bench_log_a(zap_t* z) { log_batches(z, 0); }
+static void bench_log_b(zap_t* z) { log_batches(z, 1); }
+
+TEST(test_compare_interleaved_rounds) {
+    zap_compare_group_t* g = zap_compare_group("interleave");
+    g->config.warmup_time_ns = ZAP_MILLIS(1);
+    g->config.measurement_time_ns = ZAP_SECONDS(5);  // Sample count is the limit
+    g->config.sample_count = 20;
+    zap_compare_interleave(g, true);
+
+    batch_log_len = 0;
+    zap_compare_ctx_t* ctx = zap_compare_begin(g, zap_benchmark_id("log", 1), NULL, 0);
+    zap_compare_impl(ctx, "a", bench_log_a);
+    zap_compare_impl(ctx, "b", bench_log_b);
+    ASSERT(!ctx->results[0].valid);  // Runs at zap_compare_end
+    zap_compare_end(ctx);
+
+    ASSERT(ctx->results[0].valid && ctx->results[1].valid);
+    ASSERT_EQ(ctx->results[0].stats.sample_count, 20);
+    ASSERT_EQ(ctx->results[1].stats.sample_count, 20);
+    // Every round holds one batch of each, in either order
+    ASSERT_EQ(batch_log_len, 40);
+    for (size_t i = 0; i < batch_log_len; i += 2) {
+        ASSERT(batch_log[i] != batch_log[i + 1]);
+    }
+    zap_compare_group_finish(g);
+}
+
+// b's third measured batch ends without a sample, like a --freq-monitor reject
+static void bench_log_b_reject(zap_t* z) {
+    volatile uint64_t sink = 0;
+    int measured = 0;
+    while (zap_loop_start(z)) {
+        if (z->measuring && batch_log_len < 512) batch_log[batch_log_len++] = 1;
+        for (uint64_t i = 0; i < z->iterations; i++) sink += 1;
+        if (z->measuring && ++measured == 3) {
+            z->measuring = false;
+            continue;
+        }
+        zap_loop_end(z);
+    }
+}
+
+TEST(test_compare_interleaved_drops_partial_round) {
+    zap_compare_group_t* g = zap_compare_group("interleave_hole");
+    g->config.warmup_time_ns = ZAP_MILLIS(1);
+    g->config.measurement_time_ns = ZAP_SECONDS(5);
+    g->config.sample_count = 20;
+    zap_compare_interleave(g, true);
+
+    batch_log_len = 0;
+    zap_compare_ctx_t* ctx = zap_compare_begin(g, zap_benchmark_id("hole", 1), NULL, 0);
+    zap_compare_impl(ctx, "a", bench_log_a);
+    zap_compare_impl(ctx, "b", bench_log_b_reject);
+    zap_compare_end(ctx);
+
+    // a's sample from the round b lost was dropped too, so both ran 21 batches
+    ASSERT_EQ(ctx->results[0].stats.sample_count, 20);
+    ASSERT_EQ(ctx->results[1].stats.sample_count, 20);
+    size_t a_batches = 0;
+    for (size_t i = 0; i < batch_log_len; i++) a_batches += batch_log[i] == 0;
+    ASSERT_EQ(a_batches, 21);
+    ASSERT_EQ(batch_log_len, 42);
+    zap_compare_group_finish(g);
+}
+
+static zap_metric_t user_metric(const char* name, double value, uint32_t flags) {
+    zap_metric_t m;
+    memset(&m, 0, sizeof(m));
+    snprintf(m.name, sizeof(m.name), "%s", name);
+    m.value = value;
+    m.kind = ZAP_METRIC_USER;
+    m.flags = flags;
+    return m;
+}
+
+TEST(test_counter_direction_gates) {
+    zap_t z;
+    zap_init(&z, "dir");
+    zap_counter_set_rate(&z, "probes", false);
+    zap_counter_set_direction(&z, "hits", ZAP_COUNTER_HIGHER_IS_BETTER);
+    ASSERT_EQ(z.counter_direction[0], ZAP_COUNTER_UNGATED);  // Default
+    ASSERT_EQ(z.counter_direction[1], ZAP_COUNTER_HIGHER_IS_BETTER);
+    zap_cleanup(&z);
+
+    double samples[] = {100, 101, 99, 100, 100, 101, 99, 100};
+    zap_baseline_entry_t base;
+    zap_stats_t cur;
+    summarize(samples, 8, &base, &cur);
+    zap_metric_t base_metrics[3];
+    base_metrics[0] = user_metric("probes", 2.0, 0);
+    base_metrics[1] = user_metric("hits", 10.0, ZAP_METRIC_GATED | ZAP_METRIC_HIGHER);
+    base_metrics[2] = user_metric("misses", 1.0, ZAP_METRIC_GATED);
+    base.metrics = base_metrics;
+    base.metric_count = 3;
+
+    // Everything rises: only the lower-is-better counter regressed
+    cur.metrics[0] = user_metric("probes", 4.0, 0);
+    cur.metrics[1] = user_metric("hits", 20.0, ZAP_METRIC_GATED | ZAP_METRIC_HIGHER);
+    cur.metrics[2] = user_metric("misses", 1.5, ZAP_METRIC_GATED);
+    cur.metric_count = 3;
+    zap_comparison_t cmp = zap_compare_with(&base, &cur, ZAP_TEST_CI);
+    ASSERT(cmp.metric_regressed);
+    ASSERT_STREQ(cmp.metric_name, "misses");
+    ASSERT_NEAR(cmp.metric_change_pct, 50.0, 1e-9);
+
+    // A drop in the higher-is-better counter is the regression
+    cur.metrics[1].value = 5.0;
+    cur.metrics[2].value = 1.0;
+    cmp = zap_compare_with(&base, &cur, ZAP_TEST_CI);
+    ASSERT(cmp.metric_regressed);
+    ASSERT_STREQ(cmp.metric_name, "hits");
+
+    // An ungated counter never is
+    cur.metrics[1].value = 10.0;
+    cmp = zap_compare_with(&base, &cur, ZAP_TEST_CI);
+    ASSERT(!cmp.metric_regressed);
+}
+
+void test_compare(void) {
+    RUN_TEST(test_welch_known_p);
+    RUN_TEST(test_mann_whitney_separated);
+    RUN_TEST(test_bootstrap_deterministic);
+    RUN_TEST(test_welch_finds_shift_ci_misses);
+    RUN_TEST(test_compare_without_samples_uses_ci);
+    RUN_TEST(test_compare_impl_isa_skips_and_grows);
+    RUN_TEST(test_compare_interleaved_rounds);
+    RUN_TEST(test_compare_interleaved_drops_partial_round);
+    RUN_TEST(test_counter_direction_gates);
+}
@@ -0,0 +1,122 @@
+// Environment detection tests
+#include "test.h"
+#include "zap.h"
+#include <stdio.h>
+#include <string.h>
+
+TEST(test_env_detect_noise_fields) {
+    zap_env_t env;
+    zap_env_detect(&env);
+
+    ASSERT(env.turbo >= -1 && env.turbo <= 1);
+    ASSERT(env.smt >= -1 && env.smt <= 1);
+    ASSERT(env.pinned_cpu >= -1);
+    ASSERT(env.pinned_siblings >= 0);
+    ASSERT(env.noise_count <= sizeof(env.noise) / sizeof(env.noise[0]));
+#if defined(__linux__) || defined(__APPLE__)
+    ASSERT(env.load_avg[0] >= 0.0);
+#endif
+    for (size_t i = 0; i < env.noise_count; i++) {
+        ASSERT(env.noise[i][0] != '\0');
+    }
+}
+
+TEST(test_env_detect_memory_fields) {
+    zap_env_t env;
+    zap_env_detect(&env);
+
+    ASSERT(env.cache_line >= 0);
+    ASSERT(env.numa_nodes >= 0);
+    ASSERT(env.base_mhz >= 0.0 && env.max_mhz >= 0.0);
+    if (env.cache_bytes[0] && env.cache_bytes[1]) {
+        ASSERT(env.cache_bytes[0] < env.cache_bytes[1]);
+    }
+}
+
+TEST(test_cache_sweep_straddles_levels) {
+    size_t sizes[ZAP_CACHE_SWEEP_MAX];
+    size_t n = zap_cache_sweep_sizes(sizes, ZAP_CACHE_SWEEP_MAX);
+    ASSERT(n >= 3);
+    for (size_t i = 1; i < n; i++) {
+        ASSERT(sizes[i] > sizes[i - 1]);
+    }
+
+    // Every known level has a size inside it and one past it
+    zap_env_t env;
+    zap_env_detect(&env);
+    for (int level = 0; level < 3; level++) {
+        size_t c = env.cache_bytes[level];
+        if (c == 0) continue;
+        bool below = false, above = false;
+        for (size_t i = 0; i < n; i++) {
+            if (sizes[i] <= c / 2) below = true;
+            if (sizes[i] >= c * 2) above = true;
+        }
+        ASSERT(below && above);
+    }
+
+    size_t two[2];
+    ASSERT_EQ(zap_cache_sweep_sizes(two, 2), 2);
+    ASSERT_EQ(two[0], sizes[0]);
+}
+
+static zap_machine_t sample_machine(void) {
+    zap_machine_t m;
+    memset(&m, 0, sizeof(m));
+    strcpy(m.cpu_model, "Test CPU @ 3.00GHz");
+    m.cache_bytes[0] = 32 * 1024;
+    m.cache_bytes[1] = 1024 * 1024;  // No L3
+    m.copy_gbs[0] = 200.0;
+    m.triad_gbs[0] = 150.0;
+    m.copy_gbs[1] = 80.0;
+    m.triad_gbs[1] = 90.0;
+    m.copy_gbs[ZAP_MACHINE_DRAM] = 15.0;
+    m.triad_gbs[ZAP_MACHINE_DRAM] = 12.0;
+    m.scalar_gflops = 6.0;
+    strcpy(m.isa[0], "sse2");
+    m.isa_gflops[0] = 12.0;
+    strcpy(m.isa[1], "avx2");
+    m.isa_gflops[1] = 48.0;
+    m.isa_count = 2;
+    return m;
+}
+
+TEST(test_machine_roundtrip) {
+    const char* path = "/tmp/zap_test_machine";
+    zap_machine_t m = sample_machine();
+    ASSERT(zap_machine_save(&m, path));
+
+    zap_machine_t loaded;
+    ASSERT(zap_machine_load(&loaded, path));
+    ASSERT_STREQ(loaded.cpu_model, m.cpu_model);
+    ASSERT_EQ(loaded.cache_bytes[1], m.cache_bytes[1]);
+    ASSERT_EQ(loaded.cache_bytes[2], 0);
+    ASSERT_NEAR(loaded.triad_gbs[1], 90.0, 1e-3);
+    ASSERT_NEAR(loaded.copy_gbs[ZAP_MACHINE_DRAM], 15.0, 1e-3);
+    ASSERT_EQ(loaded.isa_count, 2);
+    ASSERT_STREQ(loaded.isa[1], "avx2");
+    ASSERT_NEAR(loaded.scalar_gflops, 6.0, 1e-3);
+    remove(path);
+}
+
+TEST(test_machine_level_and_peaks) {
+    zap_machine_t m = sample_machine();
+    ASSERT_EQ(zap_machine_level(&m, 4096), 0);
+    ASSERT_EQ(zap_machine_level(&m, 32 * 1024), 0);
+    ASSERT_EQ(zap_machine_level(&m, 32 * 1024 + 1), 1);
+    ASSERT_EQ(zap_machine_level(&m, 64 * 1024 * 1024), ZAP_MACHINE_DRAM);  // Skips the missing L3
+    ASSERT_STREQ(zap_machine_level_name(ZAP_MACHINE_DRAM), "DRAM");
+    ASSERT_NEAR(zap_machine_peak_gbs(&m, 1), 90.0, 0.0);  // Better of copy and triad
+
+    const char* isa = NULL;
+    ASSERT_NEAR(zap_machine_peak_gflops(&m, &isa), 48.0, 0.0);
+    ASSERT_STREQ(isa, "avx2");
+}
+
+void test_env(void) {
+    RUN_TEST(test_env_detect_noise_fields);
+    RUN_TEST(test_env_detect_memory_fields);
+    RUN_TEST(test_cache_sweep_straddles_levels);
+    RUN_TEST(test_machine_roundtrip);
+    RUN_TEST(test_machine_level_and_peaks);
+}
@@ -1,9 +1,12 @@
 // Filter matching tests
 #include "test.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 
-// Declaration from zap.h
+// Declarations from zap.h
 bool zap_matches_filter(const char* name, const char* pattern);
+size_t zap_shard_of(const char* key, size_t shard_count);
 
 TEST(test_filter_null_pattern) {
     ASSERT(zap_matches_filter("anything", NULL) == true);
@@ -50,6 +53,24 @@ TEST(test_filter_mixed_wildcards) {
     ASSERT(zap_matches_filter("bench_sort_quick", "?????_*") == true);
 }
 
+TEST(test_shard_partition) {
+    // Every key lands in exactly one shard, the same one on every call
+    size_t per_shard[4] = {0};
+    char key[64];
+    for (int i = 0; i < 400; i++) {
+        snprintf(key, sizeof(key), "group/bench_%d", i);
+        size_t shard = zap_shard_of(key, 4);
+        ASSERT(shard < 4);
+        ASSERT_EQ(zap_shard_of(key, 4), shard);
+        per_shard[shard]++;
+    }
+    for (int i = 0; i < 4; i++) {
+        ASSERT(per_shard[i] > 50);  // Roughly even
+    }
+    ASSERT_EQ(zap_shard_of("group/bench_0", 1), 0);
+    ASSERT_EQ(zap_shard_of("group/bench_0", 0), 0);
+}
+
 void test_filter(void) {
     RUN_TEST(test_filter_null_pattern);
     RUN_TEST(test_filter_empty_pattern);
@@ -59,4 +80,5 @@ void test_filter(void) {
     RUN_TEST(test_filter_wildcard_star);
     RUN_TEST(test_filter_wildcard_question);
     RUN_TEST(test_filter_mixed_wildcards);
+    RUN_TEST(test_shard_partition);
 }
@@ -0,0 +1,538 @@
+// Measurement loop tests
+#include "test.h"
+#include "zap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Short phases so loop tests finish in a few milliseconds
+static void init_fast(zap_t* z, const char* name) {
+    zap_init(z, name);
+    z->config.warmup_time_ns = ZAP_MILLIS(2);
+    z->config.measurement_time_ns = ZAP_MILLIS(5);
+}
+
+static size_t setup_calls = 0;
+
+static void mark_slot(zap_t* z, void* input, size_t index) {
+    (void)z;
+    *(size_t*)input = index + 1;  // Non-zero marks a prepared slot
+    setup_calls++;
+}
+
+TEST(test_batched_inputs_prepared) {
+    zap_t z;
+    init_fast(&z, "batched");
+    setup_calls = 0;
+
+    size_t consumed = 0;
+    size_t stale = 0;
+    size_t* slot;
+    ZAP_ITER_BATCHED(&z, mark_slot, sizeof(size_t), slot) {
+        if (*slot == 0) stale++;
+        *slot = 0;  // Consume, so a missed setup shows up as stale
+        consumed++;
+    }
+
+    ASSERT(z.sample_count > 0);
+    ASSERT_EQ(stale, 0);
+    ASSERT_EQ(consumed, setup_calls);
+    ASSERT(z.batch_slots >= z.iterations);
+    zap_cleanup(&z);
+    ASSERT(z.batch_pool == NULL);
+}
+
+TEST(test_loop_collects_samples) {
+    zap_t z;
+    init_fast(&z, "plain");
+    z.config.sample_count = 20;
+
+    volatile uint64_t sink = 0;
+    ZAP_ITER(&z) {
+        sink += 1;
+    }
+
+    ASSERT(z.sample_count >= 10);
+    ASSERT(z.warmup_complete);
+    for (size_t i = 0; i < z.sample_count; i++) {
+        ASSERT(z.samples[i] >= 0.0);
+    }
+    zap_cleanup(&z);
+}
+
+TEST(test_precision_target_stops_early) {
+    zap_t z;
+    init_fast(&z, "precision");
+    z.config.measurement_time_ns = ZAP_SECONDS(5);  // Must not be the limit
+    z.config.target_precision = 50.0;
+
+    volatile uint64_t sink = 0;
+    ZAP_ITER(&z) {
+        sink += 1;
+    }
+
+    ASSERT(z.stop_reason == ZAP_STOP_PRECISION);
+    ASSERT(z.sample_count >= ZAP_MIN_SAMPLES);
+    ASSERT(z.sample_count < z.config.sample_count);
+    // Running mean matches the batch mean
+    ASSERT_NEAR(z.run_mean, zap_mean(z.samples, z.sample_count), 1e-9 * z.run_mean + 1e-12);
+    zap_cleanup(&z);
+}
+
+TEST(test_linear_sampling_steps) {
+    zap_t z;
+    init_fast(&z, "linear");
+    z.config.sample_count = 20;
+    z.config.sampling_mode = ZAP_SAMPLING_LINEAR;
+
+    volatile uint64_t sink = 0;
+    ZAP_ITER(&z) {
+        sink += 1;
+    }
+
+    ASSERT(z.sample_count >= 2);
+    ASSERT(z.iter_step >= 1);
+    for (size_t i = 0; i < z.sample_count; i++) {
+        ASSERT_NEAR(z.sample_iters[i], (double)((i + 1) * z.iter_step), 0.5);
+    }
+
+    zap_cleanup(&z);
+    ASSERT(z.sample_iters == NULL);
+}
+
+TEST(test_latency_records_each_op) {
+    zap_t z;
+    init_fast(&z, "latency");
+    z.config.sample_count = 20;
+
+    volatile uint64_t sink = 0;
+    uint64_t ops = 0;
+    ZAP_ITER_LATENCY(&z) {
+        sink += 1;
+        if (z.warmup_complete) ops++;
+    }
+
+    ASSERT(z.latency.counts != NULL);
+    ASSERT_EQ(z.latency.total, ops);
+    double p50 = zap_latency_hist_percentile(&z.latency, 50.0);
+    double p99 = zap_latency_hist_percentile(&z.latency, 99.0);
+    double max = zap_latency_hist_percentile(&z.latency, 100.0);
+    ASSERT(p50 <= p99);
+    ASSERT(p99 <= max);
+    zap_cleanup(&z);
+    ASSERT(z.latency.counts == NULL);
+}
+
+// Every 50th op stalls for 200us, far longer than the 10us schedule interval
+static void run_stalling_latency(zap_t* z) {
+    volatile uint64_t sink = 0;
+    uint64_t op = 0;
+    ZAP_ITER_LATENCY(z) {
+        sink += 1;
+        if (++op % 50 == 0) {
+            uint64_t until = zap_now_ns() + 200000;
+            while (zap_now_ns() < until) {}
+        }
+    }
+}
+
+TEST(test_rate_corrects_coordinated_omission) {
+    zap_t closed;
+    init_fast(&closed, "closed");
+    closed.config.sample_count = 20;
+    run_stalling_latency(&closed);
+    double closed_p90 = zap_latency_hist_percentile(&closed.latency, 90.0);
+    zap_cleanup(&closed);
+
+    zap_t open;
+    init_fast(&open, "open");
+    open.config.sample_count = 20;
+    open.config.rate = 100000.0;
+    run_stalling_latency(&open);
+    ASSERT(open.rate_ticks > 0);
+    double open_p90 = zap_latency_hist_percentile(&open.latency, 90.0);
+
+    // Closed loop hides the stall in 2% of ops; open loop charges the ~20 ops
+    // queued behind each stall, pushing well past 10% of ops over 50us
+    ASSERT(closed_p90 < 50000.0);
+    ASSERT(open_p90 > 50000.0);
+
+    // Samples are per-op means, so the schedule bounds them from below
+    double achieved = 1e9 / zap_mean(open.samples, open.sample_count);
+    ASSERT(achieved > 0.0);
+    ASSERT(achieved < 100000.0 * 1.05);  // Never runs ahead of the schedule
+    zap_cleanup(&open);
+}
+
+TEST(test_latency_hist_precision) {
+    uint64_t counts[ZAP_LATENCY_BUCKETS] = {0};
+    zap_latency_hist_t h = {0};
+    h.counts = counts;
+    h.min_ticks = UINT64_MAX;
+    h.ns_per_tick = 1.0;
+
+    // 990 fast ops at 100 ticks, 10 stalls at 1,234,567 ticks
+    for (int i = 0; i < 990; i++) zap_latency_hist_add(&h, 100);
+    for (int i = 0; i < 10; i++) zap_latency_hist_add(&h, 1234567);
+
+    ASSERT_EQ(h.total, 1000);
+    ASSERT_NEAR(zap_latency_hist_percentile(&h, 50.0), 100.0, 0.0);  // Exact below 2^8
+    ASSERT_NEAR(zap_latency_hist_percentile(&h, 99.0), 100.0, 0.0);
+    ASSERT_NEAR(zap_latency_hist_percentile(&h, 99.9), 1234567.0, 1234567.0 * 0.01);
+    ASSERT_NEAR(zap_latency_hist_percentile(&h, 100.0), 1234567.0, 0.0);
+}
+
+TEST(test_unrolled_runs_whole_trips) {
+    zap_t z;
+    init_fast(&z, "unrolled");
+    z.config.sample_count = 50;
+
+    uint64_t runs = 0;
+    ZAP_ITER_UNROLLED(&z, 8) {
+        runs++;
+        zap_black_box(runs);
+    }
+
+    // Every batch, warmup included, is whole trips of the 8 copies
+    ASSERT(z.sample_count >= ZAP_MIN_SAMPLES);
+    ASSERT_EQ(runs % 8, 0);
+    ASSERT_EQ(z.measured_iters % 8, 0);
+    ASSERT_EQ(z.unroll, 8);
+    ASSERT(z.hot);  // Steady-state batches took the inline path
+    for (size_t i = 0; i < z.sample_count; i++) {
+        ASSERT(z.samples[i] >= 0.0);
+    }
+    zap_cleanup(&z);
+}
+
+TEST(test_cold_cache_single_iteration) {
+    static uint64_t table[4096];
+    zap_t z;
+    init_fast(&z, "cold");
+    z.config.sample_count = 20;
+    z.config.cache_mode = ZAP_CACHE_COLD;
+    z.param = table;
+    z.param_size = sizeof(table);  // Flushed by line before each sample
+
+    volatile uint64_t sink = 0;
+    ZAP_ITER(&z) {
+        sink += table[sink & 4095];
+    }
+
+    ASSERT(z.sample_count >= ZAP_MIN_SAMPLES);
+    ASSERT_EQ(z.iterations, 1);
+    ASSERT_EQ(z.measured_iters, z.sample_count);
+    zap_cleanup(&z);
+}
+
+TEST(test_freq_monitor_rejects_slow_samples) {
+    zap_g_config.freq_monitor = true;
+    zap_g_config.min_freq_ratio = 0.0;  // Tag only
+
+    zap_t z;
+    init_fast(&z, "freq");
+    z.config.sample_count = 20;
+    volatile uint64_t sink = 0;
+    ZAP_ITER(&z) {
+        sink += 1;
+    }
+    ASSERT_EQ(z.freq_rejected, 0);
+    ASSERT_EQ(z.freq_count, z.sample_count);
+    ASSERT(z.freq_min > 0.0 && z.freq_min <= z.freq_sum / (double)z.freq_count);
+    zap_cleanup(&z);
+
+    // Nothing runs at twice nominal: every batch is rerun until the drop limit
+    zap_g_config.min_freq_ratio = 2.0;
+    init_fast(&z, "freq_reject");
+    z.config.sample_count = 20;
+    z.config.measurement_time_ns = ZAP_SECONDS(5);
+    ZAP_ITER(&z) {
+        sink += 1;
+    }
+    ASSERT_EQ(z.freq_rejected, z.sample_capacity);
+    ASSERT(z.sample_count > 0);
+    zap_cleanup(&z);
+
+    zap_g_config.freq_monitor = false;
+    zap_g_config.min_freq_ratio = ZAP_DEFAULT_MIN_FREQ_RATIO;
+}
+
+TEST(test_custom_counters_skip_warmup) {
+    zap_t z;
+    init_fast(&z, "counters");
+    z.config.sample_count = 20;
+    zap_counter_set_rate(&z, "hits", true);
+    zap_counter_add(&z, "probes", 5.0);  // Before the loop: not measured yet
+    ZAP_ITER(&z) {
+        zap_counter_add(&z, "probes", 3.0);
+        zap_counter_add(&z, "hits", 1.0);
+    }
+    ASSERT(z.measured_iters > 0);
+    ASSERT_EQ(z.counter_count, 2);
+    ASSERT(z.counter_rate[0] && !z.counter_rate[1]);
+    ASSERT_NEAR(z.counter_totals[0], (double)z.measured_iters, 0.0);
+    ASSERT_NEAR(z.counter_totals[1], 3.0 * (double)z.measured_iters, 0.0);
+
+    // After the loop a value counts toward the whole run; names match by content
+    char name[] = "probes";
+    zap_counter_add(&z, name, 6.0);
+    ASSERT_EQ(z.counter_count, 2);
+    ASSERT_NEAR(z.counter_totals[1], 3.0 * (double)z.measured_iters + 6.0, 0.0);
+
+    // A full table drops new names instead of growing
+    char extra[16];
+    for (int i = 0; i < ZAP_MAX_USER_COUNTERS + 2; i++) {
+        snprintf(extra, sizeof(extra), "extra%d", i);
+        zap_counter_add(&z, extra, 1.0);
+    }
+    ASSERT_EQ(z.counter_count, ZAP_MAX_USER_COUNTERS);
+    zap_cleanup(&z);
+}
+
+static int phase_events[2];
+
+static void count_phase(zap_phase_t phase, const char* name, void* user) {
+    (void)name;
+    (void)user;
+    phase_events[phase]++;
+}
+
+TEST(test_profile_runs_iteration_budget) {
+    zap_set_phase_hook(count_phase, NULL);
+    zap_g_config.profile_iters = 100000;
+
+    // Profiling keeps no samples and stops at the iteration budget
+    zap_t z;
+    init_fast(&z, "profile");
+    z.profiling = true;
+    volatile uint64_t sink = 0;
+    ZAP_ITER(&z) {
+        sink += 1;
+    }
+    ASSERT_EQ(z.sample_count, 0);
+    ASSERT_EQ(z.measured_iters, 100000);
+    ASSERT_EQ(phase_events[ZAP_PHASE_MEASURE_BEGIN], 1);
+    ASSERT_EQ(phase_events[ZAP_PHASE_MEASURE_END], 1);
+    zap_cleanup(&z);
+
+    // A normal run marks its measurement phase once, warmup excluded
+    init_fast(&z, "phases");
+    ZAP_ITER(&z) {
+        sink += 1;
+    }
+    ASSERT(z.sample_count > 0);
+    ASSERT_EQ(phase_events[ZAP_PHASE_MEASURE_BEGIN], 2);
+    ASSERT_EQ(phase_events[ZAP_PHASE_MEASURE_END], 2);
+    zap_cleanup(&z);
+
+    zap_g_config.profile_iters = 0;
+    zap_set_phase_hook(NULL, NULL);
+}
+
+static int threads_seen[4];
+static int thread_count_seen;
+
+static void bench_mark_thread(zap_t* z) {
+    __atomic_fetch_add(&threads_seen[z->thread_index], 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&thread_count_seen, z->thread_count, __ATOMIC_RELAXED);
+    volatile uint64_t sink = 0;
+    ZAP_ITER(z) {
+        sink += 1;
+    }
+}
+
+TEST(test_threaded_runs_each_count) {
+    zap_runtime_group_t* g = zap_benchmark_group("threaded");
+    zap_group_warmup_time(g, ZAP_MILLIS(2));
+    zap_group_measurement_time(g, ZAP_MILLIS(5));
+    zap_group_sample_count(g, 10);
+
+    memset(threads_seen, 0, sizeof(threads_seen));
+    const int counts[] = {1, 3};
+    zap_bench_threaded(g, "mark", bench_mark_thread, counts, 2);
+    zap_group_finish(g);
+
+    // Thread 0 ran in both sweeps, threads 1-2 only with 3 threads
+    ASSERT_EQ(threads_seen[0], 2);
+    ASSERT_EQ(threads_seen[1], 1);
+    ASSERT_EQ(threads_seen[2], 1);
+    ASSERT_EQ(threads_seen[3], 0);
+    ASSERT_EQ(thread_count_seen, 3);
+}
+
+static int isolated_calls = 0;
+
+static void bench_count_calls(zap_t* z) {
+    isolated_calls++;  // Only the child's copy changes under --isolate
+    volatile uint64_t sink = 0;
+    ZAP_ITER(z) {
+        sink += 1;
+    }
+}
+
+static void bench_crash(zap_t* z) {
+    (void)z;
+    abort();
+}
+
+TEST(test_isolate_runs_in_child) {
+    zap_runtime_group_t* g = zap_benchmark_group("isolate");
+    zap_group_warmup_time(g, ZAP_MILLIS(2));
+    zap_group_measurement_time(g, ZAP_MILLIS(5));
+    zap_group_sample_count(g, 10);
+    zap_g_config.isolate = true;
+
+    isolated_calls = 0;
+    zap_bench_function(g, "count", bench_count_calls);
+    ASSERT_EQ(isolated_calls, 0);
+    ASSERT(!zap_g_config.has_failure);
+
+    zap_bench_function(g, "crash", bench_crash);  // Must not take the runner down
+    ASSERT(zap_g_config.has_failure);
+    zap_group_finish(g);
+
+    zap_g_config.isolate = false;
+    zap_g_config.has_failure = false;
+}
+
+TEST(test_exec_runs_command) {
+    zap_runtime_group_t* g = zap_benchmark_group("exec");
+    zap_group_warmup_time(g, ZAP_MILLIS(2));
+    zap_group_measurement_time(g, ZAP_MILLIS(20));
+    zap_group_sample_count(g, 10);
+
+    char* ok[] = {"sh", "-c", "echo starting; echo ready", NULL};
+    zap_group_exec_ready(g, "ready");
+    zap_bench_exec(g, "ready", ok);
+    ASSERT(!zap_g_config.has_failure);
+
+    zap_group_exec_ready(g, "never");
+    zap_bench_exec(g, "no_marker", ok);
+    ASSERT(zap_g_config.has_failure);
+    zap_g_config.has_failure = false;
+
+    char* fails[] = {"false", NULL};
+    zap_group_exec_ready(g, NULL);
+    zap_bench_exec(g, "fails", fails);
+    ASSERT(zap_g_config.has_failure);
+    zap_group_finish(g);
+
+    zap_g_config.has_failure = false;
+}
+
+static size_t placed_calls = 0;
+
+static void bench_sum_input(zap_t* z) {
+    placed_calls++;
+    const uint64_t* table = (const uint64_t*)z->param;
+    volatile uint64_t sink = 0;
+    ZAP_ITER(z) {
+        sink += table[sink & 1023];
+    }
+}
+
+TEST(test_numa_placement_restores) {
+    static uint64_t table[1024];
+    zap_env_t before, after;
+    zap_env_detect(&before);
+
+    zap_runtime_group_t* g = zap_benchmark_group("numa");
+    zap_group_warmup_time(g, ZAP_MILLIS(2));
+    zap_group_measurement_time(g, ZAP_MILLIS(5));
+    zap_group_sample_count(g, 10);
+
+    placed_calls = 0;
+    zap_group_numa(g, 0, 0);
+    zap_bench_with_input(g, zap_benchmark_id("local", 1024), table, sizeof(table),
+                         bench_sum_input);
+    ASSERT(placed_calls > 0);
+
+    // Offline nodes are ignored rather than failing the run
+    placed_calls = 0;
+    zap_group_numa(g, 63, ZAP_NUMA_ANY);
+    zap_bench_with_input(g, zap_benchmark_id("offline", 1024), table, sizeof(table),
+                         bench_sum_input);
+    ASSERT(placed_calls > 0);
+
+    // One run per node pair, or a single run on a one-node host
+    placed_calls = 0;
+    zap_group_numa(g, ZAP_NUMA_ANY, ZAP_NUMA_ANY);
+    zap_group_numa_sweep(g, true);
+    zap_bench_with_input(g, zap_benchmark_id("sweep", 1024), table, sizeof(table),
+                         bench_sum_input);
+    size_t nodes = before.numa_nodes > 1 ? (size_t)before.numa_nodes : 1;
+    ASSERT_EQ(placed_calls, nodes * nodes);
+    zap_group_finish(g);
+
+    ASSERT(!zap_g_config.has_failure);
+    zap_env_detect(&after);
+    ASSERT_EQ(after.pinned_cpu, before.pinned_cpu);  // Affinity put back
+}
+
+static void bench_scan(zap_t* z) {
+    size_t n = *(const size_t*)z->param;
+    volatile size_t sink = 0;
+    ZAP_ITER(z) {
+        for (size_t i = 0; i < n; i++) sink += i;
+    }
+}
+
+TEST(test_complexity_stored_as_metric) {
+    zap_baseline_init(&zap_g_config.baseline);
+    zap_baseline_init(&zap_g_config.run_results);
+    zap_g_config.save_baseline = true;
+    zap_g_config.history = true;
+
+    zap_runtime_group_t* g = zap_benchmark_group("cx");
+    zap_group_warmup_time(g, ZAP_MILLIS(2));
+    zap_group_measurement_time(g, ZAP_MILLIS(5));
+    zap_group_sample_count(g, 10);
+    size_t sizes[] = {1000, 2000, 4000, 8000};
+    for (size_t i = 0; i < 4; i++) {
+        zap_bench_with_input(g, zap_benchmark_id("scan", (int64_t)sizes[i]), &sizes[i],
+                             sizeof(sizes[i]), bench_scan);
+    }
+    zap_group_finish(g);
+
+    // The exponent rides on the largest size, never as a timing entry of its own
+    ASSERT_EQ(zap_g_config.baseline.count, 4);
+    ASSERT(zap_baseline_find(&zap_g_config.baseline, "cx/scan (complexity)") == NULL);
+    const zap_baseline_entry_t* top = zap_baseline_find(&zap_g_config.baseline, "cx/scan/8000");
+    ASSERT(top != NULL);
+    const zap_metric_t* m = zap_find_metric(top->metrics, top->metric_count, ZAP_COMPLEXITY_METRIC);
+    ASSERT(m != NULL);
+    ASSERT(m->flags & ZAP_METRIC_FIT);
+    ASSERT(m->value > 0.0);
+    const zap_baseline_entry_t* small = zap_baseline_find(&zap_g_config.baseline, "cx/scan/1000");
+    ASSERT(zap_find_metric(small->metrics, small->metric_count, ZAP_COMPLEXITY_METRIC) == NULL);
+
+    // The history only holds measured times
+    ASSERT_EQ(zap_g_config.run_results.count, 4);
+    top = zap_baseline_find(&zap_g_config.run_results, "cx/scan/8000");
+    ASSERT(zap_find_metric(top->metrics, top->metric_count, ZAP_COMPLEXITY_METRIC) == NULL);
+
+    zap_g_config.save_baseline = false;
+    zap_g_config.history = false;
+    zap_baseline_free(&zap_g_config.baseline);
+    zap_baseline_free(&zap_g_config.run_results);
+}
+
+void test_loop(void) {
+    RUN_TEST(test_batched_inputs_prepared);
+    RUN_TEST(test_loop_collects_samples);
+    RUN_TEST(test_precision_target_stops_early);
+    RUN_TEST(test_linear_sampling_steps);
+    RUN_TEST(test_latency_records_each_op);
+    RUN_TEST(test_rate_corrects_coordinated_omission);
+    RUN_TEST(test_latency_hist_precision);
+    RUN_TEST(test_unrolled_runs_whole_trips);
+    RUN_TEST(test_cold_cache_single_iteration);
+    RUN_TEST(test_freq_monitor_rejects_slow_samples);
+    RUN_TEST(test_custom_counters_skip_warmup);
+    RUN_TEST(test_profile_runs_iteration_budget);
+    RUN_TEST(test_threaded_runs_each_count);
+    RUN_TEST(test_isolate_runs_in_child);
+    RUN_TEST(test_exec_runs_command);
+    RUN_TEST(test_numa_placement_restores);
+    RUN_TEST(test_complexity_stored_as_metric);
+}
@@ -14,6 +14,9 @@ void test_stats(void);
 void test_duration(void);
 void test_filter(void);
 void test_baseline(void);
+void test_compare(void);
+void test_loop(void);
+void test_env(void);
 
 int main(void) {
     printf("Running zap tests...\n\n");
@@ -30,5 +33,14 @@ int main(void) {
     printf("\nBaseline storage:\n");
     test_baseline();
 
+    printf("\nBaseline comparison:\n");
+    test_compare();
+
+    printf("\nMeasurement loop:\n");
+    test_loop();
+
+    printf("\nEnvironment:\n");
+    test_env();
+
     TEST_REPORT();
 }
@@ -1,11 +1,9 @@
 // Statistics function tests
 #include "test.h"
 
-// Declarations from zap.h
-double zap_mean(const double* samples, size_t n);
-double zap_median(double* samples, size_t n);
-double zap_percentile(const double* sorted_samples, size_t n, double p);
-double zap_std_dev(const double* samples, size_t n, double mean);
+#include "zap.h"
+#include <stdlib.h>
+#include <string.h>
 
 TEST(test_mean_basic) {
     double samples[] = {1.0, 2.0, 3.0, 4.0, 5.0};
@@ -36,6 +34,14 @@ TEST(test_median_even) {
     ASSERT_NEAR(m, 2.5, 0.0001);
 }
 
+// Callers rely on zap_median() leaving the samples sorted for zap_percentile()
+TEST(test_median_sorts_input) {
+    double samples[] = {5.0, 1.0, 4.0, 2.0, 3.0, 6.0};
+    ASSERT_NEAR(zap_median(samples, 6), 3.5, 0.0001);
+    for (size_t i = 1; i < 6; i++) ASSERT(samples[i - 1] <= samples[i]);
+    ASSERT_NEAR(zap_percentile(samples, 6, 100.0), 6.0, 0.0001);
+}
+
 TEST(test_median_single) {
     double samples[] = {42.0};
     double m = zap_median(samples, 1);
@@ -76,6 +82,130 @@ TEST(test_std_dev_single) {
     ASSERT_NEAR(sd, 0.0, 0.0001);
 }
 
+TEST(test_linear_fit_recovers_slope) {
+    // Batch time = 50ns fixed + 3ns per iteration
+    double x[] = {10.0, 20.0, 30.0, 40.0, 50.0};
+    double y[5];
+    for (int i = 0; i < 5; i++) y[i] = 50.0 + 3.0 * x[i];
+
+    double slope, intercept, r2, se;
+    zap_linear_fit(x, y, 5, &slope, &intercept, &r2, &se);
+    ASSERT_NEAR(slope, 3.0, 1e-9);
+    ASSERT_NEAR(intercept, 50.0, 1e-9);
+    ASSERT_NEAR(r2, 1.0, 1e-9);
+    ASSERT_NEAR(se, 0.0, 1e-9);
+}
+
+TEST(test_linear_fit_noisy) {
+    double x[] = {1.0, 2.0, 3.0, 4.0};
+    double y[] = {2.0, 4.5, 5.5, 8.0};  // Roughly y = 1.9x + 0.25
+    double slope, intercept, r2, se;
+    zap_linear_fit(x, y, 4, &slope, &intercept, &r2, &se);
+    ASSERT_NEAR(slope, 1.9, 1e-9);
+    ASSERT_NEAR(intercept, 0.25, 1e-9);
+    ASSERT(r2 > 0.9 && r2 < 1.0);
+    ASSERT(se > 0.0);
+}
+
+TEST(test_complexity_fit_classes) {
+    double n[6] = {100, 1000, 10000, 100000, 1000000, 10000000};
+    double y[6];
+    zap_complexity_fit_t fit;
+
+    for (int i = 0; i < 6; i++) y[i] = 40.0;
+    ASSERT(zap_complexity_fit(n, y, 6, &fit));
+    ASSERT(fit.model == ZAP_O_1);
+    ASSERT_NEAR(fit.exponent, 0.0, 1e-9);
+
+    for (int i = 0; i < 6; i++) y[i] = 3.0 * n[i] + 50.0;  // Small fixed overhead
+    ASSERT(zap_complexity_fit(n, y, 6, &fit));
+    ASSERT(fit.model == ZAP_O_N);
+    ASSERT_NEAR(fit.coef, 3.0, 0.01);
+    ASSERT_NEAR(fit.exponent, 1.0, 0.05);
+
+    for (int i = 0; i < 6; i++) y[i] = 2.0 * n[i] * log2(n[i]);
+    ASSERT(zap_complexity_fit(n, y, 6, &fit));
+    ASSERT(fit.model == ZAP_O_N_LOG_N);
+    ASSERT(fit.exponent > 1.0 && fit.exponent < 1.2);
+
+    for (int i = 0; i < 6; i++) y[i] = 0.5 * n[i] * n[i];
+    ASSERT(zap_complexity_fit(n, y, 6, &fit));
+    ASSERT(fit.model == ZAP_O_N2);
+    ASSERT_NEAR(fit.exponent, 2.0, 1e-9);
+    ASSERT_NEAR(fit.r_squared, 1.0, 1e-9);
+    ASSERT_STREQ(zap_complexity_name(fit.model), "O(n^2)");
+
+    ASSERT(!zap_complexity_fit(n, y, 1, &fit));
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Full-sort reference computation, as zap_compute_stats did before selection
+static zap_stats_t reference_stats(const double* samples, size_t n) {
+    zap_stats_t r = {0};
+    double* sorted = malloc(n * sizeof(double));
+    memcpy(sorted, samples, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), cmp_double);
+    r.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+    r.p75 = zap_percentile(sorted, n, 75.0);
+    r.p90 = zap_percentile(sorted, n, 90.0);
+    r.p95 = zap_percentile(sorted, n, 95.0);
+    r.p99 = zap_percentile(sorted, n, 99.0);
+    for (size_t i = 0; i < n; i++) sorted[i] = fabs(samples[i] - r.median);
+    qsort(sorted, n, sizeof(double), cmp_double);
+    r.mad = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+    free(sorted);
+    return r;
+}
+
+TEST(test_select_matches_sort) {
+    srand(12345);
+    double v[257], sorted[257];
+    for (size_t n = 1; n <= 257; n += 16) {
+        for (size_t i = 0; i < n; i++) v[i] = (double)(rand() % 50);  // Many ties
+        memcpy(sorted, v, n * sizeof(double));
+        qsort(sorted, n, sizeof(double), cmp_double);
+        for (size_t k = 0; k < n; k += 7) {
+            double tmp[257];
+            memcpy(tmp, v, n * sizeof(double));
+            ASSERT_NEAR(zap_select(tmp, n, k), sorted[k], 0.0);
+        }
+    }
+}
+
+TEST(test_compute_stats_matches_sort) {
+    srand(777);
+    static const size_t sizes[] = {1, 2, 3, 10, 99, 100, 1001, 100000};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+        double* samples = malloc(n * sizeof(double));
+        double* original = malloc(n * sizeof(double));
+        for (size_t i = 0; i < n; i++) {
+            // Skewed, with a long tail and repeated values
+            double u = (double)(rand() % 1000) / 1000.0;
+            samples[i] = 100.0 + (double)(rand() % 20) + 1.0 / (1.0 - u * 0.999);
+        }
+        memcpy(original, samples, n * sizeof(double));
+
+        zap_stats_t got = zap_compute_stats(samples, n);
+        zap_stats_t want = reference_stats(samples, n);
+        ASSERT_NEAR(got.median, want.median, 0.0);
+        ASSERT_NEAR(got.p75, want.p75, 0.0);
+        ASSERT_NEAR(got.p90, want.p90, 0.0);
+        ASSERT_NEAR(got.p95, want.p95, 0.0);
+        ASSERT_NEAR(got.p99, want.p99, 0.0);
+        ASSERT_NEAR(got.mad, want.mad, 0.0);
+        ASSERT_NEAR(got.mean, zap_mean(samples, n), 0.0);
+        ASSERT(memcmp(samples, original, n * sizeof(double)) == 0);  // Not reordered
+
+        free(samples);
+        free(original);
+    }
+}
+
 void test_stats(void) {
     RUN_TEST(test_mean_basic);
     RUN_TEST(test_mean_single);
@@ -83,9 +213,15 @@ void test_stats(void) {
     RUN_TEST(test_median_odd);
     RUN_TEST(test_median_even);
     RUN_TEST(test_median_single);
+    RUN_TEST(test_median_sorts_input);
     RUN_TEST(test_percentile_p50);
     RUN_TEST(test_percentile_p0);
     RUN_TEST(test_percentile_p100);
     RUN_TEST(test_std_dev_basic);
     RUN_TEST(test_std_dev_single);
+    RUN_TEST(test_linear_fit_recovers_slope);
+    RUN_TEST(test_linear_fit_noisy);
+    RUN_TEST(test_select_matches_sort);
+    RUN_TEST(test_compute_stats_matches_sort);
+    RUN_TEST(test_complexity_fit_classes);
 }
@@ -4,7 +4,7 @@
  * Inspired by criterion-rs (Rust benchmarking framework)
  *
  * USAGE:
- *   In exactly ONE C file, before including this header:
+ *   In exactly ONE C file, before including this or any other header:
  *     #define ZAP_IMPLEMENTATION
  *     #include "zap.h"
  *
@@ -36,6 +36,16 @@
 #ifndef ZAP_H
 #define ZAP_H
 
+/*
+ * The implementation uses POSIX and GNU/BSD extensions (clock_gettime,
+ * syscall, wait4, strsignal, getline, popen, ...). Request them before the
+ * first system header so it also builds with -std=c99/c11; the
+ * ZAP_IMPLEMENTATION file must include zap.h before any other header.
+ */
+#if defined(ZAP_IMPLEMENTATION) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -63,6 +73,84 @@ extern "C" {
 #define ZAP_CONFIDENCE_LEVEL 0.95
 #endif
 
+// Stop once the CI half-width is within this % of the mean (0 = off)
+#ifndef ZAP_DEFAULT_TARGET_PRECISION
+#define ZAP_DEFAULT_TARGET_PRECISION 0.0
+#endif
+
+// Latency histogram: 2^SUB_BITS buckets per power of two (<1% error with 7),
+// values up to 2^MAX_BITS ticks; larger ones land in the top bucket
+#ifndef ZAP_LATENCY_SUB_BITS
+#define ZAP_LATENCY_SUB_BITS 7
+#endif
+#ifndef ZAP_LATENCY_MAX_BITS
+#define ZAP_LATENCY_MAX_BITS 44
+#endif
+#define ZAP_LATENCY_BUCKETS \
+    (((ZAP_LATENCY_MAX_BITS) - (ZAP_LATENCY_SUB_BITS) + 1) << (ZAP_LATENCY_SUB_BITS))
+
+// Baseline comparison test: 0 = CI overlap, 1 = Welch, 2 = Mann-Whitney, 3 = bootstrap
+#ifndef ZAP_DEFAULT_STAT_TEST
+#define ZAP_DEFAULT_STAT_TEST 0
+#endif
+
+// p-value below which a sample-based test calls a change significant
+#ifndef ZAP_SIGNIFICANCE_ALPHA
+#define ZAP_SIGNIFICANCE_ALPHA 0.05
+#endif
+
+#ifndef ZAP_BOOTSTRAP_RESAMPLES
+#define ZAP_BOOTSTRAP_RESAMPLES 2000
+#endif
+
+// Baseline file written by default: 0 = text (v1), 1 = binary (v2)
+#ifndef ZAP_DEFAULT_BASELINE_FORMAT
+#define ZAP_DEFAULT_BASELINE_FORMAT 0
+#endif
+
+// Sampling mode: 0 = flat (same iterations per sample), 1 = linear (k*d, OLS slope)
+#ifndef ZAP_DEFAULT_SAMPLING_MODE
+#define ZAP_DEFAULT_SAMPLING_MODE 0
+#endif
+
+// Cache state at the start of each sample: 0 = warm, 1 = cold, 2 = both
+#ifndef ZAP_DEFAULT_CACHE_MODE
+#define ZAP_DEFAULT_CACHE_MODE 0
+#endif
+
+// Buffer walked to evict caches in cold mode, 0 = twice the detected LLC
+#ifndef ZAP_COLD_BUFFER_BYTES
+#define ZAP_COLD_BUFFER_BYTES 0
+#endif
+
+// Machine peak profile written by --roofline, measured once per host
+#ifndef ZAP_MACHINE_PATH
+#define ZAP_MACHINE_PATH ".zap/machine"
+#endif
+
+// Append-only run history with raw samples, written next to the baseline
+#ifndef ZAP_HISTORY_PATH
+#define ZAP_HISTORY_PATH ".zap/history"
+#endif
+
+// Append every saved run to the history (0 = only with --history-path)
+#ifndef ZAP_DEFAULT_HISTORY
+#define ZAP_DEFAULT_HISTORY 1
+#endif
+
+// Change points: permutation rounds, and the smallest shift worth flagging
+#ifndef ZAP_CHANGE_PERMUTATIONS
+#define ZAP_CHANGE_PERMUTATIONS 1000
+#endif
+#ifndef ZAP_CHANGE_MIN_PCT
+#define ZAP_CHANGE_MIN_PCT 2.0
+#endif
+
+// Samples required before the time cap or precision target may end a run
+#ifndef ZAP_MIN_SAMPLES
+#define ZAP_MIN_SAMPLES 10
+#endif
+
 // Output defaults (0 = off, 1 = on)
 #ifndef ZAP_DEFAULT_SHOW_ENV
 #define ZAP_DEFAULT_SHOW_ENV 0
@@ -81,6 +169,64 @@ extern "C" {
 #define ZAP_DEFAULT_COLOR_MODE 0
 #endif
 
+// Timer backend: 0 = clock (clock_gettime/mach), 1 = tsc (RDTSC/CNTVCT)
+#ifndef ZAP_DEFAULT_TIMER
+#define ZAP_DEFAULT_TIMER 0
+#endif
+
+// Subtract the calibrated per-batch timer overhead from samples (0 = off, 1 = on).
+// Off by default so results stay comparable with baselines saved without it.
+#ifndef ZAP_DEFAULT_OVERHEAD_CORRECTION
+#define ZAP_DEFAULT_OVERHEAD_CORRECTION 0
+#endif
+
+// Upper bound on the ZAP_ITER_BATCHED input pool; caps iterations per batch
+#ifndef ZAP_BATCH_MAX_BYTES
+#define ZAP_BATCH_MAX_BYTES (256ULL * 1024 * 1024)  // 256 MB
+#endif
+
+// Hardware counters (0 = off, 1 = on), same as --counters
+#ifndef ZAP_DEFAULT_HW_COUNTERS
+#define ZAP_DEFAULT_HW_COUNTERS 0
+#endif
+
+// Tag each sample with the effective CPU frequency (0 = off, 1 = on), same as --freq-monitor
+#ifndef ZAP_DEFAULT_FREQ_MONITOR
+#define ZAP_DEFAULT_FREQ_MONITOR 0
+#endif
+
+// Monitored samples below this fraction of the nominal frequency are dropped and
+// rerun (0 = only tag them), same as --min-freq-ratio
+#ifndef ZAP_DEFAULT_MIN_FREQ_RATIO
+#define ZAP_DEFAULT_MIN_FREQ_RATIO 0.9
+#endif
+
+// How long --profile runs the matched loop unless --profile-iters is given
+#ifndef ZAP_DEFAULT_PROFILE_TIME_NS
+#define ZAP_DEFAULT_PROFILE_TIME_NS 10000000000ULL  // 10 seconds
+#endif
+
+// Pin the process to this CPU at startup (-1 = off), same as --pin-cpu / ZAP_PIN_CPU
+#ifndef ZAP_DEFAULT_PIN_CPU
+#define ZAP_DEFAULT_PIN_CPU -1
+#endif
+
+// 1-minute load average above which the pre-flight check reports a busy machine
+#ifndef ZAP_NOISY_LOAD
+#define ZAP_NOISY_LOAD 1.0
+#endif
+
+/*
+ * Allocation tracking: define ZAP_TRACK_ALLOC next to ZAP_IMPLEMENTATION to
+ * interpose malloc/calloc/realloc/free (glibc only). Measured batches then
+ * report allocations, bytes and peak live bytes per benchmark, plus page
+ * faults and max RSS growth. Off by default because every allocation in the
+ * process pays for the bookkeeping.
+ *
+ * Intel ITT: define ZAP_USE_ITT (and link -littnotify) to resume/pause VTune
+ * collection around measurement phases and mark each one as an ITT task.
+ */
+
 /* INCLUDES */
 
 #include <stdint.h>
@@ -93,9 +239,104 @@ extern "C" {
 typedef enum zap_throughput_type {
     ZAP_THROUGHPUT_NONE = 0,
     ZAP_THROUGHPUT_BYTES,
-    ZAP_THROUGHPUT_ELEMENTS
+    ZAP_THROUGHPUT_ELEMENTS,
+    ZAP_THROUGHPUT_FLOPS     // Floating-point operations, compared to the FLOP peak
 } zap_throughput_type_t;
 
+// Timer backend used for sample timing
+typedef enum zap_timer_kind {
+    ZAP_TIMER_CLOCK = 0,  // clock_gettime(CLOCK_MONOTONIC) / mach_absolute_time
+    ZAP_TIMER_TSC         // Fenced RDTSC/RDTSCP (x86) or CNTVCT_EL0 (ARM64)
+} zap_timer_kind_t;
+
+// How iterations are spread over samples
+typedef enum zap_sampling_mode {
+    ZAP_SAMPLING_FLAT = 0,  // Every sample runs the same iteration count
+    ZAP_SAMPLING_LINEAR     // Sample k runs k*d iterations; time/iter is the OLS slope
+} zap_sampling_mode_t;
+
+// Cache state each sample starts from
+typedef enum zap_cache_mode {
+    ZAP_CACHE_WARM = 0,  // Warmup leaves the working set cached (default)
+    ZAP_CACHE_COLD,      // Evict before every sample, one iteration per sample
+    ZAP_CACHE_BOTH       // Run warm, then cold, and report them side by side
+} zap_cache_mode_t;
+
+// What ended the measurement phase
+typedef enum zap_stop_reason {
+    ZAP_STOP_SAMPLES = 0,  // Collected the requested sample count
+    ZAP_STOP_TIME,         // Reached the measurement time cap
+    ZAP_STOP_PRECISION     // CI half-width fell below the precision target
+} zap_stop_reason_t;
+
+// How --freq-monitor reads the effective frequency of a sample
+typedef enum zap_freq_source {
+    ZAP_FREQ_NONE = 0,  // Not monitored
+    ZAP_FREQ_SYSFS,     // cpufreq scaling_cur_freq of the current CPU against the base clock
+    ZAP_FREQ_PROBE      // Fixed dependent-multiply chain against its fastest run
+} zap_freq_source_t;
+
+// Maximum named metrics attached to a single result
+#ifndef ZAP_MAX_METRICS
+#define ZAP_MAX_METRICS 24
+#endif
+
+// Maximum zap_counter_add() names per benchmark
+#ifndef ZAP_MAX_USER_COUNTERS
+#define ZAP_MAX_USER_COUNTERS 8
+#endif
+
+// Maximum hardware counters in the perf event group (defaults + raw events)
+#ifndef ZAP_MAX_HW_COUNTERS
+#define ZAP_MAX_HW_COUNTERS 8
+#endif
+
+// Where a metric comes from; selects its section in the report
+typedef enum zap_metric_kind {
+    ZAP_METRIC_COUNTER = 0,  // Hardware counter (--counters)
+    ZAP_METRIC_MEMORY,       // Allocation / footprint (ZAP_TRACK_ALLOC)
+    ZAP_METRIC_PROCESS,      // Child process resources (zap_bench_exec)
+    ZAP_METRIC_USER          // Benchmark-defined counter (zap_counter_add)
+} zap_metric_kind_t;
+
+// Metric flags
+#define ZAP_METRIC_TOTAL  0x1u  // Whole-run value rather than per iteration
+#define ZAP_METRIC_BYTES  0x2u  // Byte quantity, formatted as a size
+#define ZAP_METRIC_GATED  0x4u  // Increase vs baseline is a regression
+#define ZAP_METRIC_TIME   0x8u  // Nanoseconds, formatted as a duration
+#define ZAP_METRIC_RATE   0x10u // Per second
+#define ZAP_METRIC_HIGHER 0x20u // With GATED a decrease is the regression instead
+#define ZAP_METRIC_FIT    0x40u // Fitted over a size sweep, not measured by this entry
+
+// Baseline metric holding a label's fitted complexity exponent
+#define ZAP_COMPLEXITY_METRIC "complexity_exponent"
+
+// Which way a custom counter may move before --fail-threshold calls it a regression
+typedef enum zap_counter_direction {
+    ZAP_COUNTER_UNGATED = 0,       // Reported and compared only (default)
+    ZAP_COUNTER_LOWER_IS_BETTER,   // A rise vs the baseline is a regression
+    ZAP_COUNTER_HIGHER_IS_BETTER   // A drop vs the baseline is a regression
+} zap_counter_direction_t;
+
+// Named metric reported alongside time (hardware counters, ...)
+typedef struct zap_metric {
+    char   name[32];
+    double value;            // Normalized per iteration unless ZAP_METRIC_TOTAL
+    zap_metric_kind_t kind;
+    uint32_t flags;
+} zap_metric_t;
+
+// Log-bucketed (HDR-style) histogram of per-operation latencies, in ticks
+typedef struct zap_latency_hist {
+    uint64_t* counts;          // ZAP_LATENCY_BUCKETS entries, allocated once
+    uint64_t  total;
+    uint64_t  min_ticks;
+    uint64_t  max_ticks;
+    uint64_t  overhead_ticks;  // Cost of one timestamp, subtracted per op
+    double    ns_per_tick;
+    bool      use_tsc;         // Read the TSC even if --timer is clock
+} zap_latency_hist_t;
+
 // Statistics results
 typedef struct zap_stats {
     double mean;             // Average
@@ -114,25 +355,60 @@ typedef struct zap_stats {
     size_t outliers_high;    // Number of high outliers
     size_t sample_count;     // Number of samples
     size_t iterations;       // Iterations per sample
+    double overhead_ns;      // Per-batch timer overhead subtracted from samples
+    zap_stop_reason_t stop_reason;
+    double precision_pct;    // CI half-width as % of the mean
+    double target_precision; // Precision target in %, 0 if unused
+    // Linear sampling fit (sampling == ZAP_SAMPLING_LINEAR)
+    zap_sampling_mode_t sampling;
+    double slope;            // ns per iteration, also stored in mean
+    double intercept;        // Fixed ns per sample
+    double r_squared;        // Fit quality, 1 = perfectly linear
+    // Per-operation latency (ZAP_ITER_LATENCY); p75-p99 then come from it too
+    const zap_latency_hist_t* latency;  // Valid until the zap_t is cleaned up
+    uint64_t latency_count;
+    double latency_p50;
+    double latency_p99;
+    double latency_p999;
+    double latency_p9999;
+    double latency_max;
+    double target_rate;      // Open-loop ops/s (zap_bench_config_t.rate), 0 = closed loop
+    double achieved_rate;    // Ops/s actually started while measuring
+    bool   cold_cache;       // Measured with ZAP_CACHE_COLD
+    // Effective frequency as a fraction of nominal (--freq-monitor)
+    zap_freq_source_t freq_source;
+    double freq_mean;        // Over kept samples
+    double freq_min;         // Over all measured samples, rejected ones included
+    size_t freq_rejected;    // Samples dropped below --min-freq-ratio and rerun
+    // Harness loop cost per iteration, measured for the loop shape used; not subtracted
+    uint32_t unroll;         // ZAP_ITER_UNROLLED copies, 0 for other loops
+    double loop_ns;
     double* samples;         // Pointer to samples for histogram
     // Throughput info
     zap_throughput_type_t throughput_type;
     size_t throughput_value; /* Bytes or elements per iteration */
+    // Per-iteration metrics
+    zap_metric_t metrics[ZAP_MAX_METRICS];
+    size_t       metric_count;
 } zap_stats_t;
 
 // Per-benchmark configuration
 typedef struct zap_bench_config {
     uint64_t warmup_time_ns;
     uint64_t measurement_time_ns;
-    size_t   sample_count;
+    size_t   sample_count;       // Maximum samples
+    double   target_precision;   // Relative CI half-width target in %, 0 = off
+    zap_sampling_mode_t sampling_mode;
+    zap_cache_mode_t cache_mode;
+    double   rate;               // Open-loop ZAP_ITER_LATENCY ops/s, 0 = closed loop
 } zap_bench_config_t;
 
 // Benchmark state
 typedef struct zap {
     const char* name;
     uint64_t    iterations;
-    uint64_t    current_iter;
-    uint64_t    start_time;
+    uint64_t    current_iter;    // Timer ticks at start of the current batch
+    uint64_t    start_time;      // Timer ticks at start of the current phase
     double*     samples;
     size_t      sample_count;
     size_t      sample_capacity;
@@ -140,6 +416,20 @@ typedef struct zap {
     bool        measuring;
     bool        status_printed;  // Track if warmup/measuring status was shown
     zap_bench_config_t config;
+    // Running mean/variance of samples (Welford) for the precision target
+    double      run_mean;
+    double      run_m2;
+    zap_stop_reason_t stop_reason;
+    // Linear sampling: iteration step d and the iterations of each sample
+    uint64_t    iter_step;
+    double*     sample_iters;
+    double      warmup_ns_per_iter;  // Last warmup batch, used to size d
+    // Per-op timestamps from ZAP_ITER_LATENCY; counts is NULL otherwise
+    zap_latency_hist_t latency;
+    uint64_t    rate_ticks;      // Open-loop interval between intended starts, 0 = closed loop
+    // Reused by the stats pass (selection buffer, MAD deviations)
+    double*     scratch;
+    size_t      scratch_capacity;
     // Throughput tracking
     zap_throughput_type_t throughput_type;
     size_t throughput_value;
@@ -147,20 +437,140 @@ typedef struct zap {
     void*       param;
     size_t      param_size;
     struct zap_runtime_group* group;
+    // ZAP_ITER_BATCHED input pool, one slot per iteration, reused across batches
+    unsigned char* batch_pool;
+    size_t      batch_stride;    // Slot size rounded up for alignment
+    size_t      batch_slots;     // Allocated slots
+    // Hardware counter accumulation over measured batches
+    uint64_t    hw_begin[ZAP_MAX_HW_COUNTERS];
+    double      hw_total[ZAP_MAX_HW_COUNTERS];
+    uint64_t    measured_iters;  // Iterations across all measured batches
+    // Allocation tracking over measured batches (ZAP_TRACK_ALLOC)
+    uint64_t    alloc_begin[2];  // Allocation count/bytes at batch start
+    int64_t     alloc_live_begin;
+    uint64_t    alloc_count;
+    uint64_t    alloc_bytes;
+    int64_t     alloc_peak;      // Largest live-byte growth within one batch
+    uint64_t    faults_begin;
+    uint64_t    faults;          // Page faults inside measured batches
+    uint64_t    rss_begin;       // Max RSS at the first measured batch
+    // --freq-monitor: frequency ratio of kept samples, lowest seen, drops
+    double      freq_sum;
+    double      freq_min;
+    size_t      freq_count;
+    size_t      freq_rejected;
+    // zap_bench_exec(): child resources over measured runs
+    uint64_t    exec_runs;
+    uint64_t    exec_faults;
+    uint64_t    exec_max_rss;    // Bytes, largest of any one run
+    double      exec_ready_ns;   // Sum of spawn-to-marker times
+    // zap_counter_add(): totals over measured batches, fixed table so adds never allocate
+    char        counter_names[ZAP_MAX_USER_COUNTERS][32];
+    double      counter_totals[ZAP_MAX_USER_COUNTERS];
+    bool        counter_rate[ZAP_MAX_USER_COUNTERS];  // Report per second, not per iteration
+    zap_counter_direction_t counter_direction[ZAP_MAX_USER_COUNTERS];
+    size_t      counter_count;
+    char        error[128];      // Why the routine could not run; reported as a failure
+    // zap_bench_threaded(): this thread's index and the number of threads
+    int         thread_index;
+    int         thread_count;
+    bool        worker;          // Runs on a worker thread: no status, counters or alloc tracking
+    bool        profiling;       // --profile: run the body for the profile budget, keep no samples
+    bool        phase_open;      // Measurement phase marker emitted and not yet closed
+    // Interleaved comparisons: the scheduler this routine takes sample turns with
+    struct zap__interleave* interleave;
+    size_t      interleave_slot;
+    // ZAP_ITER_UNROLLED: body copies per loop trip, and the inline fast path
+    // armed by zap_loop_end() for plain flat batches (see zap_loop_start_unrolled)
+    uint32_t    unroll;          // 0 = not an unrolled loop
+    bool        hot;             // Batches may skip zap_loop_start()/zap_loop_end()
+    bool        hot_tsc;         // Timer reads use the TSC
+    double      hot_ns_per_tick;
+    double      hot_overhead_ns; // Subtracted from every batch, as in zap_loop_end()
+    uint64_t    hot_deadline;    // Tick at which the measurement time is up
 } zap_t;
 
 // Benchmark function signature
 typedef void (*zap_bench_fn)(zap_t*);
 
+// Measurement phase markers: each routine's measured batches, without warmup
+// or zap_group_setup(). They go to perf (--perf-ctl), to VTune (ZAP_USE_ITT)
+// and to the hook set with zap_set_phase_hook(), e.g. for Tracy zones. The hook
+// runs on the routine's thread, so threaded benchmarks call it concurrently.
+typedef enum zap_phase {
+    ZAP_PHASE_MEASURE_BEGIN = 0,
+    ZAP_PHASE_MEASURE_END
+} zap_phase_t;
+
+typedef void (*zap_phase_hook_fn)(zap_phase_t phase, const char* name, void* user);
+void zap_set_phase_hook(zap_phase_hook_fn hook, void* user);
+
 // Setup/teardown function types
 typedef void (*zap_setup_fn)(void);
 typedef void (*zap_teardown_fn)(void);
 
+// Per-iteration input setup for ZAP_ITER_BATCHED. Fills pool slot `index`;
+// slots are reused across batches, so setup may reuse memory already there.
+typedef void (*zap_batch_setup_fn)(zap_t* z, void* input, size_t index);
+
+// Maximum threads in one zap_bench_threaded() run
+#ifndef ZAP_MAX_THREADS
+#define ZAP_MAX_THREADS 256
+#endif
+
 // Maximum tags per benchmark group
 #ifndef ZAP_MAX_TAGS
 #define ZAP_MAX_TAGS 8
 #endif
 
+// Maximum rates in one open-loop sweep (--rate, zap_group_rate_sweep())
+#ifndef ZAP_MAX_RATES
+#define ZAP_MAX_RATES 16
+#endif
+
+#ifndef ZAP_MAX_NUMA_NODES
+#define ZAP_MAX_NUMA_NODES 8  // Nodes in a zap_group_numa_sweep() matrix
+#endif
+
+// Points a zap_bench_with_input() label needs before its complexity is fitted
+#ifndef ZAP_COMPLEXITY_MIN_POINTS
+#define ZAP_COMPLEXITY_MIN_POINTS 4
+#endif
+
+// Growth of the fitted exponent vs baseline that counts as a regression
+#ifndef ZAP_COMPLEXITY_TOLERANCE
+#define ZAP_COMPLEXITY_TOLERANCE 0.3
+#endif
+
+// Complexity classes fitted to parameter sweeps
+typedef enum zap_complexity {
+    ZAP_O_1 = 0,
+    ZAP_O_LOG_N,
+    ZAP_O_N,
+    ZAP_O_N_LOG_N,
+    ZAP_O_N2,
+    ZAP_COMPLEXITY_COUNT
+} zap_complexity_t;
+
+// Result of zap_complexity_fit()
+typedef struct zap_complexity_fit {
+    zap_complexity_t model;  // Least-squares model with the lowest RMS
+    double coef;             // mean ~= coef * f(n), in ns
+    double rms_pct;          // RMS error of that model, % of the mean time
+    double exponent;         // Slope of log(mean) over log(n)
+    double r_squared;        // Of the log-log fit
+} zap_complexity_fit_t;
+
+// One zap_bench_with_input() result whose parameter parsed as a number
+typedef struct zap_scale_point {
+    char   label[128];
+    double n;                // Parameter; byte sizes ("16KB") are in bytes
+    double mean;             // ns
+    bool   bytes;            // Parameter had a KB/MB/GB unit
+    char   key[384];         // Baseline key of the result
+    double prev_exponent;    // ZAP_COMPLEXITY_METRIC of its compared baseline, NAN = none
+} zap_scale_point_t;
+
 // Runtime benchmark group
 typedef struct zap_runtime_group {
     char                     name[128];
@@ -169,6 +579,18 @@ typedef struct zap_runtime_group {
     bool                     header_printed;  // Deferred header for filtering
     zap_setup_fn             setup;           // Called before group runs
     zap_teardown_fn          teardown;        // Called after group completes
+    bool                     pin_threads;     // Pin zap_bench_threaded() workers to CPUs
+    double                   rates[ZAP_MAX_RATES];  // Open-loop rates, swept in order
+    size_t                   rate_count;
+    char                     exec_ready[128]; // zap_bench_exec() readiness marker, "" = none
+    bool                     exec_drop_caches; // zap_bench_exec(): drop the page cache per run
+    int                      numa_mem;        // Memory node, ZAP_NUMA_ANY = unplaced
+    int                      numa_cpu;        // CPU node, ZAP_NUMA_ANY = unplaced
+    bool                     numa_sweep;      // Run every (CPU node, memory node) pair
+    // Numeric zap_bench_with_input() results, fitted per label at zap_group_finish()
+    zap_scale_point_t*       scale_points;
+    size_t                   scale_count;
+    size_t                   scale_capacity;
     // Tags for filtering
     char                     tags[ZAP_MAX_TAGS][32];
     size_t                   tag_count;
@@ -190,20 +612,121 @@ typedef enum zap_change {
 
 // Baseline entry for a single benchmark
 typedef struct zap_baseline_entry {
-    char                name[256];
+    const char*         name;           // Interned in the baseline's name arena
     double              mean;
     double              std_dev;
     double              ci_lower;
     double              ci_upper;
+    const zap_metric_t* metrics;        // metric_count entries in the arena, or NULL
+    size_t              metric_count;
+    const double*       samples;        // Raw samples (v2 files and new results), or NULL
+    size_t              sample_count;
 } zap_baseline_entry_t;
 
-// Baseline storage
+// Baseline file formats
+typedef enum zap_baseline_format {
+    ZAP_BASELINE_TEXT = 0,  // "zap-baseline v1": one line per entry, summary only
+    ZAP_BASELINE_BINARY     // "zap-baseline v2": mmap-able records with raw samples
+} zap_baseline_format_t;
+
+// Chunk of the baseline arena; chunks never move once allocated
+typedef struct zap_arena_chunk {
+    struct zap_arena_chunk* next;
+    size_t                  used;
+    size_t                  size;
+    char*                   data;       // Follows the header in the same block
+} zap_arena_chunk_t;
+
+// Baseline storage. A loaded v2 file is read on demand: its records get an
+// entry in entries[] on first lookup, so count can be below zap_baseline_size().
 typedef struct zap_baseline {
     zap_baseline_entry_t* entries;
     size_t                      count;
     size_t                      capacity;
+    // Open-addressing index over names: slot holds entry index + 1, 0 = empty
+    size_t*               index;
+    size_t                index_size;   // Power of two, kept at most half full
+    zap_arena_chunk_t*    arena;        // Names, metrics and samples; head is being filled
+    // v2 files stay mapped; names, metrics and samples point into the mapping
+    void*                 map;
+    size_t                map_size;
+    const uint64_t*       map_records;  // Record offsets, in file order
+    const uint64_t*       map_slots;    // Name hash table: record number + 1, 0 = empty
+    size_t                map_count;    // Records in the file
+    size_t                map_slot_count; // Power of two
+    size_t                map_read;     // Records that already have an entry
+    zap_baseline_format_t format;       // Format of the loaded file, else the default
 } zap_baseline_t;
 
+// One run in a history file; strings point into the mapping
+typedef struct zap_history_run {
+    int64_t     timestamp;      // Unix time the run was saved
+    const char* commit;         // git HEAD, "" outside a repository
+    const char* cpu_model;
+    const char* os_info;
+    const char* compiler;
+    int         cpu_cores;
+    int         cpu_threads;
+    double      base_mhz;
+    size_t      bench_count;
+    const void* segment;        // Run header in the mapping
+    size_t      segment_size;
+} zap_history_run_t;
+
+// Mapped history file, runs oldest first
+typedef struct zap_history {
+    void*              map;
+    size_t             map_size;
+    size_t             valid_size;  // End of the last complete run
+    zap_history_run_t* runs;
+    size_t             run_count;
+} zap_history_t;
+
+// One benchmark in one run of a history
+typedef struct zap_history_point {
+    size_t        run;            // Index into zap_history_t.runs
+    double        mean;
+    double        median;
+    const double* samples;        // Raw samples in the mapping
+    size_t        sample_count;
+} zap_history_point_t;
+
+// Level shift in a series found by zap_change_points()
+typedef struct zap_change_point {
+    size_t index;                 // First value at the new level
+    double before;                // Mean of the segment before the shift
+    double after;                 // Mean of the segment after it
+    double change_pct;            // Positive = slower
+    double p_value;               // Permutation test of the CUSUM peak
+} zap_change_point_t;
+
+#define ZAP_MAX_CHANGE_POINTS 8
+
+// Memory levels in the machine profile: L1d, L2, L3 and DRAM
+#define ZAP_MACHINE_LEVELS   4
+#define ZAP_MACHINE_DRAM     3
+#define ZAP_MACHINE_MAX_ISAS 4
+
+// Peaks measured by the --roofline calibration suite
+typedef struct zap_machine {
+    char   cpu_model[128];                    // Host the profile belongs to
+    size_t cache_bytes[ZAP_MACHINE_LEVELS];   // Capacity per level, 0 = absent (and DRAM)
+    double copy_gbs[ZAP_MACHINE_LEVELS];      // Copy, bytes read + written per second
+    double triad_gbs[ZAP_MACHINE_LEVELS];     // a[i] = b[i] + s * c[i]
+    double scalar_gflops;
+    char   isa[ZAP_MACHINE_MAX_ISAS][16];     // SIMD ISAs measured, e.g. "avx2"
+    double isa_gflops[ZAP_MACHINE_MAX_ISAS];
+    size_t isa_count;
+} zap_machine_t;
+
+// How zap_compare decides whether a change is real
+typedef enum zap_stat_test {
+    ZAP_TEST_CI = 0,     // 95% CIs do not overlap (needs only the summary)
+    ZAP_TEST_WELCH,      // Welch's unequal-variance t-test; effect = Cohen's d
+    ZAP_TEST_MWU,        // Mann-Whitney U; effect = rank-biserial correlation
+    ZAP_TEST_BOOTSTRAP   // Bootstrap of the median difference; effect = % shift
+} zap_stat_test_t;
+
 // Comparison result for a single benchmark
 typedef struct zap_comparison {
     const char*         name;
@@ -212,6 +735,14 @@ typedef struct zap_comparison {
     double              change_pct;     // Percentage change (negative = faster)
     zap_change_t  change;
     bool                significant;    // Statistically significant?
+    zap_stat_test_t     test;           // Test actually used (CI without raw samples)
+    double              p_value;        // Two-sided; 0 for ZAP_TEST_CI
+    double              effect_size;    // Positive = current is slower, see zap_stat_test_t
+    const zap_baseline_entry_t* baseline; // Entry compared against (for metrics)
+    // Largest regression among gated metrics (allocations up, custom rates down, ...)
+    bool                metric_regressed;
+    char                metric_name[32];
+    double              metric_change_pct; // INFINITY when the baseline was zero
 } zap_comparison_t;
 
 // Color output mode
@@ -239,18 +770,46 @@ typedef struct zap_env {
     bool has_avx2;
     bool has_avx512f;
     bool has_neon;
+    bool has_invariant_tsc;  // TSC ticks at a constant rate across P/C-states
+    // Memory hierarchy and clocks of CPU 0, 0 if unknown
+    size_t cache_bytes[3];   // L1d, L2, L3 data/unified capacity
+    int    cache_line;       // Line size in bytes
+    int    numa_nodes;       // Online NUMA nodes
+    double base_mhz;         // Nominal (base) frequency
+    double max_mhz;          // Maximum (turbo/boost) frequency
+    // Sources of run-to-run noise (pre-flight check)
+    char   governor[32];     // cpufreq scaling governor, "" if unknown
+    int    turbo;            // Turbo/boost: 1 = on, 0 = off, -1 = unknown
+    int    smt;              // SMT: 1 = active, 0 = off, -1 = unknown
+    double load_avg[3];      // 1/5/15-minute load averages, -1 if unknown
+    int    pinned_cpu;       // CPU the process is bound to, -1 if not pinned
+    int    pinned_siblings;  // Other hardware threads on the pinned core
+    bool   realtime;         // Running under SCHED_FIFO/SCHED_RR
+    int    nice;             // Process nice value
+    char   noise[4][64];     // Reasons the environment looks noisy
+    size_t noise_count;
 } zap_env_t;
 
-// Maximum implementations in a comparison group
-#ifndef ZAP_MAX_IMPLS
-#define ZAP_MAX_IMPLS 8
-#endif
+// Instruction set an implementation needs (zap_compare_impl_isa)
+typedef enum zap_isa {
+    ZAP_ISA_SCALAR = 0,  // Runs anywhere; the speedup reference
+    ZAP_ISA_SSE2,
+    ZAP_ISA_SSE42,
+    ZAP_ISA_AVX,
+    ZAP_ISA_AVX2,
+    ZAP_ISA_AVX512F,
+    ZAP_ISA_NEON
+} zap_isa_t;
 
 // Result for a single implementation in a comparison
 typedef struct zap_impl_result {
     char             name[64];
     zap_stats_t      stats;
     bool             valid;
+    zap_isa_t        isa;       // Set by zap_compare_impl_isa (isa_variant)
+    bool             isa_variant;
+    bool             skipped;   // ISA not supported here, never run
+    zap_bench_fn     fn;        // Interleaved: registered, run by zap_compare_end
 } zap_impl_result_t;
 
 // Comparison group configuration
@@ -258,6 +817,8 @@ typedef struct zap_compare_group {
     char                     name[128];
     zap_bench_config_t       config;
     size_t                   baseline_idx;
+    bool                     baseline_set;   // zap_compare_set_baseline() was called
+    bool                     interleave;     // Alternate samples between implementations
     bool                     header_printed;
     char                     tags[ZAP_MAX_TAGS][32];
     size_t                   tag_count;
@@ -267,8 +828,10 @@ typedef struct zap_compare_group {
 typedef struct zap_compare_ctx {
     zap_compare_group_t*     group;
     zap_benchmark_id_t       id;
-    zap_impl_result_t        results[ZAP_MAX_IMPLS];
+    zap_impl_result_t*       results;        // Grows as implementations are added
     size_t                   impl_count;
+    size_t                   impl_capacity;
+    bool                     has_isa;        // Registered through zap_compare_impl_isa
     void*                    input;
     size_t                   input_size;
     bool                     skipped;  // Set if filtered out or dry-run
@@ -279,6 +842,14 @@ typedef struct zap_compare_ctx {
 #define ZAP_MAX_CLI_TAGS 16
 #endif
 
+// Maximum --merge inputs and parallel --jobs children
+#ifndef ZAP_MAX_MERGE_FILES
+#define ZAP_MAX_MERGE_FILES 256
+#endif
+#ifndef ZAP_MAX_JOBS
+#define ZAP_MAX_JOBS 256
+#endif
+
 // Global configuration
 typedef struct zap_config {
     const char*          baseline_path;
@@ -289,6 +860,7 @@ typedef struct zap_config {
     bool                 explicit_path;  // User specified a custom path
     bool                 json_output;    // Output results as JSON
     bool                 has_regression; /* Track if any benchmark regressed beyond threshold */
+    bool                 has_failure;    // A benchmark failed to run (crashed, sent no results, ...)
     zap_color_mode_t     color_mode;     // Color output mode
     bool                 dry_run;        // List benchmarks without running
     // CLI overrides for benchmark settings
@@ -296,6 +868,16 @@ typedef struct zap_config {
     uint64_t             cli_warmup_ns;  // 0 = use default
     uint64_t             cli_time_ns;    // 0 = use default
     uint64_t             cli_min_iters;  // 0 = use default
+    double               cli_target_precision; // 0 = use default
+    zap_stat_test_t      stat_test;            // --stat-test
+    bool                 cli_baseline_format_set; // --baseline-format given
+    zap_baseline_format_t cli_baseline_format;
+    bool                 cli_sampling_set;     // --sampling given
+    zap_sampling_mode_t  cli_sampling;
+    bool                 cli_cache_mode_set;   // --cache-mode given
+    zap_cache_mode_t     cli_cache_mode;
+    double               cli_rates[ZAP_MAX_RATES]; // --rate, overrides the group's rates
+    size_t               cli_rate_count;
     // Tag filtering
     char                 cli_tags[ZAP_MAX_CLI_TAGS][32];
     size_t               cli_tag_count;
@@ -303,6 +885,45 @@ typedef struct zap_config {
     bool                 show_env;        // Show environment info
     bool                 show_histogram;  // Show distribution histogram
     bool                 show_percentiles;/* Show p75/p90/p95/p99 */
+    // Timing
+    zap_timer_kind_t     timer;               // Requested timer backend
+    bool                 overhead_correction; // Subtract per-batch timer overhead
+    // Hardware counters (perf_event_open, Linux only)
+    bool                 hw_counters;     // Sample cycles/instructions/LLC/branch misses
+    uint64_t             cli_raw_events[ZAP_MAX_HW_COUNTERS];
+    size_t               cli_raw_event_count;
+    bool                 track_alloc;     // Built with ZAP_TRACK_ALLOC on a supported libc
+    // Scheduling and environment checks
+    int                  pin_cpu;         // -1 = don't pin
+    bool                 realtime;        // Request SCHED_FIFO
+    int                  nice;            // 0 = leave unchanged
+    bool                 strict_env;      // Refuse to run when the environment is noisy
+    bool                 freq_monitor;    // Tag samples with the effective CPU frequency
+    double               min_freq_ratio;  // Drop and rerun samples below this share of nominal
+    // --profile: run matched loops for a fixed budget under an external profiler
+    bool                 profile;
+    uint64_t             profile_time_ns;
+    uint64_t             profile_iters;   // 0 = run for profile_time_ns
+    bool                 perf_ctl;        // --perf-ctl: enable/disable perf record per phase
+    int                  perf_ctl_fd;     // perf record --control fds
+    int                  perf_ack_fd;     // -1 = don't wait for acks
+    // Roofline: throughput as a share of the calibrated machine peak
+    bool                 roofline;
+    bool                 machine_valid;
+    zap_machine_t        machine;
+    bool                 isolate;         // Run each benchmark in a forked child
+    size_t               jobs;            // Parallel isolated children, 0 = serial
+    // Sharding: run only keys with zap_shard_of(key, shard_count) == shard_index
+    size_t               shard_index;
+    size_t               shard_count;     // 0 = not sharded
+    zap_baseline_t       shard_results;   // What this shard measured, saved on its own
+    const char*          merge_paths[ZAP_MAX_MERGE_FILES];  // --merge inputs
+    size_t               merge_count;
+    // Run history: every saved run is appended with its raw samples
+    bool                 history;         // --no-history turns it off
+    const char*          history_path;
+    zap_baseline_t       run_results;     // What this run measured
+    bool                 show_changes;    // --changes: report change points and exit
     zap_baseline_t baseline;
     zap_env_t      env;             // System environment info
 } zap_config_t;
@@ -315,9 +936,17 @@ extern zap_config_t zap_g_config;
 // Timing functions
 uint64_t zap_now_ns(void);
 
+// Timer backend (raw ticks for sample timing, see --timer)
+void             zap_timer_init(zap_timer_kind_t kind);
+uint64_t         zap_timer_read(void);
+double           zap_timer_ns_per_tick(void);
+double           zap_timer_overhead_ns(void);
+zap_timer_kind_t zap_timer_kind(void);
+const char*      zap_timer_name(void);
+
 // Statistics functions
 double zap_mean(const double* samples, size_t n);
-double zap_median(double* samples, size_t n);
+double zap_median(double* samples, size_t n);  // Sorts samples in place
 double zap_percentile(const double* sorted_samples, size_t n, double p);
 double zap_std_dev(const double* samples, size_t n, double mean);
 double zap_mad(double* samples, size_t n, double median);
@@ -328,6 +957,28 @@ void   zap_detect_outliers(const double* samples, size_t n,
                                  double median, double mad,
                                  size_t* low, size_t* high);
 zap_stats_t zap_compute_stats(double* samples, size_t n);
+// Same results without allocating: scratch must hold n doubles. Samples
+// are not reordered; median, MAD and percentiles come from selection.
+zap_stats_t zap_compute_stats_into(double* samples, size_t n, double* scratch);
+// k-th smallest (0-based) by introselect; reorders samples around it
+double zap_select(double* samples, size_t n, size_t k);
+// Ordinary least squares y = slope*x + intercept; slope_se is the slope's standard error
+void   zap_linear_fit(const double* x, const double* y, size_t n,
+                      double* slope, double* intercept,
+                      double* r_squared, double* slope_se);
+
+// Two-sample tests of baseline a against current b: each returns the
+// two-sided p-value and writes an effect size that is positive when b is slower
+double zap_welch_test(const double* a, size_t na, const double* b, size_t nb,
+                      double* cohens_d);
+double zap_mann_whitney_test(const double* a, size_t na, const double* b, size_t nb,
+                             double* rank_biserial);
+double zap_bootstrap_test(const double* a, size_t na, const double* b, size_t nb,
+                          size_t resamples, double* median_shift_pct);
+
+// Metric lookup by name (NULL if absent)
+const zap_metric_t* zap_find_metric(const zap_metric_t* metrics, size_t n,
+                                    const char* name);
 
 // Black box - prevents compiler from optimizing away values
 #define zap_black_box(val) zap__black_box_impl(&(val), sizeof(val))
@@ -337,7 +988,16 @@ void zap__black_box_impl(void* ptr, size_t size);
 void zap_init(zap_t* c, const char* name);
 void zap_cleanup(zap_t* c);
 bool zap_loop_start(zap_t* c);
+bool zap_loop_start_batched(zap_t* c, zap_batch_setup_fn setup, size_t input_size);
+bool zap_loop_start_latency(zap_t* c);
 void zap_loop_end(zap_t* c);
+// ZAP_ITER_LATENCY hot path: one timestamp per op, closing the previous one
+uint64_t zap_latency_now(zap_t* c);
+uint64_t zap_latency_record(zap_t* c, uint64_t prev);
+
+// Latency histogram
+void   zap_latency_hist_add(zap_latency_hist_t* h, uint64_t ticks);
+double zap_latency_hist_percentile(const zap_latency_hist_t* h, double p);  // ns
 
 // Reporting
 void zap_report(const char* name, const zap_stats_t* stats);
@@ -351,11 +1011,24 @@ zap_runtime_group_t* zap_benchmark_group(const char* name);
 void zap_group_measurement_time(zap_runtime_group_t* g, uint64_t ns);
 void zap_group_warmup_time(zap_runtime_group_t* g, uint64_t ns);
 void zap_group_sample_count(zap_runtime_group_t* g, size_t count);
+void zap_group_target_precision(zap_runtime_group_t* g, double pct);
+void zap_group_sampling_mode(zap_runtime_group_t* g, zap_sampling_mode_t mode);
+void zap_group_cache_mode(zap_runtime_group_t* g, zap_cache_mode_t mode);
+// Open loop: ZAP_ITER_LATENCY ops start on a fixed schedule of ops_per_sec and
+// latency counts from the intended start. A sweep runs each rate in turn.
+void zap_group_rate(zap_runtime_group_t* g, double ops_per_sec);
+void zap_group_rate_sweep(zap_runtime_group_t* g, const double* rates, size_t count);
 void zap_group_setup(zap_runtime_group_t* g, zap_setup_fn setup);
 void zap_group_teardown(zap_runtime_group_t* g, zap_teardown_fn teardown);
 void zap_group_tag(zap_runtime_group_t* g, const char* tag);
 void zap_group_finish(zap_runtime_group_t* g);
 
+// Fit mean = coef * f(n) for each zap_complexity_t and the log-log exponent.
+// False if fewer than 2 points have n > 0.
+bool zap_complexity_fit(const double* n, const double* mean, size_t count,
+                        zap_complexity_fit_t* out);
+const char* zap_complexity_name(zap_complexity_t c);  // "O(n log n)"
+
 // Benchmark ID for parameterized benchmarks
 zap_benchmark_id_t zap_benchmark_id(const char* label, int64_t param);
 zap_benchmark_id_t zap_benchmark_id_str(const char* label, const char* param);
@@ -368,9 +1041,64 @@ void zap_bench_with_input(zap_runtime_group_t* g,
                           void* input, size_t input_size,
                           zap_bench_fn fn);
 
+// Working-set sizes that straddle each cache level of this host: half and
+// twice each of L1d, L2 and L3, then a larger DRAM-resident size. Ascending, at
+// most ZAP_CACHE_SWEEP_MAX. Assumes 32 KB / 1 MB / 32 MB if nothing is known.
+#define ZAP_CACHE_SWEEP_MAX 7
+size_t zap_cache_sweep_sizes(size_t* sizes, size_t max);
+// zap_bench_with_input() once per zap_cache_sweep_sizes() entry, named
+// "label/16KB" etc.; z->param points at the size_t working-set bytes
+void zap_bench_cache_sweep(zap_runtime_group_t* g, const char* label, zap_bench_fn fn);
+
+// Time a command from spawn to exit, one run per sample, with the child's page
+// faults and max RSS (on Linux only shown when above the runner's own peak).
+// argv is NULL-terminated; argv[0] is looked up in PATH.
+// stdin, stdout and stderr go to /dev/null. A run that fails to start or
+// exits non-zero fails the benchmark.
+void zap_bench_exec(zap_runtime_group_t* g, const char* name, char* const argv[]);
+// zap_bench_exec(): also time spawn to the first stdout output containing marker
+void zap_group_exec_ready(zap_runtime_group_t* g, const char* marker);
+// zap_bench_exec(): drop the OS page cache before each measured run (Linux, root)
+void zap_group_exec_drop_caches(zap_runtime_group_t* g, bool drop);
+
+// Run fn concurrently on N threads for each N in thread_counts. Threads start
+// off a barrier, each with its own zap_t (z->thread_index, z->thread_count).
+// Reports "name/threads=N" per count, then a scaling table against 1 thread.
+void zap_bench_threaded(zap_runtime_group_t* g, const char* name, zap_bench_fn fn,
+                        const int* thread_counts, size_t count);
+void zap_group_pin_threads(zap_runtime_group_t* g, bool pin);
+
+// Run benchmarks bound to the CPUs of cpu_node with memory on mem_node (Linux).
+// zap_bench_with_input() inputs are migrated with mbind() and allocations made
+// by fn prefer mem_node. ZAP_NUMA_ANY leaves that side alone.
+#define ZAP_NUMA_ANY (-1)
+void zap_group_numa(zap_runtime_group_t* g, int mem_node, int cpu_node);
+// Run each benchmark once per (CPU node, memory node) pair, named
+// "name @cpu0/mem1", then print the local vs remote penalty matrix
+void zap_group_numa_sweep(zap_runtime_group_t* g, bool sweep);
+
 // Throughput configuration
 void zap_set_throughput_bytes(zap_t* z, size_t bytes_per_iter);
 void zap_set_throughput_elements(zap_t* z, size_t elements_per_iter);
+void zap_set_throughput_flops(zap_t* z, size_t flops_per_iter);
+
+// Custom counters (bytes compressed, cache hits, ...), reported under "Custom:"
+// per iteration, or per second after zap_counter_set_rate(). Adds made during
+// measured batches count; after the loop a value counts toward the whole run,
+// and during warmup it is ignored. Up to ZAP_MAX_USER_COUNTERS names, stored in
+// the baseline. --fail-threshold only gates a counter given a direction.
+void zap_counter_add(zap_t* z, const char* name, double value);
+void zap_counter_set_rate(zap_t* z, const char* name, bool per_second);
+void zap_counter_set_direction(zap_t* z, const char* name, zap_counter_direction_t dir);
+
+// Machine peaks for --roofline; the profile is cached in ZAP_MACHINE_PATH
+bool        zap_machine_calibrate(zap_machine_t* m);
+bool        zap_machine_load(zap_machine_t* m, const char* path);
+bool        zap_machine_save(const zap_machine_t* m, const char* path);
+int         zap_machine_level(const zap_machine_t* m, size_t working_set);  // Smallest level that fits
+const char* zap_machine_level_name(int level);
+double      zap_machine_peak_gbs(const zap_machine_t* m, int level);
+double      zap_machine_peak_gflops(const zap_machine_t* m, const char** isa);
 
 // Baseline management
 void zap_baseline_init(zap_baseline_t* b);
@@ -379,20 +1107,49 @@ void zap_baseline_add(zap_baseline_t* b, const char* name,
                             const zap_stats_t* stats);
 const zap_baseline_entry_t* zap_baseline_find(
     const zap_baseline_t* b, const char* name);
+size_t zap_baseline_size(const zap_baseline_t* b);  // Entries, unread records included
 bool zap_baseline_save(const zap_baseline_t* b, const char* path);
-bool zap_baseline_load(zap_baseline_t* b, const char* path);
+bool zap_baseline_save_binary(const zap_baseline_t* b, const char* path);
+bool zap_baseline_load(zap_baseline_t* b, const char* path);  // Detects v1 or v2
+// Merge a baseline file (v1 or v2) or --json output into b; later files win
+bool zap_baseline_merge_file(zap_baseline_t* b, const char* path);
+
+// Run history ("zap-history v1"): append one run, map the file, read one
+// benchmark across runs through the per-run index (samples stay in place)
+bool   zap_history_append(const char* path, const zap_env_t* env, const char* commit,
+                          const zap_baseline_t* results);
+bool   zap_history_open(zap_history_t* h, const char* path);
+void   zap_history_close(zap_history_t* h);
+// Points for name, oldest first; writes up to max and returns how many exist
+size_t zap_history_series(const zap_history_t* h, const char* name,
+                          zap_history_point_t* out, size_t max);
+// Current git commit (ZAP_GIT_COMMIT overrides), false outside a repository
+bool   zap_git_commit(char* buf, size_t size);
+// Level shifts in values by binary segmentation on the CUSUM, each kept
+// when its permutation p < ZAP_SIGNIFICANCE_ALPHA and |shift| >= ZAP_CHANGE_MIN_PCT
+size_t zap_change_points(const double* values, size_t n,
+                         zap_change_point_t* out, size_t max);
 
 // Comparison
 zap_comparison_t zap_compare(const zap_baseline_entry_t* baseline,
                                          const zap_stats_t* current);
+// Same, with an explicit test instead of --stat-test
+zap_comparison_t zap_compare_with(const zap_baseline_entry_t* baseline,
+                                  const zap_stats_t* current, zap_stat_test_t test);
 void zap_report_comparison(const char* name, const zap_stats_t* stats,
                                  const zap_comparison_t* cmp);
 
 /* CLI argument parsing */
 void zap_parse_args(int argc, char** argv);
 
+// Save the baseline and release resources; returns the process exit code
+// (1 if --fail-threshold was exceeded). Also runs at exit; safe to call twice.
+int  zap_finalize(void);
+
 // Filter matching
 bool zap_matches_filter(const char* name, const char* pattern);
+// Shard (0-based) that owns a "group/name" key; stable across runs and hosts
+size_t zap_shard_of(const char* key, size_t shard_count);
 bool zap_group_matches_tags(const zap_runtime_group_t* g);
 
 // Status messages
@@ -409,13 +1166,119 @@ void zap_env_print_json(const zap_env_t* env);
 zap_compare_group_t* zap_compare_group(const char* name);
 void zap_compare_set_baseline(zap_compare_group_t* g, size_t idx);
 void zap_compare_tag(zap_compare_group_t* g, const char* tag);
+// Warm up every implementation, then take one sample of each per round in a
+// fresh random order until all are done, so drift hits them alike. Speedups
+// come from the per-round pairs, with a 95% CI. Implementations run on their
+// own threads, one at a time, and collect no hardware counters.
+void zap_compare_interleave(zap_compare_group_t* g, bool interleave);
 zap_compare_ctx_t* zap_compare_begin(zap_compare_group_t* g,
                                      zap_benchmark_id_t id,
                                      void* input, size_t input_size);
 void zap_compare_impl(zap_compare_ctx_t* ctx, const char* name, zap_bench_fn fn);
+// Run fn only if this CPU (and OS) supports isa; otherwise it is reported as
+// skipped. Speedups are then shown against the ZAP_ISA_SCALAR variant.
+void zap_compare_impl_isa(zap_compare_ctx_t* ctx, const char* name, zap_isa_t isa,
+                          zap_bench_fn fn);
+bool zap_env_has_isa(const zap_env_t* env, zap_isa_t isa);
+const char* zap_isa_name(zap_isa_t isa);
 void zap_compare_end(zap_compare_ctx_t* ctx);
 void zap_compare_group_finish(zap_compare_group_t* g);
 
+/* INLINE LOOP HOT PATH */
+
+/*
+ * TSC reads and the steady-state batch of ZAP_ITER_UNROLLED are static
+ * inline here rather than in the ZAP_IMPLEMENTATION unit, so a benchmark's
+ * batches run without calls into the library. The clock backend is a libc
+ * call either way and stays behind zap_timer_read(), which keeps this part
+ * free of POSIX-only headers. Anything beyond a plain flat sample (first
+ * batch, time or sample limit, counters, cold cache, precision target, ...)
+ * still goes through zap_loop_start()/zap_loop_end().
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define ZAP_HAS_TSC 1
+// LFENCE keeps earlier instructions from drifting past the start read
+static inline uint64_t zap__tsc_begin(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+// RDTSCP waits for prior instructions; LFENCE keeps later ones out
+static inline uint64_t zap__tsc_end(void) {
+    uint32_t lo, hi, aux;
+    __asm__ volatile("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi), "=c"(aux) : : "memory");
+    (void)aux;
+    return ((uint64_t)hi << 32) | lo;
+}
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define ZAP_HAS_TSC 1
+static inline uint64_t zap__tsc_begin(void) {
+    uint64_t v;
+    __asm__ volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(v) : : "memory");
+    return v;
+}
+static inline uint64_t zap__tsc_end(void) {
+    return zap__tsc_begin();
+}
+static inline uint64_t zap__tsc_freq(void) {
+    uint64_t v;
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(v));
+    return v;
+}
+#endif
+
+static inline uint64_t zap__hot_begin(const zap_t* c) {
+#if defined(ZAP_HAS_TSC)
+    if (c->hot_tsc) return zap__tsc_begin();
+#endif
+    (void)c;
+    return zap_timer_read();
+}
+
+static inline uint64_t zap__hot_end(const zap_t* c) {
+#if defined(ZAP_HAS_TSC)
+    if (c->hot_tsc) return zap__tsc_end();
+#endif
+    (void)c;
+    return zap_timer_read();
+}
+
+// Start a batch of k-aligned iterations; inline unless the library has work to do
+static inline bool zap_loop_start_unrolled(zap_t* c, uint32_t k) {
+    if (c->hot && c->sample_count < c->sample_capacity) {
+        uint64_t now = zap__hot_begin(c);
+        if (now < c->hot_deadline) {
+            c->measuring = true;
+            c->current_iter = now;
+            return true;
+        }
+    }
+    c->unroll = k;
+    if (!zap_loop_start(c)) return false;
+    c->iterations = (c->iterations + k - 1) / k * k;  // Untimed: the clock already started
+    return true;
+}
+
+// End a batch; the inline path stores the sample the way zap_loop_end() does
+static inline void zap_loop_end_unrolled(zap_t* c) {
+    if (!c->hot || !c->measuring) {
+        zap_loop_end(c);
+        return;
+    }
+    uint64_t end = zap__hot_end(c);
+    double elapsed = (double)(end - c->current_iter) * c->hot_ns_per_tick - c->hot_overhead_ns;
+    if (elapsed < 0) elapsed = 0;
+    double time_per_iter = elapsed / (double)c->iterations;
+    c->samples[c->sample_count++] = time_per_iter;
+    double delta = time_per_iter - c->run_mean;
+    c->run_mean += delta / (double)c->sample_count;
+    c->run_m2 += delta * (time_per_iter - c->run_mean);
+    c->measured_iters += c->iterations;
+    if (elapsed < 500000 && c->iterations < 1000000000ULL) c->iterations *= 2;
+    c->measuring = false;
+}
+
 /* MACROS */
 
 /*
@@ -430,6 +1293,73 @@ void zap_compare_group_finish(zap_compare_group_t* g);
         for (; zap_loop_start(c); _crit_done = 1, zap_loop_end(c)) \
             for (uint64_t _crit_i = 0; _crit_i < (c)->iterations; ++_crit_i)
 
+/*
+ * ZAP_ITER_BATCHED - Loop with untimed per-iteration setup
+ * Before every batch, setup(z, slot, i) prepares one input of input_size
+ * bytes per iteration outside the timed region. The body then consumes
+ * them one at a time through `input` (any pointer lvalue). Useful when the
+ * routine destroys its input: in-place sorts, queue pops, parsers.
+ * Usage:
+ *   int* arr;
+ *   ZAP_ITER_BATCHED(z, fill_unsorted, n * sizeof(int), arr) {
+ *       sort(arr, n);
+ *   }
+ */
+#define ZAP_ITER_BATCHED(c, setup, input_size, input) \
+    for (int _crit_done = 0; !_crit_done; ) \
+        for (; zap_loop_start_batched(c, setup, input_size); _crit_done = 1, zap_loop_end(c)) \
+            for (uint64_t _crit_i = 0; _crit_i < (c)->iterations && \
+                 ((input) = (void*)((c)->batch_pool + _crit_i * (c)->batch_stride), 1); ++_crit_i)
+
+/*
+ * ZAP_ITER_LATENCY - Loop that also times every single call
+ * Each op costs one extra timestamp (the TSC where available) that closes
+ * the previous op, so tails survive instead of being averaged per batch.
+ * Latencies go into a fixed-size log-bucketed histogram; the report adds
+ * p50/p99/p99.9/p99.99/max. The batch mean includes the timestamp cost.
+ * With a rate (--rate, zap_group_rate()) the loop runs open: op i is due at
+ * batch start + i / rate, and its latency counts from that intended start,
+ * so a stall also charges the ops queued behind it (no coordinated omission).
+ * Usage:
+ *   ZAP_ITER_LATENCY(z) {
+ *       handle_request(&req);
+ *   }
+ */
+#define ZAP_ITER_LATENCY(c) \
+    for (int _crit_done = 0; !_crit_done; ) \
+        for (; zap_loop_start_latency(c); _crit_done = 1, zap_loop_end(c)) \
+            for (uint64_t _crit_i = 0, _crit_t = zap_latency_now(c); _crit_i < (c)->iterations; \
+                 ++_crit_i, _crit_t = zap_latency_record(c, _crit_t))
+
+/*
+ * ZAP_ITER_UNROLLED - Loop for nanosecond kernels
+ * The body is repeated K times per trip of the loop counter (K must be an
+ * integer constant; GCC 8+ and clang unroll it at compile time), so the
+ * counter and branch cost 1/K as much per iteration. Steady-state batches
+ * take the inline path above. The report adds the harness loop cost per
+ * iteration measured for this K; it is shown, not subtracted.
+ * Usage:
+ *   ZAP_ITER_UNROLLED(z, 8) {
+ *       x = x + 1;
+ *       zap_black_box(x);
+ *   }
+ */
+#define ZAP__PRAGMA_STR(x) #x
+#if defined(__clang__)
+#define ZAP__UNROLL(k) _Pragma(ZAP__PRAGMA_STR(clang loop unroll_count(k)))
+#elif defined(__GNUC__) && __GNUC__ >= 8
+#define ZAP__UNROLL(k) _Pragma(ZAP__PRAGMA_STR(GCC unroll k))
+#else
+#define ZAP__UNROLL(k)
+#endif
+
+#define ZAP_ITER_UNROLLED(c, K) \
+    for (int _crit_done = 0; !_crit_done; ) \
+        for (; zap_loop_start_unrolled(c, K); _crit_done = 1, zap_loop_end_unrolled(c)) \
+            for (uint64_t _crit_n = (c)->iterations / (K); _crit_n > 0; --_crit_n) \
+                ZAP__UNROLL(K) \
+                for (int _crit_u = 0; _crit_u < (K); ++_crit_u)
+
 /*
  * Duration helper macros (convert to nanoseconds)
  */
@@ -451,7 +1381,7 @@ void zap_compare_group_finish(zap_compare_group_t* g);
     int main(int argc, char** argv) { \
         zap_parse_args(argc, argv); \
         zap__run_benchmarks(); \
-        return 0; \
+        return zap_finalize(); \
     } \
     static void zap__run_benchmarks(void)
 
@@ -469,7 +1399,17 @@ void zap_compare_group_finish(zap_compare_group_t* g);
 #include <math.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/mman.h>      // mmap() for binary baselines
+#include <fcntl.h>
+#include <sys/resource.h>  // getrusage() for page faults / max RSS
 #include <unistd.h>  // For isatty()
+#include <sys/wait.h>  // waitpid() for --isolate, wait4() for zap_bench_exec()
+#include <spawn.h>     // posix_spawnp() for zap_bench_exec()
+#include <signal.h>
+#include <pthread.h>  // zap_bench_threaded(), SCHED_FIFO
+#include <sched.h>
+#include <errno.h>
+#include <poll.h>     // --perf-ctl acknowledgements
 
 /* POSIX timing */
 #if defined(__APPLE__)
@@ -504,6 +1444,40 @@ void zap_compare_group_finish(zap_compare_group_t* g);
 #define ZAP_ARM64 1
 #endif
 
+/* SIMD intrinsics for the roofline FLOP kernels (per-function target attributes) */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ZAP__FLOP_X86 1
+#include <immintrin.h>
+#elif defined(ZAP_ARM64) && (defined(__GNUC__) || defined(__clang__))
+#define ZAP__FLOP_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* Raw syscalls (sched_setaffinity, perf_event_open) */
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+/* Linux perf_event_open for hardware counters */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#define ZAP_HAS_PERF 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#endif
+#endif
+
+/* Intel ITT for VTune phase markers */
+#if defined(ZAP_USE_ITT)
+#include <ittnotify.h>
+#endif
+
+/* Allocation interposition needs glibc's __libc_* entry points */
+#if defined(ZAP_TRACK_ALLOC) && defined(__GLIBC__)
+#define ZAP_HAS_ALLOC_HOOK 1
+#include <malloc.h>  // malloc_usable_size()
+#endif
+
 /* UTILITY MACROS */
 
 #if defined(__GNUC__) || defined(__clang__)
@@ -636,6 +1610,7 @@ static void zap__detect_simd(zap_env_t* env) {
     env->has_avx2 = false;
     env->has_avx512f = false;
     env->has_neon = false;
+    env->has_invariant_tsc = false;
 
 #if defined(ZAP_X86)
     unsigned int eax, ebx, ecx, edx;
@@ -658,6 +1633,18 @@ static void zap__detect_simd(zap_env_t* env) {
         env->has_avx2    = (ebx & (1 << 5)) != 0;
         env->has_avx512f = (ebx & (1 << 16)) != 0;
     }
+
+    // Invariant TSC (advanced power management leaf, EDX bit 8)
+    ZAP_CPUID(0x80000000, eax, ebx, ecx, edx);
+    if (eax >= 0x80000007) {
+        ZAP_CPUID(0x80000007, eax, ebx, ecx, edx);
+        env->has_invariant_tsc = (edx & (1 << 8)) != 0;
+    }
+#endif
+
+#if defined(ZAP_ARM64)
+    // The generic timer (CNTVCT_EL0) runs at a fixed frequency by design
+    env->has_invariant_tsc = true;
 #endif
 
 #if defined(ZAP_ARM64)
@@ -668,6 +1655,305 @@ static void zap__detect_simd(zap_env_t* env) {
 #endif
 }
 
+/* NOISE CHECKS */
+
+#if defined(__linux__)
+// Read the first line of a small sysfs/procfs file, without the newline
+static bool zap__read_line(const char* path, char* buf, size_t size) {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    bool ok = fgets(buf, (int)size, f) != NULL;
+    fclose(f);
+    if (!ok) return false;
+    char* nl = strchr(buf, '\n');
+    if (nl) *nl = '\0';
+    return true;
+}
+
+static int zap__read_int(const char* path, int fallback) {
+    char buf[32];
+    return zap__read_line(path, buf, sizeof(buf)) ? atoi(buf) : fallback;
+}
+
+// Count CPUs in a sysfs list such as "0-3,8"
+static int zap__count_cpu_list(const char* list) {
+    int count = 0;
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long lo = strtol(p, &end, 10);
+        if (end == p) break;
+        long hi = lo;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+        }
+        count += (int)(hi - lo + 1);
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
+
+// Set the bits of a sysfs list such as "0-3,8" in mask. False if none fit.
+static bool zap__list_mask(const char* list, unsigned long* mask, size_t words) {
+    size_t bits = 8 * sizeof(unsigned long);
+    bool any = false;
+    memset(mask, 0, words * sizeof(unsigned long));
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long lo = strtol(p, &end, 10);
+        if (end == p) break;
+        long hi = lo;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+        }
+        for (long i = lo; i <= hi && i >= 0 && (size_t)i < words * bits; i++) {
+            mask[(size_t)i / bits] |= 1UL << ((size_t)i % bits);
+            any = true;
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return any;
+}
+
+// The single CPU in this process's affinity mask, or -1
+static int zap__affinity_cpu(void) {
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    long len = syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask);
+    if (len <= 0) return -1;
+    int cpu = -1;
+    size_t bits = 8 * sizeof(unsigned long);
+    for (size_t i = 0; i < (size_t)len * 8; i++) {
+        if (mask[i / bits] & (1UL << (i % bits))) {
+            if (cpu >= 0) return -1;  // More than one CPU allowed
+            cpu = (int)i;
+        }
+    }
+    return cpu;
+}
+#endif
+
+static void zap__add_noise(zap_env_t* env, const char* fmt, const char* arg, double num) {
+    if (env->noise_count >= sizeof(env->noise) / sizeof(env->noise[0])) return;
+    char* out = env->noise[env->noise_count++];
+    if (arg) {
+        snprintf(out, sizeof(env->noise[0]), fmt, arg);
+    } else {
+        snprintf(out, sizeof(env->noise[0]), fmt, num);
+    }
+}
+
+static void zap__detect_noise(zap_env_t* env) {
+    env->turbo = -1;
+    env->smt = -1;
+    env->pinned_cpu = -1;
+    env->load_avg[0] = env->load_avg[1] = env->load_avg[2] = -1.0;
+
+    int policy = 0;
+    struct sched_param param;
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+        env->realtime = policy == SCHED_FIFO || policy == SCHED_RR;
+    }
+    errno = 0;
+    int prio = getpriority(PRIO_PROCESS, 0);
+    env->nice = errno == 0 ? prio : 0;
+
+#if defined(__linux__)
+    env->pinned_cpu = zap__affinity_cpu();
+    int cpu = env->pinned_cpu >= 0 ? env->pinned_cpu : 0;
+    char path[128];
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+    zap__read_line(path, env->governor, sizeof(env->governor));
+
+    // intel_pstate exposes no_turbo, acpi-cpufreq and amd-pstate expose boost
+    int no_turbo = zap__read_int("/sys/devices/system/cpu/intel_pstate/no_turbo", -1);
+    if (no_turbo >= 0) {
+        env->turbo = no_turbo ? 0 : 1;
+    } else {
+        env->turbo = zap__read_int("/sys/devices/system/cpu/cpufreq/boost", -1);
+    }
+
+    env->smt = zap__read_int("/sys/devices/system/cpu/smt/active", -1);
+    if (env->pinned_cpu >= 0) {
+        char list[64];
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        if (zap__read_line(path, list, sizeof(list))) {
+            int n = zap__count_cpu_list(list);
+            env->pinned_siblings = n > 1 ? n - 1 : 0;
+        }
+    }
+
+    FILE* f = fopen("/proc/loadavg", "r");
+    if (f) {
+        if (fscanf(f, "%lf %lf %lf", &env->load_avg[0], &env->load_avg[1], &env->load_avg[2]) != 3) {
+            env->load_avg[0] = env->load_avg[1] = env->load_avg[2] = -1.0;
+        }
+        fclose(f);
+    }
+#elif defined(__APPLE__)
+    env->smt = env->cpu_threads > env->cpu_cores ? 1 : 0;
+    double load[3];
+    if (getloadavg(load, 3) == 3) {
+        env->load_avg[0] = load[0];
+        env->load_avg[1] = load[1];
+        env->load_avg[2] = load[2];
+    }
+#endif
+
+    if (env->governor[0] && strcmp(env->governor, "performance") != 0) {
+        zap__add_noise(env, "cpufreq governor is '%s'", env->governor, 0);
+    }
+    if (env->turbo == 1) {
+        zap__add_noise(env, "turbo boost is enabled", NULL, 0);
+    }
+    if (env->pinned_siblings > 0) {
+        zap__add_noise(env, "pinned CPU shares its core with %.0f SMT sibling(s)",
+                       NULL, (double)env->pinned_siblings);
+    }
+    if (env->load_avg[0] > ZAP_NOISY_LOAD) {
+        zap__add_noise(env, "1-minute load average is %.2f", NULL, env->load_avg[0]);
+    }
+}
+
+/* MEMORY HIERARCHY */
+
+#if defined(ZAP_X86)
+/*
+ * Deterministic cache parameters: CPUID leaf 4 on Intel, 0x8000001D on AMD,
+ * one subleaf per cache until type 0. Fallback for when sysfs has no cache
+ * directory (some containers and VMs). Returns the L1d line size, 0 if
+ * neither leaf is available.
+ */
+static int zap__cpuid_caches(size_t sizes[3]) {
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int leaf = 0;
+    ZAP_CPUID(0, eax, ebx, ecx, edx);
+    if (ebx == 0x68747541) {  // "Auth"enticAMD
+        ZAP_CPUID(0x80000000, eax, ebx, ecx, edx);
+        if (eax >= 0x8000001D) leaf = 0x8000001D;
+    } else if (eax >= 4) {
+        leaf = 4;
+    }
+    if (leaf == 0) return 0;
+
+    int line = 0;
+    for (unsigned int sub = 0; sub < 16; sub++) {
+        ZAP_CPUID_COUNT(leaf, sub, eax, ebx, ecx, edx);
+        unsigned int type = eax & 0x1f;  // 1 data, 2 instruction, 3 unified
+        unsigned int level = (eax >> 5) & 0x7;
+        if (type == 0) break;
+        if (type == 2 || level < 1 || level > 3) continue;
+        size_t ways = ((ebx >> 22) & 0x3ff) + 1;
+        size_t partitions = ((ebx >> 12) & 0x3ff) + 1;
+        size_t line_size = (ebx & 0xfff) + 1;
+        size_t sets = (size_t)ecx + 1;
+        sizes[level - 1] = ways * partitions * line_size * sets;
+        if (level == 1) line = (int)line_size;
+    }
+    return line;
+}
+#endif
+
+// Data/unified cache capacity of CPU 0 per level (L1d, L2, L3), 0 if absent
+static void zap__cache_sizes(size_t sizes[3]) {
+    sizes[0] = sizes[1] = sizes[2] = 0;
+#if defined(__APPLE__)
+    static const char* keys[3] = {"hw.l1dcachesize", "hw.l2cachesize", "hw.l3cachesize"};
+    for (int i = 0; i < 3; i++) {
+        uint64_t v = 0;
+        size_t len = sizeof(v);
+        if (sysctlbyname(keys[i], &v, &len, NULL, 0) == 0) sizes[i] = (size_t)v;
+    }
+#elif defined(__linux__)
+    for (int i = 0; i < 8; i++) {
+        char path[64], line[32];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+        if (!zap__read_line(path, line, sizeof(line))) break;
+        int level = atoi(line);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+        if (level < 1 || level > 3 || !zap__read_line(path, line, sizeof(line)) ||
+            strcmp(line, "Instruction") == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+        if (!zap__read_line(path, line, sizeof(line))) continue;
+        char* unit = NULL;
+        unsigned long v = strtoul(line, &unit, 10);
+        sizes[level - 1] = (size_t)v * (*unit == 'K' ? 1024u : *unit == 'M' ? 1024u * 1024u : 1u);
+    }
+#endif
+#if defined(ZAP_X86)
+    if (sizes[0] == 0 && sizes[1] == 0 && sizes[2] == 0) zap__cpuid_caches(sizes);
+#endif
+}
+
+
+static int zap__cache_line_size(void) {
+#if defined(__APPLE__)
+    uint64_t v = 0;
+    size_t len = sizeof(v);
+    if (sysctlbyname("hw.cachelinesize", &v, &len, NULL, 0) == 0) return (int)v;
+#elif defined(__linux__)
+    int line = zap__read_int("/sys/devices/system/cpu/cpu0/cache/index0/coherency_line_size", 0);
+    if (line > 0) return line;
+#endif
+#if defined(ZAP_X86)
+    size_t sizes[3] = {0, 0, 0};
+    return zap__cpuid_caches(sizes);
+#else
+    return 0;
+#endif
+}
+
+// Base and maximum clock in MHz: cpufreq, then CPUID leaf 0x16, or sysctl
+static void zap__cpu_freqs(double* base_mhz, double* max_mhz) {
+    *base_mhz = 0.0;
+    *max_mhz = 0.0;
+#if defined(__APPLE__)
+    uint64_t hz = 0;
+    size_t len = sizeof(hz);
+    if (sysctlbyname("hw.cpufrequency", &hz, &len, NULL, 0) == 0) *base_mhz = (double)hz / 1e6;
+    len = sizeof(hz);
+    if (sysctlbyname("hw.cpufrequency_max", &hz, &len, NULL, 0) == 0) *max_mhz = (double)hz / 1e6;
+#elif defined(__linux__)
+    // intel_pstate and amd-pstate expose base_frequency; all drivers the max, in kHz
+    int khz = zap__read_int("/sys/devices/system/cpu/cpu0/cpufreq/base_frequency", 0);
+    if (khz > 0) *base_mhz = khz / 1000.0;
+    khz = zap__read_int("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq", 0);
+    if (khz > 0) *max_mhz = khz / 1000.0;
+#endif
+#if defined(ZAP_X86)
+    if (*base_mhz == 0.0 || *max_mhz == 0.0) {
+        unsigned int eax, ebx, ecx, edx;
+        ZAP_CPUID(0, eax, ebx, ecx, edx);
+        if (eax >= 0x16) {
+            ZAP_CPUID(0x16, eax, ebx, ecx, edx);
+            if (*base_mhz == 0.0) *base_mhz = (double)(eax & 0xffff);
+            if (*max_mhz == 0.0) *max_mhz = (double)(ebx & 0xffff);
+        }
+    }
+#endif
+}
+
+static void zap__detect_memory(zap_env_t* env) {
+    zap__cache_sizes(env->cache_bytes);
+    env->cache_line = zap__cache_line_size();
+    zap__cpu_freqs(&env->base_mhz, &env->max_mhz);
+#if defined(__linux__)
+    char list[256];
+    if (zap__read_line("/sys/devices/system/node/online", list, sizeof(list))) {
+        env->numa_nodes = zap__count_cpu_list(list);
+    }
+#elif defined(__APPLE__)
+    env->numa_nodes = 1;
+#endif
+}
+
 void zap_env_detect(zap_env_t* env) {
     memset(env, 0, sizeof(*env));
     zap__detect_cpu_model(env);
@@ -675,6 +1961,8 @@ void zap_env_detect(zap_env_t* env) {
     zap__detect_os(env);
     zap__detect_compiler(env);
     zap__detect_simd(env);
+    zap__detect_memory(env);
+    zap__detect_noise(env);
 }
 
 /* TIMING IMPLEMENTATION */
@@ -693,12 +1981,294 @@ uint64_t zap_now_ns(void) {
 #endif
 }
 
-/* STATISTICS IMPLEMENTATION */
+/*
+ * Sample timing goes through a small backend abstraction. zap_t keeps raw
+ * ticks and converts to nanoseconds only when a batch ends, so each batch
+ * costs exactly one timer read at the start and one at the end.
+ *
+ *   clock: clock_gettime(CLOCK_MONOTONIC) on Linux, mach_absolute_time on macOS
+ *   tsc:   LFENCE;RDTSC to start and RDTSCP;LFENCE to stop on x86 (requires an
+ *          invariant TSC), ISB;CNTVCT_EL0 on ARM64
+ *
+ * zap_timer_init() converts ticks to ns (TSC against CLOCK_MONOTONIC over
+ * ~10ms, ARM64 via CNTFRQ_EL0) and measures the cost of an empty batch: the
+ * zap_loop_start()/zap_loop_end() sequence ZAP_ITER runs around a one-iteration
+ * body. --overhead-correction subtracts that from every batch.
+ */
+typedef struct {
+    zap_timer_kind_t kind;
+    double           ns_per_tick;
+    double           overhead_ns;  // Median cost of an empty batch
+    bool             initialized;
+} zap__timer_t;
 
-static int zap__cmp_double(const void* a, const void* b) {
-    double da = *(const double*)a;
-    double db = *(const double*)b;
-    return (da > db) - (da < db);
+static zap__timer_t zap__timer = {ZAP_TIMER_CLOCK, 1.0, 0.0, false};
+
+// TSC reads are defined with the inline loop hot path above
+static inline uint64_t zap__clock_ticks(void) {
+#if defined(__APPLE__)
+    return mach_absolute_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t zap__timer_begin(void) {
+#if defined(ZAP_HAS_TSC)
+    if (zap__timer.kind == ZAP_TIMER_TSC) return zap__tsc_begin();
+#endif
+    return zap__clock_ticks();
+}
+
+static inline uint64_t zap__timer_end(void) {
+#if defined(ZAP_HAS_TSC)
+    if (zap__timer.kind == ZAP_TIMER_TSC) return zap__tsc_end();
+#endif
+    return zap__clock_ticks();
+}
+
+static inline double zap__ticks_to_ns(uint64_t ticks) {
+    return (double)ticks * zap__timer.ns_per_tick;
+}
+
+#if defined(ZAP_HAS_TSC)
+// ns per TSC tick, or 0 without an invariant TSC; calibrated once
+static double zap__tsc_ns_per_tick(void) {
+    static double ns_per_tick = -1.0;
+    if (ns_per_tick >= 0) return ns_per_tick;
+
+    zap_env_t env;
+    zap__detect_simd(&env);
+    if (!env.has_invariant_tsc) {
+        ns_per_tick = 0.0;
+        return ns_per_tick;
+    }
+#if defined(ZAP_ARM64)
+    ns_per_tick = 1e9 / (double)zap__tsc_freq();
+#else
+    // Calibrate against the monotonic clock over ~10ms
+    uint64_t c0 = zap_now_ns();
+    uint64_t t0 = zap__tsc_begin();
+    while (zap_now_ns() - c0 < 10000000ULL) { }
+    uint64_t c1 = zap_now_ns();
+    uint64_t t1 = zap__tsc_end();
+    ns_per_tick = (double)(c1 - c0) / (double)(t1 - t0);
+#endif
+    return ns_per_tick;
+}
+#endif
+
+void zap_timer_init(zap_timer_kind_t kind) {
+    zap__timer.kind = ZAP_TIMER_CLOCK;
+#if defined(__APPLE__)
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    zap__timer.ns_per_tick = (double)timebase.numer / (double)timebase.denom;
+#else
+    zap__timer.ns_per_tick = 1.0;
+#endif
+
+    if (kind == ZAP_TIMER_TSC) {
+#if defined(ZAP_HAS_TSC)
+        double tsc = zap__tsc_ns_per_tick();
+        if (tsc <= 0) {
+            fprintf(stderr, "Warning: TSC is not invariant, using clock timer\n");
+        } else {
+            zap__timer.kind = ZAP_TIMER_TSC;
+            zap__timer.ns_per_tick = tsc;
+        }
+#else
+        fprintf(stderr, "Warning: TSC timer not supported on this platform, using clock timer\n");
+#endif
+    }
+
+    zap__timer.overhead_ns = 0.0;
+    zap__timer.initialized = true;  // The calibration loop below reads the timer
+
+    // Per-batch overhead: median of empty one-iteration batches run through
+    // the real loop path. A worker routine keeps counters and status out.
+    enum { ZAP__OVERHEAD_RUNS = 1001 };
+    static double deltas[ZAP__OVERHEAD_RUNS];
+    zap_t cal;
+    zap_init(&cal, "overhead");
+    free(cal.samples);
+    cal.samples = deltas;
+    cal.sample_capacity = ZAP__OVERHEAD_RUNS;
+    cal.worker = true;
+    cal.warmup_complete = true;
+    cal.config.measurement_time_ns = UINT64_MAX;
+    cal.config.target_precision = 0;
+    cal.config.cache_mode = ZAP_CACHE_WARM;
+    cal.start_time = zap__timer_begin();
+    while (cal.iterations = 1, zap_loop_start(&cal)) {
+        for (uint64_t n = 0; n < cal.iterations; n++) {
+            __asm__ volatile("");
+        }
+        zap_loop_end(&cal);
+    }
+    if (cal.sample_count > 0) {
+        zap__timer.overhead_ns = zap_median(deltas, cal.sample_count);
+    }
+    cal.samples = NULL;
+    zap_cleanup(&cal);
+}
+
+// Lazy init for code paths that never ran zap_parse_args()
+static void zap__timer_ensure_init(void) {
+    if (!zap__timer.initialized) {
+        zap_timer_init(zap_g_config.timer);
+    }
+}
+
+uint64_t zap_timer_read(void) {
+    zap__timer_ensure_init();
+    return zap__timer_begin();
+}
+
+double zap_timer_ns_per_tick(void) {
+    zap__timer_ensure_init();
+    return zap__timer.ns_per_tick;
+}
+
+double zap_timer_overhead_ns(void) {
+    zap__timer_ensure_init();
+    return zap__timer.overhead_ns;
+}
+
+zap_timer_kind_t zap_timer_kind(void) {
+    zap__timer_ensure_init();
+    return zap__timer.kind;
+}
+
+const char* zap_timer_name(void) {
+    return zap_timer_kind() == ZAP_TIMER_TSC ? "tsc" : "clock";
+}
+
+/* STATISTICS IMPLEMENTATION */
+
+/*
+ * Introselect: quickselect with a median-of-three pivot, falling back to
+ * heapsort on the remaining range once the recursion depth passes
+ * 2*log2(n), so the worst case stays O(n log n). Afterwards v[k] holds the
+ * k-th smallest value, everything before it is <= and everything after >=.
+ */
+static void zap__swap_double(double* a, double* b) {
+    double t = *a;
+    *a = *b;
+    *b = t;
+}
+
+static void zap__sift_down(double* v, size_t root, size_t n) {
+    for (;;) {
+        size_t child = 2 * root + 1;
+        if (child >= n) return;
+        if (child + 1 < n && v[child + 1] > v[child]) child++;
+        if (v[root] >= v[child]) return;
+        zap__swap_double(&v[root], &v[child]);
+        root = child;
+    }
+}
+
+static void zap__heapsort(double* v, size_t n) {
+    for (size_t i = n / 2; i-- > 0; ) zap__sift_down(v, i, n);
+    for (size_t end = n; end-- > 1; ) {
+        zap__swap_double(&v[0], &v[end]);
+        zap__sift_down(v, 0, end);
+    }
+}
+
+static void zap__insertion_sort(double* v, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        double x = v[i];
+        size_t j = i;
+        while (j > 0 && v[j - 1] > x) {
+            v[j] = v[j - 1];
+            j--;
+        }
+        v[j] = x;
+    }
+}
+
+double zap_select(double* v, size_t n, size_t k) {
+    if (n == 0) return 0.0;
+    if (k >= n) k = n - 1;
+
+    size_t lo = 0, hi = n;  // k is in [lo, hi)
+    int depth = 0;
+    for (size_t m = n; m > 1; m >>= 1) depth += 2;
+
+    while (hi - lo > 16) {
+        if (depth-- == 0) {
+            zap__heapsort(v + lo, hi - lo);
+            return v[k];
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        if (v[mid] < v[lo]) zap__swap_double(&v[mid], &v[lo]);
+        if (v[hi - 1] < v[lo]) zap__swap_double(&v[hi - 1], &v[lo]);
+        if (v[hi - 1] < v[mid]) zap__swap_double(&v[hi - 1], &v[mid]);
+        double pivot = v[mid];
+
+        // Hoare partition: [lo, j] <= pivot <= [j + 1, hi)
+        size_t i = lo, j = hi - 1;
+        for (;;) {
+            while (v[i] < pivot) i++;
+            while (v[j] > pivot) j--;
+            if (i >= j) break;
+            zap__swap_double(&v[i], &v[j]);
+            i++;
+            j--;
+        }
+        if (k <= j) hi = j + 1;
+        else lo = j + 1;
+    }
+    zap__insertion_sort(v + lo, hi - lo);
+    return v[k];
+}
+
+/*
+ * Select several order statistics at once. ks must be ascending; each
+ * selection only reorders the range right of the previous k, so every
+ * v[ks[i]] ends up where a full sort would put it.
+ */
+static void zap__select_many(double* v, size_t n, const size_t* ks, size_t count) {
+    size_t from = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t k = ks[i];
+        if (k < from || k >= n) continue;  // Already in place
+        zap_select(v + from, n - from, k - from);
+        from = k + 1;
+    }
+}
+
+static void zap__insertion_sort_size(size_t* v, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        size_t x = v[i];
+        size_t j = i;
+        while (j > 0 && v[j - 1] > x) {
+            v[j] = v[j - 1];
+            j--;
+        }
+        v[j] = x;
+    }
+}
+
+// Median of v (reordered); same value as sorting and taking the middle
+static double zap__median_select(double* v, size_t n) {
+    if (n == 0) return 0.0;
+    if (n % 2 == 0) {
+        size_t ks[2] = {n / 2 - 1, n / 2};
+        zap__select_many(v, n, ks, 2);
+        return (v[n / 2 - 1] + v[n / 2]) / 2.0;
+    }
+    return zap_select(v, n, n / 2);
+}
+
+static int zap__cmp_double(const void* a, const void* b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da > db) - (da < db);
 }
 
 double zap_mean(const double* samples, size_t n) {
@@ -752,16 +2322,64 @@ double zap_mad(double* samples, size_t n, double median) {
         deviations[i] = fabs(samples[i] - median);
     }
 
-    double result = zap_median(deviations, n);
+    double result = zap__median_select(deviations, n);
     free(deviations);
     return result;
 }
 
-void zap_confidence_interval(const double* samples, size_t n,
-                                   double mean, double std_dev,
-                                   double* ci_lower, double* ci_upper) {
-    (void)samples;  // CI computed from mean/std_dev directly
-    // Using t-distribution approximation for 95% CI
+/*
+ * Min, max, mean and sample std dev. The default path sums in order so the
+ * results match zap_mean/zap_std_dev bit for bit; ZAP_FAST_STATS uses four
+ * independent accumulators, which the compiler can vectorize, at the cost
+ * of last-bit differences from the reassociated sums.
+ */
+static void zap__moments(const double* v, size_t n, double* min, double* max,
+                         double* mean, double* std_dev) {
+    double lo = v[0], hi = v[0];
+#ifdef ZAP_FAST_STATS
+    double s[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int l = 0; l < 4; l++) {
+            double x = v[i + l];
+            s[l] += x;
+            lo = x < lo ? x : lo;
+            hi = x > hi ? x : hi;
+        }
+    }
+    double sum = (s[0] + s[1]) + (s[2] + s[3]);
+    for (; i < n; i++) {
+        sum += v[i];
+        lo = v[i] < lo ? v[i] : lo;
+        hi = v[i] > hi ? v[i] : hi;
+    }
+    double m = sum / (double)n;
+
+    double q[4] = {0, 0, 0, 0};
+    for (i = 0; i + 4 <= n; i += 4) {
+        for (int l = 0; l < 4; l++) {
+            double d = v[i + l] - m;
+            q[l] += d * d;
+        }
+    }
+    double sum_sq = (q[0] + q[1]) + (q[2] + q[3]);
+    for (; i < n; i++) sum_sq += (v[i] - m) * (v[i] - m);
+    *mean = m;
+    *std_dev = n > 1 ? sqrt(sum_sq / (double)(n - 1)) : 0.0;
+#else
+    for (size_t i = 1; i < n; i++) {
+        if (v[i] < lo) lo = v[i];
+        if (v[i] > hi) hi = v[i];
+    }
+    *mean = zap_mean(v, n);
+    *std_dev = zap_std_dev(v, n, *mean);
+#endif
+    *min = lo;
+    *max = hi;
+}
+
+// Two-sided 95% Student t critical value for n samples (n - 1 dof)
+static double zap__t_value(size_t n) {
     // For large n, t approaches 1.96
     double t = 1.96;
     if (n < 30) {
@@ -778,7 +2396,15 @@ void zap_confidence_interval(const double* samples, size_t n,
             t = t_values[n - 2];
         }
     }
+    return t;
+}
 
+void zap_confidence_interval(const double* samples, size_t n,
+                                   double mean, double std_dev,
+                                   double* ci_lower, double* ci_upper) {
+    (void)samples;  // CI computed from mean/std_dev directly
+    // Using t-distribution approximation for 95% CI
+    double t = zap__t_value(n);
     double margin = t * std_dev / sqrt((double)n);
     *ci_lower = mean - margin;
     *ci_upper = mean + margin;
@@ -810,35 +2436,54 @@ zap_stats_t zap_compute_stats(double* samples, size_t n) {
     zap_stats_t stats = {0};
     if (n == 0) return stats;
 
-    stats.sample_count = n;
-    stats.samples = samples;  // Keep reference for histogram
+    double* scratch = (double*)malloc(n * sizeof(double));
+    if (!scratch) return stats;
+    stats = zap_compute_stats_into(samples, n, scratch);
+    free(scratch);
+    return stats;
+}
 
-    // Calculate min/max
-    stats.min = samples[0];
-    stats.max = samples[0];
-    for (size_t i = 1; i < n; i++) {
-        if (samples[i] < stats.min) stats.min = samples[i];
-        if (samples[i] > stats.max) stats.max = samples[i];
-    }
+// Index pair zap_percentile() interpolates between
+static void zap__percentile_ranks(size_t n, double p, size_t* lower, size_t* upper) {
+    double rank = (p / 100.0) * (n - 1);
+    *lower = (size_t)rank;
+    *upper = *lower + 1 < n ? *lower + 1 : n - 1;
+}
 
-    // Need a copy for median since it sorts
-    double* sorted = (double*)malloc(n * sizeof(double));
-    if (!sorted) return stats;
-    memcpy(sorted, samples, n * sizeof(double));
+zap_stats_t zap_compute_stats_into(double* samples, size_t n, double* scratch) {
+    zap_stats_t stats = {0};
+    if (n == 0) return stats;
 
-    stats.mean = zap_mean(samples, n);
-    stats.median = zap_median(sorted, n);  // sorted is now sorted
-    stats.std_dev = zap_std_dev(samples, n, stats.mean);
+    stats.sample_count = n;
+    stats.samples = samples;  // Keep reference for histogram; never reordered
+
+    zap__moments(samples, n, &stats.min, &stats.max, &stats.mean, &stats.std_dev);
+
+    // Select just the order statistics the median and percentiles read
+    static const double pcts[4] = {75.0, 90.0, 95.0, 99.0};
+    size_t ks[10];
+    size_t count = 0;
+    ks[count++] = (n - 1) / 2;
+    ks[count++] = n / 2;
+    for (int i = 0; i < 4; i++) {
+        zap__percentile_ranks(n, pcts[i], &ks[count], &ks[count + 1]);
+        count += 2;
+    }
+    zap__insertion_sort_size(ks, count);
 
-    // Calculate percentiles from sorted data
-    stats.p75 = zap_percentile(sorted, n, 75.0);
-    stats.p90 = zap_percentile(sorted, n, 90.0);
-    stats.p95 = zap_percentile(sorted, n, 95.0);
-    stats.p99 = zap_percentile(sorted, n, 99.0);
+    memcpy(scratch, samples, n * sizeof(double));
+    zap__select_many(scratch, n, ks, count);
+    stats.median = n % 2 ? scratch[n / 2] : (scratch[n / 2 - 1] + scratch[n / 2]) / 2.0;
+    stats.p75 = zap_percentile(scratch, n, 75.0);  // Reads only selected slots
+    stats.p90 = zap_percentile(scratch, n, 90.0);
+    stats.p95 = zap_percentile(scratch, n, 95.0);
+    stats.p99 = zap_percentile(scratch, n, 99.0);
 
-    // Need fresh copy for MAD calculation (it sorts internally)
-    memcpy(sorted, samples, n * sizeof(double));
-    stats.mad = zap_mad(sorted, n, stats.median);
+    // MAD reuses the same buffer for the absolute deviations
+    for (size_t i = 0; i < n; i++) {
+        scratch[i] = fabs(samples[i] - stats.median);
+    }
+    stats.mad = zap__median_select(scratch, n);
 
     zap_confidence_interval(samples, n, stats.mean, stats.std_dev,
                                   &stats.ci_lower, &stats.ci_upper);
@@ -846,119 +2491,795 @@ zap_stats_t zap_compute_stats(double* samples, size_t n) {
     zap_detect_outliers(samples, n, stats.median, stats.mad,
                               &stats.outliers_low, &stats.outliers_high);
 
-    free(sorted);
     return stats;
 }
 
-/* BLACK BOX IMPLEMENTATION */
+void zap_linear_fit(const double* x, const double* y, size_t n,
+                    double* slope, double* intercept,
+                    double* r_squared, double* slope_se) {
+    *slope = 0.0;
+    *intercept = 0.0;
+    *r_squared = 0.0;
+    *slope_se = 0.0;
+    if (n < 2) return;
+
+    double mx = zap_mean(x, n);
+    double my = zap_mean(y, n);
+    double sxx = 0.0, sxy = 0.0, syy = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double dx = x[i] - mx;
+        double dy = y[i] - my;
+        sxx += dx * dx;
+        sxy += dx * dy;
+        syy += dy * dy;
+    }
+    if (sxx <= 0.0) return;
 
-// Prevent compiler from optimizing away the value
-void zap__black_box_impl(void* ptr, size_t size) {
-    (void)size;
-    __asm__ volatile("" : : "g"(ptr) : "memory");
+    *slope = sxy / sxx;
+    *intercept = my - *slope * mx;
+
+    // Residual sum of squares = syy - slope * sxy
+    double ssr = syy - *slope * sxy;
+    if (ssr < 0.0) ssr = 0.0;
+    *r_squared = syy > 0.0 ? 1.0 - ssr / syy : 1.0;
+    if (n > 2) {
+        *slope_se = sqrt(ssr / (double)(n - 2) / sxx);
+    }
 }
 
-/* STATUS MESSAGE IMPLEMENTATION */
+/* TWO-SAMPLE TESTS */
+
+// Continued fraction for the regularized incomplete beta (modified Lentz)
+static double zap__betacf(double a, double b, double x) {
+    const double tiny = 1e-300;
+    double qab = a + b, qap = a + 1.0, qam = a - 1.0;
+    double c = 1.0;
+    double d = 1.0 - qab * x / qap;
+    if (fabs(d) < tiny) d = tiny;
+    d = 1.0 / d;
+    double h = d;
+    for (int m = 1; m <= 200; m++) {
+        int m2 = 2 * m;
+        double aa = m * (b - m) * x / ((qam + m2) * (a + m2));
+        d = 1.0 + aa * d;
+        if (fabs(d) < tiny) d = tiny;
+        c = 1.0 + aa / c;
+        if (fabs(c) < tiny) c = tiny;
+        d = 1.0 / d;
+        h *= d * c;
+        aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2));
+        d = 1.0 + aa * d;
+        if (fabs(d) < tiny) d = tiny;
+        c = 1.0 + aa / c;
+        if (fabs(c) < tiny) c = tiny;
+        d = 1.0 / d;
+        double del = d * c;
+        h *= del;
+        if (fabs(del - 1.0) < 1e-12) break;
+    }
+    return h;
+}
 
-static int zap__is_tty = -1;  // -1 = not checked yet
+static double zap__betai(double a, double b, double x) {
+    if (x <= 0.0) return 0.0;
+    if (x >= 1.0) return 1.0;
+    double bt = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+                    a * log(x) + b * log(1.0 - x));
+    if (x < (a + 1.0) / (a + b + 2.0)) return bt * zap__betacf(a, b, x) / a;
+    return 1.0 - bt * zap__betacf(b, a, 1.0 - x) / b;
+}
 
-static int zap__check_tty(void) {
-    if (zap__is_tty < 0) {
-        zap__is_tty = isatty(STDOUT_FILENO);
-    }
-    return zap__is_tty;
+double zap_welch_test(const double* a, size_t na, const double* b, size_t nb,
+                      double* cohens_d) {
+    *cohens_d = 0.0;
+    if (na < 2 || nb < 2) return 1.0;
+
+    double ma = zap_mean(a, na), mb = zap_mean(b, nb);
+    double sa = zap_std_dev(a, na, ma), sb = zap_std_dev(b, nb, mb);
+    double va = sa * sa / (double)na, vb = sb * sb / (double)nb;
+    double pooled = sqrt((sa * sa + sb * sb) / 2.0);
+    if (pooled > 0) *cohens_d = (mb - ma) / pooled;
+    if (va + vb <= 0) return ma == mb ? 1.0 : 0.0;
+
+    double t = (mb - ma) / sqrt(va + vb);
+    double df = (va + vb) * (va + vb) /
+                (va * va / (double)(na - 1) + vb * vb / (double)(nb - 1));
+    return zap__betai(df / 2.0, 0.5, df / (df + t * t));
 }
 
-// Check if colors should be used based on color_mode setting
-static int zap__use_colors(void) {
-    switch (zap_g_config.color_mode) {
-        case ZAP_COLOR_ALWAYS: return 1;
-        case ZAP_COLOR_NEVER:  return 0;
-        default:               return zap__check_tty();
+typedef struct {
+    double value;
+    int    group;  // 0 = a, 1 = b
+} zap__ranked_t;
+
+static int zap__cmp_ranked(const void* x, const void* y) {
+    double a = ((const zap__ranked_t*)x)->value;
+    double b = ((const zap__ranked_t*)y)->value;
+    return (a > b) - (a < b);
+}
+
+double zap_mann_whitney_test(const double* a, size_t na, const double* b, size_t nb,
+                             double* rank_biserial) {
+    *rank_biserial = 0.0;
+    if (na == 0 || nb == 0) return 1.0;
+
+    size_t n = na + nb;
+    zap__ranked_t* all = (zap__ranked_t*)malloc(n * sizeof(zap__ranked_t));
+    if (!all) return 1.0;
+    for (size_t i = 0; i < na; i++) { all[i].value = a[i]; all[i].group = 0; }
+    for (size_t i = 0; i < nb; i++) { all[na + i].value = b[i]; all[na + i].group = 1; }
+    qsort(all, n, sizeof(zap__ranked_t), zap__cmp_ranked);
+
+    // Sum of b's ranks, ties get their average rank
+    double rank_sum_b = 0.0, tie_term = 0.0;
+    for (size_t i = 0; i < n; ) {
+        size_t j = i + 1;
+        while (j < n && all[j].value == all[i].value) j++;
+        double rank = (double)(i + j + 1) / 2.0;  // 1-based ranks i+1 .. j
+        for (size_t k = i; k < j; k++) {
+            if (all[k].group == 1) rank_sum_b += rank;
+        }
+        double t = (double)(j - i);
+        tie_term += t * t * t - t;
+        i = j;
     }
+    free(all);
+
+    double fa = (double)na, fb = (double)nb, fn = (double)n;
+    double u = rank_sum_b - fb * (fb + 1.0) / 2.0;
+    *rank_biserial = 2.0 * u / (fa * fb) - 1.0;
+
+    // Normal approximation with tie and continuity corrections
+    double mu = fa * fb / 2.0;
+    double var = fa * fb / 12.0 * ((fn + 1.0) - tie_term / (fn * (fn - 1.0)));
+    if (var <= 0) return 1.0;
+    double diff = fabs(u - mu) - 0.5;
+    if (diff < 0) diff = 0;
+    return erfc(diff / sqrt(var) / sqrt(2.0));
 }
 
-// Conditional color codes - return empty string if colors disabled
-static ZAP_UNUSED const char* zap__c_reset(void)   { return zap__use_colors() ? ZAP_COLOR_RESET : ""; }
-static ZAP_UNUSED const char* zap__c_bold(void)    { return zap__use_colors() ? ZAP_COLOR_BOLD : ""; }
-static ZAP_UNUSED const char* zap__c_dim(void)     { return zap__use_colors() ? ZAP_COLOR_DIM : ""; }
-static ZAP_UNUSED const char* zap__c_green(void)   { return zap__use_colors() ? ZAP_COLOR_GREEN : ""; }
-static ZAP_UNUSED const char* zap__c_yellow(void)  { return zap__use_colors() ? ZAP_COLOR_YELLOW : ""; }
-static ZAP_UNUSED const char* zap__c_blue(void)    { return zap__use_colors() ? ZAP_COLOR_BLUE : ""; }
-static ZAP_UNUSED const char* zap__c_cyan(void)    { return zap__use_colors() ? ZAP_COLOR_CYAN : ""; }
-static ZAP_UNUSED const char* zap__c_red(void)     { return zap__use_colors() ? ZAP_COLOR_RED : ""; }
-static ZAP_UNUSED const char* zap__c_magenta(void) { return zap__use_colors() ? ZAP_COLOR_MAGENTA : ""; }
-static ZAP_UNUSED const char* zap__c_purple(void)  { return zap__use_colors() ? ZAP_COLOR_PURPLE : ""; }
+// xorshift64*: fixed seed so a comparison gives the same verdict every run
+static uint64_t zap__rand_next(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ULL;
+}
 
-/* ENVIRONMENT PRINT */
+static double zap__resample_median(const double* src, size_t n, double* scratch,
+                                   uint64_t* rng) {
+    for (size_t i = 0; i < n; i++) scratch[i] = src[zap__rand_next(rng) % n];
+    return zap__median_select(scratch, n);
+}
 
-void zap_env_print(const zap_env_t* env) {
-    printf("%s%sEnvironment:%s\n", zap__c_bold(), zap__c_magenta(), zap__c_reset());
-    printf("  %sCPU:%s      %s%s%s\n",
-           zap__c_dim(), zap__c_reset(),
-           zap__c_cyan(), env->cpu_model, zap__c_reset());
-    printf("  %sCores:%s    %s%d%s physical, %s%d%s logical\n",
-           zap__c_dim(), zap__c_reset(),
-           zap__c_cyan(), env->cpu_cores, zap__c_reset(),
-           zap__c_cyan(), env->cpu_threads, zap__c_reset());
-    printf("  %sOS:%s       %s\n",
-           zap__c_dim(), zap__c_reset(), env->os_info);
-    printf("  %sCompiler:%s %s\n",
-           zap__c_dim(), zap__c_reset(), env->compiler);
+double zap_bootstrap_test(const double* a, size_t na, const double* b, size_t nb,
+                          size_t resamples, double* median_shift_pct) {
+    *median_shift_pct = 0.0;
+    if (na == 0 || nb == 0 || resamples == 0) return 1.0;
+
+    double* scratch = (double*)malloc((na > nb ? na : nb) * sizeof(double));
+    if (!scratch) return 1.0;
+
+    memcpy(scratch, a, na * sizeof(double));
+    double med_a = zap__median_select(scratch, na);
+    memcpy(scratch, b, nb * sizeof(double));
+    double med_b = zap__median_select(scratch, nb);
+    if (med_a != 0) *median_shift_pct = (med_b - med_a) / med_a * 100.0;
+
+    // Two-sided percentile test: how often does the resampled shift cross zero?
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    size_t below = 0, above = 0;
+    for (size_t r = 0; r < resamples; r++) {
+        double diff = zap__resample_median(b, nb, scratch, &rng) -
+                      zap__resample_median(a, na, scratch, &rng);
+        if (diff <= 0) below++;
+        if (diff >= 0) above++;
+    }
+    free(scratch);
 
-    // Build SIMD string
-    printf("  %sSIMD:%s     %s", zap__c_dim(), zap__c_reset(), zap__c_cyan());
-    bool first = true;
+    double tail = (double)(below < above ? below : above);
+    double p = 2.0 * (tail + 1.0) / ((double)resamples + 1.0);
+    return p > 1.0 ? 1.0 : p;
+}
 
-#if defined(ZAP_X86)
-    if (env->has_avx512f) { printf("%sAVX-512", first ? "" : ", "); first = false; }
-    else if (env->has_avx2) { printf("%sAVX2", first ? "" : ", "); first = false; }
-    else if (env->has_avx) { printf("%sAVX", first ? "" : ", "); first = false; }
+const zap_metric_t* zap_find_metric(const zap_metric_t* metrics, size_t n,
+                                    const char* name) {
+    for (size_t i = 0; i < n; i++) {
+        if (strcmp(metrics[i].name, name) == 0) {
+            return &metrics[i];
+        }
+    }
+    return NULL;
+}
 
-    if (env->has_sse42) { printf("%sSSE4.2", first ? "" : ", "); first = false; }
-    else if (env->has_sse41) { printf("%sSSE4.1", first ? "" : ", "); first = false; }
-    else if (env->has_ssse3) { printf("%sSSSE3", first ? "" : ", "); first = false; }
-    else if (env->has_sse3) { printf("%sSSE3", first ? "" : ", "); first = false; }
-    else if (env->has_sse2) { printf("%sSSE2", first ? "" : ", "); first = false; }
-    else if (env->has_sse) { printf("%sSSE", first ? "" : ", "); first = false; }
-#endif
+// Append or overwrite a named metric, silently dropping when the table is full
+static void zap__set_metric(zap_metric_t* metrics, size_t* n, const char* name,
+                            double value, zap_metric_kind_t kind, uint32_t flags) {
+    zap_metric_t* m = NULL;
+    for (size_t i = 0; i < *n && !m; i++) {
+        if (strcmp(metrics[i].name, name) == 0) m = &metrics[i];
+    }
+    if (!m) {
+        if (*n >= ZAP_MAX_METRICS) return;
+        m = &metrics[(*n)++];
+        memset(m, 0, sizeof(*m));
+        strncpy(m->name, name, sizeof(m->name) - 1);
+    }
+    m->value = value;
+    m->kind = kind;
+    m->flags = flags;
+}
 
-    if (env->has_neon) { printf("%sNEON", first ? "" : ", "); first = false; }
+/* HARDWARE COUNTERS IMPLEMENTATION */
 
-    if (first) printf("%snone detected", zap__c_yellow());
-    printf("%s\n\n", zap__c_reset());
+/*
+ * One perf event group per process, opened lazily on the first measured
+ * batch. The leader is cycles; members are read together with a single
+ * read() so all counters cover exactly the same interval. Counts exclude
+ * kernel and hypervisor so perf_event_paranoid <= 2 is enough.
+ */
+typedef struct {
+    int      fds[ZAP_MAX_HW_COUNTERS];
+    char     names[ZAP_MAX_HW_COUNTERS][32];
+    size_t   count;
+    bool     opened;   // Open was attempted
+    bool     ready;    // Group is usable
+} zap__hw_t;
+
+static zap__hw_t zap__hw = {0};
+
+#if defined(ZAP_HAS_PERF)
+static int zap__hw_open_event(uint32_t type, uint64_t config, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd == -1 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP |
+                       PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
 }
 
-void zap_env_print_json(const zap_env_t* env) {
-    printf("{\"type\":\"environment\"");
-    printf(",\"cpu\":\"%s\"", env->cpu_model);
-    printf(",\"cores\":%d", env->cpu_cores);
-    printf(",\"threads\":%d", env->cpu_threads);
-    printf(",\"os\":\"%s\"", env->os_info);
-    printf(",\"compiler\":\"%s\"", env->compiler);
+static void zap__hw_add(uint32_t type, uint64_t config, const char* name) {
+    if (zap__hw.count >= ZAP_MAX_HW_COUNTERS) return;
+    int leader = zap__hw.count > 0 ? zap__hw.fds[0] : -1;
+    int fd = zap__hw_open_event(type, config, leader);
+    if (fd < 0) {
+        // Leader failure is reported once by the caller
+        if (leader != -1 && !zap_g_config.json_output) {
+            fprintf(stderr, "Warning: hardware counter '%s' unavailable\n", name);
+        }
+        return;
+    }
+    zap__hw.fds[zap__hw.count] = fd;
+    snprintf(zap__hw.names[zap__hw.count], sizeof(zap__hw.names[0]), "%s", name);
+    zap__hw.count++;
+}
+#endif
 
-    printf(",\"simd\":[");
-    bool first = true;
-    if (env->has_sse) { printf("%s\"SSE\"", first ? "" : ","); first = false; }
-    if (env->has_sse2) { printf("%s\"SSE2\"", first ? "" : ","); first = false; }
-    if (env->has_sse3) { printf("%s\"SSE3\"", first ? "" : ","); first = false; }
-    if (env->has_ssse3) { printf("%s\"SSSE3\"", first ? "" : ","); first = false; }
-    if (env->has_sse41) { printf("%s\"SSE4.1\"", first ? "" : ","); first = false; }
-    if (env->has_sse42) { printf("%s\"SSE4.2\"", first ? "" : ","); first = false; }
-    if (env->has_avx) { printf("%s\"AVX\"", first ? "" : ","); first = false; }
-    if (env->has_avx2) { printf("%s\"AVX2\"", first ? "" : ","); first = false; }
-    if (env->has_avx512f) { printf("%s\"AVX-512\"", first ? "" : ","); first = false; }
-    if (env->has_neon) { printf("%s\"NEON\"", first ? "" : ","); first = false; }
-    printf("]");
+static bool zap__hw_open(void) {
+    if (zap__hw.opened) return zap__hw.ready;
+    zap__hw.opened = true;
 
-    printf("}\n");
-    fflush(stdout);
+#if defined(ZAP_HAS_PERF)
+    // Leader must open, otherwise the whole group is unavailable
+    zap__hw_add(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles");
+    if (zap__hw.count == 0) {
+        fprintf(stderr, "Warning: perf_event_open failed, hardware counters disabled "
+                        "(check /proc/sys/kernel/perf_event_paranoid)\n");
+        return false;
+    }
+    zap__hw_add(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions");
+    zap__hw_add(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "llc_misses");
+    zap__hw_add(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch_misses");
+    for (size_t i = 0; i < zap_g_config.cli_raw_event_count; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "raw_0x%llx",
+                 (unsigned long long)zap_g_config.cli_raw_events[i]);
+        zap__hw_add(PERF_TYPE_RAW, zap_g_config.cli_raw_events[i], name);
+    }
+
+    ioctl(zap__hw.fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(zap__hw.fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    zap__hw.ready = true;
+#else
+    fprintf(stderr, "Warning: hardware counters are only supported on Linux\n");
+#endif
+    return zap__hw.ready;
 }
 
-/* STATUS MESSAGE IMPLEMENTATION */
+static void zap__hw_close(void) {
+#if defined(ZAP_HAS_PERF)
+    for (size_t i = 0; i < zap__hw.count; i++) {
+        close(zap__hw.fds[i]);
+    }
+#endif
+    memset(&zap__hw, 0, sizeof(zap__hw));
+}
+
+// Read all counters, scaled for multiplexing. Returns false on failure.
+static bool zap__hw_read(uint64_t* out) {
+#if defined(ZAP_HAS_PERF)
+    uint64_t buf[3 + ZAP_MAX_HW_COUNTERS];
+    ssize_t want = (ssize_t)((3 + zap__hw.count) * sizeof(uint64_t));
+    if (read(zap__hw.fds[0], buf, sizeof(buf)) < want) return false;
+
+    uint64_t enabled = buf[1];
+    uint64_t running = buf[2];
+    for (size_t i = 0; i < zap__hw.count; i++) {
+        uint64_t v = buf[3 + i];
+        if (running > 0 && running < enabled) {
+            v = (uint64_t)((double)v * (double)enabled / (double)running);
+        }
+        out[i] = v;
+    }
+    return true;
+#else
+    (void)out;
+    return false;
+#endif
+}
+
+static void zap__hw_sample_begin(zap_t* c) {
+    if (!zap_g_config.hw_counters || !zap__hw_open()) return;
+    zap__hw_read(c->hw_begin);
+}
+
+static void zap__hw_sample_end(zap_t* c) {
+    if (!zap__hw.ready) return;
+    uint64_t end[ZAP_MAX_HW_COUNTERS];
+    if (!zap__hw_read(end)) return;
+    for (size_t i = 0; i < zap__hw.count; i++) {
+        c->hw_total[i] += (double)(end[i] - c->hw_begin[i]);
+    }
+}
+
+/* ALLOCATION TRACKING IMPLEMENTATION */
+
+/*
+ * Process-wide counters fed by the malloc family overrides below. They only
+ * count while a measured batch is running, so warmup, setup and reporting
+ * stay out of the numbers. Updates are relaxed atomics: benchmarks that
+ * spawn threads are still counted, just not ordered.
+ */
+typedef struct {
+    int      active;
+    uint64_t count;    // Allocations (realloc of an existing block counts too)
+    uint64_t bytes;    // Requested bytes
+    int64_t  live;     // Usable bytes allocated minus freed while active
+    int64_t  peak;     // High-water mark of live
+} zap__alloc_t;
+
+static zap__alloc_t zap__alloc = {0};
+
+#if defined(ZAP_HAS_ALLOC_HOOK)
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void  __libc_free(void* ptr);
+
+static void zap__alloc_note(void* p, size_t requested) {
+    if (!p || !__atomic_load_n(&zap__alloc.active, __ATOMIC_RELAXED)) return;
+    __atomic_add_fetch(&zap__alloc.count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&zap__alloc.bytes, requested, __ATOMIC_RELAXED);
+    int64_t live = __atomic_add_fetch(&zap__alloc.live,
+                                      (int64_t)malloc_usable_size(p), __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&zap__alloc.peak, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&zap__alloc.peak, &peak, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void zap__alloc_release(void* p) {
+    if (!p || !__atomic_load_n(&zap__alloc.active, __ATOMIC_RELAXED)) return;
+    __atomic_sub_fetch(&zap__alloc.live, (int64_t)malloc_usable_size(p), __ATOMIC_RELAXED);
+}
+
+void* malloc(size_t size) {
+    void* p = __libc_malloc(size);
+    zap__alloc_note(p, size);
+    return p;
+}
+
+void* calloc(size_t count, size_t size) {
+    void* p = __libc_calloc(count, size);
+    zap__alloc_note(p, count * size);
+    return p;
+}
+
+void* realloc(void* ptr, size_t size) {
+    zap__alloc_release(ptr);
+    void* p = __libc_realloc(ptr, size);
+    if (!p && size > 0) {
+        // Original block is still allocated
+        if (ptr && __atomic_load_n(&zap__alloc.active, __ATOMIC_RELAXED)) {
+            __atomic_add_fetch(&zap__alloc.live, (int64_t)malloc_usable_size(ptr),
+                               __ATOMIC_RELAXED);
+        }
+        return p;
+    }
+    zap__alloc_note(p, size);
+    return p;
+}
+
+void free(void* ptr) {
+    zap__alloc_release(ptr);
+    __libc_free(ptr);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) return EINVAL;
+    void* p = __libc_memalign(alignment, size);
+    if (!p) return ENOMEM;
+    zap__alloc_note(p, size);
+    *out = p;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    void* p = __libc_memalign(alignment, size);
+    zap__alloc_note(p, size);
+    return p;
+}
+
+void* memalign(size_t alignment, size_t size) {
+    void* p = __libc_memalign(alignment, size);
+    zap__alloc_note(p, size);
+    return p;
+}
+#endif
+
+static bool zap__alloc_supported(void) {
+#if defined(ZAP_HAS_ALLOC_HOOK)
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Minor + major page faults and max RSS (bytes) of the process so far
+static void zap__rusage(uint64_t* faults, uint64_t* max_rss) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        *faults = 0;
+        *max_rss = 0;
+        return;
+    }
+    *faults = (uint64_t)ru.ru_minflt + (uint64_t)ru.ru_majflt;
+#if defined(__APPLE__)
+    *max_rss = (uint64_t)ru.ru_maxrss;         // Bytes on macOS
+#else
+    *max_rss = (uint64_t)ru.ru_maxrss * 1024;  // Kilobytes on Linux
+#endif
+}
+
+static void zap__alloc_sample_begin(zap_t* c) {
+    if (!zap_g_config.track_alloc) return;
+    uint64_t rss;
+    zap__rusage(&c->faults_begin, &rss);
+    if (c->measured_iters == 0) c->rss_begin = rss;
+
+    c->alloc_begin[0] = __atomic_load_n(&zap__alloc.count, __ATOMIC_RELAXED);
+    c->alloc_begin[1] = __atomic_load_n(&zap__alloc.bytes, __ATOMIC_RELAXED);
+    c->alloc_live_begin = __atomic_load_n(&zap__alloc.live, __ATOMIC_RELAXED);
+    __atomic_store_n(&zap__alloc.peak, c->alloc_live_begin, __ATOMIC_RELAXED);
+    __atomic_store_n(&zap__alloc.active, 1, __ATOMIC_RELAXED);
+}
+
+// Stop counting without recording the batch (measurement ended early)
+static void zap__alloc_sample_cancel(void) {
+    __atomic_store_n(&zap__alloc.active, 0, __ATOMIC_RELAXED);
+}
+
+static void zap__alloc_sample_end(zap_t* c) {
+    if (!zap_g_config.track_alloc) return;
+    __atomic_store_n(&zap__alloc.active, 0, __ATOMIC_RELAXED);
+
+    c->alloc_count += __atomic_load_n(&zap__alloc.count, __ATOMIC_RELAXED) - c->alloc_begin[0];
+    c->alloc_bytes += __atomic_load_n(&zap__alloc.bytes, __ATOMIC_RELAXED) - c->alloc_begin[1];
+    int64_t peak = __atomic_load_n(&zap__alloc.peak, __ATOMIC_RELAXED) - c->alloc_live_begin;
+    if (peak > c->alloc_peak) c->alloc_peak = peak;
+
+    uint64_t faults, rss;
+    zap__rusage(&faults, &rss);
+    c->faults += faults - c->faults_begin;
+}
+
+// Attach per-iteration metrics collected during measurement to stats
+static void zap__collect_metrics(const zap_t* c, zap_stats_t* stats) {
+    if (c->measured_iters == 0) return;
+    double iters = (double)c->measured_iters;
+
+    if (c->exec_runs > 0) {
+        double runs = (double)c->exec_runs;
+        zap_metric_t* m = stats->metrics;
+        size_t* n = &stats->metric_count;
+        if (c->exec_ready_ns > 0) {
+            zap__set_metric(m, n, "ready_time", c->exec_ready_ns / runs,
+                            ZAP_METRIC_PROCESS, ZAP_METRIC_TIME | ZAP_METRIC_GATED);
+        }
+        zap__set_metric(m, n, "page_faults", (double)c->exec_faults / runs,
+                        ZAP_METRIC_PROCESS, 0);
+        if (c->exec_max_rss > 0) {
+            zap__set_metric(m, n, "max_rss", (double)c->exec_max_rss, ZAP_METRIC_PROCESS,
+                            ZAP_METRIC_TOTAL | ZAP_METRIC_BYTES | ZAP_METRIC_GATED);
+        }
+    }
+
+    if (zap__hw.ready) {
+        for (size_t i = 0; i < zap__hw.count; i++) {
+            zap__set_metric(stats->metrics, &stats->metric_count, zap__hw.names[i],
+                            c->hw_total[i] / iters, ZAP_METRIC_COUNTER, 0);
+        }
+    }
+
+    if (zap_g_config.track_alloc) {
+        uint64_t faults, rss;
+        zap__rusage(&faults, &rss);
+        zap_metric_t* m = stats->metrics;
+        size_t* n = &stats->metric_count;
+        zap__set_metric(m, n, "allocs", (double)c->alloc_count / iters,
+                        ZAP_METRIC_MEMORY, ZAP_METRIC_GATED);
+        zap__set_metric(m, n, "alloc_bytes", (double)c->alloc_bytes / iters,
+                        ZAP_METRIC_MEMORY, ZAP_METRIC_BYTES | ZAP_METRIC_GATED);
+        zap__set_metric(m, n, "peak_live_bytes", (double)c->alloc_peak,
+                        ZAP_METRIC_MEMORY, ZAP_METRIC_TOTAL | ZAP_METRIC_BYTES | ZAP_METRIC_GATED);
+        zap__set_metric(m, n, "page_faults", (double)c->faults / iters,
+                        ZAP_METRIC_MEMORY, 0);
+        zap__set_metric(m, n, "max_rss_growth", rss > c->rss_begin ? (double)(rss - c->rss_begin) : 0.0,
+                        ZAP_METRIC_MEMORY, ZAP_METRIC_TOTAL | ZAP_METRIC_BYTES);
+    }
+
+    // Custom counters last; rates use the mean, which finish_stats has by now
+    for (size_t i = 0; i < c->counter_count; i++) {
+        double value = c->counter_totals[i] / iters;
+        uint32_t flags = 0;
+        if (c->counter_rate[i]) {
+            value = stats->mean > 0 ? value * 1e9 / stats->mean : 0.0;
+            flags |= ZAP_METRIC_RATE;
+        }
+        if (c->counter_direction[i] == ZAP_COUNTER_LOWER_IS_BETTER) {
+            flags |= ZAP_METRIC_GATED;
+        } else if (c->counter_direction[i] == ZAP_COUNTER_HIGHER_IS_BETTER) {
+            flags |= ZAP_METRIC_GATED | ZAP_METRIC_HIGHER;
+        }
+        zap__set_metric(stats->metrics, &stats->metric_count, c->counter_names[i], value,
+                        ZAP_METRIC_USER, flags);
+    }
+}
+
+// Counter/allocation snapshots around a measured batch, outside the timed region.
+// Worker threads leave them alone; interleaved routines skip the perf events,
+// which only count the thread that opened them.
+static void zap__sample_begin(zap_t* c) {
+    if (c->worker) return;
+    if (!c->interleave) zap__hw_sample_begin(c);
+    zap__alloc_sample_begin(c);
+}
+
+static void zap__sample_end(zap_t* c) {
+    if (!c->worker) {
+        zap__alloc_sample_end(c);
+        if (!c->interleave) zap__hw_sample_end(c);
+    }
+    c->measured_iters += c->iterations;
+}
+
+/* BLACK BOX IMPLEMENTATION */
+
+// Prevent compiler from optimizing away the value
+void zap__black_box_impl(void* ptr, size_t size) {
+    (void)size;
+    __asm__ volatile("" : : "g"(ptr) : "memory");
+}
+
+/* STATUS MESSAGE IMPLEMENTATION */
+
+static int zap__is_tty = -1;  // -1 = not checked yet
+
+static int zap__check_tty(void) {
+    if (zap__is_tty < 0) {
+        zap__is_tty = isatty(STDOUT_FILENO);
+    }
+    return zap__is_tty;
+}
+
+// Check if colors should be used based on color_mode setting
+static int zap__use_colors(void) {
+    switch (zap_g_config.color_mode) {
+        case ZAP_COLOR_ALWAYS: return 1;
+        case ZAP_COLOR_NEVER:  return 0;
+        default:               return zap__check_tty();
+    }
+}
+
+// Conditional color codes - return empty string if colors disabled
+static ZAP_UNUSED const char* zap__c_reset(void)   { return zap__use_colors() ? ZAP_COLOR_RESET : ""; }
+static ZAP_UNUSED const char* zap__c_bold(void)    { return zap__use_colors() ? ZAP_COLOR_BOLD : ""; }
+static ZAP_UNUSED const char* zap__c_dim(void)     { return zap__use_colors() ? ZAP_COLOR_DIM : ""; }
+static ZAP_UNUSED const char* zap__c_green(void)   { return zap__use_colors() ? ZAP_COLOR_GREEN : ""; }
+static ZAP_UNUSED const char* zap__c_yellow(void)  { return zap__use_colors() ? ZAP_COLOR_YELLOW : ""; }
+static ZAP_UNUSED const char* zap__c_blue(void)    { return zap__use_colors() ? ZAP_COLOR_BLUE : ""; }
+static ZAP_UNUSED const char* zap__c_cyan(void)    { return zap__use_colors() ? ZAP_COLOR_CYAN : ""; }
+static ZAP_UNUSED const char* zap__c_red(void)     { return zap__use_colors() ? ZAP_COLOR_RED : ""; }
+static ZAP_UNUSED const char* zap__c_magenta(void) { return zap__use_colors() ? ZAP_COLOR_MAGENTA : ""; }
+static ZAP_UNUSED const char* zap__c_purple(void)  { return zap__use_colors() ? ZAP_COLOR_PURPLE : ""; }
+
+/* ENVIRONMENT PRINT */
+
+static void zap__format_time(double ns, char* buf, size_t bufsize);
+static void zap__format_bytes(double v, char* buf, size_t bufsize);
+
+void zap_env_print(const zap_env_t* env) {
+    printf("%s%sEnvironment:%s\n", zap__c_bold(), zap__c_magenta(), zap__c_reset());
+    printf("  %sCPU:%s      %s%s%s\n",
+           zap__c_dim(), zap__c_reset(),
+           zap__c_cyan(), env->cpu_model, zap__c_reset());
+    printf("  %sCores:%s    %s%d%s physical, %s%d%s logical\n",
+           zap__c_dim(), zap__c_reset(),
+           zap__c_cyan(), env->cpu_cores, zap__c_reset(),
+           zap__c_cyan(), env->cpu_threads, zap__c_reset());
+    if (env->cache_bytes[0] || env->cache_bytes[1] || env->cache_bytes[2]) {
+        static const char* const levels[3] = {"L1d", "L2", "L3"};
+        printf("  %sCaches:%s   ", zap__c_dim(), zap__c_reset());
+        bool first_level = true;
+        for (int i = 0; i < 3; i++) {
+            if (env->cache_bytes[i] == 0) continue;
+            char size_buf[32];
+            zap__format_bytes((double)env->cache_bytes[i], size_buf, sizeof(size_buf));
+            printf("%s%s %s%s%s", first_level ? "" : ", ", levels[i],
+                   zap__c_cyan(), size_buf, zap__c_reset());
+            first_level = false;
+        }
+        if (env->cache_line > 0) printf(", %d B lines", env->cache_line);
+        if (env->numa_nodes > 0) {
+            printf(", %d NUMA node%s", env->numa_nodes, env->numa_nodes == 1 ? "" : "s");
+        }
+        printf("\n");
+    }
+    if (env->base_mhz > 0 || env->max_mhz > 0) {
+        printf("  %sClock:%s    ", zap__c_dim(), zap__c_reset());
+        if (env->base_mhz > 0) {
+            printf("%s%.2f GHz%s base", zap__c_cyan(), env->base_mhz / 1000.0, zap__c_reset());
+        }
+        if (env->max_mhz > 0) {
+            printf("%s%s%.2f GHz%s max", env->base_mhz > 0 ? ", " : "",
+                   zap__c_cyan(), env->max_mhz / 1000.0, zap__c_reset());
+        }
+        printf("\n");
+    }
+    printf("  %sOS:%s       %s\n",
+           zap__c_dim(), zap__c_reset(), env->os_info);
+    printf("  %sCompiler:%s %s\n",
+           zap__c_dim(), zap__c_reset(), env->compiler);
+
+    // Build SIMD string
+    printf("  %sSIMD:%s     %s", zap__c_dim(), zap__c_reset(), zap__c_cyan());
+    bool first = true;
+
+#if defined(ZAP_X86)
+    if (env->has_avx512f) { printf("%sAVX-512", first ? "" : ", "); first = false; }
+    else if (env->has_avx2) { printf("%sAVX2", first ? "" : ", "); first = false; }
+    else if (env->has_avx) { printf("%sAVX", first ? "" : ", "); first = false; }
+
+    if (env->has_sse42) { printf("%sSSE4.2", first ? "" : ", "); first = false; }
+    else if (env->has_sse41) { printf("%sSSE4.1", first ? "" : ", "); first = false; }
+    else if (env->has_ssse3) { printf("%sSSSE3", first ? "" : ", "); first = false; }
+    else if (env->has_sse3) { printf("%sSSE3", first ? "" : ", "); first = false; }
+    else if (env->has_sse2) { printf("%sSSE2", first ? "" : ", "); first = false; }
+    else if (env->has_sse) { printf("%sSSE", first ? "" : ", "); first = false; }
+#endif
+
+    if (env->has_neon) { printf("%sNEON", first ? "" : ", "); first = false; }
+
+    if (first) printf("%snone detected", zap__c_yellow());
+    printf("%s\n", zap__c_reset());
+
+    char overhead_buf[32];
+    zap__format_time(zap_timer_overhead_ns(), overhead_buf, sizeof(overhead_buf));
+    printf("  %sTimer:%s    %s%s%s%s, %.3f ns/tick, %s/batch overhead%s\n",
+           zap__c_dim(), zap__c_reset(), zap__c_cyan(), zap_timer_name(), zap__c_reset(),
+           zap_timer_kind() == ZAP_TIMER_TSC && env->has_invariant_tsc ? " (invariant)" : "",
+           zap_timer_ns_per_tick(), overhead_buf,
+           zap_g_config.overhead_correction ? " subtracted" : "");
+
+    // Scheduling: pinning, priority
+    printf("  %sSched:%s    ", zap__c_dim(), zap__c_reset());
+    if (env->pinned_cpu >= 0) {
+        printf("pinned to cpu %d", env->pinned_cpu);
+    } else {
+        printf("not pinned");
+    }
+    printf("%s, nice %d\n", env->realtime ? ", realtime" : "", env->nice);
+
+    // Frequency scaling, SMT and load
+    printf("  %sNoise:%s    governor %s, turbo %s, SMT %s, load ",
+           zap__c_dim(), zap__c_reset(),
+           env->governor[0] ? env->governor : "n/a",
+           env->turbo < 0 ? "n/a" : env->turbo ? "on" : "off",
+           env->smt < 0 ? "n/a" : env->smt ? "on" : "off");
+    if (env->load_avg[0] >= 0) {
+        printf("%.2f %.2f %.2f\n", env->load_avg[0], env->load_avg[1], env->load_avg[2]);
+    } else {
+        printf("n/a\n");
+    }
+    for (size_t i = 0; i < env->noise_count; i++) {
+        printf("            %s! %s%s\n", zap__c_yellow(), env->noise[i], zap__c_reset());
+    }
+    printf("\n");
+}
+
+void zap_env_print_json(const zap_env_t* env) {
+    printf("{\"type\":\"environment\"");
+    printf(",\"cpu\":\"%s\"", env->cpu_model);
+    printf(",\"cores\":%d", env->cpu_cores);
+    printf(",\"threads\":%d", env->cpu_threads);
+    printf(",\"os\":\"%s\"", env->os_info);
+    printf(",\"compiler\":\"%s\"", env->compiler);
+
+    printf(",\"simd\":[");
+    bool first = true;
+    if (env->has_sse) { printf("%s\"SSE\"", first ? "" : ","); first = false; }
+    if (env->has_sse2) { printf("%s\"SSE2\"", first ? "" : ","); first = false; }
+    if (env->has_sse3) { printf("%s\"SSE3\"", first ? "" : ","); first = false; }
+    if (env->has_ssse3) { printf("%s\"SSSE3\"", first ? "" : ","); first = false; }
+    if (env->has_sse41) { printf("%s\"SSE4.1\"", first ? "" : ","); first = false; }
+    if (env->has_sse42) { printf("%s\"SSE4.2\"", first ? "" : ","); first = false; }
+    if (env->has_avx) { printf("%s\"AVX\"", first ? "" : ","); first = false; }
+    if (env->has_avx2) { printf("%s\"AVX2\"", first ? "" : ","); first = false; }
+    if (env->has_avx512f) { printf("%s\"AVX-512\"", first ? "" : ","); first = false; }
+    if (env->has_neon) { printf("%s\"NEON\"", first ? "" : ","); first = false; }
+    printf("]");
+
+    printf(",\"invariant_tsc\":%s", env->has_invariant_tsc ? "true" : "false");
+    printf(",\"l1d_bytes\":%zu,\"l2_bytes\":%zu,\"l3_bytes\":%zu",
+           env->cache_bytes[0], env->cache_bytes[1], env->cache_bytes[2]);
+    printf(",\"cache_line\":%d", env->cache_line);
+    printf(",\"numa_nodes\":%d", env->numa_nodes);
+    printf(",\"base_mhz\":%.0f,\"max_mhz\":%.0f", env->base_mhz, env->max_mhz);
+    printf(",\"timer\":\"%s\"", zap_timer_name());
+    printf(",\"timer_ns_per_tick\":%.6f", zap_timer_ns_per_tick());
+    printf(",\"timer_overhead_ns\":%.6f", zap_timer_overhead_ns());
+    printf(",\"overhead_correction\":%s", zap_g_config.overhead_correction ? "true" : "false");
+
+    printf(",\"governor\":\"%s\"", env->governor);
+    printf(",\"turbo\":%s", env->turbo < 0 ? "null" : env->turbo ? "true" : "false");
+    printf(",\"smt\":%s", env->smt < 0 ? "null" : env->smt ? "true" : "false");
+    if (env->load_avg[0] >= 0) {
+        printf(",\"load_avg\":[%.2f,%.2f,%.2f]",
+               env->load_avg[0], env->load_avg[1], env->load_avg[2]);
+    } else {
+        printf(",\"load_avg\":null");
+    }
+    printf(",\"pinned_cpu\":%d", env->pinned_cpu);
+    printf(",\"pinned_siblings\":%d", env->pinned_siblings);
+    printf(",\"realtime\":%s", env->realtime ? "true" : "false");
+    printf(",\"nice\":%d", env->nice);
+    printf(",\"noisy\":%s", env->noise_count > 0 ? "true" : "false");
+    printf(",\"noise\":[");
+    for (size_t i = 0; i < env->noise_count; i++) {
+        printf("%s\"%s\"", i > 0 ? "," : "", env->noise[i]);
+    }
+    printf("]");
+
+    printf("}\n");
+    fflush(stdout);
+}
+
+/* STATUS MESSAGE IMPLEMENTATION */
+
+static bool zap__status_quiet = false;  // Parallel --jobs children share the terminal
 
 void zap_status_warmup(const char* name) {
-    if (zap_g_config.json_output) return;  // No status in JSON mode
+    if (zap_g_config.json_output || zap__status_quiet) return;  // No status in JSON mode
     if (zap__check_tty()) {
         // TTY: overwrite in place
         printf("\r\033[K%s  Warming up %s%s%s%s...%s",
@@ -973,7 +3294,7 @@ void zap_status_warmup(const char* name) {
 }
 
 void zap_status_measuring(const char* name) {
-    if (zap_g_config.json_output) return;  // No status in JSON mode
+    if (zap_g_config.json_output || zap__status_quiet) return;  // No status in JSON mode
     if (zap__check_tty()) {
         // TTY: overwrite in place
         printf("\r\033[K%s  Measuring  %s%s%s%s...%s",
@@ -1008,6 +3329,12 @@ void zap_init(zap_t* c, const char* name) {
         ? zap_g_config.cli_time_ns : ZAP_DEFAULT_MEASUREMENT_TIME_NS;
     c->config.sample_count = zap_g_config.cli_samples > 0
         ? zap_g_config.cli_samples : ZAP_DEFAULT_SAMPLE_COUNT;
+    c->config.target_precision = zap_g_config.cli_target_precision > 0
+        ? zap_g_config.cli_target_precision : ZAP_DEFAULT_TARGET_PRECISION;
+    c->config.sampling_mode = zap_g_config.cli_sampling_set
+        ? zap_g_config.cli_sampling : (zap_sampling_mode_t)ZAP_DEFAULT_SAMPLING_MODE;
+    c->config.cache_mode = zap_g_config.cli_cache_mode_set
+        ? zap_g_config.cli_cache_mode : (zap_cache_mode_t)ZAP_DEFAULT_CACHE_MODE;
     if (zap_g_config.cli_min_iters > 0) {
         c->iterations = zap_g_config.cli_min_iters;
     }
@@ -1015,803 +3342,5238 @@ void zap_init(zap_t* c, const char* name) {
     c->samples = (double*)malloc(c->sample_capacity * sizeof(double));
 }
 
+static void zap__phase_end(zap_t* c);
+
 void zap_cleanup(zap_t* c) {
+    zap__phase_end(c);  // A loop left with break never reached its end
     free(c->samples);
     c->samples = NULL;
+    free(c->sample_iters);
+    c->sample_iters = NULL;
+    free(c->scratch);
+    c->scratch = NULL;
+    c->scratch_capacity = 0;
+    free(c->latency.counts);
+    c->latency.counts = NULL;
+    free(c->batch_pool);
+    c->batch_pool = NULL;
+    c->batch_slots = 0;
 }
 
-bool zap_loop_start(zap_t* c) {
-    if (!c->warmup_complete) {
-        // Warmup phase: run for warmup time while calibrating iterations
-        uint64_t now = zap_now_ns();
+/*
+ * Linear sampling: sample k (1-based) runs k*d iterations, with d chosen so
+ * that all samples together take about the measurement time:
+ *   sum(k*d*t, k = 1..n) = n(n+1)/2 * d * t = T
+ * where t is the per-iteration time seen at the end of warmup.
+ */
+static void zap__linear_plan(zap_t* c) {
+    double n = (double)c->sample_capacity;
+    double t = c->warmup_ns_per_iter > 0 ? c->warmup_ns_per_iter : 1.0;
+    double d = (double)c->config.measurement_time_ns / (t * n * (n + 1.0) / 2.0);
+    if (d > 1e9 / n) d = 1e9 / n;  // Same per-batch cap as flat sampling
+    if (d < 1.0) d = 1.0;
+    c->iter_step = (uint64_t)d;
+    c->iterations = c->iter_step;
+
+    free(c->sample_iters);
+    c->sample_iters = (double*)malloc(c->sample_capacity * sizeof(double));
+}
 
-        if (c->start_time == 0) {
-            // First warmup iteration - print status
-            zap_status_warmup(c->name);
-            c->start_time = now;
-            c->current_iter = now;
-            return true;
-        }
+static void zap__latency_reset(zap_latency_hist_t* h) {
+    memset(h->counts, 0, ZAP_LATENCY_BUCKETS * sizeof(uint64_t));
+    h->total = 0;
+    h->min_ticks = UINT64_MAX;
+    h->max_ticks = 0;
+}
 
-        // Measure time for previous warmup iteration batch
-        uint64_t batch_elapsed = now - c->current_iter;
-        uint64_t total_elapsed = now - c->start_time;
+/* COLD CACHE */
 
-        // Calibrate: target 1ms per iteration batch
-        if (batch_elapsed > 0 && batch_elapsed < 1000000) {
-            // Scale up iterations to get closer to 1ms
-            uint64_t factor = 1000000 / batch_elapsed;
-            if (factor > 1) {
-                c->iterations *= factor;
-                if (c->iterations > 1000000000ULL) {
-                    c->iterations = 1000000000ULL;
-                }
-            } else {
-                c->iterations *= 2;
-            }
-        } else if (batch_elapsed > 10000000) {
-            // Way too long, scale down
-            c->iterations = (c->iterations > 2) ? c->iterations / 2 : 1;
-        }
+static unsigned char* zap__evict_buf = NULL;
+static size_t zap__evict_size = 0;
+static pthread_once_t zap__evict_once = PTHREAD_ONCE_INIT;
 
-        if (total_elapsed >= c->config.warmup_time_ns) {
-            // Warmup complete, switch to measurement
-            c->warmup_complete = true;
-            c->start_time = 0;
-            c->measuring = false;
-            c->status_printed = false;  // Reset for measuring status
-        }
+// Largest cache reported for CPU 0 (the LLC), 0 if unknown
+static size_t zap__llc_size(void) {
+    size_t sizes[3];
+    zap__cache_sizes(sizes);
+    return sizes[2] ? sizes[2] : sizes[1] ? sizes[1] : sizes[0];
+}
 
-        c->current_iter = now;
-        return true;
+static void zap__evict_alloc(void) {
+    size_t size = ZAP_COLD_BUFFER_BYTES;
+    if (size == 0) {
+        size = 2 * zap__llc_size();
+        if (size == 0) size = (size_t)64 << 20;  // Unknown: assume a 32 MB LLC
     }
-
-    // Measurement phase
-    if (c->sample_count >= c->sample_capacity) {
-        return false;  // Done collecting samples
+    zap__evict_buf = (unsigned char*)malloc(size);
+    if (!zap__evict_buf) {
+        fprintf(stderr, "Warning: cannot allocate %zu bytes to evict caches\n", size);
+        return;
     }
+    memset(zap__evict_buf, 1, size);  // Fault the pages in now, not on the first walk
+    zap__evict_size = size;
+}
 
-    // Check if we've exceeded measurement time
-    uint64_t now = zap_now_ns();
-    if (c->start_time == 0) {
-        // First measurement iteration - print status
-        zap_status_measuring(c->name);
-        c->start_time = now;
+// Read one byte per line of a buffer twice the LLC, displacing everything else
+static void zap__evict_walk(void) {
+    pthread_once(&zap__evict_once, zap__evict_alloc);
+    unsigned char acc = 0;
+    for (size_t i = 0; i < zap__evict_size; i += 64) acc += zap__evict_buf[i];
+    volatile unsigned char sink = acc;
+    (void)sink;
+}
+
+// Write back and invalidate every line of a region; false if unsupported
+static bool zap__flush_region(const void* p, size_t size) {
+#if (defined(ZAP_X86) || defined(ZAP_ARM64)) && (defined(__GNUC__) || defined(__clang__))
+    const char* line = (const char*)((uintptr_t)p & ~(uintptr_t)63);
+    const char* end = (const char*)p + size;
+    for (; line < end; line += 64) {
+#if defined(ZAP_X86)
+        __asm__ volatile("clflush (%0)" : : "r"(line) : "memory");
+#else
+        __asm__ volatile("dc civac, %0" : : "r"(line) : "memory");
+#endif
+    }
+#if defined(ZAP_X86)
+    __asm__ volatile("mfence" : : : "memory");
+#else
+    __asm__ volatile("dsb ish\n\tisb" : : : "memory");
+#endif
+    return true;
+#else
+    (void)p;
+    (void)size;
+    return false;
+#endif
+}
+
+/*
+ * Cold mode: flush the registered input (zap_bench_with_input) by cache line,
+ * or walk the eviction buffer when there is none. The time spent here does
+ * not count against the measurement budget.
+ */
+static void zap__cold_evict(zap_t* c) {
+    uint64_t t0 = zap__timer_begin();
+    if (!(c->param && c->param_size > 0 && zap__flush_region(c->param, c->param_size))) {
+        zap__evict_walk();
+    }
+    if (c->start_time != 0) c->start_time += zap__timer_begin() - t0;
+}
+
+/* PROFILER MARKERS */
+
+static zap_phase_hook_fn zap__phase_hook = NULL;
+static void* zap__phase_user = NULL;
+static int zap__phase_depth = 0;  // Routines inside their measurement phase
+
+void zap_set_phase_hook(zap_phase_hook_fn hook, void* user) {
+    zap__phase_hook = hook;
+    zap__phase_user = user;
+}
+
+/*
+ * perf record --control: "enable" / "disable" on the control fd, then wait
+ * (briefly) for perf's "ack" so the first measured batch is already counted.
+ * A broken pipe turns the markers off instead of failing the run.
+ */
+static void zap__perf_ctl_send(const char* cmd) {
+    size_t len = strlen(cmd);
+    if (write(zap_g_config.perf_ctl_fd, cmd, len) != (ssize_t)len) {
+        fprintf(stderr, "Warning: --perf-ctl write failed (%s), markers disabled\n",
+                strerror(errno));
+        zap_g_config.perf_ctl = false;
+        return;
+    }
+    if (zap_g_config.perf_ack_fd < 0) return;
+    struct pollfd p = {zap_g_config.perf_ack_fd, POLLIN, 0};
+    char ack[16];
+    if (poll(&p, 1, 1000) > 0 && read(zap_g_config.perf_ack_fd, ack, sizeof(ack)) <= 0) {
+        zap_g_config.perf_ack_fd = -1;
+    }
+}
+
+#if defined(ZAP_USE_ITT)
+static __itt_domain* zap__itt_domain(void) {
+    static __itt_domain* domain = NULL;
+    if (!domain) domain = __itt_domain_create("zap");
+    return domain;
+}
+#endif
+
+/*
+ * Open and close a routine's measurement phase. Collection is global, so
+ * perf and ITT are switched on for the first routine in (threaded and
+ * interleaved runs overlap) and off after the last one out; the hook and
+ * ITT tasks see every routine.
+ */
+static void zap__phase_begin(zap_t* c) {
+    if (c->phase_open) return;
+    c->phase_open = true;
+    if (__atomic_fetch_add(&zap__phase_depth, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (zap_g_config.perf_ctl) zap__perf_ctl_send("enable\n");
+#if defined(ZAP_USE_ITT)
+        __itt_resume();
+#endif
+    }
+#if defined(ZAP_USE_ITT)
+    __itt_task_begin(zap__itt_domain(), __itt_null, __itt_null,
+                     __itt_string_handle_create(c->name ? c->name : "zap"));
+#endif
+    if (zap__phase_hook) zap__phase_hook(ZAP_PHASE_MEASURE_BEGIN, c->name, zap__phase_user);
+}
+
+static void zap__phase_end(zap_t* c) {
+    if (!c->phase_open) return;
+    c->phase_open = false;
+    if (zap__phase_hook) zap__phase_hook(ZAP_PHASE_MEASURE_END, c->name, zap__phase_user);
+#if defined(ZAP_USE_ITT)
+    __itt_task_end(zap__itt_domain());
+#endif
+    if (__atomic_sub_fetch(&zap__phase_depth, 1, __ATOMIC_ACQ_REL) == 0) {
+#if defined(ZAP_USE_ITT)
+        __itt_pause();
+#endif
+        if (zap_g_config.perf_ctl) zap__perf_ctl_send("disable\n");
+    }
+}
+
+// --profile measurement: no samples, just batches until the time or iteration
+// budget runs out. On return current_iter - start_time is the profiled time.
+static bool zap__profile_advance(zap_t* c) {
+    uint64_t now = zap__timer_begin();
+    if (c->start_time == 0) {
+        c->start_time = now;
+        zap__phase_begin(c);
+    }
+    uint64_t cap = zap_g_config.profile_iters;
+    bool done = cap > 0 ? c->measured_iters >= cap
+              : zap__ticks_to_ns(now - c->start_time) >= (double)zap_g_config.profile_time_ns;
+    c->current_iter = now;
+    if (done) {
+        zap__phase_end(c);
+        c->measuring = false;
+        c->stop_reason = cap > 0 ? ZAP_STOP_SAMPLES : ZAP_STOP_TIME;
+        return false;
+    }
+    if (cap > 0 && c->iterations > cap - c->measured_iters) {
+        c->iterations = cap - c->measured_iters;
+    }
+    c->measuring = true;
+    return true;
+}
+
+static void zap__interleave_yield(zap_t* c);
+
+/*
+ * Phase bookkeeping shared by the loop variants. Returns false once sampling
+ * is done. With start_batch, the timer read that checks the budget also
+ * starts the next batch; otherwise the caller starts it after its own
+ * untimed work (see zap_loop_start_batched).
+ */
+static bool zap__loop_advance(zap_t* c, bool start_batch) {
+    if (!c->warmup_complete) {
+        // Warmup phase: run for warmup time while calibrating iterations
+        if (c->start_time == 0) {
+            // First warmup iteration - print status
+            zap__timer_ensure_init();
+            if (!c->worker) zap_status_warmup(c->name);
+            uint64_t now = zap__timer_begin();
+            c->start_time = now;
+            c->current_iter = now;
+            return true;
+        }
+
+        // Measure time for previous warmup iteration batch
+        uint64_t now = zap__timer_begin();
+        double batch_elapsed = zap__ticks_to_ns(now - c->current_iter);
+        double total_elapsed = zap__ticks_to_ns(now - c->start_time);
+        c->warmup_ns_per_iter = batch_elapsed / (double)c->iterations;
+
+        // Calibrate: target 1ms per iteration batch
+        if (batch_elapsed > 0 && batch_elapsed < 1000000) {
+            // Scale up iterations to get closer to 1ms
+            uint64_t factor = (uint64_t)(1000000 / batch_elapsed);
+            if (factor > 1) {
+                c->iterations *= factor;
+                if (c->iterations > 1000000000ULL) {
+                    c->iterations = 1000000000ULL;
+                }
+            } else {
+                c->iterations *= 2;
+            }
+        } else if (batch_elapsed > 10000000) {
+            // Way too long, scale down
+            c->iterations = (c->iterations > 2) ? c->iterations / 2 : 1;
+        }
+
+        if (total_elapsed >= (double)c->config.warmup_time_ns) {
+            // Warmup complete, switch to measurement
+            c->warmup_complete = true;
+            c->start_time = 0;
+            c->measuring = false;
+            c->status_printed = false;  // Reset for measuring status
+            if (c->config.cache_mode == ZAP_CACHE_COLD) {
+                c->iterations = 1;  // Later iterations would run warm again
+            } else if (c->config.sampling_mode == ZAP_SAMPLING_LINEAR) {
+                zap__linear_plan(c);
+            }
+            if (c->latency.counts) {
+                zap__latency_reset(&c->latency);  // Keep warmup ops out
+            }
+        }
+
+        c->current_iter = now;
+        return true;
+    }
+
+    // Measurement phase; interleaved routines wait here for their next turn
+    if (c->interleave) zap__interleave_yield(c);
+    if (c->profiling) return zap__profile_advance(c);
+    if (c->sample_count >= c->sample_capacity) {
+        c->stop_reason = ZAP_STOP_SAMPLES;
+        zap__phase_end(c);
+        return false;  // Done collecting samples
+    }
+
+    // Precision target: relative CI half-width from the running variance
+    if (c->config.target_precision > 0 && c->sample_count >= ZAP_MIN_SAMPLES &&
+        c->run_mean > 0) {
+        double n = (double)c->sample_count;
+        double half = zap__t_value(c->sample_count) * sqrt(c->run_m2 / (n - 1.0) / n);
+        if (half / c->run_mean * 100.0 <= c->config.target_precision) {
+            c->stop_reason = ZAP_STOP_PRECISION;
+            zap__phase_end(c);
+            return false;
+        }
+    }
+
+    // Check if we've exceeded measurement time
+    if (c->start_time == 0) {
+        // First measurement iteration - print status
+        if (!c->worker) zap_status_measuring(c->name);
+        zap__phase_begin(c);
+    }
+
+    c->measuring = true;
+    if (start_batch) {
+        if (c->config.cache_mode == ZAP_CACHE_COLD) zap__cold_evict(c);
+        zap__sample_begin(c);  // Read counters outside the timed region
+    }
+
+    // One timer read both checks the time budget and starts the batch
+    uint64_t now = zap__timer_begin();
+    if (c->start_time == 0) {
+        c->start_time = now;
+    } else if (zap__ticks_to_ns(now - c->start_time) >= (double)c->config.measurement_time_ns &&
+               c->sample_count >= ZAP_MIN_SAMPLES) {
+        c->measuring = false;
+        c->stop_reason = ZAP_STOP_TIME;
+        if (!c->worker) zap__alloc_sample_cancel();
+        zap__phase_end(c);
+        return false;  // Time's up and we have enough samples
+    }
+    c->current_iter = now;
+    return true;
+}
+
+bool zap_loop_start(zap_t* c) {
+    return zap__loop_advance(c, true);
+}
+
+bool zap_loop_start_batched(zap_t* c, zap_batch_setup_fn setup, size_t input_size) {
+    if (!zap__loop_advance(c, false)) return false;
+
+    // Keep the pool bounded; calibration adapts to the capped batch size
+    size_t stride = (input_size + 15) & ~(size_t)15;
+    if (stride == 0) stride = 16;
+    uint64_t max_slots = ZAP_BATCH_MAX_BYTES / stride;
+    if (max_slots == 0) max_slots = 1;
+    if (c->iterations > max_slots) c->iterations = max_slots;
+
+    // Grow only; the same slots are refilled for every batch
+    if (c->batch_stride != stride || c->batch_slots < c->iterations) {
+        size_t slots = (size_t)c->iterations;
+        unsigned char* pool = (unsigned char*)realloc(c->batch_pool, slots * stride);
+        if (!pool) {
+            fprintf(stderr, "Error: cannot allocate %zu bytes for batched inputs\n",
+                    slots * stride);
+            c->measuring = false;
+            return false;
+        }
+        c->batch_pool = pool;
+        c->batch_stride = stride;
+        c->batch_slots = slots;
+    }
+
+    for (uint64_t i = 0; i < c->iterations; i++) {
+        setup(c, c->batch_pool + i * stride, (size_t)i);
+    }
+
+    // Start timing only after setup so it stays out of the batch
+    if (c->measuring && !c->profiling) {
+        if (c->config.cache_mode == ZAP_CACHE_COLD) zap__cold_evict(c);
+        zap__sample_begin(c);
+    }
+    c->current_iter = zap__timer_begin();
+    return true;
+}
+
+/* PER-OP LATENCY */
+
+/*
+ * Bucket layout: values below 2^(S+1) get one bucket each, then every power
+ * of two [2^p, 2^(p+1)) is split into 2^S equal sub-buckets, so the relative
+ * error stays below 2^-S at any magnitude with a fixed number of buckets.
+ */
+static inline size_t zap__latency_bucket(uint64_t v) {
+    const unsigned sub = ZAP_LATENCY_SUB_BITS;
+    if (v < (2ULL << sub)) return (size_t)v;
+    unsigned p = 63;
+    while (!(v >> p)) p--;  // Highest set bit; v >= 2^(S+1) so this is short
+    if (p >= ZAP_LATENCY_MAX_BITS) return ZAP_LATENCY_BUCKETS - 1;
+    return ((size_t)(p - sub + 1) << sub) + (size_t)((v >> (p - sub)) - (1ULL << sub));
+}
+
+// Midpoint of a bucket, in ticks
+static double zap__latency_bucket_value(size_t idx) {
+    const unsigned sub = ZAP_LATENCY_SUB_BITS;
+    if (idx < (2u << sub)) return (double)idx;
+    size_t block = idx >> sub;
+    unsigned shift = (unsigned)block - 1;
+    uint64_t lower = ((uint64_t)(idx & ((1u << sub) - 1)) + (1ULL << sub)) << shift;
+    return (double)lower + (double)(1ULL << shift) / 2.0;
+}
+
+void zap_latency_hist_add(zap_latency_hist_t* h, uint64_t ticks) {
+    h->counts[zap__latency_bucket(ticks)]++;
+    h->total++;
+    if (ticks < h->min_ticks) h->min_ticks = ticks;
+    if (ticks > h->max_ticks) h->max_ticks = ticks;
+}
+
+double zap_latency_hist_percentile(const zap_latency_hist_t* h, double p) {
+    if (!h->counts || h->total == 0) return 0.0;
+    if (p >= 100.0) return (double)h->max_ticks * h->ns_per_tick;
+
+    uint64_t rank = (uint64_t)ceil(p / 100.0 * (double)h->total);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < ZAP_LATENCY_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            // Bucket midpoints can fall outside the observed range
+            double v = zap__latency_bucket_value(i);
+            if (v < (double)h->min_ticks) v = (double)h->min_ticks;
+            if (v > (double)h->max_ticks) v = (double)h->max_ticks;
+            return v * h->ns_per_tick;
+        }
+    }
+    return (double)h->max_ticks * h->ns_per_tick;
+}
+
+// Allocate the histogram and pick the timestamp source on first use
+static bool zap__latency_init(zap_t* c) {
+    zap_latency_hist_t* h = &c->latency;
+    h->counts = (uint64_t*)malloc(ZAP_LATENCY_BUCKETS * sizeof(uint64_t));
+    if (!h->counts) {
+        fprintf(stderr, "Error: cannot allocate the latency histogram\n");
+        return false;
+    }
+    zap__latency_reset(h);
+
+    zap__timer_ensure_init();
+    h->use_tsc = false;
+    h->ns_per_tick = zap__timer.ns_per_tick;
+#if defined(ZAP_HAS_TSC)
+    double tsc = zap__tsc_ns_per_tick();
+    if (tsc > 0) {
+        h->use_tsc = true;
+        h->ns_per_tick = tsc;
+    }
+#endif
+
+    // Cost of one timestamp: smallest back-to-back difference
+    h->overhead_ticks = 0;
+    if (zap_g_config.overhead_correction) {
+        uint64_t best = UINT64_MAX;
+        uint64_t prev = zap_latency_now(c);
+        for (int i = 0; i < 1000; i++) {
+            uint64_t now = zap_latency_now(c);
+            if (now - prev < best) best = now - prev;
+            prev = now;
+        }
+        h->overhead_ticks = best;
+    }
+
+    c->rate_ticks = 0;
+    if (c->config.rate > 0) {
+        double ticks = 1e9 / c->config.rate / h->ns_per_tick;
+        c->rate_ticks = ticks >= 1.0 ? (uint64_t)(ticks + 0.5) : 1;
+    }
+    return true;
+}
+
+bool zap_loop_start_latency(zap_t* c) {
+    if (!c->latency.counts && !zap__latency_init(c)) return false;
+    return zap__loop_advance(c, true);
+}
+
+uint64_t zap_latency_now(zap_t* c) {
+#if defined(ZAP_HAS_TSC)
+    if (c->latency.use_tsc) return zap__tsc_end();
+#endif
+    return zap__timer_end();
+}
+
+uint64_t zap_latency_record(zap_t* c, uint64_t prev) {
+    uint64_t now = zap_latency_now(c);
+    uint64_t d = now - prev;
+    d = d > c->latency.overhead_ticks ? d - c->latency.overhead_ticks : 0;
+    zap_latency_hist_add(&c->latency, d);
+    if (!c->rate_ticks) return now;
+
+    // Open loop: prev was this op's intended start, and the next op is due one
+    // interval later whether or not this one finished on time
+    uint64_t next = prev + c->rate_ticks;
+    while ((int64_t)(next - now) > 0) now = zap_latency_now(c);
+    return next;
+}
+
+/* FREQUENCY MONITOR */
+
+/*
+ * --freq-monitor reads the effective frequency right after each measured
+ * batch. With cpufreq, scaling_cur_freq of the CPU the batch ran on is
+ * compared with the base clock; on x86 the kernel derives it from
+ * APERF/MPERF over the last tick, so it is what the core actually ran at
+ * rather than the governor's request. Without a base clock (most VMs) a
+ * short chain of dependent multiplies is timed instead and its fastest run
+ * stands for full speed, which also catches steal time.
+ */
+
+#define ZAP__FREQ_PROBE_OPS 2048  // ~8k cycles, a few microseconds per run
+
+typedef struct {
+    bool              init;
+    zap_freq_source_t source;
+    double            nominal_khz;    // ZAP_FREQ_SYSFS
+    double            probe_best_ns;  // ZAP_FREQ_PROBE, fastest run so far
+} zap__freq_t;
+
+static zap__freq_t zap__freq = {0};
+
+// Shortest of three runs, so an interrupt during one does not read as throttling
+static double zap__freq_probe_ns(void) {
+    double best = 0.0;
+    for (int r = 0; r < 3; r++) {
+        uint64_t x = (uint64_t)r + 1;
+        uint64_t t0 = zap__timer_begin();
+        for (int i = 0; i < ZAP__FREQ_PROBE_OPS; i++) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            __asm__ volatile("" : "+r"(x));  // Keep the chain serial and unfolded
+        }
+        double ns = zap__ticks_to_ns(zap__timer_end() - t0);
+        if (r == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+static void zap__freq_init(void) {
+    if (zap__freq.init) return;
+    zap__freq.init = true;
+    zap__timer_ensure_init();
+#if defined(__linux__)
+    double base_mhz, max_mhz;
+    zap__cpu_freqs(&base_mhz, &max_mhz);  // Only the base clock is nominal; max is turbo
+    if (base_mhz > 0 &&
+        zap__read_int("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq", 0) > 0) {
+        zap__freq.source = ZAP_FREQ_SYSFS;
+        zap__freq.nominal_khz = base_mhz * 1000.0;
+        return;
+    }
+#endif
+    zap__freq.source = ZAP_FREQ_PROBE;
+    for (int i = 0; i < 16; i++) {
+        double ns = zap__freq_probe_ns();
+        if (i == 0 || ns < zap__freq.probe_best_ns) zap__freq.probe_best_ns = ns;
+    }
+}
+
+// Effective frequency of the batch that just ended as a share of nominal, 0 if unknown
+static double zap__freq_ratio(void) {
+    zap__freq_init();
+#if defined(__linux__)
+    if (zap__freq.source == ZAP_FREQ_SYSFS) {
+        unsigned cpu = 0;
+        if (syscall(SYS_getcpu, &cpu, NULL, NULL) != 0) cpu = 0;
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u/cpufreq/scaling_cur_freq", cpu);
+        int khz = zap__read_int(path, 0);
+        return khz > 0 ? khz / zap__freq.nominal_khz : 0.0;
+    }
+#endif
+    double ns = zap__freq_probe_ns();
+    if (ns <= 0) return 0.0;
+    if (ns < zap__freq.probe_best_ns) zap__freq.probe_best_ns = ns;
+    return zap__freq.probe_best_ns / ns;
+}
+
+/*
+ * Tag the batch that just ended. True if it ran below --min-freq-ratio and
+ * should be dropped so the loop measures another; after as many drops as
+ * requested samples everything is kept, so a throttled machine still ends.
+ * ZAP_ITER_LATENCY histograms keep the ops of a dropped batch.
+ */
+static bool zap__freq_reject(zap_t* c) {
+    uint64_t t0 = zap__timer_begin();
+    double ratio = zap__freq_ratio();
+    if (c->start_time != 0) c->start_time += zap__timer_begin() - t0;  // Off the budget
+    if (ratio <= 0) return false;
+
+    if (c->freq_min == 0.0 || ratio < c->freq_min) c->freq_min = ratio;
+    if (ratio < zap_g_config.min_freq_ratio && c->freq_rejected < c->sample_capacity) {
+        c->freq_rejected++;
+        return true;
+    }
+    c->freq_sum += ratio;
+    c->freq_count++;
+    return false;
+}
+
+/*
+ * ZAP_ITER_UNROLLED batches may bypass zap_loop_start()/zap_loop_end() only
+ * when a sample is nothing but a timed flat batch: no counters, allocation
+ * or frequency checks, cold cache, linear steps, precision target, latency
+ * histogram or interleaving. Batches past the deadline come back here.
+ */
+static void zap__hot_arm(zap_t* c) {
+    c->hot = !c->worker && !c->interleave && !c->profiling && c->start_time != 0 &&
+             !zap_g_config.hw_counters && !zap_g_config.track_alloc &&
+             !zap_g_config.freq_monitor && c->config.cache_mode != ZAP_CACHE_COLD &&
+             c->iter_step == 0 && c->config.target_precision <= 0 && !c->latency.counts &&
+             !c->batch_pool;
+    if (!c->hot) return;
+    c->hot_tsc = zap__timer.kind == ZAP_TIMER_TSC;
+    c->hot_ns_per_tick = zap__timer.ns_per_tick;
+    c->hot_overhead_ns = zap_g_config.overhead_correction ? zap__timer.overhead_ns : 0.0;
+    c->hot_deadline = c->start_time +
+        (uint64_t)((double)c->config.measurement_time_ns / zap__timer.ns_per_tick);
+}
+
+void zap_loop_end(zap_t* c) {
+    if (!c->measuring || !c->warmup_complete) return;
+
+    uint64_t end = zap__timer_end();
+    double elapsed = zap__ticks_to_ns(end - c->current_iter);
+    if (c->profiling) {
+        // Nothing to keep; grow batches so loop overhead stays out of the profile
+        c->measured_iters += c->iterations;
+        if (elapsed < 500000 && c->iterations < 1000000000ULL) c->iterations *= 2;
+        c->measuring = false;
+        return;
+    }
+    zap__sample_end(c);
+
+    // Remove the fixed cost of the start/stop timer reads
+    if (zap_g_config.overhead_correction) {
+        elapsed -= zap__timer.overhead_ns;
+        if (elapsed < 0) elapsed = 0;
+    }
+
+    // A throttled batch is not a sample; the loop measures another instead
+    if (zap_g_config.freq_monitor && !c->worker && zap__freq_reject(c)) {
+        c->measuring = false;
+        return;
+    }
+
+    // Store sample (time per iteration in nanoseconds)
+    double time_per_iter = elapsed / (double)c->iterations;
+
+    if (c->sample_count < c->sample_capacity) {
+        c->samples[c->sample_count++] = time_per_iter;
+        // Welford update, O(1) per sample
+        double delta = time_per_iter - c->run_mean;
+        c->run_mean += delta / (double)c->sample_count;
+        c->run_m2 += delta * (time_per_iter - c->run_mean);
+        if (c->sample_iters) {
+            c->sample_iters[c->sample_count - 1] = (double)c->iterations;
+        }
+    }
+
+    if (c->iter_step > 0) {
+        // Linear sampling: the next sample runs one more step
+        c->iterations = (uint64_t)(c->sample_count + 1) * c->iter_step;
+    } else if (c->config.cache_mode == ZAP_CACHE_COLD) {
+        // Cold samples stay at one iteration, each right after an eviction
+    } else if (elapsed < 500000) {  // Less than 0.5ms
+        // Fine-tune iterations if samples are too short/long
+        c->iterations = c->iterations * 2;
+        if (c->iterations > 1000000000ULL) {
+            c->iterations = 1000000000ULL;
+        }
+    }
+
+    c->measuring = false;
+    if (c->unroll) zap__hot_arm(c);
+}
+
+/* MACHINE PEAKS (ROOFLINE) */
+
+/*
+ * --roofline measures the host once and caches the result in
+ * ZAP_MACHINE_PATH: STREAM-style copy and triad bandwidth with a working set
+ * sized for each cache level and for DRAM, and FLOP peaks for scalar code
+ * and each SIMD ISA the CPU supports. Throughput lines then show the share
+ * of the peak for the level the working set fits in.
+ */
+
+static FILE* zap__baseline_open_tmp(const char* path, char* tmp, size_t tmp_size);
+static bool zap__baseline_commit_tmp(FILE* f, const char* tmp, const char* path);
+
+#define ZAP__KERNEL_NS 20000000ULL  // Time spent on each calibration kernel
+
+static const char* zap__level_names[ZAP_MACHINE_LEVELS] = {"L1", "L2", "L3", "DRAM"};
+
+const char* zap_machine_level_name(int level) {
+    return level >= 0 && level < ZAP_MACHINE_LEVELS ? zap__level_names[level] : "?";
+}
+
+// Best-case GB/s of copy (2 arrays) or triad (3 arrays) over `footprint` bytes
+static double zap__bandwidth(size_t footprint, bool triad) {
+    size_t arrays = triad ? 3 : 2;
+    size_t n = footprint / arrays / sizeof(double) & ~(size_t)7;
+    if (n < 256) n = 256;
+    double* a = (double*)malloc(n * sizeof(double));
+    double* b = (double*)malloc(n * sizeof(double));
+    double* c = (double*)malloc(n * sizeof(double));
+    if (!a || !b || !c) {
+        free(a);
+        free(b);
+        free(c);
+        return 0.0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        a[i] = 1.0;
+        b[i] = 2.0;
+        c[i] = 0.5;
+    }
+
+    // Time groups of passes so small levels are not dominated by the clock
+    size_t pass_bytes = n * sizeof(double) * arrays;
+    size_t reps = ((size_t)8 << 20) / pass_bytes;
+    if (reps == 0) reps = 1;
+
+    double best = 0.0;
+    uint64_t deadline = zap_now_ns() + ZAP__KERNEL_NS;
+    for (int round = 0; round < 5 || zap_now_ns() < deadline; round++) {
+        uint64_t t0 = zap_now_ns();
+        for (size_t r = 0; r < reps; r++) {
+            if (triad) {
+                // Unrolled by 8 so the default -O2 already emits vector code
+                for (size_t i = 0; i < n; i += 8) {
+                    a[i + 0] = b[i + 0] + 3.0 * c[i + 0];
+                    a[i + 1] = b[i + 1] + 3.0 * c[i + 1];
+                    a[i + 2] = b[i + 2] + 3.0 * c[i + 2];
+                    a[i + 3] = b[i + 3] + 3.0 * c[i + 3];
+                    a[i + 4] = b[i + 4] + 3.0 * c[i + 4];
+                    a[i + 5] = b[i + 5] + 3.0 * c[i + 5];
+                    a[i + 6] = b[i + 6] + 3.0 * c[i + 6];
+                    a[i + 7] = b[i + 7] + 3.0 * c[i + 7];
+                }
+            } else {
+                memcpy(b, a, n * sizeof(double));
+            }
+            zap__black_box_impl(a, 0);
+            zap__black_box_impl(b, 0);
+        }
+        uint64_t dt = zap_now_ns() - t0;
+        if (dt > 0) {
+            double gbs = (double)(reps * pass_bytes) / (double)dt;  // Bytes per ns = GB/s
+            if (gbs > best) best = gbs;
+        }
+    }
+    free(a);
+    free(b);
+    free(c);
+    return best;
+}
+
+/*
+ * FLOP kernels: twelve independent multiply-add chains hide the FMA latency,
+ * and x = x * m + a converges instead of overflowing or going denormal.
+ */
+#define ZAP__CHAINS(S) S(0) S(1) S(2) S(3) S(4) S(5) S(6) S(7) S(8) S(9) S(10) S(11)
+
+typedef double (*zap__flop_kernel_t)(uint64_t iters);
+
+static double zap__flops_scalar(uint64_t iters) {
+    const double m = 0.999999, a = 1e-6;
+#define ZAP__DECL(k) double x##k = 1.0 + k * 1e-3;
+#define ZAP__STEP(k) x##k = x##k * m + a;
+#define ZAP__SUM(k) + x##k
+    ZAP__CHAINS(ZAP__DECL)
+    for (uint64_t i = 0; i < iters; i++) {
+        ZAP__CHAINS(ZAP__STEP)
+#if defined(ZAP__FLOP_X86)
+        // One value per register, so the compiler cannot pack chains into vectors
+        __asm__("" : "+x"(x0), "+x"(x1), "+x"(x2), "+x"(x3), "+x"(x4), "+x"(x5),
+                     "+x"(x6), "+x"(x7), "+x"(x8), "+x"(x9), "+x"(x10), "+x"(x11));
+#elif defined(ZAP__FLOP_NEON)
+        __asm__("" : "+w"(x0), "+w"(x1), "+w"(x2), "+w"(x3), "+w"(x4), "+w"(x5),
+                     "+w"(x6), "+w"(x7), "+w"(x8), "+w"(x9), "+w"(x10), "+w"(x11));
+#endif
+    }
+    return 0.0 ZAP__CHAINS(ZAP__SUM);
+#undef ZAP__DECL
+#undef ZAP__STEP
+}
+
+#if defined(ZAP__FLOP_X86)
+static double zap__flops_sse2(uint64_t iters) {
+    const __m128d m = _mm_set1_pd(0.999999), a = _mm_set1_pd(1e-6);
+#define ZAP__DECL(k) __m128d x##k = _mm_set1_pd(1.0 + k * 1e-3);
+#define ZAP__STEP(k) x##k = _mm_add_pd(_mm_mul_pd(x##k, m), a);
+    ZAP__CHAINS(ZAP__DECL)
+    for (uint64_t i = 0; i < iters; i++) {
+        ZAP__CHAINS(ZAP__STEP)
+    }
+    __m128d sum = _mm_setzero_pd() ZAP__CHAINS(ZAP__SUM);
+    return _mm_cvtsd_f64(sum);
+#undef ZAP__DECL
+#undef ZAP__STEP
+}
+
+__attribute__((target("avx2,fma")))
+static double zap__flops_avx2(uint64_t iters) {
+    const __m256d m = _mm256_set1_pd(0.999999), a = _mm256_set1_pd(1e-6);
+#define ZAP__DECL(k) __m256d x##k = _mm256_set1_pd(1.0 + k * 1e-3);
+#define ZAP__STEP(k) x##k = _mm256_fmadd_pd(x##k, m, a);
+    ZAP__CHAINS(ZAP__DECL)
+    for (uint64_t i = 0; i < iters; i++) {
+        ZAP__CHAINS(ZAP__STEP)
+    }
+    __m256d sum = _mm256_setzero_pd() ZAP__CHAINS(ZAP__SUM);
+    return _mm256_cvtsd_f64(sum);
+#undef ZAP__DECL
+#undef ZAP__STEP
+}
+
+__attribute__((target("avx512f")))
+static double zap__flops_avx512(uint64_t iters) {
+    const __m512d m = _mm512_set1_pd(0.999999), a = _mm512_set1_pd(1e-6);
+#define ZAP__DECL(k) __m512d x##k = _mm512_set1_pd(1.0 + k * 1e-3);
+#define ZAP__STEP(k) x##k = _mm512_fmadd_pd(x##k, m, a);
+    ZAP__CHAINS(ZAP__DECL)
+    for (uint64_t i = 0; i < iters; i++) {
+        ZAP__CHAINS(ZAP__STEP)
+    }
+    __m512d sum = _mm512_setzero_pd() ZAP__CHAINS(ZAP__SUM);
+    return _mm512_reduce_add_pd(sum);
+#undef ZAP__DECL
+#undef ZAP__STEP
+}
+#elif defined(ZAP__FLOP_NEON)
+static double zap__flops_neon(uint64_t iters) {
+    const float64x2_t m = vdupq_n_f64(0.999999), a = vdupq_n_f64(1e-6);
+#define ZAP__DECL(k) float64x2_t x##k = vdupq_n_f64(1.0 + k * 1e-3);
+#define ZAP__STEP(k) x##k = vfmaq_f64(a, x##k, m);
+    ZAP__CHAINS(ZAP__DECL)
+    for (uint64_t i = 0; i < iters; i++) {
+        ZAP__CHAINS(ZAP__STEP)
+    }
+    float64x2_t sum = vdupq_n_f64(0.0) ZAP__CHAINS(ZAP__SUM);
+    return vgetq_lane_f64(sum, 0);
+#undef ZAP__DECL
+#undef ZAP__STEP
+}
+#endif
+#undef ZAP__SUM
+
+// Best-case GFLOP/s of a kernel doing `flops_per_iter` per loop iteration
+static double zap__flop_rate(zap__flop_kernel_t kernel, double flops_per_iter) {
+    uint64_t iters = 1 << 12;
+    double best = 0.0;
+    uint64_t deadline = zap_now_ns() + ZAP__KERNEL_NS;
+    for (int round = 0; round < 3 || zap_now_ns() < deadline; round++) {
+        uint64_t t0 = zap_now_ns();
+        volatile double sink = kernel(iters);
+        (void)sink;
+        uint64_t dt = zap_now_ns() - t0;
+        if (dt > 0) {
+            double gflops = (double)iters * flops_per_iter / (double)dt;
+            if (gflops > best) best = gflops;
+        }
+        if (dt < 1000000 && iters < (1ULL << 32)) iters *= 2;  // Grow to ~1 ms per round
+    }
+    return best;
+}
+
+static void zap__machine_add_isa(zap_machine_t* m, const char* isa, double gflops) {
+    if (m->isa_count >= ZAP_MACHINE_MAX_ISAS) return;
+    snprintf(m->isa[m->isa_count], sizeof(m->isa[0]), "%s", isa);
+    m->isa_gflops[m->isa_count++] = gflops;
+}
+
+bool zap_machine_calibrate(zap_machine_t* m) {
+    memset(m, 0, sizeof(*m));
+    zap_env_t env;
+    memset(&env, 0, sizeof(env));
+    zap__detect_cpu_model(&env);
+    snprintf(m->cpu_model, sizeof(m->cpu_model), "%s", env.cpu_model);
+
+    // Half of each level, so the arrays fit next to whatever else is cached
+    size_t sizes[3];
+    zap__cache_sizes(sizes);
+    size_t llc = 0;
+    for (int level = 0; level < 3; level++) {
+        if (sizes[level] == 0) continue;
+        m->cache_bytes[level] = sizes[level];
+        m->copy_gbs[level] = zap__bandwidth(sizes[level] / 2, false);
+        m->triad_gbs[level] = zap__bandwidth(sizes[level] / 2, true);
+        llc = sizes[level];
+    }
+    // Well past the LLC, but bounded: some VMs report a huge shared L3
+    size_t dram = 4 * llc;
+    if (dram < ((size_t)64 << 20)) dram = (size_t)64 << 20;
+    if (dram > ((size_t)512 << 20)) dram = (size_t)512 << 20;
+    m->copy_gbs[ZAP_MACHINE_DRAM] = zap__bandwidth(dram, false);
+    m->triad_gbs[ZAP_MACHINE_DRAM] = zap__bandwidth(dram, true);
+
+    // Each chain step is a multiply and an add (2 FLOPs per lane)
+    m->scalar_gflops = zap__flop_rate(zap__flops_scalar, 12 * 2);
+#if defined(ZAP__FLOP_X86)
+    zap__machine_add_isa(m, "sse2", zap__flop_rate(zap__flops_sse2, 12 * 2 * 2));
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        zap__machine_add_isa(m, "avx2", zap__flop_rate(zap__flops_avx2, 12 * 4 * 2));
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        zap__machine_add_isa(m, "avx512", zap__flop_rate(zap__flops_avx512, 12 * 8 * 2));
+    }
+#elif defined(ZAP__FLOP_NEON)
+    zap__machine_add_isa(m, "neon", zap__flop_rate(zap__flops_neon, 12 * 2 * 2));
+#endif
+    return m->copy_gbs[ZAP_MACHINE_DRAM] > 0;
+}
+
+/*
+ * Profile file, one fact per line:
+ *   zap-machine v1
+ *   cpu <model>
+ *   level <L1|L2|L3|DRAM> <bytes> <copy GB/s> <triad GB/s>
+ *   flops <scalar|isa> <GFLOP/s>
+ */
+bool zap_machine_save(const zap_machine_t* m, const char* path) {
+    char tmp[512];
+    FILE* f = zap__baseline_open_tmp(path, tmp, sizeof(tmp));
+    if (!f) return false;
+    fprintf(f, "zap-machine v1\n");
+    fprintf(f, "cpu %s\n", m->cpu_model);
+    for (int level = 0; level < ZAP_MACHINE_LEVELS; level++) {
+        if (level != ZAP_MACHINE_DRAM && m->cache_bytes[level] == 0) continue;
+        fprintf(f, "level %s %zu %.3f %.3f\n", zap__level_names[level],
+                m->cache_bytes[level], m->copy_gbs[level], m->triad_gbs[level]);
+    }
+    fprintf(f, "flops scalar %.3f\n", m->scalar_gflops);
+    for (size_t i = 0; i < m->isa_count; i++) {
+        fprintf(f, "flops %s %.3f\n", m->isa[i], m->isa_gflops[i]);
+    }
+    return zap__baseline_commit_tmp(f, tmp, path);
+}
+
+bool zap_machine_load(zap_machine_t* m, const char* path) {
+    memset(m, 0, sizeof(*m));
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+
+    char line[256];
+    if (!fgets(line, sizeof(line), f) || strcmp(line, "zap-machine v1\n") != 0) {
+        fclose(f);
+        return false;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        char name[16];
+        size_t bytes;
+        double copy, triad, gflops;
+        if (strncmp(line, "cpu ", 4) == 0) {
+            size_t len = strlen(line + 4);
+            if (len >= sizeof(m->cpu_model)) len = sizeof(m->cpu_model) - 1;
+            memcpy(m->cpu_model, line + 4, len);
+            m->cpu_model[len] = '\0';
+        } else if (sscanf(line, "level %15s %zu %lf %lf", name, &bytes, &copy, &triad) == 4) {
+            for (int level = 0; level < ZAP_MACHINE_LEVELS; level++) {
+                if (strcmp(name, zap__level_names[level]) != 0) continue;
+                m->cache_bytes[level] = bytes;
+                m->copy_gbs[level] = copy;
+                m->triad_gbs[level] = triad;
+            }
+        } else if (sscanf(line, "flops %15s %lf", name, &gflops) == 2) {
+            if (strcmp(name, "scalar") == 0) {
+                m->scalar_gflops = gflops;
+            } else {
+                zap__machine_add_isa(m, name, gflops);
+            }
+        }
+    }
+    fclose(f);
+    return m->copy_gbs[ZAP_MACHINE_DRAM] > 0;
+}
+
+int zap_machine_level(const zap_machine_t* m, size_t working_set) {
+    for (int level = 0; level < ZAP_MACHINE_DRAM; level++) {
+        if (m->cache_bytes[level] > 0 && working_set <= m->cache_bytes[level]) return level;
+    }
+    return ZAP_MACHINE_DRAM;
+}
+
+double zap_machine_peak_gbs(const zap_machine_t* m, int level) {
+    if (level < 0 || level >= ZAP_MACHINE_LEVELS) return 0.0;
+    return m->copy_gbs[level] > m->triad_gbs[level] ? m->copy_gbs[level] : m->triad_gbs[level];
+}
+
+double zap_machine_peak_gflops(const zap_machine_t* m, const char** isa) {
+    double best = m->scalar_gflops;
+    const char* name = "scalar";
+    for (size_t i = 0; i < m->isa_count; i++) {
+        if (m->isa_gflops[i] > best) {
+            best = m->isa_gflops[i];
+            name = m->isa[i];
+        }
+    }
+    if (isa) *isa = name;
+    return best;
+}
+
+// Load the cached profile, or calibrate when it is missing or from another CPU
+static void zap__machine_prepare(void) {
+    zap_machine_t* m = &zap_g_config.machine;
+    if (zap_machine_load(m, ZAP_MACHINE_PATH) &&
+        strcmp(m->cpu_model, zap_g_config.env.cpu_model) == 0) {
+        zap_g_config.machine_valid = true;
+        return;
+    }
+    fprintf(stderr, "Calibrating machine peaks for --roofline (once per host)...\n");
+    if (!zap_machine_calibrate(m)) {
+        fprintf(stderr, "%sWarning: machine calibration failed, --roofline disabled%s\n",
+                zap__c_yellow(), zap__c_reset());
+        return;
+    }
+    zap_g_config.machine_valid = true;
+    zap_machine_save(m, ZAP_MACHINE_PATH);
+}
+
+static void zap__machine_print(const zap_machine_t* m) {
+    printf("%s%sMachine peaks:%s\n", zap__c_bold(), zap__c_magenta(), zap__c_reset());
+    for (int level = 0; level < ZAP_MACHINE_LEVELS; level++) {
+        if (level != ZAP_MACHINE_DRAM && m->cache_bytes[level] == 0) continue;
+        char size_buf[32] = "";
+        if (level != ZAP_MACHINE_DRAM) zap__format_bytes((double)m->cache_bytes[level], size_buf, sizeof(size_buf));
+        printf("  %s%-5s%s %-10s copy %s%.1f GB/s%s, triad %s%.1f GB/s%s\n",
+               zap__c_dim(), zap__level_names[level], zap__c_reset(), size_buf,
+               zap__c_cyan(), m->copy_gbs[level], zap__c_reset(),
+               zap__c_cyan(), m->triad_gbs[level], zap__c_reset());
+    }
+    printf("  %sFLOPs%s %-10s scalar %s%.1f%s", zap__c_dim(), zap__c_reset(), "",
+           zap__c_cyan(), m->scalar_gflops, zap__c_reset());
+    for (size_t i = 0; i < m->isa_count; i++) {
+        printf(", %s %s%.1f%s", m->isa[i], zap__c_cyan(), m->isa_gflops[i], zap__c_reset());
+    }
+    printf(" GFLOP/s\n\n");
+}
+
+static void zap__machine_print_json(const zap_machine_t* m) {
+    printf("{\"type\":\"machine\",\"cpu\":\"%s\",\"levels\":[", m->cpu_model);
+    bool first = true;
+    for (int level = 0; level < ZAP_MACHINE_LEVELS; level++) {
+        if (level != ZAP_MACHINE_DRAM && m->cache_bytes[level] == 0) continue;
+        printf("%s{\"level\":\"%s\",\"bytes\":%zu,\"copy_gbs\":%.3f,\"triad_gbs\":%.3f}",
+               first ? "" : ",", zap__level_names[level], m->cache_bytes[level],
+               m->copy_gbs[level], m->triad_gbs[level]);
+        first = false;
+    }
+    printf("],\"gflops\":{\"scalar\":%.3f", m->scalar_gflops);
+    for (size_t i = 0; i < m->isa_count; i++) {
+        printf(",\"%s\":%.3f", m->isa[i], m->isa_gflops[i]);
+    }
+    printf("}}\n");
+}
+
+/*
+ * Peak for a throughput result: bytes go against the best bandwidth of the
+ * level that holds bytes-per-iteration (taken as the working set), FLOPs
+ * against the fastest ISA. Returns the % of peak, or 0 without a profile.
+ */
+static double zap__roofline(const zap_stats_t* stats, double* peak, const char** where) {
+    if (!zap_g_config.roofline || !zap_g_config.machine_valid || stats->mean <= 0 ||
+        stats->throughput_value == 0) {
+        return 0.0;
+    }
+    const zap_machine_t* m = &zap_g_config.machine;
+    double per_ns = (double)stats->throughput_value / stats->mean;  // G units per second
+    if (stats->throughput_type == ZAP_THROUGHPUT_BYTES) {
+        int level = zap_machine_level(m, stats->throughput_value);
+        *peak = zap_machine_peak_gbs(m, level);
+        *where = zap__level_names[level];
+    } else if (stats->throughput_type == ZAP_THROUGHPUT_FLOPS) {
+        *peak = zap_machine_peak_gflops(m, where);
+    } else {
+        return 0.0;
+    }
+    return *peak > 0 ? per_ns / *peak * 100.0 : 0.0;
+}
+
+// ", 41% of L2 peak 30.1 GB/s" after the throughput value, empty otherwise
+static void zap__format_roofline(const zap_stats_t* stats, char* buf, size_t size) {
+    double peak = 0.0;
+    const char* where = "";
+    double pct = zap__roofline(stats, &peak, &where);
+    buf[0] = '\0';
+    if (pct <= 0) return;
+    snprintf(buf, size, " (%.0f%% of %s peak %.1f %s)", pct, where, peak,
+             stats->throughput_type == ZAP_THROUGHPUT_BYTES ? "GB/s" : "GFLOP/s");
+}
+
+static void zap__print_roofline_json(const zap_stats_t* stats) {
+    double peak = 0.0;
+    const char* where = "";
+    double pct = zap__roofline(stats, &peak, &where);
+    if (pct <= 0) return;
+    printf(",\"peak\":\"%s\",\"peak_per_second\":%.2f,\"peak_pct\":%.2f",
+           where, peak * 1e9, pct);
+}
+
+/* REPORTING IMPLEMENTATION */
+
+// Greek mu (μ) for microseconds: UTF-8 = \316\274
+static void zap__format_time(double ns, char* buf, size_t bufsize) {
+    if (ns >= 1e9) {
+        snprintf(buf, bufsize, "%.3f s", ns / 1e9);
+    } else if (ns >= 1e6) {
+        snprintf(buf, bufsize, "%.3f ms", ns / 1e6);
+    } else if (ns >= 1e3) {
+        snprintf(buf, bufsize, "%.3f \316\274s", ns / 1e3);
+    } else {
+        snprintf(buf, bufsize, "%.3f ns", ns);
+    }
+}
+
+static void zap__format_time_short(double ns, char* buf, size_t bufsize) {
+    if (ns >= 1e9) {
+        snprintf(buf, bufsize, "%.2f s", ns / 1e9);
+    } else if (ns >= 1e6) {
+        snprintf(buf, bufsize, "%.2f ms", ns / 1e6);
+    } else if (ns >= 1e3) {
+        snprintf(buf, bufsize, "%.2f \316\274s", ns / 1e3);
+    } else {
+        snprintf(buf, bufsize, "%.2f ns", ns);
+    }
+}
+
+static const char* zap__throughput_name(zap_throughput_type_t type) {
+    switch (type) {
+        case ZAP_THROUGHPUT_BYTES: return "bytes";
+        case ZAP_THROUGHPUT_FLOPS: return "flops";
+        default:                   return "elements";
+    }
+}
+
+// Format throughput: bytes/sec, FLOP/s or elements/sec
+static void zap__format_throughput(double mean_ns, size_t value,
+                                   zap_throughput_type_t type,
+                                   char* buf, size_t bufsize) {
+    if (type == ZAP_THROUGHPUT_NONE || value == 0 || mean_ns <= 0) {
+        buf[0] = '\0';
+        return;
+    }
+
+    /* Calculate per-second rate: value / (mean_ns / 1e9) = value * 1e9 / mean_ns */
+    double per_sec = (double)value * 1e9 / mean_ns;
+
+    if (type == ZAP_THROUGHPUT_BYTES) {
+        // Format as human-readable bytes/sec
+        if (per_sec >= 1e12) {
+            snprintf(buf, bufsize, "%.2f TB/s", per_sec / 1e12);
+        } else if (per_sec >= 1e9) {
+            snprintf(buf, bufsize, "%.2f GB/s", per_sec / 1e9);
+        } else if (per_sec >= 1e6) {
+            snprintf(buf, bufsize, "%.2f MB/s", per_sec / 1e6);
+        } else if (per_sec >= 1e3) {
+            snprintf(buf, bufsize, "%.2f KB/s", per_sec / 1e3);
+        } else {
+            snprintf(buf, bufsize, "%.2f B/s", per_sec);
+        }
+    } else if (type == ZAP_THROUGHPUT_FLOPS) {
+        if (per_sec >= 1e12) {
+            snprintf(buf, bufsize, "%.2f TFLOP/s", per_sec / 1e12);
+        } else if (per_sec >= 1e9) {
+            snprintf(buf, bufsize, "%.2f GFLOP/s", per_sec / 1e9);
+        } else if (per_sec >= 1e6) {
+            snprintf(buf, bufsize, "%.2f MFLOP/s", per_sec / 1e6);
+        } else {
+            snprintf(buf, bufsize, "%.2f FLOP/s", per_sec);
+        }
+    } else {
+        // Format as elements/sec (ops/sec)
+        if (per_sec >= 1e9) {
+            snprintf(buf, bufsize, "%.2f Gops/s", per_sec / 1e9);
+        } else if (per_sec >= 1e6) {
+            snprintf(buf, bufsize, "%.2f Mops/s", per_sec / 1e6);
+        } else if (per_sec >= 1e3) {
+            snprintf(buf, bufsize, "%.2f Kops/s", per_sec / 1e3);
+        } else {
+            snprintf(buf, bufsize, "%.2f ops/s", per_sec);
+        }
+    }
+}
+
+// Unicode block characters for histogram (increasing height)
+// ▁▂▃▄▅▆▇█
+static const char* zap__blocks[] = {
+    " ", "\342\226\201", "\342\226\202", "\342\226\203",
+    "\342\226\204", "\342\226\205", "\342\226\206", "\342\226\207",
+    "\342\226\210"
+};
+
+#define HIST_MAX_BINS 80
+#define HIST_HEIGHT 2
+
+// Julia: histwidth = 42 + lmaxtimewidth + rmaxtimewidth, bins = histwidth - 1
+static int zap__histogram_bins(const char* min_buf, const char* max_buf) {
+    int hist_width = 42 + (int)strlen(min_buf) + (int)strlen(max_buf);
+    int num_bins = hist_width - 1;
+    if (num_bins > HIST_MAX_BINS) num_bins = HIST_MAX_BINS;
+    if (num_bins < 10) num_bins = 10;
+    return num_bins;
+}
+
+static void zap__render_histogram(const uint64_t* bins, int num_bins,
+                                  const char* min_buf, const char* max_buf);
+
+static void zap__print_histogram(const double* samples, size_t n,
+                                       double min_val, double max_val) {
+    if (n == 0 || max_val <= min_val) return;
+
+    // Format time labels first to determine histogram width (Julia style)
+    char min_buf[32], max_buf[32];
+    zap__format_time_short(min_val, min_buf, sizeof(min_buf));
+    zap__format_time_short(max_val, max_buf, sizeof(max_buf));
+    int num_bins = zap__histogram_bins(min_buf, max_buf);
+
+    uint64_t bins[HIST_MAX_BINS] = {0};
+
+    double range = max_val - min_val;
+    if (range <= 0) return;
+
+    // Simple binning - count samples in each bin (Julia style)
+    double bin_width = range / num_bins;
+    for (size_t i = 0; i < n; i++) {
+        int bin = (int)((samples[i] - min_val) / bin_width);
+        if (bin >= num_bins) bin = num_bins - 1;
+        if (bin < 0) bin = 0;
+        bins[bin]++;
+    }
+
+    zap__render_histogram(bins, num_bins, min_buf, max_buf);
+}
+
+/*
+ * Latency mode: rebin the log buckets linearly from the fastest op to
+ * p99.99, so one stall does not squash the body into a single column.
+ * Slower ops pile into the last column.
+ */
+static void zap__print_latency_histogram(const zap_stats_t* stats) {
+    const zap_latency_hist_t* h = stats->latency;
+    double min_val = (double)h->min_ticks * h->ns_per_tick;
+    double max_val = stats->latency_p9999;
+    if (h->total == 0 || max_val <= min_val) return;
+
+    char min_buf[32], max_buf[32];
+    zap__format_time_short(min_val, min_buf, sizeof(min_buf));
+    zap__format_time_short(max_val, max_buf, sizeof(max_buf));
+    int num_bins = zap__histogram_bins(min_buf, max_buf);
+
+    uint64_t bins[HIST_MAX_BINS] = {0};
+    double bin_width = (max_val - min_val) / num_bins;
+    for (size_t i = 0; i < ZAP_LATENCY_BUCKETS; i++) {
+        if (!h->counts[i]) continue;
+        double ns = zap__latency_bucket_value(i) * h->ns_per_tick;
+        int bin = (int)((ns - min_val) / bin_width);
+        if (bin >= num_bins) bin = num_bins - 1;
+        if (bin < 0) bin = 0;
+        bins[bin] += h->counts[i];
+    }
+
+    zap__render_histogram(bins, num_bins, min_buf, max_buf);
+}
+
+// Print the rows and the time axis for already-binned counts
+static void zap__render_histogram(const uint64_t* bins, int num_bins,
+                                  const char* min_buf, const char* max_buf) {
+    int min_len = (int)strlen(min_buf);
+    int max_len = (int)strlen(max_buf);
+
+    // Find max bin count
+    uint64_t max_count = 0;
+    for (int i = 0; i < num_bins; i++) {
+        if (bins[i] > max_count) max_count = bins[i];
+    }
+
+    if (max_count == 0) return;
+
+    /*
+     * Julia-style multi-row histogram:
+     * Compute bar heights in range [1, HIST_HEIGHT * 8]
+     * Zero bins get height 0 (space)
+     * Non-zero bins get at least height 1
+     */
+    int barheights[HIST_MAX_BINS];
+    int total_levels = HIST_HEIGHT * 8;
+
+    for (int i = 0; i < num_bins; i++) {
+        if (bins[i] == 0) {
+            barheights[i] = 0;
+        } else {
+            // Scale to [1, total_levels]
+            barheights[i] = 1 + (int)((double)(bins[i] - 1) / (double)(max_count - 1) * (total_levels - 1) + 0.5);
+            if (barheights[i] > total_levels) barheights[i] = total_levels;
+            if (max_count == 1) barheights[i] = total_levels; /* Single max gets full height */
+        }
+    }
+
+    // Render rows from top to bottom
+    for (int row = HIST_HEIGHT; row >= 1; row--) {
+        printf("  ");
+        int row_base = (row - 1) * 8;  // Heights 0-7 for row 1, 8-15 for row 2, etc
+
+        for (int i = 0; i < num_bins; i++) {
+            int height_in_row = barheights[i] - row_base;
+            if (height_in_row <= 0) {
+                printf(" ");
+            } else if (height_in_row >= 8) {
+                printf("%s", zap__blocks[8]);  // Full block
+            } else {
+                printf("%s", zap__blocks[height_in_row]);
+            }
+        }
+        printf("\n");
+    }
+
+    // Center the label text
+    int label_len = 28;  // "Histogram: frequency by time"
+    int total_width = num_bins + 2;
+    int padding = (total_width - min_len - max_len - label_len) / 2;
+    if (padding < 1) padding = 1;
+
+    printf("  %s", min_buf);
+    for (int i = 0; i < padding; i++) printf(" ");
+    printf("%sHistogram: frequency by time%s", zap__c_cyan(), zap__c_reset());
+    for (int i = 0; i < padding; i++) printf(" ");
+    printf("%s\n", max_buf);
+}
+
+#undef HIST_HEIGHT
+#undef HIST_MAX_BINS
+
+// Format a per-iteration count compactly: 0.012, 38.5, 1.23k, 4.56M
+static void zap__format_count(double v, char* buf, size_t bufsize) {
+    double a = fabs(v);
+    if (a >= 1e9) {
+        snprintf(buf, bufsize, "%.2fG", v / 1e9);
+    } else if (a >= 1e6) {
+        snprintf(buf, bufsize, "%.2fM", v / 1e6);
+    } else if (a >= 1e4) {
+        snprintf(buf, bufsize, "%.2fk", v / 1e3);
+    } else if (a >= 100 || a == 0) {
+        snprintf(buf, bufsize, "%.1f", v);
+    } else {
+        snprintf(buf, bufsize, "%.3g", v);
+    }
+}
+
+static const char* zap__stop_reason_name(zap_stop_reason_t reason) {
+    switch (reason) {
+        case ZAP_STOP_TIME:      return "time";
+        case ZAP_STOP_PRECISION: return "precision";
+        default:                 return "samples";
+    }
+}
+
+static const char* zap__stat_test_name(zap_stat_test_t test) {
+    switch (test) {
+        case ZAP_TEST_WELCH:     return "welch";
+        case ZAP_TEST_MWU:       return "mwu";
+        case ZAP_TEST_BOOTSTRAP: return "bootstrap";
+        default:                 return "ci";
+    }
+}
+
+// ", welch p=0.003" after "(was ...)"; empty for the CI-overlap check
+static void zap__format_test(const zap_comparison_t* cmp, char* buf, size_t size) {
+    if (cmp->test == ZAP_TEST_CI) {
+        buf[0] = '\0';
+        return;
+    }
+    if (cmp->p_value < 0.001) {
+        snprintf(buf, size, ", %s p<0.001", zap__stat_test_name(cmp->test));
+    } else {
+        snprintf(buf, size, ", %s p=%.3f", zap__stat_test_name(cmp->test), cmp->p_value);
+    }
+}
+
+static void zap__print_test_json(const zap_comparison_t* cmp) {
+    printf(",\"test\":\"%s\"", zap__stat_test_name(cmp->test));
+    if (cmp->test != ZAP_TEST_CI) {
+        printf(",\"p_value\":%.6g", cmp->p_value);
+        printf(",\"effect_size\":%.6g", cmp->effect_size);
+    }
+}
+
+// With a precision target, say how tight the CI got and what ended the run
+static void zap__print_precision(const zap_stats_t* stats, const char* indent) {
+    if (stats->target_precision <= 0) return;
+    const char* why = stats->stop_reason == ZAP_STOP_PRECISION ? "target reached"
+                    : stats->stop_reason == ZAP_STOP_TIME ? "stopped by time cap"
+                    : "stopped at sample limit";
+    const char* color = stats->stop_reason == ZAP_STOP_PRECISION ? zap__c_green() : zap__c_yellow();
+    printf("%s%sPrecision:%s         \302\261%.2f%% (target %.2f%%, %s%s%s)\n",
+           indent, zap__c_dim(), zap__c_reset(), stats->precision_pct,
+           stats->target_precision, color, why, zap__c_reset());
+}
+
+// "1000 evals" for flat sampling, "kÂ·250 evals" when sample k runs k*d iterations
+static void zap__format_evals(const zap_stats_t* stats, char* buf, size_t size) {
+    if (stats->sampling == ZAP_SAMPLING_LINEAR) {
+        snprintf(buf, size, "k\302\267%zu evals", stats->iterations);
+    } else {
+        snprintf(buf, size, "%zu evals", stats->iterations);
+    }
+}
+
+// Linear sampling: show the fit behind the slope-based mean
+static void zap__print_fit(const zap_stats_t* stats, const char* indent) {
+    if (stats->sampling != ZAP_SAMPLING_LINEAR) return;
+    char slope_buf[32], icpt_buf[32];
+    zap__format_time(stats->slope, slope_buf, sizeof(slope_buf));
+    zap__format_time(fabs(stats->intercept), icpt_buf, sizeof(icpt_buf));
+    const char* color = stats->r_squared >= 0.99 ? zap__c_green()
+                      : stats->r_squared >= 0.9 ? zap__c_yellow() : zap__c_red();
+    printf("%s%sFit:%s               slope %s, intercept %s%s, R\302\262 %s%.4f%s\n",
+           indent, zap__c_dim(), zap__c_reset(), slope_buf,
+           stats->intercept < 0 ? "-" : "", icpt_buf,
+           color, stats->r_squared, zap__c_reset());
+}
+
+// A rate counts as sustained when at least this share of it was achieved
+#define ZAP__RATE_SUSTAINED_PCT 95.0
+
+// ZAP_ITER_LATENCY: per-op tail percentiles from the histogram
+static void zap__print_latency(const zap_stats_t* stats, const char* indent) {
+    if (stats->latency_count == 0) return;
+    char p50[32], p99[32], p999[32], p9999[32], max[32];
+    zap__format_time(stats->latency_p50, p50, sizeof(p50));
+    zap__format_time(stats->latency_p99, p99, sizeof(p99));
+    zap__format_time(stats->latency_p999, p999, sizeof(p999));
+    zap__format_time(stats->latency_p9999, p9999, sizeof(p9999));
+    zap__format_time(stats->latency_max, max, sizeof(max));
+    printf("%s%sLatency (per op):%s  p50: %s, p99: %s, p99.9: %s%s%s, p99.99: %s%s%s, max: %s\n",
+           indent, zap__c_dim(), zap__c_reset(), p50, p99,
+           zap__c_yellow(), p999, zap__c_reset(),
+           zap__c_yellow(), p9999, zap__c_reset(), max);
+}
+
+// "200.0k/s", "1.50M/s"
+static void zap__format_rate(double per_sec, char* buf, size_t size) {
+    if (per_sec >= 1e9) {
+        snprintf(buf, size, "%.2fG/s", per_sec / 1e9);
+    } else if (per_sec >= 1e6) {
+        snprintf(buf, size, "%.2fM/s", per_sec / 1e6);
+    } else if (per_sec >= 1e3) {
+        snprintf(buf, size, "%.1fk/s", per_sec / 1e3);
+    } else {
+        snprintf(buf, size, "%.1f/s", per_sec);
+    }
+}
+
+// Open loop: achieved vs target rate; red once the routine falls behind
+static void zap__print_rate(const zap_stats_t* stats, const char* indent) {
+    if (stats->target_rate <= 0) return;
+    char target[32], achieved[32];
+    zap__format_rate(stats->target_rate, target, sizeof(target));
+    zap__format_rate(stats->achieved_rate, achieved, sizeof(achieved));
+    double pct = stats->achieved_rate / stats->target_rate * 100.0;
+    printf("%s%sRate (open loop):%s  %s target, %s%s achieved (%.1f%%)%s\n",
+           indent, zap__c_dim(), zap__c_reset(), target,
+           pct >= ZAP__RATE_SUSTAINED_PCT ? zap__c_green() : zap__c_red(),
+           achieved, pct, zap__c_reset());
+}
+
+static const char* zap__freq_source_name(zap_freq_source_t source) {
+    switch (source) {
+    case ZAP_FREQ_SYSFS: return "cpufreq";
+    case ZAP_FREQ_PROBE: return "probe";
+    default: return "none";
+    }
+}
+
+// --freq-monitor: frequency stability, yellow once any sample ran throttled
+static void zap__print_freq(const zap_stats_t* stats, const char* indent) {
+    if (stats->freq_source == ZAP_FREQ_NONE) return;
+    bool throttled = stats->freq_rejected > 0 ||
+                     stats->freq_min < zap_g_config.min_freq_ratio;
+    const char* nominal = stats->freq_source == ZAP_FREQ_SYSFS ? "base" : "peak";
+    printf("%s%sFrequency:%s %s%.0f%% of %s, min %.0f%%%s (%s)", indent, zap__c_dim(),
+           zap__c_reset(), throttled ? zap__c_yellow() : "", stats->freq_mean * 100.0,
+           nominal, stats->freq_min * 100.0, throttled ? zap__c_reset() : "",
+           zap__freq_source_name(stats->freq_source));
+    if (stats->freq_rejected > 0) {
+        printf(", %s%zu sample%s rerun below %.0f%%%s", zap__c_yellow(),
+               stats->freq_rejected, stats->freq_rejected == 1 ? "" : "s",
+               zap_g_config.min_freq_ratio * 100.0, zap__c_reset());
+    }
+    printf("\n");
+}
+
+// Mention the subtracted timer overhead when it is a visible share of a batch
+static void zap__print_overhead(const zap_stats_t* stats, const char* indent) {
+    double batch_ns = stats->mean * (double)stats->iterations + stats->overhead_ns;
+    if (stats->overhead_ns <= 0 || batch_ns <= 0) return;
+    double share = stats->overhead_ns / batch_ns * 100.0;
+    if (share < 1.0) return;
+
+    char buf[32];
+    zap__format_time(stats->overhead_ns, buf, sizeof(buf));
+    printf("%s%sOverhead:%s          %s/batch subtracted (%.1f%% of batch)\n",
+           indent, zap__c_dim(), zap__c_reset(), buf, share);
+}
+
+// ZAP_ITER_UNROLLED: loop cost left in each per-iteration time
+static void zap__print_loop_cost(const zap_stats_t* stats, const char* indent) {
+    if (stats->unroll == 0) return;
+    char buf[32];
+    zap__format_time(stats->loop_ns, buf, sizeof(buf));
+    double share = stats->mean > 0 ? stats->loop_ns / stats->mean * 100.0 : 0.0;
+    printf("%s%sLoop:%s              %s/iter harness loop, unrolled x%u (%.1f%% of time)\n",
+           indent, zap__c_dim(), zap__c_reset(), buf, stats->unroll, share);
+}
+
+// Format a byte quantity: 512 B, 1.50 KB, 2.25 MB
+static void zap__format_bytes(double v, char* buf, size_t bufsize) {
+    double a = fabs(v);
+    if (a >= 1024.0 * 1024 * 1024) {
+        snprintf(buf, bufsize, "%.2f GB", v / (1024.0 * 1024 * 1024));
+    } else if (a >= 1024.0 * 1024) {
+        snprintf(buf, bufsize, "%.2f MB", v / (1024.0 * 1024));
+    } else if (a >= 1024.0) {
+        snprintf(buf, bufsize, "%.2f KB", v / 1024.0);
+    } else {
+        snprintf(buf, bufsize, "%.0f B", v);
+    }
+}
+
+static void zap__format_metric(const zap_metric_t* m, double v, char* buf, size_t bufsize) {
+    if (m->flags & ZAP_METRIC_TIME) {
+        zap__format_time(v, buf, bufsize);
+    } else if (m->flags & ZAP_METRIC_BYTES) {
+        zap__format_bytes(v, buf, bufsize);
+    } else {
+        zap__format_count(v, buf, bufsize);
+    }
+}
+
+// Print metrics by section, with the change against prev when available
+static void zap__print_metrics(const zap_stats_t* stats,
+                               const zap_baseline_entry_t* prev,
+                               const char* indent) {
+    if (stats->metric_count == 0) return;
+
+    const zap_metric_t* cycles = zap_find_metric(stats->metrics, stats->metric_count, "cycles");
+    const zap_metric_t* instrs = zap_find_metric(stats->metrics, stats->metric_count, "instructions");
+
+    static const char* const section[] = {"Counters:", "Memory:", "Process:", "Custom:"};
+    bool shown[4] = {false, false, false, false};
+
+    for (size_t i = 0; i < stats->metric_count; i++) {
+        const zap_metric_t* m = &stats->metrics[i];
+        int kind = (int)m->kind <= (int)ZAP_METRIC_USER ? (int)m->kind : 0;
+        bool rate = (m->flags & ZAP_METRIC_RATE) != 0;
+        bool higher = (m->flags & ZAP_METRIC_HIGHER) != 0;
+        // A custom counter without a direction is neither better nor worse
+        bool neutral = m->kind == ZAP_METRIC_USER && !(m->flags & ZAP_METRIC_GATED);
+        char val_buf[32];
+        zap__format_metric(m, m->value, val_buf, sizeof(val_buf));
+
+        printf("%s%s%-19s%s%s%-16s %s%9s%s%s",
+               indent, zap__c_dim(), shown[kind] ? "" : section[kind], zap__c_reset(),
+               zap__c_dim(), m->name, zap__c_cyan(), val_buf, zap__c_reset(),
+               rate ? " /s" : (m->flags & (ZAP_METRIC_TOTAL | ZAP_METRIC_TIME)) ? "" : " /iter");
+        shown[kind] = true;
+
+        if (m == instrs && cycles && cycles->value > 0) {
+            printf("  %s(%.2f IPC)%s", zap__c_dim(), instrs->value / cycles->value, zap__c_reset());
+        }
+
+        const zap_metric_t* old = prev
+            ? zap_find_metric(prev->metrics, prev->metric_count, m->name) : NULL;
+        if (old) {
+            char old_buf[32];
+            zap__format_metric(m, old->value, old_buf, sizeof(old_buf));
+            if (old->value > 0) {
+                double pct = (m->value - old->value) / old->value * 100.0;
+                const char* color = fabs(pct) < 1.0 || neutral ? zap__c_purple()
+                                  : (pct < 0) != higher ? zap__c_green() : zap__c_red();
+                printf("  %s%+.1f%%%s (was %s)", color, pct, zap__c_reset(), old_buf);
+            } else if (m->value > 0 && (m->flags & ZAP_METRIC_GATED) && !higher) {
+                printf("  %snew%s (was %s)", zap__c_red(), zap__c_reset(), old_buf);
+            } else {
+                printf("  (was %s)", old_buf);
+            }
+        }
+        printf("\n");
+    }
+}
+
+void zap_report(const char* name, const zap_stats_t* stats) {
+    // Clear any status message before printing results
+    zap_status_clear();
+
+    char median_buf[32], mean_buf[32], std_buf[32];
+    char min_buf[32], max_buf[32];
+
+    zap__format_time(stats->median, median_buf, sizeof(median_buf));
+    zap__format_time(stats->mean, mean_buf, sizeof(mean_buf));
+    zap__format_time(stats->std_dev, std_buf, sizeof(std_buf));
+    zap__format_time(stats->min, min_buf, sizeof(min_buf));
+    zap__format_time(stats->max, max_buf, sizeof(max_buf));
+
+    // Header - hot pink for benchmark name
+    printf("%s%s%s:%s\n", zap__c_bold(), zap__c_magenta(), name, zap__c_reset());
+
+    // Sample info line with median
+    char evals_buf[48];
+    zap__format_evals(stats, evals_buf, sizeof(evals_buf));
+    printf("  %zu samples \303\227 %s, median: %s%s%s\n",
+           stats->sample_count, evals_buf,
+           zap__c_cyan(), median_buf, zap__c_reset());
+
+    // Time (mean ± σ)
+    printf("  %sTime  (mean \302\261 \317\203):%s  %s%s%s \302\261 %s\n",
+           zap__c_dim(), zap__c_reset(),
+           zap__c_bold(), mean_buf, zap__c_reset(), std_buf);
+
+    // Range (min … max) using ellipsis character
+    printf("  %sRange (min \342\200\246 max):%s  %s \342\200\246 %s\n",
+           zap__c_dim(), zap__c_reset(), min_buf, max_buf);
+    zap__print_precision(stats, "  ");
+    zap__print_fit(stats, "  ");
+    zap__print_latency(stats, "  ");
+    zap__print_rate(stats, "  ");
+
+    // Percentiles (only with --percentiles flag)
+    if (zap_g_config.show_percentiles) {
+        char p75_buf[32], p90_buf[32], p95_buf[32], p99_buf[32];
+        zap__format_time(stats->p75, p75_buf, sizeof(p75_buf));
+        zap__format_time(stats->p90, p90_buf, sizeof(p90_buf));
+        zap__format_time(stats->p95, p95_buf, sizeof(p95_buf));
+        zap__format_time(stats->p99, p99_buf, sizeof(p99_buf));
+        printf("  %sPercentiles:%s       p75: %s, p90: %s, p95: %s, p99: %s\n",
+               zap__c_dim(), zap__c_reset(),
+               p75_buf, p90_buf, p95_buf, p99_buf);
+    }
+
+    // Throughput if set
+    if (stats->throughput_type != ZAP_THROUGHPUT_NONE && stats->throughput_value > 0) {
+        char tput_buf[32], peak_buf[64];
+        zap__format_throughput(stats->mean, stats->throughput_value,
+                               stats->throughput_type, tput_buf, sizeof(tput_buf));
+        zap__format_roofline(stats, peak_buf, sizeof(peak_buf));
+        printf("  %sThroughput:%s        %s%s%s%s\n",
+               zap__c_dim(), zap__c_reset(),
+               zap__c_cyan(), tput_buf, zap__c_reset(), peak_buf);
+    }
+
+    // Hardware counters / memory if collected
+    zap__print_metrics(stats, NULL, "  ");
+    zap__print_overhead(stats, "  ");
+    zap__print_loop_cost(stats, "  ");
+
+    // Outliers if any
+    size_t total_outliers = stats->outliers_low + stats->outliers_high;
+    if (total_outliers > 0) {
+        printf("  %sOutliers:%s %s%zu low, %zu high%s\n",
+               zap__c_dim(), zap__c_reset(),
+               zap__c_yellow(), stats->outliers_low, stats->outliers_high, zap__c_reset());
+    }
+    zap__print_freq(stats, "  ");
+
+    // Histogram (only with --histogram flag)
+    if (zap_g_config.show_histogram && stats->latency) {
+        printf("\n");
+        zap__print_latency_histogram(stats);
+    } else if (zap_g_config.show_histogram && stats->samples && stats->sample_count > 1) {
+        printf("\n");
+        zap__print_histogram(stats->samples, stats->sample_count,
+                                   stats->min, stats->max);
+    }
+
+    printf("\n");
+}
+
+void zap_report_group_start(const char* name) {
+    if (zap_g_config.json_output) return;  // No group headers in JSON mode
+    printf("%s%sRunning benchmark group:%s %s%s%s\n\n",
+           zap__c_bold(), zap__c_purple(), zap__c_reset(),
+           zap__c_purple(), name, zap__c_reset());
+}
+
+void zap_report_group_end(void) {
+    printf("\n");
+}
+
+/* RUNTIME BENCHMARK GROUPS */
+
+static zap_runtime_group_t zap__current_group = {0};
+
+static bool zap__setup_called = false;  // Track if setup has been called for current group
+
+static void zap__jobs_drain(void);
+
+zap_runtime_group_t* zap_benchmark_group(const char* name) {
+    zap__jobs_drain();  // Results of the previous group come first
+    zap_runtime_group_t* g = &zap__current_group;
+
+    strncpy(g->name, name, sizeof(g->name) - 1);
+    g->name[sizeof(g->name) - 1] = '\0';
+
+    // Set defaults
+    g->config.warmup_time_ns = ZAP_DEFAULT_WARMUP_TIME_NS;
+    g->config.measurement_time_ns = ZAP_DEFAULT_MEASUREMENT_TIME_NS;
+    g->config.sample_count = ZAP_DEFAULT_SAMPLE_COUNT;
+    g->config.target_precision = ZAP_DEFAULT_TARGET_PRECISION;
+    g->config.sampling_mode = (zap_sampling_mode_t)ZAP_DEFAULT_SAMPLING_MODE;
+    g->config.cache_mode = (zap_cache_mode_t)ZAP_DEFAULT_CACHE_MODE;
+    g->active = true;
+    g->header_printed = false;  // Defer header until first matching benchmark
+    g->setup = NULL;
+    g->teardown = NULL;
+    g->pin_threads = false;
+    g->rate_count = 0;
+    g->exec_ready[0] = '\0';
+    g->exec_drop_caches = false;
+    g->numa_mem = ZAP_NUMA_ANY;
+    g->numa_cpu = ZAP_NUMA_ANY;
+    g->numa_sweep = false;
+    g->scale_count = 0;
+    g->tag_count = 0;
+    zap__setup_called = false;
+
+    // Only print header immediately if no filter is set and no tag filter
+    if (!zap_g_config.filter && !zap_g_config.dry_run && zap_g_config.cli_tag_count == 0 &&
+        zap_g_config.shard_count == 0) {
+        zap_report_group_start(name);
+        g->header_printed = true;
+    }
+    return g;
+}
+
+void zap_group_measurement_time(zap_runtime_group_t* g, uint64_t ns) {
+    g->config.measurement_time_ns = ns;
+}
+
+void zap_group_warmup_time(zap_runtime_group_t* g, uint64_t ns) {
+    g->config.warmup_time_ns = ns;
+}
+
+void zap_group_sample_count(zap_runtime_group_t* g, size_t count) {
+    g->config.sample_count = count;
+}
+
+void zap_group_target_precision(zap_runtime_group_t* g, double pct) {
+    g->config.target_precision = pct;
+}
+
+void zap_group_sampling_mode(zap_runtime_group_t* g, zap_sampling_mode_t mode) {
+    g->config.sampling_mode = mode;
+}
+
+void zap_group_cache_mode(zap_runtime_group_t* g, zap_cache_mode_t mode) {
+    g->config.cache_mode = mode;
+}
+
+void zap_group_exec_ready(zap_runtime_group_t* g, const char* marker) {
+    snprintf(g->exec_ready, sizeof(g->exec_ready), "%s", marker ? marker : "");
+}
+
+void zap_group_exec_drop_caches(zap_runtime_group_t* g, bool drop) {
+    g->exec_drop_caches = drop;
+}
+
+void zap_group_rate(zap_runtime_group_t* g, double ops_per_sec) {
+    zap_group_rate_sweep(g, &ops_per_sec, ops_per_sec > 0 ? 1 : 0);
+}
+
+void zap_group_rate_sweep(zap_runtime_group_t* g, const double* rates, size_t count) {
+    g->rate_count = 0;
+    for (size_t i = 0; i < count && g->rate_count < ZAP_MAX_RATES; i++) {
+        if (rates[i] > 0) g->rates[g->rate_count++] = rates[i];
+    }
+}
+
+void zap_group_setup(zap_runtime_group_t* g, zap_setup_fn setup) {
+    g->setup = setup;
+}
+
+void zap_group_teardown(zap_runtime_group_t* g, zap_teardown_fn teardown) {
+    g->teardown = teardown;
+}
+
+void zap_group_pin_threads(zap_runtime_group_t* g, bool pin) {
+    g->pin_threads = pin;
+}
+
+void zap_group_numa(zap_runtime_group_t* g, int mem_node, int cpu_node) {
+    g->numa_mem = mem_node < 0 ? ZAP_NUMA_ANY : mem_node;
+    g->numa_cpu = cpu_node < 0 ? ZAP_NUMA_ANY : cpu_node;
+}
+
+void zap_group_numa_sweep(zap_runtime_group_t* g, bool sweep) {
+    g->numa_sweep = sweep;
+}
+
+void zap_group_tag(zap_runtime_group_t* g, const char* tag) {
+    if (g->tag_count < ZAP_MAX_TAGS) {
+        strncpy(g->tags[g->tag_count], tag, sizeof(g->tags[0]) - 1);
+        g->tags[g->tag_count][sizeof(g->tags[0]) - 1] = '\0';
+        g->tag_count++;
+    }
+}
+
+/* COMPLEXITY */
+
+/*
+ * zap_bench_with_input() results named "label/param" with a numeric param
+ * are kept per group. At zap_group_finish(), every label with at least
+ * ZAP_COMPLEXITY_MIN_POINTS sizes gets a BigO-style fit: mean = c * f(n) by
+ * least squares for each class, the one with the lowest RMS wins. The slope
+ * of log(mean) over log(n) is the fitted exponent. It is stored as the
+ * ZAP_COMPLEXITY_METRIC metric of the largest size's baseline entry, so a
+ * change from O(n) to O(n^2) is caught even when the small sizes still
+ * look fine, a --merge keeps it with that entry, and the history (which
+ * holds only times) never sees it.
+ */
+
+// Parse "1000", "2.5e6" or "16KB"; false for anything else ("threads=4", "64 (cold)")
+static bool zap__parse_scale_param(const char* str, double* n, bool* bytes) {
+    char* end;
+    double v = strtod(str, &end);
+    if (end == str) return false;
+    *bytes = true;
+    if (strcmp(end, "KB") == 0) {
+        v *= 1024.0;
+    } else if (strcmp(end, "MB") == 0) {
+        v *= 1024.0 * 1024.0;
+    } else if (strcmp(end, "GB") == 0) {
+        v *= 1024.0 * 1024.0 * 1024.0;
+    } else if (strcmp(end, "B") == 0) {
+        // Already bytes
+    } else if (*end == '\0') {
+        *bytes = false;
+    } else {
+        return false;
+    }
+    *n = v;
+    return v > 0;
+}
+
+// Keep a reported result of the current group for the complexity fit. Runs
+// before the result replaces its baseline entry, to keep the old exponent.
+static void zap__scale_record(const char* group_name, const char* name, const char* key,
+                              double mean) {
+    zap_runtime_group_t* g = &zap__current_group;
+    if (!g->active || !group_name || strcmp(group_name, g->name) != 0 || mean <= 0) return;
+    const char* slash = strrchr(name, '/');
+    if (!slash || slash == name || (size_t)(slash - name) >= sizeof(g->scale_points[0].label)) {
+        return;
+    }
+    double n;
+    bool bytes;
+    if (!zap__parse_scale_param(slash + 1, &n, &bytes)) return;
+
+    if (g->scale_count == g->scale_capacity) {
+        size_t cap = g->scale_capacity ? g->scale_capacity * 2 : 16;
+        zap_scale_point_t* p = (zap_scale_point_t*)realloc(g->scale_points, cap * sizeof(*p));
+        if (!p) return;
+        g->scale_points = p;
+        g->scale_capacity = cap;
+    }
+    zap_scale_point_t* p = &g->scale_points[g->scale_count++];
+    memcpy(p->label, name, (size_t)(slash - name));
+    p->label[slash - name] = '\0';
+    p->n = n;
+    p->mean = mean;
+    p->bytes = bytes;
+    snprintf(p->key, sizeof(p->key), "%s", key);
+    const zap_baseline_entry_t* prev = zap_g_config.compare
+        ? zap_baseline_find(&zap_g_config.baseline, key) : NULL;
+    const zap_metric_t* m = prev
+        ? zap_find_metric(prev->metrics, prev->metric_count, ZAP_COMPLEXITY_METRIC) : NULL;
+    p->prev_exponent = m ? m->value : NAN;
+}
+
+static double zap__complexity_f(zap_complexity_t c, double n) {
+    switch (c) {
+        case ZAP_O_1:       return 1.0;
+        case ZAP_O_LOG_N:   return log2(n);
+        case ZAP_O_N:       return n;
+        case ZAP_O_N_LOG_N: return n * log2(n);
+        case ZAP_O_N2:      return n * n;
+        default:            return 1.0;
+    }
+}
+
+const char* zap_complexity_name(zap_complexity_t c) {
+    switch (c) {
+        case ZAP_O_1:       return "O(1)";
+        case ZAP_O_LOG_N:   return "O(log n)";
+        case ZAP_O_N:       return "O(n)";
+        case ZAP_O_N_LOG_N: return "O(n log n)";
+        case ZAP_O_N2:      return "O(n^2)";
+        default:            return "O(?)";
+    }
+}
+
+bool zap_complexity_fit(const double* n, const double* mean, size_t count,
+                        zap_complexity_fit_t* out) {
+    memset(out, 0, sizeof(*out));
+    double* lx = (double*)malloc(2 * count * sizeof(double));
+    if (!lx) return false;
+    double* ly = lx + count;
+    size_t m = 0;
+    double y_sum = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        if (n[i] <= 0 || mean[i] <= 0) continue;
+        lx[m] = log(n[i]);
+        ly[m] = log(mean[i]);
+        y_sum += mean[i];
+        m++;
+    }
+    if (m < 2) {
+        free(lx);
+        return false;
+    }
+
+    // coef = sum(y f) / sum(f^2) minimizes sum((y - coef f)^2)
+    double best_rms = INFINITY;
+    for (int c = 0; c < ZAP_COMPLEXITY_COUNT; c++) {
+        double fy = 0.0, ff = 0.0;
+        for (size_t i = 0; i < count; i++) {
+            if (n[i] <= 0 || mean[i] <= 0) continue;
+            double f = zap__complexity_f((zap_complexity_t)c, n[i]);
+            fy += f * mean[i];
+            ff += f * f;
+        }
+        if (ff <= 0) continue;
+        double coef = fy / ff;
+        double sq = 0.0;
+        for (size_t i = 0; i < count; i++) {
+            if (n[i] <= 0 || mean[i] <= 0) continue;
+            double r = mean[i] - coef * zap__complexity_f((zap_complexity_t)c, n[i]);
+            sq += r * r;
+        }
+        double rms = sqrt(sq / (double)m) / (y_sum / (double)m) * 100.0;
+        if (rms < best_rms) {
+            best_rms = rms;
+            out->model = (zap_complexity_t)c;
+            out->coef = coef;
+        }
+    }
+    out->rms_pct = best_rms;
+
+    double intercept, se;
+    zap_linear_fit(lx, ly, m, &out->exponent, &intercept, &out->r_squared, &se);
+    free(lx);
+    return true;
+}
+
+// Per-element cost this many times the fitted model's, from one size to the next
+#define ZAP__COST_JUMP 1.5
+
+static bool zap__entry_set_metrics(zap_baseline_t* b, zap_baseline_entry_t* e,
+                                   const zap_metric_t* metrics, size_t n);
+
+// Attach the exponent to the entry of the largest size, if it was saved
+static void zap__save_exponent(zap_baseline_t* b, const char* key, double exponent) {
+    zap_baseline_entry_t* e = (zap_baseline_entry_t*)zap_baseline_find(b, key);
+    if (!e) return;
+    zap_metric_t metrics[ZAP_MAX_METRICS];
+    size_t n = e->metric_count;
+    if (n > 0) memcpy(metrics, e->metrics, n * sizeof(zap_metric_t));
+    zap__set_metric(metrics, &n, ZAP_COMPLEXITY_METRIC, exponent,
+                    ZAP_METRIC_USER, ZAP_METRIC_TOTAL | ZAP_METRIC_FIT);
+    zap__entry_set_metrics(b, e, metrics, n);
+}
+
+static void zap__report_complexity(const zap_runtime_group_t* g, const char* label,
+                                   const double* n, const double* mean, size_t count,
+                                   bool bytes, const zap_scale_point_t* top) {
+    zap_complexity_fit_t fit;
+    if (!zap_complexity_fit(n, mean, count, &fit)) return;
+
+    bool prev = !isnan(top->prev_exponent);
+    double prev_exponent = top->prev_exponent;
+    bool regressed = prev && fit.exponent > prev_exponent + ZAP_COMPLEXITY_TOLERANCE;
+    if (regressed && zap_g_config.fail_threshold > 0) zap_g_config.has_regression = true;
+
+    // Cache levels a byte-sized sweep crosses, to name where cost jumps
+    size_t caches[3] = {0, 0, 0};
+    if (bytes) zap__cache_sizes(caches);
+    static const char* const level_names[3] = {"L1d", "L2", "L3"};
+
+    if (zap_g_config.json_output) {
+        printf("{\"type\":\"complexity\",\"group\":\"%s\",\"name\":\"%s\""
+               ",\"model\":\"%s\",\"coef_ns\":%.6g,\"rms_pct\":%.2f"
+               ",\"exponent\":%.4f,\"r_squared\":%.4f,\"points\":%zu",
+               g->name, label, zap_complexity_name(fit.model), fit.coef, fit.rms_pct,
+               fit.exponent, fit.r_squared, count);
+        if (prev) {
+            printf(",\"baseline_exponent\":%.4f,\"regressed\":%s",
+                   prev_exponent, regressed ? "true" : "false");
+        }
+        printf(",\"jumps\":[");
+    } else {
+        printf("%s%s%s complexity:%s %s%s%s (exponent %.2f, R\302\262 %.3f, RMS %.1f%%)",
+               zap__c_bold(), zap__c_magenta(), label, zap__c_reset(),
+               zap__c_bold(), zap_complexity_name(fit.model), zap__c_reset(),
+               fit.exponent, fit.r_squared, fit.rms_pct);
+        if (regressed) {
+            printf("  %sgrew%s (was %.2f)", zap__c_red(), zap__c_reset(), prev_exponent);
+        } else if (prev) {
+            printf("  (was %.2f)", prev_exponent);
+        }
+        printf("\n");
+    }
+
+    /*
+     * Cost relative to the model from one size to the next: flat for a good
+     * fit, a step where a level spills. Steps are judged against the median
+     * step too, so a model that is merely off by a steady factor shows none.
+     */
+    double* steps = (double*)malloc(2 * count * sizeof(double));
+    size_t step_count = 0;
+    for (size_t i = 0; steps && i + 1 < count; i++) {
+        double f0 = zap__complexity_f(fit.model, n[i]);
+        double f1 = zap__complexity_f(fit.model, n[i + 1]);
+        steps[i] = f0 > 0 && f1 > 0 ? (mean[i + 1] / f1) / (mean[i] / f0) : 0.0;
+        steps[count + step_count++] = steps[i];
+    }
+    double typical = step_count > 0 ? zap__median_select(steps + count, step_count) : 0.0;
+
+    bool first = true;
+    for (size_t i = 0; i < step_count; i++) {
+        double ratio = steps[i];
+        if (ratio < ZAP__COST_JUMP || ratio < typical * ZAP__COST_JUMP) continue;
+
+        int level = -1;
+        for (int l = 2; l >= 0 && level < 0; l--) {
+            if (caches[l] && n[i] <= (double)caches[l] && (double)caches[l] <= n[i + 1]) level = l;
+        }
+        if (zap_g_config.json_output) {
+            printf("%s{\"from\":%.6g,\"to\":%.6g,\"ratio\":%.3f,\"level\":",
+                   first ? "" : ",", n[i], n[i + 1], ratio);
+            if (level >= 0) {
+                printf("\"%s\"}", level_names[level]);
+            } else {
+                printf("null}");
+            }
+        } else {
+            char from[32], to[32];
+            if (bytes) {
+                zap__format_bytes(n[i], from, sizeof(from));
+                zap__format_bytes(n[i + 1], to, sizeof(to));
+            } else {
+                snprintf(from, sizeof(from), "%.6g", n[i]);
+                snprintf(to, sizeof(to), "%.6g", n[i + 1]);
+            }
+            printf("  %sCost jump:%s %s%.2fx%s per element from %s to %s", zap__c_dim(),
+                   zap__c_reset(), zap__c_yellow(), ratio, zap__c_reset(), from, to);
+            if (level >= 0) {
+                char size_buf[32];
+                zap__format_bytes((double)caches[level], size_buf, sizeof(size_buf));
+                printf(", past %s (%s)", level_names[level], size_buf);
+            }
+            printf("\n");
+        }
+        first = false;
+    }
+    free(steps);
+    if (zap_g_config.json_output) {
+        printf("]}\n");
+        fflush(stdout);
+    } else {
+        printf("\n");
+    }
+
+    // Not through zap__save_result(): the exponent is no time and stays out of the history
+    if (zap_g_config.save_baseline) {
+        zap__save_exponent(&zap_g_config.baseline, top->key, fit.exponent);
+        if (zap_g_config.shard_count > 0) {
+            zap__save_exponent(&zap_g_config.shard_results, top->key, fit.exponent);
+        }
+    }
+}
+
+// Fit each label with enough sizes, in the order labels first appeared
+static void zap__group_complexity(zap_runtime_group_t* g) {
+    size_t count = g->scale_count;
+    if (count < ZAP_COMPLEXITY_MIN_POINTS) return;
+    double* n = (double*)malloc(2 * count * sizeof(double));
+    bool* done = (bool*)calloc(count, sizeof(bool));
+    if (!n || !done) {
+        free(n);
+        free(done);
+        return;
+    }
+    double* mean = n + count;
+
+    for (size_t i = 0; i < count; i++) {
+        if (done[i]) continue;
+        const char* label = g->scale_points[i].label;
+        size_t m = 0;
+        bool bytes = true;
+        const zap_scale_point_t* top = NULL;
+        for (size_t j = i; j < count; j++) {
+            const zap_scale_point_t* p = &g->scale_points[j];
+            if (done[j] || strcmp(p->label, label) != 0) continue;
+            done[j] = true;
+            bytes = bytes && p->bytes;
+            if (!top || p->n >= top->n) top = p;
+            // Insert by size; a repeated size keeps the later result
+            size_t k = 0;
+            while (k < m && n[k] < p->n) k++;
+            if (k < m && n[k] == p->n) {
+                mean[k] = p->mean;
+                continue;
+            }
+            memmove(n + k + 1, n + k, (m - k) * sizeof(double));
+            memmove(mean + k + 1, mean + k, (m - k) * sizeof(double));
+            n[k] = p->n;
+            mean[k] = p->mean;
+            m++;
+        }
+        if (m >= ZAP_COMPLEXITY_MIN_POINTS) zap__report_complexity(g, label, n, mean, m, bytes, top);
+    }
+    free(n);
+    free(done);
+}
+
+void zap_group_finish(zap_runtime_group_t* g) {
+    zap__jobs_drain();
+    zap__group_complexity(g);
+    free(g->scale_points);
+    g->scale_points = NULL;
+    g->scale_count = 0;
+    g->scale_capacity = 0;
+
+    // Call teardown if set and not in dry run mode
+    if (g->teardown && !zap_g_config.dry_run) {
+        g->teardown();
+    }
+    g->active = false;
+    // Only print group end if header was printed
+    if (g->header_printed) {
+        zap_report_group_end();
+    }
+}
+
+/* BENCHMARK ID */
+
+zap_benchmark_id_t zap_benchmark_id(const char* label, int64_t param) {
+    zap_benchmark_id_t id;
+    strncpy(id.label, label, sizeof(id.label) - 1);
+    id.label[sizeof(id.label) - 1] = '\0';
+    snprintf(id.param_str, sizeof(id.param_str), "%lld", (long long)param);
+    return id;
+}
+
+zap_benchmark_id_t zap_benchmark_id_str(const char* label, const char* param) {
+    zap_benchmark_id_t id;
+    strncpy(id.label, label, sizeof(id.label) - 1);
+    id.label[sizeof(id.label) - 1] = '\0';
+    strncpy(id.param_str, param, sizeof(id.param_str) - 1);
+    id.param_str[sizeof(id.param_str) - 1] = '\0';
+    return id;
+}
+
+/* BENCHER FUNCTIONS */
+
+static void zap__init_with_config(zap_t* c, const char* name,
+                                        const zap_bench_config_t* config) {
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    c->iterations = 1;
+    // Apply CLI overrides over group config
+    c->config = *config;
+    if (zap_g_config.cli_warmup_ns > 0) {
+        c->config.warmup_time_ns = zap_g_config.cli_warmup_ns;
+    }
+    if (zap_g_config.cli_time_ns > 0) {
+        c->config.measurement_time_ns = zap_g_config.cli_time_ns;
+    }
+    if (zap_g_config.cli_samples > 0) {
+        c->config.sample_count = zap_g_config.cli_samples;
+    }
+    if (zap_g_config.cli_target_precision > 0) {
+        c->config.target_precision = zap_g_config.cli_target_precision;
+    }
+    if (zap_g_config.cli_sampling_set) {
+        c->config.sampling_mode = zap_g_config.cli_sampling;
+    }
+    if (zap_g_config.cli_cache_mode_set) {
+        c->config.cache_mode = zap_g_config.cli_cache_mode;
+    }
+    if (zap_g_config.cli_min_iters > 0) {
+        c->iterations = zap_g_config.cli_min_iters;
+    }
+    c->sample_capacity = c->config.sample_count;
+    c->samples = (double*)malloc(c->sample_capacity * sizeof(double));
+}
+
+// Print benchmark in dry-run mode
+static void zap__print_dry_run(const char* group_name, const char* bench_name) {
+    if (zap_g_config.json_output) {
+        printf("{\"type\":\"benchmark\",\"group\":\"%s\",\"name\":\"%s\"}\n",
+               group_name ? group_name : "", bench_name);
+    } else {
+        if (group_name) {
+            printf("  %s%s%s/%s%s%s\n",
+                   zap__c_purple(), group_name, zap__c_reset(),
+                   zap__c_magenta(), bench_name, zap__c_reset());
+        } else {
+            printf("  %s%s%s\n", zap__c_magenta(), bench_name, zap__c_reset());
+        }
+    }
+}
+
+/*
+ * Linear sampling: regress batch time on iteration count. The slope is the
+ * per-iteration time with any fixed per-batch cost moved into the intercept,
+ * so it replaces the mean and its standard error gives the CI. Median, range
+ * and percentiles stay per-sample (elapsed / iterations).
+ */
+static void zap__apply_linear_fit(zap_t* c, zap_stats_t* stats) {
+    size_t n = c->sample_count;
+    stats->sampling = ZAP_SAMPLING_LINEAR;
+    stats->iterations = c->iter_step;
+    if (n < 2) return;
+
+    double* totals = (double*)malloc(n * sizeof(double));
+    if (!totals) return;
+    for (size_t i = 0; i < n; i++) {
+        totals[i] = c->samples[i] * c->sample_iters[i];
+    }
+    double slope_se;
+    zap_linear_fit(c->sample_iters, totals, n, &stats->slope, &stats->intercept,
+                   &stats->r_squared, &slope_se);
+    free(totals);
+
+    if (stats->slope <= 0) return;  // Noise swamped the signal; keep the flat mean
+    stats->mean = stats->slope;
+    double half = zap__t_value(n - 1) * slope_se;  // n - 2 degrees of freedom
+    stats->ci_lower = stats->slope - half;
+    stats->ci_upper = stats->slope + half;
+}
+
+/*
+ * Harness cost per iteration of a ZAP_ITER_UNROLLED loop: the counter and
+ * branch of one trip of an empty loop, spread over the k copies of the body
+ * it runs. Best of a few timed runs; the batch timer reads are the separate
+ * per-batch overhead.
+ */
+static double zap__loop_cost_ns(uint32_t k) {
+    static uint32_t cached_k = 0;
+    static double cached_ns = 0.0;
+    if (k == 0) return 0.0;
+    if (k == cached_k) return cached_ns;
+
+    const uint64_t trips = 1u << 20;
+    double best = 0.0;
+    for (int run = 0; run < 5; run++) {
+        uint64_t t0 = zap__timer_begin();
+        for (uint64_t n = trips; n > 0; --n) {
+            __asm__ volatile("");
+        }
+        double ns = zap__ticks_to_ns(zap__timer_end() - t0);
+        if (run == 0 || ns < best) best = ns;
+    }
+    cached_k = k;
+    cached_ns = best / (double)trips / (double)k;
+    return cached_ns;
+}
+
+// Compute stats for a finished benchmark and attach its run metadata
+static zap_stats_t zap__finish_stats(zap_t* c) {
+    if (c->scratch_capacity < c->sample_count) {
+        free(c->scratch);
+        c->scratch = (double*)malloc(c->sample_count * sizeof(double));
+        c->scratch_capacity = c->scratch ? c->sample_count : 0;
+    }
+    zap_stats_t stats = c->scratch
+        ? zap_compute_stats_into(c->samples, c->sample_count, c->scratch)
+        : zap_compute_stats(c->samples, c->sample_count);
+    stats.iterations = c->iterations;
+    stats.throughput_type = c->throughput_type;
+    stats.throughput_value = c->throughput_value;
+    stats.overhead_ns = zap_g_config.overhead_correction ? zap__timer.overhead_ns : 0.0;
+    stats.unroll = c->unroll;
+    stats.loop_ns = zap__loop_cost_ns(c->unroll);
+    stats.stop_reason = c->stop_reason;
+    stats.target_precision = c->config.target_precision;
+    stats.cold_cache = c->config.cache_mode == ZAP_CACHE_COLD;
+    if (c->iter_step > 0 && c->sample_iters) {
+        zap__apply_linear_fit(c, &stats);
+    }
+    if (c->latency.counts && c->latency.total > 0) {
+        // Per-op tails; --percentiles reads the same histogram
+        const zap_latency_hist_t* h = &c->latency;
+        stats.latency = h;
+        stats.latency_count = h->total;
+        stats.latency_p50 = zap_latency_hist_percentile(h, 50.0);
+        stats.latency_p99 = zap_latency_hist_percentile(h, 99.0);
+        stats.latency_p999 = zap_latency_hist_percentile(h, 99.9);
+        stats.latency_p9999 = zap_latency_hist_percentile(h, 99.99);
+        stats.latency_max = zap_latency_hist_percentile(h, 100.0);
+        stats.p75 = zap_latency_hist_percentile(h, 75.0);
+        stats.p90 = zap_latency_hist_percentile(h, 90.0);
+        stats.p95 = zap_latency_hist_percentile(h, 95.0);
+        stats.p99 = stats.latency_p99;
+    }
+    if (stats.mean > 0) {
+        stats.precision_pct = (stats.ci_upper - stats.ci_lower) / 2.0 / stats.mean * 100.0;
+    }
+    if (c->rate_ticks > 0 && stats.latency_count > 0) {
+        // Batches are paced, so the per-op mean is the achieved interval
+        stats.target_rate = c->config.rate;
+        stats.achieved_rate = stats.mean > 0 ? 1e9 / stats.mean : 0.0;
+    }
+    if (c->freq_count > 0 || c->freq_rejected > 0) {
+        stats.freq_source = zap__freq.source;
+        stats.freq_mean = c->freq_count > 0 ? c->freq_sum / (double)c->freq_count : 0.0;
+        stats.freq_min = c->freq_min;
+        stats.freq_rejected = c->freq_rejected;
+    }
+    zap__collect_metrics(c, &stats);
+    return stats;
+}
+
+static bool zap__exceeds_threshold(const zap_comparison_t* cmp);
+
+// Group of the result zap_report_json() is printing, for its "group" field
+static const char* zap__json_group = NULL;
+
+// Record a result for the baseline; a sharded run also keeps its own copy,
+// and so does the history, which only holds what this run measured
+static void zap__save_result(const char* key, const zap_stats_t* stats) {
+    if (!zap_g_config.save_baseline) return;
+    zap_baseline_add(&zap_g_config.baseline, key, stats);
+    if (zap_g_config.shard_count > 0) {
+        zap_baseline_add(&zap_g_config.shard_results, key, stats);
+    }
+    if (zap_g_config.history) {
+        zap_baseline_add(&zap_g_config.run_results, key, stats);
+    }
+}
+
+// Compare, report and record finished stats. Returns what was reported,
+// without the borrowed samples and histogram.
+static zap_stats_t zap__report_stats(const zap_stats_t* s, size_t requested_samples,
+                                     const char* group_name, const char* name) {
+    zap_stats_t stats = *s;
+
+    // Open-loop runs are keyed by rate, so a sweep keeps one baseline per rate
+    char rate_name[320];
+    if (stats.target_rate > 0) {
+        char rate_buf[32];
+        zap__format_rate(stats.target_rate, rate_buf, sizeof(rate_buf));
+        snprintf(rate_name, sizeof(rate_name), "%s @%s", name, rate_buf);
+        name = rate_name;
+    }
+
+    // Warn if time limit was reached before collecting all samples
+    if (!zap_g_config.json_output && stats.stop_reason == ZAP_STOP_TIME &&
+        stats.sample_count < requested_samples) {
+        printf("%sWarning: time limit reached, collected %zu/%zu samples%s\n",
+               zap__c_yellow(), stats.sample_count, requested_samples, zap__c_reset());
+    }
+
+    // Build baseline key with group prefix to avoid collisions
+    char baseline_key[384];
+    if (group_name && group_name[0]) {
+        snprintf(baseline_key, sizeof(baseline_key), "%s/%s", group_name, name);
+    } else {
+        snprintf(baseline_key, sizeof(baseline_key), "%s", name);
+    }
+
+    // Check if we should compare against baseline
+    zap_comparison_t cmp = {0};
+    const zap_baseline_entry_t* baseline = NULL;
+
+    if (zap_g_config.compare) {
+        baseline = zap_baseline_find(&zap_g_config.baseline, baseline_key);
+        if (baseline) {
+            cmp = zap_compare(baseline, &stats);
+
+            // Track regression for --fail-threshold
+            if (zap__exceeds_threshold(&cmp)) {
+                zap_g_config.has_regression = true;
+            }
+        }
+    }
+
+    // Output results
+    if (zap_g_config.json_output) {
+        zap__json_group = group_name;
+        zap_report_json(name, &stats, baseline ? &cmp : NULL);
+        zap__json_group = NULL;
+    } else if (baseline) {
+        zap_report_comparison(name, &stats, &cmp);
+    } else if (zap_g_config.compare) {
+        printf("%s(new)%s ", zap__c_yellow(), zap__c_reset());
+        zap_report(name, &stats);
+    } else {
+        zap_report(name, &stats);
+    }
+
+    zap__scale_record(group_name, name, baseline_key, stats.mean);
+    zap__save_result(baseline_key, &stats);
+    stats.samples = NULL;
+    stats.latency = NULL;
+    return stats;
+}
+
+static void zap__report_failure(const char* name, const char* why);
+
+// Returns the reported stats so callers can relate runs to each other
+static zap_stats_t zap__run_and_report(zap_t* c, const char* group_name, const char* name) {
+    if (c->error[0]) {
+        zap_stats_t none;
+        memset(&none, 0, sizeof(none));
+        zap__report_failure(name, c->error);
+        return none;
+    }
+    zap_stats_t stats = zap__finish_stats(c);
+    return zap__report_stats(&stats, c->config.sample_count, group_name, name);
+}
+
+/* ISOLATED RUNS (--isolate) */
+
+/*
+ * The child runs the benchmark and writes one message to a pipe: this
+ * header, then the raw samples, then the latency buckets if any. Both ends
+ * are the same binary, so structs go over as-is; pointers are rebuilt on
+ * the parent side. The parent owns reporting and the baseline, so results
+ * do not depend on what earlier benchmarks did to the heap or caches, and
+ * a crash only loses that one benchmark.
+ */
+#define ZAP__ISOLATE_MAGIC 0x7a61702d69736f31ULL  // "zap-iso1"
+
+typedef struct {
+    uint64_t           magic;
+    uint64_t           requested_samples;
+    uint64_t           sample_count;
+    uint64_t           latency_buckets;  // 0 or ZAP_LATENCY_BUCKETS
+    zap_stats_t        stats;
+    zap_latency_hist_t latency;          // Counts follow the samples
+    char               error[128];       // zap_t.error: the routine could not run
+} zap__isolate_msg_t;
+
+static bool zap__write_all(int fd, const void* data, size_t size) {
+    const char* p = (const char*)data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool zap__read_all(int fd, void* data, size_t size) {
+    char* p = (char*)data;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;  // Error, or the child died mid-message
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+// Child side: run, send the results and exit without atexit handlers
+static void zap__isolate_child(int fd, zap_t* z, zap_bench_fn fn) {
+    // An inherited counter group would count the parent, not this process
+    if (zap__hw.opened) {
+        bool was_ready = zap__hw.ready;
+        zap__hw_close();
+        if (was_ready) zap__hw_open();
+    }
+
+    fn(z);
+    zap_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    if (!z->error[0]) stats = zap__finish_stats(z);
+
+    zap__isolate_msg_t msg;
+    memset(&msg, 0, sizeof(msg));
+    memcpy(msg.error, z->error, sizeof(msg.error));
+    msg.magic = ZAP__ISOLATE_MAGIC;
+    msg.requested_samples = z->config.sample_count;
+    msg.sample_count = stats.sample_count;
+    msg.latency_buckets = stats.latency ? ZAP_LATENCY_BUCKETS : 0;
+    msg.stats = stats;
+    msg.latency = z->latency;
+
+    bool ok = zap__write_all(fd, &msg, sizeof(msg));
+    if (ok && msg.sample_count > 0) {
+        ok = zap__write_all(fd, stats.samples, (size_t)msg.sample_count * sizeof(double));
+    }
+    if (ok && msg.latency_buckets > 0) {
+        ok = zap__write_all(fd, z->latency.counts, ZAP_LATENCY_BUCKETS * sizeof(uint64_t));
+    }
+    close(fd);
+    fflush(stdout);
+    fflush(stderr);
+    _exit(ok ? 0 : 1);  // Skip zap_finalize(), the parent saves the baseline
+}
+
+static void zap__report_failure(const char* name, const char* why) {
+    zap_status_clear();
+    if (zap_g_config.json_output) {
+        printf("{\"name\":\"%s\",\"error\":\"%s\"}\n", name, why);
+    } else {
+        printf("%s%s:%s\n", zap__c_bold(), name, zap__c_reset());
+        printf("  %sFailed:%s %s\n\n", zap__c_red(), zap__c_reset(), why);
+    }
+    zap_g_config.has_failure = true;
+}
+
+/*
+ * --profile: run fn on z for the profile budget instead of sampling it and
+ * report how much of the loop ran. Nothing is compared or saved, so the
+ * profiler sees the body, not statistics or baseline I/O.
+ */
+static void zap__run_profiled(zap_t* z, zap_bench_fn fn, const char* group_name,
+                              const char* name) {
+    z->profiling = true;
+    fn(z);
+    zap_status_clear();
+    if (z->error[0]) {
+        zap__report_failure(name, z->error);
+        return;
+    }
+
+    double ns = z->start_time ? zap__ticks_to_ns(z->current_iter - z->start_time) : 0.0;
+    double per_iter = z->measured_iters > 0 ? ns / (double)z->measured_iters : 0.0;
+    if (zap_g_config.json_output) {
+        printf("{\"type\":\"profile\",\"group\":\"%s\",\"name\":\"%s\",\"iterations\":%llu,"
+               "\"time_ns\":%.0f,\"ns_per_iter\":%.4f}\n",
+               group_name ? group_name : "", name,
+               (unsigned long long)z->measured_iters, ns, per_iter);
+        fflush(stdout);
+        return;
+    }
+    char iters[32], total[32], each[32];
+    zap__format_count((double)z->measured_iters, iters, sizeof(iters));
+    zap__format_time(ns, total, sizeof(total));
+    zap__format_time(per_iter, each, sizeof(each));
+    printf("%s%s%s:%s\n", zap__c_bold(), zap__c_magenta(), name, zap__c_reset());
+    printf("  %sProfiled:%s %s iterations in %s (%s%s%s/iter)\n\n",
+           zap__c_dim(), zap__c_reset(), iters, total, zap__c_cyan(), each, zap__c_reset());
+    fflush(stdout);
+}
+
+static bool zap__pin_thread(int cpu);
+
+// Fork a child running fn on z, pinned to cpu unless it is -1. Returns the
+// child's pid and the read end of its pipe in fd_out, or -1 on failure.
+static pid_t zap__isolate_spawn(zap_t* z, zap_bench_fn fn, int cpu, bool quiet,
+                                int* fd_out) {
+    // Probe counters once here so every child does not repeat the warnings
+    if (zap_g_config.hw_counters) zap__hw_open();
+
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+
+    // Unflushed output would otherwise be printed by both processes
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        zap__status_quiet = quiet;
+        if (cpu >= 0 && !zap__pin_thread(cpu)) {
+            fprintf(stderr, "Warning: cannot pin '%s' to cpu %d\n", z->name, cpu);
+        }
+        zap__isolate_child(fds[1], z, fn);
+    }
+    close(fds[1]);
+    *fd_out = fds[0];
+    return pid;
+}
+
+// Read a child's results, reap it and report. Returns the reported stats,
+// all zero if the child failed.
+static zap_stats_t zap__isolate_collect(pid_t pid, int fd, const char* group_name,
+                                   const char* name) {
+    zap__isolate_msg_t msg;
+    double* samples = NULL;
+    uint64_t* counts = NULL;
+    bool ok = zap__read_all(fd, &msg, sizeof(msg)) && msg.magic == ZAP__ISOLATE_MAGIC &&
+              (msg.latency_buckets == 0 || msg.latency_buckets == ZAP_LATENCY_BUCKETS);
+    if (ok && msg.sample_count > 0) {
+        samples = (double*)malloc((size_t)msg.sample_count * sizeof(double));
+        ok = samples &&
+             zap__read_all(fd, samples, (size_t)msg.sample_count * sizeof(double));
+    }
+    if (ok && msg.latency_buckets > 0) {
+        counts = (uint64_t*)malloc(ZAP_LATENCY_BUCKETS * sizeof(uint64_t));
+        ok = counts && zap__read_all(fd, counts, ZAP_LATENCY_BUCKETS * sizeof(uint64_t));
+    }
+    close(fd);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+
+    zap_stats_t reported;
+    memset(&reported, 0, sizeof(reported));
+    if (ok && WIFEXITED(status) && WEXITSTATUS(status) == 0 && msg.error[0]) {
+        zap__report_failure(name, msg.error);
+    } else if (ok && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        zap_stats_t stats = msg.stats;
+        stats.samples = samples;
+        stats.latency = NULL;
+        if (counts) {
+            msg.latency.counts = counts;
+            stats.latency = &msg.latency;
+        }
+        reported = zap__report_stats(&stats, (size_t)msg.requested_samples, group_name, name);
+    } else {
+        char why[96];
+        if (WIFSIGNALED(status)) {
+            snprintf(why, sizeof(why), "killed by signal %d (%s)",
+                     WTERMSIG(status), strsignal(WTERMSIG(status)));
+        } else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+            snprintf(why, sizeof(why), "exited with status %d", WEXITSTATUS(status));
+        } else {
+            snprintf(why, sizeof(why), "sent incomplete results");
+        }
+        zap__report_failure(name, why);
+    }
+    free(samples);
+    free(counts);
+    return reported;
+}
+
+// Run fn in a forked child and report what it sends back
+static zap_stats_t zap__run_isolated(zap_t* z, zap_bench_fn fn, const char* group_name,
+                                const char* name) {
+    int fd;
+    pid_t pid = zap__isolate_spawn(z, fn, -1, false, &fd);
+    if (pid < 0) {
+        fprintf(stderr, "Warning: cannot fork, running '%s' in-process\n", name);
+        fn(z);
+        return zap__run_and_report(z, group_name, name);
+    }
+    return zap__isolate_collect(pid, fd, group_name, name);
+}
+
+static void zap__print_cold_ratio(double warm_mean, double cold_mean) {
+    if (warm_mean <= 0 || cold_mean <= 0 || zap_g_config.json_output) return;
+    char warm_buf[32], cold_buf[32];
+    zap__format_time(warm_mean, warm_buf, sizeof(warm_buf));
+    zap__format_time(cold_mean, cold_buf, sizeof(cold_buf));
+    printf("  %sCold vs warm:%s      %s%.2fx%s (warm %s, cold %s)\n\n",
+           zap__c_dim(), zap__c_reset(), zap__c_bold(), cold_mean / warm_mean,
+           zap__c_reset(), warm_buf, cold_buf);
+}
+
+/* PARALLEL JOBS (--jobs) */
+
+/*
+ * With --jobs N, up to N isolated children run at once, each pinned to its
+ * own physical core. Only one logical CPU per core is used, so no job ever
+ * shares a core with an SMT sibling. Jobs are collected in the order they
+ * were started, which keeps the report order identical to a serial run.
+ */
+typedef struct {
+    pid_t  pid;
+    int    fd;
+    size_t slot;             // Index into zap__job_cpus
+    bool   cold_ratio;       // Cold pass of ZAP_CACHE_BOTH, right after its warm pass
+    char   group_name[128];
+    char   name[288];
+} zap__job_t;
+
+static zap__job_t zap__jobs[ZAP_MAX_JOBS];
+static size_t     zap__job_head = 0;
+static size_t     zap__job_count = 0;
+static int        zap__job_cpus[ZAP_MAX_JOBS];   // -1 = unpinned
+static bool       zap__job_busy[ZAP_MAX_JOBS];
+static size_t     zap__job_slots = 0;            // 0 until probed
+static double     zap__job_last_mean = 0.0;
+
+// One CPU per physical core in our affinity mask, lowest sibling first.
+// Returns how many were found, 0 if the topology is unknown.
+static size_t zap__physical_cpus(int* out, size_t max) {
+#if defined(__linux__)
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    long len = syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask);
+    if (len <= 0) return 0;
+    size_t bits = 8 * sizeof(unsigned long);
+    size_t count = 0;
+    for (size_t cpu = 0; cpu < (size_t)len * 8 && count < max; cpu++) {
+        if (!((mask[cpu / bits] >> (cpu % bits)) & 1UL)) continue;
+
+        // A lower sibling we may also run on already stands for this core
+        char path[96], list[64];
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%zu/topology/thread_siblings_list", cpu);
+        bool primary = true;
+        if (zap__read_line(path, list, sizeof(list))) {
+            const char* p = list;
+            while (*p && primary) {
+                char* end;
+                long lo = strtol(p, &end, 10);
+                if (end == p) break;
+                long hi = lo;
+                if (*end == '-') {
+                    p = end + 1;
+                    hi = strtol(p, &end, 10);
+                }
+                for (long s = lo; s <= hi && s < (long)cpu; s++) {
+                    if (s >= 0 && (size_t)s < (size_t)len * 8 &&
+                        ((mask[(size_t)s / bits] >> ((size_t)s % bits)) & 1UL)) {
+                        primary = false;
+                    }
+                }
+                p = (*end == ',') ? end + 1 : end;
+            }
+        }
+        if (primary) out[count++] = (int)cpu;
+    }
+    return count;
+#else
+    (void)out;
+    (void)max;
+    return 0;
+#endif
+}
+
+static void zap__jobs_probe(void) {
+    if (zap__job_slots > 0) return;
+    size_t want = zap_g_config.jobs < ZAP_MAX_JOBS ? zap_g_config.jobs : ZAP_MAX_JOBS;
+    size_t found = zap__physical_cpus(zap__job_cpus, want);
+    if (found > 0) {
+        zap__job_slots = found;
+        if (found < zap_g_config.jobs) {
+            fprintf(stderr, "Warning: --jobs %zu limited to %zu (one job per physical core, "
+                            "SMT siblings excluded)\n", zap_g_config.jobs, found);
+        }
+    } else {
+        for (size_t i = 0; i < want; i++) zap__job_cpus[i] = -1;
+        zap__job_slots = want;
+        fprintf(stderr, "Warning: CPU topology unknown, --jobs children are not pinned\n");
+    }
+}
+
+// Collect the oldest running job and free its core
+static void zap__jobs_reap_one(void) {
+    zap__job_t* j = &zap__jobs[zap__job_head];
+    double mean = zap__isolate_collect(j->pid, j->fd, j->group_name, j->name).mean;
+    zap__job_busy[j->slot] = false;
+    if (j->cold_ratio) zap__print_cold_ratio(zap__job_last_mean, mean);
+    zap__job_last_mean = mean;
+    zap__job_head = (zap__job_head + 1) % ZAP_MAX_JOBS;
+    zap__job_count--;
+}
+
+// Wait for every running job; called before anything that reports or
+// measures in this process
+static void zap__jobs_drain(void) {
+    while (zap__job_count > 0) zap__jobs_reap_one();
+}
+
+static void zap__jobs_submit(zap_t* z, zap_bench_fn fn, const char* group_name,
+                             const char* name, bool cold_ratio) {
+    zap__jobs_probe();
+    if (zap__job_count >= zap__job_slots) zap__jobs_reap_one();
+
+    size_t slot = 0;
+    while (zap__job_busy[slot]) slot++;
+
+    int fd;
+    pid_t pid = zap__isolate_spawn(z, fn, zap__job_cpus[slot], zap__job_slots > 1, &fd);
+    if (pid < 0) {
+        zap__jobs_drain();
+        fprintf(stderr, "Warning: cannot fork, running '%s' in-process\n", name);
+        fn(z);
+        double mean = zap__run_and_report(z, group_name, name).mean;
+        if (cold_ratio) zap__print_cold_ratio(zap__job_last_mean, mean);
+        zap__job_last_mean = mean;
+        return;
+    }
+
+    zap__job_t* j = &zap__jobs[(zap__job_head + zap__job_count) % ZAP_MAX_JOBS];
+    j->pid = pid;
+    j->fd = fd;
+    j->slot = slot;
+    j->cold_ratio = cold_ratio;
+    snprintf(j->group_name, sizeof(j->group_name), "%s", group_name ? group_name : "");
+    snprintf(j->name, sizeof(j->name), "%s", name);
+    zap__job_busy[slot] = true;
+    zap__job_count++;
+
+    // A single slot is just --isolate; report right away
+    if (zap__job_slots == 1) zap__jobs_reap_one();
+}
+
+/* OPEN-LOOP RATE SWEEPS */
+
+typedef struct {
+    double target;     // ops/s
+    double achieved;
+    double p50;        // ns, from the intended start
+    double p99;
+    double p999;
+} zap__rate_row_t;
+
+/*
+ * Knee of the latency curve: the highest rate that is still sustained
+ * (ZAP__RATE_SUSTAINED_PCT of it achieved) with p99 within 2x of the p99 at
+ * the lowest rate. Rows are sorted by target rate in place. Returns the
+ * index, or -1 if even the lowest rate was not sustained.
+ */
+static int zap__rate_knee(zap__rate_row_t* rows, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        zap__rate_row_t row = rows[i];
+        size_t j = i;
+        while (j > 0 && rows[j - 1].target > row.target) {
+            rows[j] = rows[j - 1];
+            j--;
+        }
+        rows[j] = row;
+    }
+    int knee = -1;
+    for (size_t i = 0; i < n; i++) {
+        bool sustained = rows[i].achieved >= rows[i].target * ZAP__RATE_SUSTAINED_PCT / 100.0;
+        if (!sustained || rows[i].p99 > 2.0 * rows[0].p99) break;
+        knee = (int)i;
+    }
+    return knee;
+}
+
+static void zap__print_rate_sweep(const char* group_name, const char* name,
+                                  zap__rate_row_t* rows, size_t n) {
+    int knee = zap__rate_knee(rows, n);
+
+    if (zap_g_config.json_output) {
+        printf("{\"type\":\"rate_sweep\",\"group\":\"%s\",\"name\":\"%s\"",
+               group_name ? group_name : "", name);
+        if (knee >= 0) {
+            printf(",\"knee_per_s\":%.2f", rows[knee].target);
+        } else {
+            printf(",\"knee_per_s\":null");
+        }
+        printf(",\"results\":[");
+        for (size_t i = 0; i < n; i++) {
+            printf("%s{\"target_per_s\":%.2f,\"achieved_per_s\":%.2f"
+                   ",\"p50_ns\":%.6f,\"p99_ns\":%.6f,\"p999_ns\":%.6f}",
+                   i > 0 ? "," : "", rows[i].target, rows[i].achieved,
+                   rows[i].p50, rows[i].p99, rows[i].p999);
+        }
+        printf("]}\n");
+        fflush(stdout);
+        return;
+    }
+
+    printf("%s%s%s rate sweep:%s\n", zap__c_bold(), zap__c_magenta(), name, zap__c_reset());
+    printf("  %s%10s  %10s  %10s  %10s  %10s%s\n", zap__c_dim(),
+           "target", "achieved", "p50", "p99", "p99.9", zap__c_reset());
+    for (size_t i = 0; i < n; i++) {
+        const zap__rate_row_t* r = &rows[i];
+        char target[32], achieved[32], p50[32], p99[32], p999[32];
+        zap__format_rate(r->target, target, sizeof(target));
+        zap__format_rate(r->achieved, achieved, sizeof(achieved));
+        zap__format_time(r->p50, p50, sizeof(p50));
+        zap__format_time(r->p99, p99, sizeof(p99));
+        zap__format_time(r->p999, p999, sizeof(p999));
+        bool sustained = r->achieved >= r->target * ZAP__RATE_SUSTAINED_PCT / 100.0;
+        printf("  %10s  %s%10s%s  %10s  %10s  %10s%s\n", target,
+               sustained ? "" : zap__c_red(), achieved, sustained ? "" : zap__c_reset(),
+               p50, p99, p999, (int)i == knee ? "  <- knee" : "");
+    }
+    if (knee >= 0) {
+        char rate[32];
+        zap__format_rate(rows[knee].target, rate, sizeof(rate));
+        printf("  %sKnee:%s %s%s%s (highest rate sustained with p99 within 2x of the lowest)\n\n",
+               zap__c_dim(), zap__c_reset(), zap__c_bold(), rate, zap__c_reset());
+    } else {
+        printf("  %sKnee:%s %snone%s (the lowest rate was not sustained)\n\n",
+               zap__c_dim(), zap__c_reset(), zap__c_red(), zap__c_reset());
+    }
+}
+
+static bool zap__numa_requested(const zap_runtime_group_t* g) {
+    return g->numa_sweep || g->numa_mem != ZAP_NUMA_ANY || g->numa_cpu != ZAP_NUMA_ANY;
+}
+
+/*
+ * Run fn once per requested cache state. Cold runs are reported (and keyed
+ * in baselines) as "<name> (cold)"; with ZAP_CACHE_BOTH a ratio line
+ * follows the cold report. Returns the closed-loop mean of the first pass,
+ * or 0 when it ran as a job or open loop.
+ */
+static double zap__run_cache_modes(zap_runtime_group_t* g, const char* name, zap_bench_fn fn,
+                                   void* input, size_t input_size) {
+    zap_cache_mode_t mode = zap_g_config.cli_cache_mode_set
+        ? zap_g_config.cli_cache_mode : g->config.cache_mode;
+    double warm_mean = 0.0;
+    double first_mean = 0.0;
+
+    // One profiled run in the first cache state; rates and jobs don't apply
+    if (zap_g_config.profile) {
+        zap_t z;
+        zap__init_with_config(&z, name, &g->config);
+        z.config.cache_mode = mode == ZAP_CACHE_COLD ? ZAP_CACHE_COLD : ZAP_CACHE_WARM;
+        z.group = g;
+        z.param = input;
+        z.param_size = input_size;
+        zap__run_profiled(&z, fn, g->name, name);
+        zap_cleanup(&z);
+        return 0.0;
+    }
+
+    // Open-loop rates, --rate over zap_group_rate(); none means closed loop
+    const double* rates = g->rates;
+    size_t rate_count = g->rate_count;
+    if (zap_g_config.cli_rate_count > 0) {
+        rates = zap_g_config.cli_rates;
+        rate_count = zap_g_config.cli_rate_count;
+    }
+
+    // A sweep needs each result before moving on, so it never runs as a job;
+    // nor does a NUMA-placed run, since jobs pin themselves to their own cores
+    bool use_jobs = zap_g_config.jobs > 0 && rate_count <= 1 && !zap__numa_requested(g);
+    if (zap_g_config.jobs > 0 && !use_jobs) zap__jobs_drain();
+
+    for (int pass = 0; pass < (mode == ZAP_CACHE_BOTH ? 2 : 1); pass++) {
+        bool cold = mode == ZAP_CACHE_COLD || pass == 1;
+        char cold_name[288];
+        const char* run_name = name;
+        if (cold) {
+            snprintf(cold_name, sizeof(cold_name), "%s (cold)", name);
+            run_name = cold_name;
+        }
+
+        zap__rate_row_t rows[ZAP_MAX_RATES];
+        size_t row_count = 0;
+        zap_stats_t stats;
+        for (size_t r = 0; r < (rate_count > 0 ? rate_count : 1); r++) {
+            zap_t z;
+            zap__init_with_config(&z, run_name, &g->config);
+            z.config.cache_mode = cold ? ZAP_CACHE_COLD : ZAP_CACHE_WARM;
+            z.config.rate = rate_count > 0 ? rates[r] : 0.0;
+            z.group = g;
+            z.param = input;
+            z.param_size = input_size;
+
+            // Run the benchmark and report results; jobs report when collected
+            memset(&stats, 0, sizeof(stats));
+            if (use_jobs) {
+                zap__jobs_submit(&z, fn, g->name, run_name,
+                                 cold && mode == ZAP_CACHE_BOTH && rate_count == 0);
+            } else if (zap_g_config.isolate) {
+                stats = zap__run_isolated(&z, fn, g->name, run_name);
+            } else {
+                fn(&z);
+                stats = zap__run_and_report(&z, g->name, run_name);
+            }
+            zap_cleanup(&z);
+
+            // Not a ZAP_ITER_LATENCY routine (or it failed): nothing to sweep
+            if (stats.target_rate <= 0) break;
+            zap__rate_row_t* row = &rows[row_count++];
+            row->target = stats.target_rate;
+            row->achieved = stats.achieved_rate;
+            row->p50 = stats.latency_p50;
+            row->p99 = stats.latency_p99;
+            row->p999 = stats.latency_p999;
+        }
+        if (row_count > 1) {
+            zap__print_rate_sweep(g->name, run_name, rows, row_count);
+        }
+
+        // Open-loop means are the schedule interval, not worth a ratio
+        if (rate_count > 0) continue;
+        if (pass == 0) first_mean = stats.mean;
+        if (!cold) {
+            warm_mean = stats.mean;
+        } else if (mode == ZAP_CACHE_BOTH) {
+            zap__print_cold_ratio(warm_mean, stats.mean);
+        }
+    }
+    return first_mean;
+}
+
+/* NUMA PLACEMENT */
+
+/*
+ * zap_group_numa() binds the calling thread to one node's CPUs with
+ * sched_setaffinity() and puts memory on a node with raw mbind() and
+ * set_mempolicy() calls, so there is no libnuma dependency. The input range
+ * is widened to whole pages, which may carry neighbouring data along.
+ * --isolate children and zap_bench_exec() commands inherit the placement.
+ */
+
+#define ZAP__MPOL_DEFAULT   0
+#define ZAP__MPOL_PREFERRED 1
+#define ZAP__MPOL_BIND      2
+#define ZAP__MPOL_MF_MOVE   (1 << 1)
+
+typedef struct {
+    unsigned long cpus[1024 / (8 * sizeof(unsigned long))];  // Affinity before binding
+    bool          cpus_saved;
+    bool          policy_set;
+    uintptr_t     range_lo;  // Input pages bound with mbind()
+    uintptr_t     range_hi;
+} zap__numa_saved_t;
+
+// Online NUMA node ids, ascending; 0 without Linux sysfs
+static size_t zap__numa_node_ids(int* ids, size_t max) {
+    size_t n = 0;
+#if defined(__linux__)
+    char list[256];
+    unsigned long mask;
+    if (!zap__read_line("/sys/devices/system/node/online", list, sizeof(list)) ||
+        !zap__list_mask(list, &mask, 1)) {
+        return 0;
+    }
+    for (size_t i = 0; i < 8 * sizeof(mask) && n < max; i++) {
+        if (mask & (1UL << i)) ids[n++] = (int)i;
+    }
+#else
+    (void)ids;
+    (void)max;
+#endif
+    return n;
+}
+
+// node if it is online, otherwise ZAP_NUMA_ANY with a warning
+static int zap__numa_check(int node, const int* ids, size_t n) {
+    if (node == ZAP_NUMA_ANY) return node;
+    for (size_t i = 0; i < n; i++) {
+        if (ids[i] == node) return node;
+    }
+    fprintf(stderr, "Warning: NUMA node %d is not online, ignoring it\n", node);
+    return ZAP_NUMA_ANY;
+}
+
+static void zap__numa_bind(int mem_node, int cpu_node, void* input, size_t input_size,
+                           zap__numa_saved_t* saved) {
+    memset(saved, 0, sizeof(*saved));
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_set_mempolicy)
+    if (cpu_node != ZAP_NUMA_ANY) {
+        char path[64], list[1024];
+        unsigned long mask[sizeof(saved->cpus) / sizeof(unsigned long)];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", cpu_node);
+        if (!zap__read_line(path, list, sizeof(list)) ||
+            !zap__list_mask(list, mask, sizeof(mask) / sizeof(mask[0]))) {
+            fprintf(stderr, "Warning: NUMA node %d has no CPUs, thread not bound\n", cpu_node);
+        } else if (syscall(SYS_sched_getaffinity, 0, sizeof(saved->cpus), saved->cpus) > 0) {
+            if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) == 0) {
+                saved->cpus_saved = true;
+            } else {
+                fprintf(stderr, "Warning: cannot bind to NUMA node %d CPUs: %s\n",
+                        cpu_node, strerror(errno));
+            }
+        }
+    }
+
+    if (mem_node != ZAP_NUMA_ANY && (size_t)mem_node < 8 * sizeof(unsigned long)) {
+        unsigned long nodes = 1UL << mem_node;
+        unsigned long maxnode = 8 * sizeof(nodes) + 1;  // The kernel reads maxnode - 1 bits
+
+        // Preferred, not bound, so an allocation in fn spills over instead of failing
+        if (syscall(SYS_set_mempolicy, ZAP__MPOL_PREFERRED, &nodes, maxnode) == 0) {
+            saved->policy_set = true;
+        }
+        if (input && input_size > 0) {
+            uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+            uintptr_t lo = (uintptr_t)input & ~(page - 1);
+            uintptr_t hi = ((uintptr_t)input + input_size + page - 1) & ~(page - 1);
+            if (syscall(SYS_mbind, lo, hi - lo, ZAP__MPOL_BIND, &nodes, maxnode,
+                        ZAP__MPOL_MF_MOVE) == 0) {
+                saved->range_lo = lo;
+                saved->range_hi = hi;
+            } else {
+                fprintf(stderr, "Warning: cannot move input to NUMA node %d: %s\n",
+                        mem_node, strerror(errno));
+            }
+        }
+    }
+#else
+    (void)mem_node;
+    (void)cpu_node;
+    (void)input;
+    (void)input_size;
+#endif
+}
+
+// Undo zap__numa_bind(); pages already moved stay where they are
+static void zap__numa_restore(const zap__numa_saved_t* saved) {
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_set_mempolicy)
+    if (saved->range_hi > saved->range_lo) {
+        syscall(SYS_mbind, saved->range_lo, saved->range_hi - saved->range_lo,
+                ZAP__MPOL_DEFAULT, NULL, 0, 0);
+    }
+    if (saved->policy_set) syscall(SYS_set_mempolicy, ZAP__MPOL_DEFAULT, NULL, 0);
+    if (saved->cpus_saved) {
+        syscall(SYS_sched_setaffinity, 0, sizeof(saved->cpus), saved->cpus);
+    }
+#else
+    (void)saved;
+#endif
+}
+
+/*
+ * mean is n x n, row = CPU node, column = memory node. Each remote cell's
+ * penalty is against the local cell of its row, so it reads as "what this
+ * thread pays when its data lives elsewhere".
+ */
+static void zap__print_numa_matrix(const char* group_name, const char* name,
+                                   const int* nodes, size_t n, const double* mean) {
+    double penalty_sum = 0.0, worst = 0.0;
+    size_t remote = 0;
+    for (size_t c = 0; c < n; c++) {
+        double local = mean[c * n + c];
+        for (size_t m = 0; m < n; m++) {
+            if (m == c || local <= 0 || mean[c * n + m] <= 0) continue;
+            double pct = (mean[c * n + m] / local - 1.0) * 100.0;
+            penalty_sum += pct;
+            if (remote == 0 || pct > worst) worst = pct;
+            remote++;
+        }
+    }
+
+    if (zap_g_config.json_output) {
+        printf("{\"type\":\"numa_matrix\",\"group\":\"%s\",\"name\":\"%s\",\"nodes\":[",
+               group_name ? group_name : "", name);
+        for (size_t i = 0; i < n; i++) printf("%s%d", i > 0 ? "," : "", nodes[i]);
+        printf("],\"mean_ns\":[");
+        for (size_t c = 0; c < n; c++) {
+            printf("%s[", c > 0 ? "," : "");
+            for (size_t m = 0; m < n; m++) {
+                if (m > 0) printf(",");
+                if (mean[c * n + m] > 0) {
+                    printf("%.6f", mean[c * n + m]);
+                } else {
+                    printf("null");
+                }
+            }
+            printf("]");
+        }
+        if (remote > 0) {
+            printf("],\"remote_penalty_pct\":%.2f,\"worst_penalty_pct\":%.2f}\n",
+                   penalty_sum / (double)remote, worst);
+        } else {
+            printf("],\"remote_penalty_pct\":null,\"worst_penalty_pct\":null}\n");
+        }
+        fflush(stdout);
+        return;
+    }
+
+    printf("%s%s%s NUMA placement:%s %s(rows: CPU node, columns: memory node)%s\n",
+           zap__c_bold(), zap__c_magenta(), name, zap__c_reset(), zap__c_dim(), zap__c_reset());
+    printf("  %s%6s", zap__c_dim(), "");
+    for (size_t m = 0; m < n; m++) {
+        char label[16];
+        snprintf(label, sizeof(label), "mem%d", nodes[m]);
+        printf("  %17s", label);
+    }
+    printf("%s\n", zap__c_reset());
+    for (size_t c = 0; c < n; c++) {
+        char label[16];
+        snprintf(label, sizeof(label), "cpu%d", nodes[c]);
+        printf("  %s%6s%s", zap__c_dim(), label, zap__c_reset());
+        double local = mean[c * n + c];
+        for (size_t m = 0; m < n; m++) {
+            double v = mean[c * n + m];
+            char time_buf[32], pct_buf[16] = "";
+            if (v > 0) {
+                zap__format_time(v, time_buf, sizeof(time_buf));
+            } else {
+                snprintf(time_buf, sizeof(time_buf), "-");
+            }
+            if (m != c && v > 0 && local > 0) {
+                snprintf(pct_buf, sizeof(pct_buf), "%+.0f%%", (v / local - 1.0) * 100.0);
+            }
+            printf("  %10s %s%6s%s", time_buf,
+                   pct_buf[0] && v > local * 1.1 ? zap__c_red() : "", pct_buf,
+                   pct_buf[0] && v > local * 1.1 ? zap__c_reset() : "");
+        }
+        printf("\n");
+    }
+    if (remote > 0) {
+        printf("  %sRemote penalty:%s %s%+.1f%%%s mean, %+.1f%% worst\n\n", zap__c_dim(),
+               zap__c_reset(), zap__c_bold(), penalty_sum / (double)remote, zap__c_reset(), worst);
     } else {
-        uint64_t elapsed = now - c->start_time;
-        if (elapsed >= c->config.measurement_time_ns &&
-            c->sample_count >= 10) {
-            return false;  // Time's up and we have enough samples
+        printf("\n");
+    }
+}
+
+// zap__run_cache_modes() under the group's NUMA placement or sweep
+static void zap__run_placed(zap_runtime_group_t* g, const char* name, zap_bench_fn fn,
+                            void* input, size_t input_size) {
+    if (!zap__numa_requested(g)) {
+        zap__run_cache_modes(g, name, fn, input, input_size);
+        return;
+    }
+
+    int nodes[ZAP_MAX_NUMA_NODES];
+    size_t n = zap__numa_node_ids(nodes, ZAP_MAX_NUMA_NODES);
+    if (n == 0) {
+        static bool warned = false;
+        if (!warned) {
+            fprintf(stderr, "Warning: NUMA placement needs Linux, running unplaced\n");
+            warned = true;
         }
+        zap__run_cache_modes(g, name, fn, input, input_size);
+        return;
     }
 
-    c->measuring = true;
-    c->current_iter = zap_now_ns();
+    zap__numa_saved_t saved;
+    // A profile is one run, so a sweep runs it once with the fixed placement
+    if (!g->numa_sweep || n < 2 || zap_g_config.profile) {
+        static bool noted = false;
+        if (g->numa_sweep && n < 2 && !noted) {
+            fprintf(stderr, "Warning: NUMA sweep needs 2+ online nodes, found 1\n");
+            noted = true;
+        }
+        zap__numa_bind(zap__numa_check(g->numa_mem, nodes, n),
+                       zap__numa_check(g->numa_cpu, nodes, n), input, input_size, &saved);
+        zap__run_cache_modes(g, name, fn, input, input_size);
+        zap__numa_restore(&saved);
+        return;
+    }
+
+    double mean[ZAP_MAX_NUMA_NODES * ZAP_MAX_NUMA_NODES];
+    for (size_t c = 0; c < n; c++) {
+        for (size_t m = 0; m < n; m++) {
+            char cell_name[288];
+            snprintf(cell_name, sizeof(cell_name), "%s @cpu%d/mem%d", name, nodes[c], nodes[m]);
+            zap__numa_bind(nodes[m], nodes[c], input, input_size, &saved);
+            mean[c * n + m] = zap__run_cache_modes(g, cell_name, fn, input, input_size);
+            zap__numa_restore(&saved);
+        }
+    }
+    zap__print_numa_matrix(g->name, name, nodes, n, mean);
+}
+
+// Whether this --shard owns group/name (always true when not sharded)
+static bool zap__in_shard(const char* group_name, const char* name) {
+    if (zap_g_config.shard_count == 0) return true;
+    char key[384];
+    snprintf(key, sizeof(key), "%s/%s", group_name, name);
+    return zap_shard_of(key, zap_g_config.shard_count) == zap_g_config.shard_index;
+}
+
+// Filters, dry run, deferred header and group setup. False if name is skipped.
+static bool zap__bench_begin(zap_runtime_group_t* g, const char* name) {
+    // Check filter before running
+    if (!zap_matches_filter(name, zap_g_config.filter) || !zap__in_shard(g->name, name)) {
+        return false;
+    }
+
+    // Check tag filter
+    if (!zap_group_matches_tags(g)) {
+        return false;
+    }
+
+    // Dry run mode: just print the benchmark name
+    if (zap_g_config.dry_run) {
+        zap__print_dry_run(g->name, name);
+        return false;
+    }
+
+    // Print deferred group header on first matching benchmark
+    if (!g->header_printed) {
+        zap_report_group_start(g->name);
+        g->header_printed = true;
+    }
+
+    // Call setup on first matching benchmark
+    if (g->setup && !zap__setup_called) {
+        g->setup();
+        zap__setup_called = true;
+    }
     return true;
 }
 
-void zap_loop_end(zap_t* c) {
-    if (!c->measuring || !c->warmup_complete) return;
+void zap_bench_function(zap_runtime_group_t* g, const char* name,
+                        zap_bench_fn fn) {
+    if (!zap__bench_begin(g, name)) return;
+    zap__run_placed(g, name, fn, NULL, 0);
+}
+
+void zap_bench_with_input(zap_runtime_group_t* g,
+                          zap_benchmark_id_t id,
+                          void* input, size_t input_size,
+                          zap_bench_fn fn) {
+    // Build full name: "label/param"
+    char full_name[256];
+    snprintf(full_name, sizeof(full_name), "%s/%s", id.label, id.param_str);
 
-    uint64_t end = zap_now_ns();
-    uint64_t elapsed = end - c->current_iter;
+    if (!zap__bench_begin(g, full_name)) return;
+    zap__run_placed(g, full_name, fn, input, input_size);
+}
 
-    // Store sample (time per iteration in nanoseconds)
-    double time_per_iter = (double)elapsed / (double)c->iterations;
+/* CACHE SWEEPS */
 
-    if (c->sample_count < c->sample_capacity) {
-        c->samples[c->sample_count++] = time_per_iter;
+size_t zap_cache_sweep_sizes(size_t* sizes, size_t max) {
+    size_t caches[3];
+    zap__cache_sizes(caches);
+    if (caches[0] == 0 && caches[1] == 0 && caches[2] == 0) {
+        caches[0] = (size_t)32 << 10;
+        caches[1] = (size_t)1 << 20;
+        caches[2] = (size_t)32 << 20;
     }
 
-    // Fine-tune iterations if samples are too short/long
-    if (elapsed < 500000) {  // Less than 0.5ms
-        c->iterations = c->iterations * 2;
-        if (c->iterations > 1000000000ULL) {
-            c->iterations = 1000000000ULL;
+    size_t points[ZAP_CACHE_SWEEP_MAX];
+    size_t n = 0;
+    size_t llc = 0;
+    for (int level = 0; level < 3; level++) {
+        if (caches[level] == 0) continue;
+        points[n++] = caches[level] / 2;
+        points[n++] = caches[level] * 2;
+        llc = caches[level];
+    }
+    // Same DRAM working set as the --roofline calibration
+    size_t dram = 4 * llc;
+    if (dram < ((size_t)64 << 20)) dram = (size_t)64 << 20;
+    if (dram > ((size_t)512 << 20)) dram = (size_t)512 << 20;
+    if (dram > 2 * llc) points[n++] = dram;  // Else twice the LLC already is
+
+    // Ascending, without sizes that do not grow (tiny or overlapping levels)
+    for (size_t i = 1; i < n; i++) {
+        size_t v = points[i];
+        size_t j = i;
+        while (j > 0 && points[j - 1] > v) {
+            points[j] = points[j - 1];
+            j--;
         }
+        points[j] = v;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < n && count < max; i++) {
+        if (count > 0 && points[i] <= sizes[count - 1]) continue;
+        sizes[count++] = points[i];
     }
+    return count;
+}
 
-    c->measuring = false;
+void zap_bench_cache_sweep(zap_runtime_group_t* g, const char* label, zap_bench_fn fn) {
+    size_t sizes[ZAP_CACHE_SWEEP_MAX];
+    size_t n = zap_cache_sweep_sizes(sizes, ZAP_CACHE_SWEEP_MAX);
+    for (size_t i = 0; i < n; i++) {
+        // Whole units keep names short and stable: "16KB", "2MB"
+        char param[32];
+        size_t v = sizes[i];
+        if (v % ((size_t)1 << 30) == 0) {
+            snprintf(param, sizeof(param), "%zuGB", v >> 30);
+        } else if (v % ((size_t)1 << 20) == 0) {
+            snprintf(param, sizeof(param), "%zuMB", v >> 20);
+        } else if (v % 1024 == 0) {
+            snprintf(param, sizeof(param), "%zuKB", v >> 10);
+        } else {
+            snprintf(param, sizeof(param), "%zuB", v);
+        }
+        // No input size: cold mode then evicts whole caches, not the size_t
+        zap_bench_with_input(g, zap_benchmark_id_str(label, param), &sizes[i], 0, fn);
+    }
 }
 
-/* REPORTING IMPLEMENTATION */
+/* PROCESS BENCHMARKS */
 
-// Greek mu (μ) for microseconds: UTF-8 = \316\274
-static void zap__format_time(double ns, char* buf, size_t bufsize) {
-    if (ns >= 1e9) {
-        snprintf(buf, bufsize, "%.3f s", ns / 1e9);
-    } else if (ns >= 1e6) {
-        snprintf(buf, bufsize, "%.3f ms", ns / 1e6);
-    } else if (ns >= 1e3) {
-        snprintf(buf, bufsize, "%.3f \316\274s", ns / 1e3);
-    } else {
-        snprintf(buf, bufsize, "%.3f ns", ns);
+extern char** environ;
+
+typedef struct {
+    char* const* argv;
+    const char*  ready;        // Marker to wait for on stdout, NULL = none
+    bool         drop_caches;
+} zap__exec_t;
+
+// Linux: write back dirty pages, then drop the page cache, dentries and inodes
+static bool zap__drop_page_cache(void) {
+#if defined(__linux__)
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd < 0) return false;
+    bool ok = write(fd, "3", 1) == 1;
+    close(fd);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+static bool zap__contains(const char* hay, size_t len, const char* needle, size_t nlen) {
+    for (size_t i = 0; i + nlen <= len; i++) {
+        if (memcmp(hay + i, needle, nlen) == 0) return true;
     }
+    return false;
 }
 
-static void zap__format_time_short(double ns, char* buf, size_t bufsize) {
-    if (ns >= 1e9) {
-        snprintf(buf, bufsize, "%.2f s", ns / 1e9);
-    } else if (ns >= 1e6) {
-        snprintf(buf, bufsize, "%.2f ms", ns / 1e6);
-    } else if (ns >= 1e3) {
-        snprintf(buf, bufsize, "%.2f \316\274s", ns / 1e3);
+/*
+ * One run: spawn, optionally watch stdout for the marker, drain it and reap
+ * the child with its rusage. Everything up to the reap is timed. False with
+ * z->error set if the command could not run or failed.
+ */
+static bool zap__exec_once(zap_t* z, const zap__exec_t* e) {
+    int fds[2] = {-1, -1};
+    if (e->ready && pipe(fds) != 0) {
+        snprintf(z->error, sizeof(z->error), "cannot create pipe: %s", strerror(errno));
+        return false;
+    }
+
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    if (e->ready) {
+        posix_spawn_file_actions_adddup2(&fa, fds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&fa, fds[0]);
+        posix_spawn_file_actions_addclose(&fa, fds[1]);
     } else {
-        snprintf(buf, bufsize, "%.2f ns", ns);
+        posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+    posix_spawn_file_actions_addopen(&fa, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    uint64_t start = zap_now_ns();
+    pid_t pid;
+    int err = posix_spawnp(&pid, e->argv[0], &fa, NULL, e->argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    if (fds[1] >= 0) close(fds[1]);
+    if (err != 0) {
+        if (fds[0] >= 0) close(fds[0]);
+        snprintf(z->error, sizeof(z->error), "cannot run '%s': %s", e->argv[0], strerror(err));
+        return false;
     }
-}
 
-// Format throughput: bytes/sec or elements/sec
-static void zap__format_throughput(double mean_ns, size_t value,
-                                   zap_throughput_type_t type,
-                                   char* buf, size_t bufsize) {
-    if (type == ZAP_THROUGHPUT_NONE || value == 0 || mean_ns <= 0) {
-        buf[0] = '\0';
-        return;
+    // Search chunk by chunk, keeping a marker-sized tail so a split match counts
+    double ready_ns = -1.0;
+    if (e->ready) {
+        size_t mlen = strlen(e->ready);
+        char buf[4096 + sizeof(((zap_runtime_group_t*)0)->exec_ready)];
+        size_t keep = 0;
+        for (;;) {
+            ssize_t n = read(fds[0], buf + keep, 4096);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            if (ready_ns >= 0) continue;  // Already seen, just drain
+            size_t len = keep + (size_t)n;
+            if (zap__contains(buf, len, e->ready, mlen)) {
+                ready_ns = (double)(zap_now_ns() - start);
+                continue;
+            }
+            keep = mlen > 1 && len >= mlen - 1 ? mlen - 1 : len;
+            memmove(buf, buf + len - keep, keep);
+        }
+        close(fds[0]);
     }
 
-    /* Calculate per-second rate: value / (mean_ns / 1e9) = value * 1e9 / mean_ns */
-    double per_sec = (double)value * 1e9 / mean_ns;
+    int status = 0;
+    struct rusage ru;
+    while (wait4(pid, &status, 0, &ru) < 0) {
+        if (errno != EINTR) {
+            snprintf(z->error, sizeof(z->error), "cannot wait for '%s': %s",
+                     e->argv[0], strerror(errno));
+            return false;
+        }
+    }
 
-    if (type == ZAP_THROUGHPUT_BYTES) {
-        // Format as human-readable bytes/sec
-        if (per_sec >= 1e12) {
-            snprintf(buf, bufsize, "%.2f TB/s", per_sec / 1e12);
-        } else if (per_sec >= 1e9) {
-            snprintf(buf, bufsize, "%.2f GB/s", per_sec / 1e9);
-        } else if (per_sec >= 1e6) {
-            snprintf(buf, bufsize, "%.2f MB/s", per_sec / 1e6);
-        } else if (per_sec >= 1e3) {
-            snprintf(buf, bufsize, "%.2f KB/s", per_sec / 1e3);
-        } else {
-            snprintf(buf, bufsize, "%.2f B/s", per_sec);
+    if (WIFSIGNALED(status)) {
+        snprintf(z->error, sizeof(z->error), "'%s' killed by signal %d (%s)",
+                 e->argv[0], WTERMSIG(status), strsignal(WTERMSIG(status)));
+        return false;
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        snprintf(z->error, sizeof(z->error), "'%s' exited with status %d",
+                 e->argv[0], WEXITSTATUS(status));
+        return false;
+    }
+    if (e->ready && ready_ns < 0) {
+        snprintf(z->error, sizeof(z->error), "'%s' exited without printing '%s'",
+                 e->argv[0], e->ready);
+        return false;
+    }
+
+    if (z->warmup_complete) {
+        uint64_t rss = (uint64_t)ru.ru_maxrss;
+#if defined(__APPLE__)
+        uint64_t floor = 0;
+#else
+        rss *= 1024;  // Kilobytes on Linux
+        // Linux folds the pre-exec address space, ours with vfork-style
+        // spawning, into the child's peak; only a peak above ours is its own
+        uint64_t faults, floor;
+        zap__rusage(&faults, &floor);
+#endif
+        z->exec_runs++;
+        z->exec_faults += (uint64_t)ru.ru_minflt + (uint64_t)ru.ru_majflt;
+        if (rss > floor && rss > z->exec_max_rss) z->exec_max_rss = rss;
+        if (ready_ns > 0) z->exec_ready_ns += ready_ns;
+    }
+    return true;
+}
+
+/*
+ * Benchmark body for zap_bench_exec(), driven by the normal loop so warmup,
+ * sample counts, precision targets and time limits all apply. Measured
+ * samples are single runs; page cache drops happen before the batch timer.
+ */
+static void zap__exec_bench(zap_t* z) {
+    zap__exec_t* e = (zap__exec_t*)z->param;
+    for (;;) {
+        if (e->drop_caches && z->warmup_complete) {
+            uint64_t t0 = zap__timer_begin();
+            if (!zap__drop_page_cache()) {
+                fprintf(stderr, "Warning: cannot drop the page cache (needs root on Linux), "
+                                "runs keep a warm page cache\n");
+                e->drop_caches = false;
+            }
+            if (z->start_time != 0) z->start_time += zap__timer_begin() - t0;
         }
-    } else {
-        // Format as elements/sec (ops/sec)
-        if (per_sec >= 1e9) {
-            snprintf(buf, bufsize, "%.2f Gops/s", per_sec / 1e9);
-        } else if (per_sec >= 1e6) {
-            snprintf(buf, bufsize, "%.2f Mops/s", per_sec / 1e6);
-        } else if (per_sec >= 1e3) {
-            snprintf(buf, bufsize, "%.2f Kops/s", per_sec / 1e3);
-        } else {
-            snprintf(buf, bufsize, "%.2f ops/s", per_sec);
+        if (!zap_loop_start(z)) break;
+        if (z->warmup_complete) z->iterations = 1;
+
+        bool ok = true;
+        for (uint64_t i = 0; ok && i < z->iterations; i++) ok = zap__exec_once(z, e);
+        if (!ok) {
+            z->measuring = false;
+            if (!z->worker) zap__alloc_sample_cancel();
+            zap_status_clear();
+            return;
         }
+        zap_loop_end(z);
     }
+    z->iterations = 1;  // zap_loop_end() may have scaled it for a next batch
 }
 
-// Unicode block characters for histogram (increasing height)
-// ▁▂▃▄▅▆▇█
-static const char* zap__blocks[] = {
-    " ", "\342\226\201", "\342\226\202", "\342\226\203",
-    "\342\226\204", "\342\226\205", "\342\226\206", "\342\226\207",
-    "\342\226\210"
-};
+void zap_bench_exec(zap_runtime_group_t* g, const char* name, char* const argv[]) {
+    if (!zap__bench_begin(g, name)) return;
 
-static void zap__print_histogram(const double* samples, size_t n,
-                                       double min_val, double max_val) {
-    if (n == 0 || max_val <= min_val) return;
+    zap__exec_t e;
+    e.argv = argv;
+    e.ready = g->exec_ready[0] ? g->exec_ready : NULL;
+    e.drop_caches = g->exec_drop_caches;
+    zap__run_placed(g, name, zap__exec_bench, &e, 0);
+}
 
-    // Format time labels first to determine histogram width (Julia style)
-    char min_buf[32], max_buf[32];
-    zap__format_time_short(min_val, min_buf, sizeof(min_buf));
-    zap__format_time_short(max_val, max_buf, sizeof(max_buf));
+/* THREADED BENCHMARKS */
 
-    int min_len = (int)strlen(min_buf);
-    int max_len = (int)strlen(max_buf);
+// Reusable barrier; pthread_barrier_t is missing on macOS
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    int             count;
+    int             waiting;
+    unsigned        generation;
+} zap__barrier_t;
+
+static void zap__barrier_wait(zap__barrier_t* b) {
+    pthread_mutex_lock(&b->mutex);
+    unsigned gen = b->generation;
+    if (++b->waiting == b->count) {
+        b->waiting = 0;
+        b->generation++;
+        pthread_cond_broadcast(&b->cond);
+    } else {
+        while (gen == b->generation) {
+            pthread_cond_wait(&b->cond, &b->mutex);
+        }
+    }
+    pthread_mutex_unlock(&b->mutex);
+}
 
-    // Julia: histwidth = 42 + lmaxtimewidth + rmaxtimewidth, bins = histwidth - 1
-    #define HIST_MAX_BINS 80
-    #define HIST_HEIGHT 2
-    int hist_width = 42 + min_len + max_len;
-    int num_bins = hist_width - 1;
-    if (num_bins > HIST_MAX_BINS) num_bins = HIST_MAX_BINS;
-    if (num_bins < 10) num_bins = 10;
+// Change the party size, e.g. when a thread fails to start; releases the
+// threads already waiting if they now make up the whole party
+static void zap__barrier_resize(zap__barrier_t* b, int count) {
+    pthread_mutex_lock(&b->mutex);
+    b->count = count;
+    if (b->waiting > 0 && b->waiting >= count) {
+        b->waiting = 0;
+        b->generation++;
+        pthread_cond_broadcast(&b->cond);
+    }
+    pthread_mutex_unlock(&b->mutex);
+}
+
+// Pin the calling thread to one CPU. Linux only; elsewhere a no-op.
+static bool zap__pin_thread(int cpu) {
+#if defined(__linux__)
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    size_t bits = 8 * sizeof(unsigned long);
+    if (cpu < 0 || (size_t)cpu >= sizeof(mask) * 8) return false;
+    mask[(size_t)cpu / bits] |= 1UL << ((size_t)cpu % bits);
+    return syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
 
-    int bins[HIST_MAX_BINS] = {0};
+typedef struct {
+    zap_t             z;
+    zap_bench_fn      fn;
+    zap__barrier_t*   barrier;
+    int               cpu;      // -1 = not pinned
+    bool              pinned;
+    uint64_t          end_tick; // When fn returned, after its last batch
+} zap__worker_t;
+
+static void* zap__worker_main(void* arg) {
+    zap__worker_t* w = (zap__worker_t*)arg;
+    if (w->cpu >= 0) w->pinned = zap__pin_thread(w->cpu);
+    zap__barrier_wait(w->barrier);
+    w->fn(&w->z);
+    w->end_tick = zap__timer_end();
+    return NULL;
+}
 
-    double range = max_val - min_val;
-    if (range <= 0) return;
+typedef struct {
+    int    threads;
+    double latency_ns;   // Mean time per iteration on one thread
+    double iters_per_s;  // Measured iterations of all threads over the wall-clock window
+} zap__scaling_row_t;
+
+// Run fn on n threads and merge their samples into out (caller cleans up)
+static bool zap__run_threads(zap_runtime_group_t* g, const char* full_name, zap_bench_fn fn,
+                             int n, zap_t* out, zap__scaling_row_t* row) {
+    memset(out, 0, sizeof(*out));
+    zap__worker_t* workers = (zap__worker_t*)calloc((size_t)n, sizeof(zap__worker_t));
+    pthread_t* threads = (pthread_t*)calloc((size_t)n, sizeof(pthread_t));
+    if (!workers || !threads) {
+        free(workers);
+        free(threads);
+        return false;
+    }
 
-    // Simple binning - count samples in each bin (Julia style)
-    double bin_width = range / num_bins;
-    for (size_t i = 0; i < n; i++) {
-        int bin = (int)((samples[i] - min_val) / bin_width);
-        if (bin >= num_bins) bin = num_bins - 1;
-        if (bin < 0) bin = 0;
-        bins[bin]++;
+    zap__barrier_t barrier;
+    pthread_mutex_init(&barrier.mutex, NULL);
+    pthread_cond_init(&barrier.cond, NULL);
+    barrier.count = n;
+    barrier.waiting = 0;
+    barrier.generation = 0;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+
+    // Calibrate once here; workers only read the timer state
+    zap__timer_ensure_init();
+    zap_status_measuring(full_name);
+
+    int started = 0;
+    for (int i = 0; i < n; i++) {
+        zap__worker_t* w = &workers[i];
+        zap__init_with_config(&w->z, full_name, &g->config);
+        w->z.group = g;
+        w->z.thread_index = i;
+        w->z.thread_count = n;
+        w->z.worker = true;
+        w->fn = fn;
+        w->barrier = &barrier;
+        w->cpu = g->pin_threads ? (int)(i % cpus) : -1;
+        if (pthread_create(&threads[i], NULL, zap__worker_main, w) != 0) {
+            // Release the threads already waiting on the barrier
+            fprintf(stderr, "Error: cannot create thread %d for %s\n", i, full_name);
+            zap__barrier_resize(&barrier, started);
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
     }
 
-    // Find max bin count
-    int max_count = 0;
-    for (int i = 0; i < num_bins; i++) {
-        if (bins[i] > max_count) max_count = bins[i];
+    bool ok = started == n;
+    if (ok && g->pin_threads && !workers[0].pinned && !zap_g_config.json_output) {
+        fprintf(stderr, "Warning: could not pin threads to CPUs\n");
     }
 
-    if (max_count == 0) return;
+    // Merge per-thread samples; rates add up across threads
+    size_t total = 0;
+    for (int i = 0; i < started; i++) total += workers[i].z.sample_count;
+
+    zap__init_with_config(out, full_name, &g->config);
+    free(out->samples);
+    out->samples = (double*)malloc((total > 0 ? total : 1) * sizeof(double));
+    out->sample_capacity = total;
+    out->config.sample_count = (size_t)n * g->config.sample_count;
+    out->group = g;
+    out->thread_count = n;
+    if (g->config.sampling_mode == ZAP_SAMPLING_LINEAR) {
+        out->sample_iters = (double*)malloc((total > 0 ? total : 1) * sizeof(double));
+    }
 
-    /*
-     * Julia-style multi-row histogram:
-     * Compute bar heights in range [1, HIST_HEIGHT * 8]
-     * Zero bins get height 0 (space)
-     * Non-zero bins get at least height 1
-     */
-    int barheights[HIST_MAX_BINS];
-    int total_levels = HIST_HEIGHT * 8;
+    row->threads = n;
+    row->latency_ns = 0.0;
+    row->iters_per_s = 0.0;
+
+    // Threads only share the start barrier and measure unaligned windows, so
+    // throughput is all measured iterations over first measured start to last end
+    uint64_t first_start = UINT64_MAX, last_end = 0, all_iters = 0;
+    for (int i = 0; i < started; i++) {
+        zap__worker_t* w = &workers[i];
+        if (w->z.start_time == 0 || w->z.measured_iters == 0) continue;
+        if (w->z.start_time < first_start) first_start = w->z.start_time;
+        if (w->end_tick > last_end) last_end = w->end_tick;
+        all_iters += w->z.measured_iters;
+    }
+    if (all_iters > 0 && last_end > first_start) {
+        row->iters_per_s = (double)all_iters * 1e9 / zap__ticks_to_ns(last_end - first_start);
+    }
 
-    for (int i = 0; i < num_bins; i++) {
-        if (bins[i] == 0) {
-            barheights[i] = 0;
-        } else {
-            // Scale to [1, total_levels]
-            barheights[i] = 1 + (int)((double)(bins[i] - 1) / (max_count - 1) * (total_levels - 1) + 0.5);
-            if (barheights[i] > total_levels) barheights[i] = total_levels;
-            if (max_count == 1) barheights[i] = total_levels; /* Single max gets full height */
+    for (int i = 0; i < started && out->samples; i++) {
+        zap_t* z = &workers[i].z;
+        memcpy(out->samples + out->sample_count, z->samples, z->sample_count * sizeof(double));
+        if (out->sample_iters && z->sample_iters) {
+            // Per-thread (iterations, time) pairs share one linear fit
+            memcpy(out->sample_iters + out->sample_count, z->sample_iters,
+                   z->sample_count * sizeof(double));
+        }
+        out->sample_count += z->sample_count;
+        if (out->stop_reason != ZAP_STOP_TIME && z->stop_reason != ZAP_STOP_SAMPLES) {
+            out->stop_reason = z->stop_reason;  // A time-capped thread wins
+        }
+        if (i == 0) {
+            out->iterations = z->iterations;
+            out->throughput_type = z->throughput_type;
+            out->throughput_value = z->throughput_value;
+            out->measured_iters = z->measured_iters;
+            out->iter_step = z->iter_step;
+            // Custom counters follow measured_iters: thread 0's, per its iterations
+            memcpy(out->counter_names, z->counter_names, sizeof(z->counter_names));
+            memcpy(out->counter_totals, z->counter_totals, sizeof(z->counter_totals));
+            memcpy(out->counter_rate, z->counter_rate, sizeof(z->counter_rate));
+            memcpy(out->counter_direction, z->counter_direction, sizeof(z->counter_direction));
+            out->counter_count = z->counter_count;
+        }
+        if (z->latency.counts) {
+            // One histogram across threads: per-op latencies simply add up
+            zap_latency_hist_t* h = &out->latency;
+            if (!h->counts) {
+                h->counts = (uint64_t*)calloc(ZAP_LATENCY_BUCKETS, sizeof(uint64_t));
+                if (!h->counts) continue;
+                h->min_ticks = UINT64_MAX;
+                h->ns_per_tick = z->latency.ns_per_tick;
+                h->use_tsc = z->latency.use_tsc;
+            }
+            for (size_t b = 0; b < ZAP_LATENCY_BUCKETS; b++) h->counts[b] += z->latency.counts[b];
+            h->total += z->latency.total;
+            if (z->latency.min_ticks < h->min_ticks) h->min_ticks = z->latency.min_ticks;
+            if (z->latency.max_ticks > h->max_ticks) h->max_ticks = z->latency.max_ticks;
         }
     }
+    row->latency_ns = zap_mean(out->samples, out->sample_count);
+
+    for (int i = 0; i < n; i++) zap_cleanup(&workers[i].z);
+    pthread_mutex_destroy(&barrier.mutex);
+    pthread_cond_destroy(&barrier.cond);
+    free(workers);
+    free(threads);
+    return ok && out->sample_count > 0;
+}
 
-    // Render rows from top to bottom
-    for (int row = HIST_HEIGHT; row >= 1; row--) {
-        printf("  ");
-        int row_base = (row - 1) * 8;  // Heights 0-7 for row 1, 8-15 for row 2, etc
+static void zap__print_scaling(const char* group_name, const char* name,
+                               const zap__scaling_row_t* rows, size_t n,
+                               zap_throughput_type_t type, size_t value) {
+    if (n == 0) return;
 
-        for (int i = 0; i < num_bins; i++) {
-            int height_in_row = barheights[i] - row_base;
-            if (height_in_row <= 0) {
-                printf(" ");
-            } else if (height_in_row >= 8) {
-                printf("%s", zap__blocks[8]);  // Full block
-            } else {
-                printf("%s", zap__blocks[height_in_row]);
-            }
+    // Efficiency is relative to the 1-thread run, or the smallest count measured
+    const zap__scaling_row_t* ref = &rows[0];
+    for (size_t i = 0; i < n; i++) {
+        if (rows[i].threads < ref->threads) ref = &rows[i];
+    }
+    if (type == ZAP_THROUGHPUT_NONE || value == 0) {
+        type = ZAP_THROUGHPUT_ELEMENTS;  // Report iterations as ops/s
+        value = 1;
+    }
+
+    if (zap_g_config.json_output) {
+        printf("{\"type\":\"scaling\",\"group\":\"%s\",\"name\":\"%s\",\"results\":[",
+               group_name ? group_name : "", name);
+        for (size_t i = 0; i < n; i++) {
+            const zap__scaling_row_t* r = &rows[i];
+            double speedup = ref->iters_per_s > 0 ? r->iters_per_s / ref->iters_per_s : 0.0;
+            printf("%s{\"threads\":%d,\"mean_ns\":%.6f,\"per_second\":%.2f"
+                   ",\"speedup\":%.4f,\"efficiency\":%.4f}",
+                   i > 0 ? "," : "", r->threads, r->latency_ns,
+                   r->iters_per_s * (double)value, speedup,
+                   speedup * ref->threads / r->threads);
         }
-        printf("\n");
+        printf("]}\n");
+        fflush(stdout);
+        return;
     }
 
-    #undef HIST_HEIGHT
-    #undef HIST_MAX_BINS
+    printf("%s%s%s scaling:%s\n", zap__c_bold(), zap__c_magenta(), name, zap__c_reset());
+    printf("  %s%7s  %12s  %14s  %8s  %10s%s\n", zap__c_dim(),
+           "threads", "latency/op", "aggregate", "speedup", "efficiency", zap__c_reset());
+    for (size_t i = 0; i < n; i++) {
+        const zap__scaling_row_t* r = &rows[i];
+        char lat_buf[32], tput_buf[32];
+        zap__format_time(r->latency_ns, lat_buf, sizeof(lat_buf));
+        zap__format_throughput(r->iters_per_s > 0 ? 1e9 / r->iters_per_s : 0.0,
+                               value, type, tput_buf, sizeof(tput_buf));
+        double speedup = ref->iters_per_s > 0 ? r->iters_per_s / ref->iters_per_s : 0.0;
+        double efficiency = speedup * ref->threads / r->threads * 100.0;
+        const char* color = efficiency >= 90.0 ? zap__c_green()
+                          : efficiency >= 50.0 ? zap__c_yellow() : zap__c_red();
+        printf("  %7d  %12s  %s%14s%s  %7.2fx  %s%9.1f%%%s\n",
+               r->threads, lat_buf, zap__c_cyan(), tput_buf, zap__c_reset(),
+               speedup, color, efficiency, zap__c_reset());
+    }
+    printf("\n");
+}
 
-    // Center the label text
-    int label_len = 28;  // "Histogram: frequency by time"
-    int total_width = num_bins + 2;
-    int padding = (total_width - min_len - max_len - label_len) / 2;
-    if (padding < 1) padding = 1;
+void zap_bench_threaded(zap_runtime_group_t* g, const char* name, zap_bench_fn fn,
+                        const int* thread_counts, size_t count) {
+    // Check tag filter; one shard runs every thread count for the scaling table
+    if (!zap_group_matches_tags(g) || !zap__in_shard(g->name, name)) {
+        return;
+    }
 
-    printf("  %s", min_buf);
-    for (int i = 0; i < padding; i++) printf(" ");
-    printf("%sHistogram: frequency by time%s", zap__c_cyan(), zap__c_reset());
-    for (int i = 0; i < padding; i++) printf(" ");
-    printf("%s\n", max_buf);
+    // Workers use every core, so nothing else may be running
+    zap__jobs_drain();
 
-    #undef HIST_BINS
-}
+    zap__scaling_row_t* rows = (zap__scaling_row_t*)calloc(count > 0 ? count : 1, sizeof(*rows));
+    if (!rows) return;
+    size_t row_count = 0;
+    zap_throughput_type_t type = ZAP_THROUGHPUT_NONE;
+    size_t value = 0;
 
-void zap_report(const char* name, const zap_stats_t* stats) {
-    // Clear any status message before printing results
-    zap_status_clear();
+    for (size_t i = 0; i < count; i++) {
+        int n = thread_counts[i];
+        if (n < 1 || n > ZAP_MAX_THREADS) {
+            fprintf(stderr, "Warning: skipping %s with %d threads (1..%d)\n",
+                    name, n, ZAP_MAX_THREADS);
+            continue;
+        }
 
-    char median_buf[32], mean_buf[32], std_buf[32];
-    char min_buf[32], max_buf[32];
+        char full_name[256];
+        snprintf(full_name, sizeof(full_name), "%s/threads=%d", name, n);
 
-    zap__format_time(stats->median, median_buf, sizeof(median_buf));
-    zap__format_time(stats->mean, mean_buf, sizeof(mean_buf));
-    zap__format_time(stats->std_dev, std_buf, sizeof(std_buf));
-    zap__format_time(stats->min, min_buf, sizeof(min_buf));
-    zap__format_time(stats->max, max_buf, sizeof(max_buf));
+        // Check filter before running
+        if (!zap_matches_filter(full_name, zap_g_config.filter)) {
+            continue;
+        }
 
-    // Header - hot pink for benchmark name
-    printf("%s%s%s:%s\n", zap__c_bold(), zap__c_magenta(), name, zap__c_reset());
+        // Dry run mode: just print the benchmark name
+        if (zap_g_config.dry_run) {
+            zap__print_dry_run(g->name, full_name);
+            continue;
+        }
 
-    // Sample info line with median
-    printf("  %zu samples \303\227 %zu evals, median: %s%s%s\n",
-           stats->sample_count, stats->iterations,
-           zap__c_cyan(), median_buf, zap__c_reset());
+        // Several threads run the loop at once, so there is no single loop to profile
+        if (zap_g_config.profile) {
+            fprintf(stderr, "Warning: --profile skips threaded benchmark %s\n", full_name);
+            continue;
+        }
 
-    // Time (mean ± σ)
-    printf("  %sTime  (mean \302\261 \317\203):%s  %s%s%s \302\261 %s\n",
-           zap__c_dim(), zap__c_reset(),
-           zap__c_bold(), mean_buf, zap__c_reset(), std_buf);
+        // Print deferred group header on first matching benchmark
+        if (!g->header_printed) {
+            zap_report_group_start(g->name);
+            g->header_printed = true;
+        }
 
-    // Range (min … max) using ellipsis character
-    printf("  %sRange (min \342\200\246 max):%s  %s \342\200\246 %s\n",
-           zap__c_dim(), zap__c_reset(), min_buf, max_buf);
+        // Call setup on first matching benchmark
+        if (g->setup && !zap__setup_called) {
+            g->setup();
+            zap__setup_called = true;
+        }
 
-    // Percentiles (only with --percentiles flag)
-    if (zap_g_config.show_percentiles) {
-        char p75_buf[32], p90_buf[32], p95_buf[32], p99_buf[32];
-        zap__format_time(stats->p75, p75_buf, sizeof(p75_buf));
-        zap__format_time(stats->p90, p90_buf, sizeof(p90_buf));
-        zap__format_time(stats->p95, p95_buf, sizeof(p95_buf));
-        zap__format_time(stats->p99, p99_buf, sizeof(p99_buf));
-        printf("  %sPercentiles:%s       p75: %s, p90: %s, p95: %s, p99: %s\n",
-               zap__c_dim(), zap__c_reset(),
-               p75_buf, p90_buf, p95_buf, p99_buf);
+        zap_t merged;
+        if (zap__run_threads(g, full_name, fn, n, &merged, &rows[row_count])) {
+            zap__run_and_report(&merged, g->name, full_name);
+            type = merged.throughput_type;
+            value = merged.throughput_value;
+            row_count++;
+        }
+        zap_cleanup(&merged);
     }
 
-    // Throughput if set
-    if (stats->throughput_type != ZAP_THROUGHPUT_NONE && stats->throughput_value > 0) {
-        char tput_buf[32];
-        zap__format_throughput(stats->mean, stats->throughput_value,
-                               stats->throughput_type, tput_buf, sizeof(tput_buf));
-        printf("  %sThroughput:%s        %s%s%s\n",
-               zap__c_dim(), zap__c_reset(),
-               zap__c_cyan(), tput_buf, zap__c_reset());
+    if (row_count > 1) {
+        zap__print_scaling(g->name, name, rows, row_count, type, value);
     }
+    free(rows);
+}
 
-    // Outliers if any
-    size_t total_outliers = stats->outliers_low + stats->outliers_high;
-    if (total_outliers > 0) {
-        printf("  %sOutliers:%s %s%zu low, %zu high%s\n",
-               zap__c_dim(), zap__c_reset(),
-               zap__c_yellow(), stats->outliers_low, stats->outliers_high, zap__c_reset());
-    }
+/* THROUGHPUT CONFIGURATION */
 
-    // Histogram (only with --histogram flag)
-    if (zap_g_config.show_histogram && stats->samples && stats->sample_count > 1) {
-        printf("\n");
-        zap__print_histogram(stats->samples, stats->sample_count,
-                                   stats->min, stats->max);
+void zap_set_throughput_bytes(zap_t* z, size_t bytes_per_iter) {
+    z->throughput_type = ZAP_THROUGHPUT_BYTES;
+    z->throughput_value = bytes_per_iter;
+}
+
+void zap_set_throughput_elements(zap_t* z, size_t elements_per_iter) {
+    z->throughput_type = ZAP_THROUGHPUT_ELEMENTS;
+    z->throughput_value = elements_per_iter;
+}
+
+void zap_set_throughput_flops(zap_t* z, size_t flops_per_iter) {
+    z->throughput_type = ZAP_THROUGHPUT_FLOPS;
+    z->throughput_value = flops_per_iter;
+}
+
+/* CUSTOM COUNTERS */
+
+// Table slot for name, adding it when new; -1 once the table is full
+static int zap__counter_slot(zap_t* z, const char* name) {
+    size_t len = sizeof(z->counter_names[0]) - 1;
+    for (size_t i = 0; i < z->counter_count; i++) {
+        if (strncmp(z->counter_names[i], name, len) == 0) return (int)i;
+    }
+    if (z->counter_count >= ZAP_MAX_USER_COUNTERS) {
+        static bool warned = false;
+        if (!warned) {
+            fprintf(stderr, "zap: warning: more than %d custom counters, ignoring \"%s\"\n",
+                    ZAP_MAX_USER_COUNTERS, name);
+            warned = true;
+        }
+        return -1;
     }
+    size_t i = z->counter_count++;
+    strncpy(z->counter_names[i], name, len);
+    z->counter_names[i][len] = '\0';
+    z->counter_totals[i] = 0.0;
+    z->counter_rate[i] = false;
+    z->counter_direction[i] = ZAP_COUNTER_UNGATED;
+    return (int)i;
+}
 
-    printf("\n");
+void zap_counter_add(zap_t* z, const char* name, double value) {
+    // Warmup batches and the unmeasured call that ends warmup do not count
+    if (!z->measuring && z->sample_count == 0) return;
+    int i = zap__counter_slot(z, name);
+    if (i >= 0) z->counter_totals[i] += value;
 }
 
-void zap_report_group_start(const char* name) {
-    if (zap_g_config.json_output) return;  // No group headers in JSON mode
-    printf("%s%sRunning benchmark group:%s %s%s%s\n\n",
-           zap__c_bold(), zap__c_purple(), zap__c_reset(),
-           zap__c_purple(), name, zap__c_reset());
+void zap_counter_set_rate(zap_t* z, const char* name, bool per_second) {
+    int i = zap__counter_slot(z, name);
+    if (i >= 0) z->counter_rate[i] = per_second;
 }
 
-void zap_report_group_end(void) {
-    printf("\n");
+void zap_counter_set_direction(zap_t* z, const char* name, zap_counter_direction_t dir) {
+    int i = zap__counter_slot(z, name);
+    if (i >= 0) z->counter_direction[i] = dir;
 }
 
-/* RUNTIME BENCHMARK GROUPS */
+/* GLOBAL CONFIG */
 
-static zap_runtime_group_t zap__current_group = {0};
+zap_config_t zap_g_config = {0};
 
-static bool zap__setup_called = false;  // Track if setup has been called for current group
+/* BASELINE MANAGEMENT IMPLEMENTATION */
 
-zap_runtime_group_t* zap_benchmark_group(const char* name) {
-    zap_runtime_group_t* g = &zap__current_group;
+#define ZAP__ARENA_CHUNK_SIZE 16384
 
-    strncpy(g->name, name, sizeof(g->name) - 1);
-    g->name[sizeof(g->name) - 1] = '\0';
+void zap_baseline_init(zap_baseline_t* b) {
+    memset(b, 0, sizeof(*b));
+    b->capacity = 64;
+    b->entries = (zap_baseline_entry_t*)malloc(
+        b->capacity * sizeof(zap_baseline_entry_t));
+    b->format = (zap_baseline_format_t)ZAP_DEFAULT_BASELINE_FORMAT;
+}
 
-    // Set defaults
-    g->config.warmup_time_ns = ZAP_DEFAULT_WARMUP_TIME_NS;
-    g->config.measurement_time_ns = ZAP_DEFAULT_MEASUREMENT_TIME_NS;
-    g->config.sample_count = ZAP_DEFAULT_SAMPLE_COUNT;
-    g->active = true;
-    g->header_printed = false;  // Defer header until first matching benchmark
-    g->setup = NULL;
-    g->teardown = NULL;
-    g->tag_count = 0;
-    zap__setup_called = false;
+void zap_baseline_free(zap_baseline_t* b) {
+    free(b->entries);
+    b->entries = NULL;
+    b->count = 0;
+    b->capacity = 0;
+    free(b->index);
+    b->index = NULL;
+    b->index_size = 0;
+    while (b->arena) {
+        zap_arena_chunk_t* next = b->arena->next;
+        free(b->arena);
+        b->arena = next;
+    }
+    if (b->map) {
+        munmap(b->map, b->map_size);
+        b->map = NULL;
+        b->map_size = 0;
+    }
+    b->map_records = NULL;
+    b->map_slots = NULL;
+    b->map_count = 0;
+    b->map_slot_count = 0;
+    b->map_read = 0;
+}
 
-    // Only print header immediately if no filter is set and no tag filter
-    if (!zap_g_config.filter && !zap_g_config.dry_run && zap_g_config.cli_tag_count == 0) {
-        zap_report_group_start(name);
-        g->header_printed = true;
+// FNV-1a over the group-prefixed key
+static uint64_t zap__hash_name(const char* name, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
     }
-    return g;
+    return h;
 }
 
-void zap_group_measurement_time(zap_runtime_group_t* g, uint64_t ns) {
-    g->config.measurement_time_ns = ns;
+/*
+ * Binary baseline format ("zap-baseline v2"), native byte order:
+ *   header   zap__v2_header_t (magic, version, byte-order mark, entry count)
+ *   index    entry_count x uint64 record offsets from the start of the file
+ *   hash     hash_size x uint64 slots, a power of two at least twice
+ *            entry_count: record number + 1 (0 = empty) at the FNV-1a hash of
+ *            its name, linear probing
+ *   records  zap__v2_record_t, then metric_count x zap__v2_metric_t, then
+ *            the NUL-terminated name padded to 8 bytes, then sample_count
+ *            doubles
+ * Every offset is 8-byte aligned, so a mapped file is read in place. Loading
+ * checks the header only; zap_baseline_find() probes the hash table and gives
+ * a record its entry on first use, with name, metrics and samples pointing
+ * into the mapping. Nothing is parsed or copied up front.
+ */
+#define ZAP__V2_MAGIC "zap-baseline v2\n"
+#define ZAP__V2_BOM 0x01020304u
+
+typedef struct {
+    char     magic[16];
+    uint32_t version;
+    uint32_t bom;          // Reads back differently on the other byte order
+    uint64_t entry_count;
+    uint64_t index_offset;
+    uint64_t hash_offset;
+    uint64_t hash_size;
+    uint64_t file_size;
+} zap__v2_header_t;
+
+typedef struct {
+    uint32_t name_len;
+    uint32_t metric_count;
+    uint64_t sample_count;
+    double   mean;
+    double   std_dev;
+    double   ci_lower;
+    double   ci_upper;
+} zap__v2_record_t;
+
+typedef struct {
+    char     name[32];
+    double   value;
+    uint32_t kind;
+    uint32_t flags;
+} zap__v2_metric_t;
+
+// Mapped metrics are used as zap_metric_t in place
+typedef char zap__v2_metric_layout_check[
+    sizeof(zap__v2_metric_t) == sizeof(zap_metric_t) &&
+    offsetof(zap__v2_metric_t, value) == offsetof(zap_metric_t, value) &&
+    offsetof(zap__v2_metric_t, kind) == offsetof(zap_metric_t, kind) &&
+    offsetof(zap__v2_metric_t, flags) == offsetof(zap_metric_t, flags) ? 1 : -1];
+
+// Record i of the mapping, bounds-checked when it is first used; NULL if damaged
+static const zap__v2_record_t* zap__v2_record(const zap_baseline_t* b, size_t i,
+                                               const char** name_out) {
+    const unsigned char* base = (const unsigned char*)b->map;
+    size_t size = b->map_size;
+    uint64_t off = b->map_records[i];
+    if (off % 8 != 0 || off > size || size - off < sizeof(zap__v2_record_t)) return NULL;
+    const zap__v2_record_t* r = (const zap__v2_record_t*)(base + off);
+    size_t metrics_bytes = (size_t)r->metric_count * sizeof(zap__v2_metric_t);
+    size_t name_bytes = ((size_t)r->name_len + 1 + 7) & ~(size_t)7;
+    size_t avail = size - off - sizeof(*r);
+    if (metrics_bytes > avail || name_bytes > avail - metrics_bytes ||
+        r->sample_count > (avail - metrics_bytes - name_bytes) / sizeof(double)) {
+        return NULL;
+    }
+    const zap__v2_metric_t* metrics = (const zap__v2_metric_t*)(r + 1);
+    for (uint32_t m = 0; m < r->metric_count; m++) {
+        if (metrics[m].name[sizeof(metrics[m].name) - 1] != '\0') return NULL;
+    }
+    const char* name = (const char*)(base + off + sizeof(*r) + metrics_bytes);
+    if (name[r->name_len] != '\0') return NULL;
+    *name_out = name;
+    return r;
 }
 
-void zap_group_warmup_time(zap_runtime_group_t* g, uint64_t ns) {
-    g->config.warmup_time_ns = ns;
+// Record for name in the mapping's hash table, or NULL
+static const zap__v2_record_t* zap__v2_find(const zap_baseline_t* b, const char* name,
+                                            size_t len, const char** name_out) {
+    if (!b->map_slots) return NULL;
+    size_t mask = b->map_slot_count - 1;
+    size_t slot = (size_t)zap__hash_name(name, len) & mask;
+    for (size_t probes = 0; probes < b->map_slot_count; probes++) {
+        uint64_t v = b->map_slots[slot];
+        if (v == 0 || v > b->map_count) return NULL;
+        const char* rec_name;
+        const zap__v2_record_t* r = zap__v2_record(b, (size_t)(v - 1), &rec_name);
+        if (r && r->name_len == len && memcmp(rec_name, name, len) == 0) {
+            *name_out = rec_name;
+            return r;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
 }
 
-void zap_group_sample_count(zap_runtime_group_t* g, size_t count) {
-    g->config.sample_count = count;
+// Point e at a mapped record; the mapping outlives every entry
+static void zap__v2_fill(zap_baseline_entry_t* e, const zap__v2_record_t* r) {
+    size_t metrics_bytes = (size_t)r->metric_count * sizeof(zap__v2_metric_t);
+    size_t name_bytes = ((size_t)r->name_len + 1 + 7) & ~(size_t)7;
+    e->mean = r->mean;
+    e->std_dev = r->std_dev;
+    e->ci_lower = r->ci_lower;
+    e->ci_upper = r->ci_upper;
+    e->metrics = r->metric_count > 0 ? (const zap_metric_t*)(r + 1) : NULL;
+    e->metric_count = r->metric_count < ZAP_MAX_METRICS ? r->metric_count : ZAP_MAX_METRICS;
+    e->samples = r->sample_count > 0
+        ? (const double*)((const char*)(r + 1) + metrics_bytes + name_bytes) : NULL;
+    e->sample_count = (size_t)r->sample_count;
 }
 
-void zap_group_setup(zap_runtime_group_t* g, zap_setup_fn setup) {
-    g->setup = setup;
+// 8-byte aligned arena allocation; pointers stay valid until free
+static void* zap__arena_alloc(zap_baseline_t* b, size_t bytes) {
+    bytes = (bytes + 7) & ~(size_t)7;
+    zap_arena_chunk_t* chunk = b->arena;
+    if (!chunk || chunk->size - chunk->used < bytes) {
+        size_t size = bytes > ZAP__ARENA_CHUNK_SIZE ? bytes : ZAP__ARENA_CHUNK_SIZE;
+        chunk = (zap_arena_chunk_t*)malloc(sizeof(zap_arena_chunk_t) + size);
+        if (!chunk) return NULL;
+        chunk->next = b->arena;
+        chunk->data = (char*)(chunk + 1);  // Header size is a multiple of 8
+        chunk->used = 0;
+        chunk->size = size;
+        b->arena = chunk;
+    }
+    void* dst = chunk->data + chunk->used;
+    chunk->used += bytes;
+    return dst;
 }
 
-void zap_group_teardown(zap_runtime_group_t* g, zap_teardown_fn teardown) {
-    g->teardown = teardown;
+static const char* zap__intern_name(zap_baseline_t* b, const char* name, size_t len) {
+    char* dst = (char*)zap__arena_alloc(b, len + 1);
+    if (!dst) return NULL;
+    memcpy(dst, name, len);
+    dst[len] = '\0';
+    return dst;
 }
 
-void zap_group_tag(zap_runtime_group_t* g, const char* tag) {
-    if (g->tag_count < ZAP_MAX_TAGS) {
-        strncpy(g->tags[g->tag_count], tag, sizeof(g->tags[0]) - 1);
-        g->tags[g->tag_count][sizeof(g->tags[0]) - 1] = '\0';
-        g->tag_count++;
-    }
+// Point e at a copy of metrics in the arena; entries stay small that way
+static bool zap__entry_set_metrics(zap_baseline_t* b, zap_baseline_entry_t* e,
+                                   const zap_metric_t* metrics, size_t n) {
+    e->metrics = NULL;
+    e->metric_count = 0;
+    if (n == 0) return true;
+    zap_metric_t* dst = (zap_metric_t*)zap__arena_alloc(b, n * sizeof(zap_metric_t));
+    if (!dst) return false;
+    memcpy(dst, metrics, n * sizeof(zap_metric_t));
+    e->metrics = dst;
+    e->metric_count = n;
+    return true;
 }
 
-void zap_group_finish(zap_runtime_group_t* g) {
-    // Call teardown if set and not in dry run mode
-    if (g->teardown && !zap_g_config.dry_run) {
-        g->teardown();
+// Slot for name: either the slot holding it or the empty slot it would go in
+static size_t zap__index_slot(const zap_baseline_t* b, const char* name, size_t len) {
+    size_t mask = b->index_size - 1;
+    size_t slot = (size_t)zap__hash_name(name, len) & mask;
+    while (b->index[slot]) {
+        const char* other = b->entries[b->index[slot] - 1].name;
+        if (strncmp(other, name, len) == 0 && other[len] == '\0') break;
+        slot = (slot + 1) & mask;
     }
-    g->active = false;
-    // Only print group end if header was printed
-    if (g->header_printed) {
-        zap_report_group_end();
+    return slot;
+}
+
+static bool zap__index_grow(zap_baseline_t* b) {
+    size_t size = b->index_size ? b->index_size * 2 : 128;
+    size_t* index = (size_t*)calloc(size, sizeof(size_t));
+    if (!index) return false;
+    free(b->index);
+    b->index = index;
+    b->index_size = size;
+    for (size_t i = 0; i < b->count; i++) {
+        const char* name = b->entries[i].name;
+        b->index[zap__index_slot(b, name, strlen(name))] = i + 1;
     }
+    return true;
 }
 
-/* BENCHMARK ID */
+// Find the entry for name, appending one if it is new: filled from the mapped
+// record of that name if there is one, else empty. A stable name
+// (NUL-terminated and outliving the baseline) is used without a copy.
+static zap_baseline_entry_t* zap__baseline_upsert(zap_baseline_t* b,
+                                                  const char* name, size_t len,
+                                                  bool stable) {
+    if ((b->count + 1) * 2 > b->index_size && !zap__index_grow(b)) return NULL;
 
-zap_benchmark_id_t zap_benchmark_id(const char* label, int64_t param) {
-    zap_benchmark_id_t id;
-    strncpy(id.label, label, sizeof(id.label) - 1);
-    id.label[sizeof(id.label) - 1] = '\0';
-    snprintf(id.param_str, sizeof(id.param_str), "%lld", (long long)param);
-    return id;
+    size_t slot = zap__index_slot(b, name, len);
+    if (b->index[slot]) return &b->entries[b->index[slot] - 1];
+
+    if (b->count >= b->capacity) {
+        size_t capacity = b->capacity ? b->capacity * 2 : 64;
+        zap_baseline_entry_t* entries = (zap_baseline_entry_t*)realloc(
+            b->entries, capacity * sizeof(zap_baseline_entry_t));
+        if (!entries) return NULL;
+        b->entries = entries;
+        b->capacity = capacity;
+    }
+    const char* mapped_name = NULL;
+    const zap__v2_record_t* r = zap__v2_find(b, name, len, &mapped_name);
+    const char* interned = r ? mapped_name : stable ? name : zap__intern_name(b, name, len);
+    if (!interned) return NULL;
+
+    zap_baseline_entry_t* e = &b->entries[b->count];
+    memset(e, 0, sizeof(*e));
+    e->name = interned;
+    if (r) {
+        zap__v2_fill(e, r);
+        b->map_read++;
+    }
+    b->index[slot] = ++b->count;
+    return e;
 }
 
-zap_benchmark_id_t zap_benchmark_id_str(const char* label, const char* param) {
-    zap_benchmark_id_t id;
-    strncpy(id.label, label, sizeof(id.label) - 1);
-    id.label[sizeof(id.label) - 1] = '\0';
-    strncpy(id.param_str, param, sizeof(id.param_str) - 1);
-    id.param_str[sizeof(id.param_str) - 1] = '\0';
-    return id;
+// Give every mapped record its entry, for code that walks entries[]. The
+// entries are a cache of the file, so this is allowed on a const baseline.
+static void zap__baseline_read_all(const zap_baseline_t* cb) {
+    zap_baseline_t* b = (zap_baseline_t*)cb;
+    for (size_t i = 0; i < b->map_count && b->map_read < b->map_count; i++) {
+        const char* name;
+        const zap__v2_record_t* r = zap__v2_record(b, i, &name);
+        if (!r) {
+            fprintf(stderr, "Warning: skipping damaged record %zu of the binary baseline\n", i);
+            continue;
+        }
+        zap__baseline_upsert(b, name, r->name_len, true);
+    }
 }
 
-/* BENCHER FUNCTIONS */
+void zap_baseline_add(zap_baseline_t* b, const char* name,
+                            const zap_stats_t* stats) {
+    // Existing entries are updated in place
+    zap_baseline_entry_t* e = zap__baseline_upsert(b, name, strlen(name), false);
+    if (!e) {
+        fprintf(stderr, "Error: cannot grow baseline for '%s'\n", name);
+        return;
+    }
+    e->mean = stats->mean;
+    e->std_dev = stats->std_dev;
+    e->ci_lower = stats->ci_lower;
+    e->ci_upper = stats->ci_upper;
+    zap__entry_set_metrics(b, e, stats->metrics, stats->metric_count);
+
+    // Keep the raw samples for the binary format; stats->samples is borrowed
+    e->samples = NULL;
+    e->sample_count = 0;
+    if (stats->samples && stats->sample_count > 0) {
+        double* copy = (double*)zap__arena_alloc(b, stats->sample_count * sizeof(double));
+        if (copy) {
+            memcpy(copy, stats->samples, stats->sample_count * sizeof(double));
+            e->samples = copy;
+            e->sample_count = stats->sample_count;
+        }
+    }
+}
 
-static void zap__init_with_config(zap_t* c, const char* name,
-                                        const zap_bench_config_t* config) {
-    memset(c, 0, sizeof(*c));
-    c->name = name;
-    c->iterations = 1;
-    // Apply CLI overrides over group config
-    c->config = *config;
-    if (zap_g_config.cli_warmup_ns > 0) {
-        c->config.warmup_time_ns = zap_g_config.cli_warmup_ns;
+const zap_baseline_entry_t* zap_baseline_find(
+    const zap_baseline_t* b, const char* name) {
+    size_t len = strlen(name);
+    if (b->count > 0 && b->index) {
+        size_t slot = zap__index_slot(b, name, len);
+        if (b->index[slot]) return &b->entries[b->index[slot] - 1];
     }
-    if (zap_g_config.cli_time_ns > 0) {
-        c->config.measurement_time_ns = zap_g_config.cli_time_ns;
+    // A mapped record gets its entry on first lookup, as in zap__baseline_read_all()
+    const char* mapped_name;
+    if (!zap__v2_find(b, name, len, &mapped_name)) return NULL;
+    return zap__baseline_upsert((zap_baseline_t*)b, mapped_name, len, true);
+}
+
+size_t zap_baseline_size(const zap_baseline_t* b) {
+    return b->count + (b->map_count - b->map_read);
+}
+
+/*
+ * Baseline file format (text):
+ * Line 1: "zap-baseline v1"
+ * Following lines: name|mean|std_dev|ci_lower|ci_upper[|metric=value...]
+ *
+ * Metric fields are optional, so older readers that only scan the first
+ * four values still accept files with metrics.
+ *
+ * Name format includes group prefix to avoid collisions:
+ *   - Static/Runtime API: group_name/bench_name
+ *   - Comparison API: group_name/label/param [impl_name]
+ */
+/*
+ * Baselines are written to "<path>.tmp" and renamed over the old file. A
+ * loaded v2 file is still mapped while we save, and truncating it in place
+ * would invalidate the mapped names and samples.
+ */
+static FILE* zap__baseline_open_tmp(const char* path, char* tmp, size_t tmp_size) {
+    // Create parent directory if it doesn't exist
+    char dir[256];
+    strncpy(dir, path, sizeof(dir) - 1);
+    dir[sizeof(dir) - 1] = '\0';
+    char* last_slash = strrchr(dir, '/');
+    if (last_slash) {
+        *last_slash = '\0';
+        mkdir(dir, 0755);  // Ignore error if already exists
     }
-    if (zap_g_config.cli_samples > 0) {
-        c->config.sample_count = zap_g_config.cli_samples;
+
+    snprintf(tmp, tmp_size, "%s.tmp", path);
+    FILE* f = fopen(tmp, "wb");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open '%s' for writing\n", path);
     }
-    if (zap_g_config.cli_min_iters > 0) {
-        c->iterations = zap_g_config.cli_min_iters;
+    return f;
+}
+
+static bool zap__baseline_commit_tmp(FILE* f, const char* tmp, const char* path) {
+    bool ok = !ferror(f);
+    if (fclose(f) != 0) ok = false;
+    if (ok && rename(tmp, path) != 0) ok = false;
+    if (!ok) {
+        fprintf(stderr, "Error: Cannot write '%s'\n", path);
+        remove(tmp);
     }
-    c->sample_capacity = c->config.sample_count;
-    c->samples = (double*)malloc(c->sample_capacity * sizeof(double));
+    return ok;
 }
 
-// Print benchmark in dry-run mode
-static void zap__print_dry_run(const char* group_name, const char* bench_name) {
-    if (zap_g_config.json_output) {
-        printf("{\"type\":\"benchmark\",\"group\":\"%s\",\"name\":\"%s\"}\n",
-               group_name ? group_name : "", bench_name);
-    } else {
-        if (group_name) {
-            printf("  %s%s%s/%s%s%s\n",
-                   zap__c_purple(), group_name, zap__c_reset(),
-                   zap__c_magenta(), bench_name, zap__c_reset());
-        } else {
-            printf("  %s%s%s\n", zap__c_magenta(), bench_name, zap__c_reset());
+bool zap_baseline_save(const zap_baseline_t* b, const char* path) {
+    char tmp[512];
+    FILE* f = zap__baseline_open_tmp(path, tmp, sizeof(tmp));
+    if (!f) return false;
+
+    zap__baseline_read_all(b);
+    fprintf(f, "zap-baseline v1\n");
+    for (size_t i = 0; i < b->count; i++) {
+        const zap_baseline_entry_t* e = &b->entries[i];
+        fprintf(f, "%s|%.17g|%.17g|%.17g|%.17g",
+                e->name, e->mean, e->std_dev, e->ci_lower, e->ci_upper);
+        for (size_t m = 0; m < e->metric_count; m++) {
+            fprintf(f, "|%s=%.17g", e->metrics[m].name, e->metrics[m].value);
         }
+        fprintf(f, "\n");
     }
+
+    // Message is printed by zap_finalize if needed
+    return zap__baseline_commit_tmp(f, tmp, path);
 }
 
-static void zap__run_and_report(zap_t* c, const char* group_name, const char* name) {
-    // Warn if time limit was reached before collecting all samples
-    if (!zap_g_config.json_output && c->sample_count < c->config.sample_count) {
-        printf("%sWarning: time limit reached, collected %zu/%zu samples%s\n",
-               zap__c_yellow(), c->sample_count, c->config.sample_count, zap__c_reset());
-    }
+static size_t zap__v2_record_size(const zap_baseline_entry_t* e) {
+    size_t name_len = strlen(e->name);
+    return sizeof(zap__v2_record_t)
+         + e->metric_count * sizeof(zap__v2_metric_t)
+         + ((name_len + 1 + 7) & ~(size_t)7)
+         + e->sample_count * sizeof(double);
+}
 
-    zap_stats_t stats = zap_compute_stats(c->samples, c->sample_count);
-    stats.iterations = c->iterations;
-    stats.throughput_type = c->throughput_type;
-    stats.throughput_value = c->throughput_value;
+bool zap_baseline_save_binary(const zap_baseline_t* b, const char* path) {
+    char tmp[512];
+    zap__baseline_read_all(b);
+    size_t hash_size = 16;
+    while (hash_size < 2 * b->count) hash_size *= 2;
+    uint64_t* slots = (uint64_t*)calloc(hash_size, sizeof(uint64_t));
+    if (!slots) {
+        fprintf(stderr, "Error: Cannot write '%s'\n", path);
+        return false;
+    }
+    for (size_t i = 0; i < b->count; i++) {
+        const char* name = b->entries[i].name;
+        size_t slot = (size_t)zap__hash_name(name, strlen(name)) & (hash_size - 1);
+        while (slots[slot]) slot = (slot + 1) & (hash_size - 1);
+        slots[slot] = i + 1;
+    }
 
-    // Build baseline key with group prefix to avoid collisions
-    char baseline_key[384];
-    if (group_name && group_name[0]) {
-        snprintf(baseline_key, sizeof(baseline_key), "%s/%s", group_name, name);
-    } else {
-        snprintf(baseline_key, sizeof(baseline_key), "%s", name);
+    FILE* f = zap__baseline_open_tmp(path, tmp, sizeof(tmp));
+    if (!f) {
+        free(slots);
+        return false;
     }
 
-    // Check if we should compare against baseline
-    zap_comparison_t cmp = {0};
-    const zap_baseline_entry_t* baseline = NULL;
+    zap__v2_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ZAP__V2_MAGIC, sizeof(h.magic));
+    h.version = 2;
+    h.bom = ZAP__V2_BOM;
+    h.entry_count = b->count;
+    h.index_offset = sizeof(h);
+    h.hash_offset = h.index_offset + b->count * sizeof(uint64_t);
+    h.hash_size = hash_size;
+
+    uint64_t records = h.hash_offset + hash_size * sizeof(uint64_t);
+    uint64_t offset = records;
+    for (size_t i = 0; i < b->count; i++) offset += zap__v2_record_size(&b->entries[i]);
+    h.file_size = offset;
+    fwrite(&h, sizeof(h), 1, f);
+
+    offset = records;
+    for (size_t i = 0; i < b->count; i++) {
+        fwrite(&offset, sizeof(offset), 1, f);
+        offset += zap__v2_record_size(&b->entries[i]);
+    }
+    fwrite(slots, sizeof(uint64_t), hash_size, f);
+    free(slots);
 
-    if (zap_g_config.compare) {
-        baseline = zap_baseline_find(&zap_g_config.baseline, baseline_key);
-        if (baseline) {
-            cmp = zap_compare(baseline, &stats);
+    static const char pad[8] = {0};
+    for (size_t i = 0; i < b->count; i++) {
+        const zap_baseline_entry_t* e = &b->entries[i];
+        size_t name_len = strlen(e->name);
+        zap__v2_record_t r;
+        memset(&r, 0, sizeof(r));
+        r.name_len = (uint32_t)name_len;
+        r.metric_count = (uint32_t)e->metric_count;
+        r.sample_count = e->sample_count;
+        r.mean = e->mean;
+        r.std_dev = e->std_dev;
+        r.ci_lower = e->ci_lower;
+        r.ci_upper = e->ci_upper;
+        fwrite(&r, sizeof(r), 1, f);
+
+        for (size_t m = 0; m < e->metric_count; m++) {
+            zap__v2_metric_t dm;
+            memset(&dm, 0, sizeof(dm));
+            memcpy(dm.name, e->metrics[m].name, sizeof(dm.name));
+            dm.name[sizeof(dm.name) - 1] = '\0';
+            dm.value = e->metrics[m].value;
+            dm.kind = (uint32_t)e->metrics[m].kind;
+            dm.flags = e->metrics[m].flags;
+            fwrite(&dm, sizeof(dm), 1, f);
+        }
 
-            // Track regression for --fail-threshold
-            if (zap_g_config.fail_threshold > 0.0 &&
-                cmp.change == ZAP_REGRESSED &&
-                cmp.change_pct > zap_g_config.fail_threshold) {
-                zap_g_config.has_regression = true;
-            }
+        fwrite(e->name, 1, name_len + 1, f);
+        size_t padded = (name_len + 1 + 7) & ~(size_t)7;
+        fwrite(pad, 1, padded - (name_len + 1), f);
+        if (e->sample_count > 0) {
+            fwrite(e->samples, sizeof(double), e->sample_count, f);
         }
     }
 
-    // Output results
-    if (zap_g_config.json_output) {
-        zap_report_json(name, &stats, baseline ? &cmp : NULL);
-    } else if (baseline) {
-        zap_report_comparison(name, &stats, &cmp);
-    } else if (zap_g_config.compare) {
-        printf("%s(new)%s ", zap__c_yellow(), zap__c_reset());
-        zap_report(name, &stats);
-    } else {
-        zap_report(name, &stats);
-    }
+    return zap__baseline_commit_tmp(f, tmp, path);
+}
 
-    // Save to baseline if requested
-    if (zap_g_config.save_baseline) {
-        zap_baseline_add(&zap_g_config.baseline, baseline_key, &stats);
+// Map a v2 file and check its header; records are read by zap_baseline_find()
+static bool zap__baseline_load_v2(zap_baseline_t* b, const char* path) {
+    if (b->map) {
+        fprintf(stderr, "Error: a binary baseline is already loaded\n");
+        return false;
     }
-}
 
-void zap_bench_function(zap_runtime_group_t* g, const char* name,
-                        zap_bench_fn fn) {
-    // Check filter before running
-    if (!zap_matches_filter(name, zap_g_config.filter)) {
-        return;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(zap__v2_header_t)) {
+        close(fd);
+        fprintf(stderr, "Error: Invalid baseline file format\n");
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map '%s'\n", path);
+        return false;
     }
 
-    // Check tag filter
-    if (!zap_group_matches_tags(g)) {
-        return;
+    const unsigned char* base = (const unsigned char*)map;
+    const zap__v2_header_t* h = (const zap__v2_header_t*)map;
+    bool ok = memcmp(h->magic, ZAP__V2_MAGIC, sizeof(h->magic)) == 0 &&
+              h->version == 2 && h->bom == ZAP__V2_BOM &&
+              h->file_size == size &&
+              h->index_offset % 8 == 0 && h->index_offset <= size &&
+              h->entry_count <= (size - h->index_offset) / sizeof(uint64_t) &&
+              h->hash_offset % 8 == 0 && h->hash_offset <= size &&
+              h->hash_size > h->entry_count && (h->hash_size & (h->hash_size - 1)) == 0 &&
+              h->hash_size <= (size - h->hash_offset) / sizeof(uint64_t);
+    if (!ok) {
+        fprintf(stderr, "Error: Invalid baseline file format\n");
+        munmap(map, size);
+        return false;
     }
 
-    // Dry run mode: just print the benchmark name
-    if (zap_g_config.dry_run) {
-        zap__print_dry_run(g->name, name);
-        return;
+    b->map = map;
+    b->map_size = size;
+    b->map_records = (const uint64_t*)(base + h->index_offset);
+    b->map_slots = (const uint64_t*)(base + h->hash_offset);
+    b->map_count = (size_t)h->entry_count;
+    b->map_slot_count = (size_t)h->hash_size;
+    b->map_read = 0;
+    b->format = ZAP_BASELINE_BINARY;
+
+    // Entries already in b take the file's values, as a text load would give them
+    for (size_t i = 0; i < b->count; i++) {
+        zap_baseline_entry_t* e = &b->entries[i];
+        const char* name;
+        const zap__v2_record_t* r = zap__v2_find(b, e->name, strlen(e->name), &name);
+        if (!r) continue;
+        zap__v2_fill(e, r);
+        b->map_read++;
     }
+    return true;
+}
 
-    // Print deferred group header on first matching benchmark
-    if (!g->header_printed) {
-        zap_report_group_start(g->name);
-        g->header_printed = true;
+bool zap_baseline_load(zap_baseline_t* b, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return false;  // File doesn't exist - not an error for comparison
     }
 
-    // Call setup on first matching benchmark
-    if (g->setup && !zap__setup_called) {
-        g->setup();
-        zap__setup_called = true;
+    // Lines have no length limit: each carries up to ZAP_MAX_METRICS metrics
+    char* line = NULL;
+    size_t line_cap = 0;
+
+    // Check header
+    if (getline(&line, &line_cap, f) < 0) {
+        free(line);
+        fclose(f);
+        return false;
+    }
+    if (strncmp(line, "zap-baseline v2", 15) == 0) {
+        free(line);
+        fclose(f);
+        return zap__baseline_load_v2(b, path);
+    }
+    if (strncmp(line, "zap-baseline v1", 15) != 0) {
+        fprintf(stderr, "Error: Invalid baseline file format\n");
+        free(line);
+        fclose(f);
+        return false;
     }
 
-    zap_t z;
-    zap__init_with_config(&z, name, &g->config);
-    z.group = g;
+    // Read entries
+    ssize_t line_len;
+    while ((line_len = getline(&line, &line_cap, f)) > 0) {
+        zap_baseline_entry_t e = {0};
+        zap_metric_t metrics[ZAP_MAX_METRICS];
+        char* p = line;
 
-    // Run the benchmark
-    fn(&z);
+        // A last line without its newline was cut off mid-write
+        if (line[line_len - 1] != '\n') {
+            fprintf(stderr, "Warning: ignoring incomplete last line of '%s'\n", path);
+            break;
+        }
+        line[line_len - 1] = '\0';
 
-    // Report results
-    zap__run_and_report(&z, g->name, name);
+        // Parse name
+        char* sep = strchr(p, '|');
+        if (!sep) continue;
+        const char* name = p;
+        size_t name_len = (size_t)(sep - p);
+        p = sep + 1;
 
-    zap_cleanup(&z);
-}
+        // Parse values
+        if (sscanf(p, "%lf|%lf|%lf|%lf", &e.mean, &e.std_dev,
+                   &e.ci_lower, &e.ci_upper) != 4) {
+            continue;
+        }
 
-void zap_bench_with_input(zap_runtime_group_t* g,
-                          zap_benchmark_id_t id,
-                          void* input, size_t input_size,
-                          zap_bench_fn fn) {
-    // Build full name: "label/param"
-    char full_name[256];
-    snprintf(full_name, sizeof(full_name), "%s/%s", id.label, id.param_str);
+        // Optional metrics after the fourth value: |name=value
+        for (int field = 0; field < 4 && p; field++) {
+            p = strchr(p, '|');
+            if (p) p++;
+        }
+        while (p && *p && e.metric_count < ZAP_MAX_METRICS) {
+            char* eq = strchr(p, '=');
+            char* next = strchr(p, '|');
+            if (!eq || (next && eq > next)) break;
+            zap_metric_t* m = &metrics[e.metric_count];
+            memset(m, 0, sizeof(*m));
+            size_t len = (size_t)(eq - p);
+            if (len >= sizeof(m->name)) len = sizeof(m->name) - 1;
+            memcpy(m->name, p, len);
+            m->name[len] = '\0';
+            char* end;
+            m->value = strtod(eq + 1, &end);
+            if (end == eq + 1 || (*end != '|' && *end != '\0')) break;  // Not a whole number
+            e.metric_count++;
+            p = next ? next + 1 : NULL;
+        }
+        if (p && *p) {
+            fprintf(stderr, "Warning: ignoring malformed baseline entry '%.*s'\n",
+                    (int)name_len, name);
+            continue;
+        }
 
-    // Check filter before running
-    if (!zap_matches_filter(full_name, zap_g_config.filter)) {
-        return;
+        // Add to baseline; a repeated name keeps the last line
+        zap_baseline_entry_t* dst = zap__baseline_upsert(b, name, name_len, false);
+        if (!dst) break;
+        e.name = dst->name;
+        *dst = e;
+        zap__entry_set_metrics(b, dst, metrics, e.metric_count);
     }
 
-    // Check tag filter
-    if (!zap_group_matches_tags(g)) {
-        return;
+    free(line);
+    fclose(f);
+    return true;
+}
+
+/* BASELINE MERGING (--merge) */
+
+// Copy an entry into b, samples included; an existing name is replaced
+static bool zap__baseline_put(zap_baseline_t* b, const zap_baseline_entry_t* src) {
+    zap_baseline_entry_t* e = zap__baseline_upsert(b, src->name, strlen(src->name), false);
+    if (!e) return false;
+    const char* name = e->name;
+    *e = *src;
+    e->name = name;
+    e->samples = NULL;
+    e->sample_count = 0;
+    if (!zap__entry_set_metrics(b, e, src->metrics, src->metric_count)) return false;
+    if (src->samples && src->sample_count > 0) {
+        double* copy = (double*)zap__arena_alloc(b, src->sample_count * sizeof(double));
+        if (!copy) return false;
+        memcpy(copy, src->samples, src->sample_count * sizeof(double));
+        e->samples = copy;
+        e->sample_count = src->sample_count;
     }
+    return true;
+}
 
-    // Dry run mode: just print the benchmark name
-    if (zap_g_config.dry_run) {
-        zap__print_dry_run(g->name, full_name);
-        return;
+// First "key":number in one of our JSON lines
+static bool zap__json_number(const char* line, const char* key, double* out) {
+    char pattern[48];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char* p = strstr(line, pattern);
+    if (!p) return false;
+    p += strlen(pattern);
+    char* end;
+    *out = strtod(p, &end);
+    return end != p;
+}
+
+// First "key":"string"; our names never contain quotes
+static bool zap__json_string(const char* line, const char* key, char* out, size_t size) {
+    char pattern[48];
+    snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+    const char* p = strstr(line, pattern);
+    if (!p) return false;
+    p += strlen(pattern);
+    const char* end = strchr(p, '"');
+    if (!end) return false;
+    size_t len = (size_t)(end - p);
+    if (len >= size) len = size - 1;
+    memcpy(out, p, len);
+    out[len] = '\0';
+    return true;
+}
+
+/*
+ * Result lines of --json output carry the same summary as a text baseline:
+ * the "group/name" key, mean, std_dev, CI bounds and metrics. Environment,
+ * comparison and failure lines are skipped.
+ */
+static bool zap__baseline_merge_json(zap_baseline_t* b, FILE* f, const char* path) {
+    char* line = NULL;
+    size_t cap = 0;
+    size_t added = 0;
+    bool ok = true;
+    while (getline(&line, &cap, f) > 0) {
+        if (strncmp(line, "{\"name\":\"", 9) != 0 || strstr(line, "\"error\":")) continue;
+
+        zap_baseline_entry_t e;
+        memset(&e, 0, sizeof(e));
+        zap_metric_t metrics[ZAP_MAX_METRICS];
+        e.metrics = metrics;
+        char name[256], group[128], key[384];
+        if (!zap__json_string(line, "name", name, sizeof(name)) ||
+            !zap__json_number(line, "mean_ns", &e.mean)) {
+            continue;
+        }
+        zap__json_number(line, "std_dev_ns", &e.std_dev);
+        zap__json_number(line, "ci_lower_ns", &e.ci_lower);
+        zap__json_number(line, "ci_upper_ns", &e.ci_upper);
+        if (zap__json_string(line, "group", group, sizeof(group)) && group[0]) {
+            snprintf(key, sizeof(key), "%s/%s", group, name);
+        } else {
+            snprintf(key, sizeof(key), "%s", name);
+        }
+
+        // "metrics":{"name":value,...}
+        const char* p = strstr(line, "\"metrics\":{");
+        if (p) p += 11;
+        while (p && *p == '"' && e.metric_count < ZAP_MAX_METRICS) {
+            const char* end = strchr(p + 1, '"');
+            if (!end || end[1] != ':') break;
+            zap_metric_t* m = &metrics[e.metric_count];
+            memset(m, 0, sizeof(*m));
+            size_t len = (size_t)(end - p - 1);
+            if (len >= sizeof(m->name)) len = sizeof(m->name) - 1;
+            memcpy(m->name, p + 1, len);
+            m->name[len] = '\0';
+            char* num_end;
+            m->value = strtod(end + 2, &num_end);
+            e.metric_count++;
+            p = *num_end == ',' ? num_end + 1 : NULL;
+        }
+
+        e.name = key;
+        if (!zap__baseline_put(b, &e)) {
+            ok = false;
+            break;
+        }
+        added++;
+    }
+    free(line);
+    if (!zap_g_config.json_output) {
+        printf("%sLoaded results:%s %s%s%s (%zu entries)\n",
+               zap__c_purple(), zap__c_reset(), zap__c_cyan(), path, zap__c_reset(), added);
     }
+    return ok;
+}
 
-    // Print deferred group header on first matching benchmark
-    if (!g->header_printed) {
-        zap_report_group_start(g->name);
-        g->header_printed = true;
+bool zap_baseline_merge_file(zap_baseline_t* b, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Error: cannot open '%s'\n", path);
+        return false;
+    }
+    int c = fgetc(f);
+    if (c == '{') {
+        ungetc(c, f);
+        bool ok = zap__baseline_merge_json(b, f, path);
+        fclose(f);
+        return ok;
     }
+    fclose(f);
 
-    // Call setup on first matching benchmark
-    if (g->setup && !zap__setup_called) {
-        g->setup();
-        zap__setup_called = true;
+    zap_baseline_t src;
+    zap_baseline_init(&src);
+    bool ok = zap_baseline_load(&src, path);
+    if (ok && !zap_g_config.json_output) {
+        printf("%sLoaded baseline:%s %s%s%s (%zu entries)\n",
+               zap__c_purple(), zap__c_reset(), zap__c_cyan(), path, zap__c_reset(),
+               zap_baseline_size(&src));
     }
+    if (ok && src.format == ZAP_BASELINE_BINARY) {
+        b->format = ZAP_BASELINE_BINARY;  // Keep raw samples if any input had them
+    }
+    if (ok) zap__baseline_read_all(&src);
+    for (size_t i = 0; ok && i < src.count; i++) {
+        ok = zap__baseline_put(b, &src.entries[i]);
+    }
+    zap_baseline_free(&src);
+    return ok;
+}
 
-    zap_t z;
-    zap__init_with_config(&z, full_name, &g->config);
-    z.group = g;
-    z.param = input;
-    z.param_size = input_size;
+/* RESULTS HISTORY */
 
-    // Run the benchmark
-    fn(&z);
+/*
+ * History file ("zap-history v1"), native byte order, append-only:
+ *   header   zap__hist_header_t (magic, version, byte-order mark), once
+ *   runs     one segment per saved run, back to back:
+ *            zap__hist_run_t (segment size, run metadata, bench count),
+ *            bench_count x zap__hist_key_t sorted by name hash, then a
+ *            zap__hist_bench_t per benchmark: summary, the NUL-terminated
+ *            name padded to 8 bytes, then its raw samples as one column
+ * A run is written with a single fwrite, so a crash can only leave a torn
+ * last segment; readers stop before it and the next append cuts it off.
+ * Reading one benchmark across runs touches each run's key table and that
+ * benchmark's record, never the other benchmarks or their samples.
+ */
+#define ZAP__HIST_MAGIC "zap-history v1\n"
+#define ZAP__HIST_RUN_MAGIC "zap-run"
 
-    // Report results
-    zap__run_and_report(&z, g->name, full_name);
+typedef struct {
+    char     magic[16];
+    uint32_t version;
+    uint32_t bom;
+    uint64_t reserved;
+} zap__hist_header_t;
 
-    zap_cleanup(&z);
-}
+typedef struct {
+    char     magic[8];
+    uint64_t size;          // Whole segment, this header included
+    int64_t  timestamp;
+    uint64_t bench_count;
+    char     commit[48];
+    char     cpu_model[128];
+    char     os_info[64];
+    char     compiler[64];
+    int32_t  cpu_cores;
+    int32_t  cpu_threads;
+    double   base_mhz;
+} zap__hist_run_t;
 
-/* THROUGHPUT CONFIGURATION */
+typedef struct {
+    uint64_t hash;          // zap__hash_name() of the key
+    uint64_t offset;        // Of the zap__hist_bench_t, from the segment start
+} zap__hist_key_t;
 
-void zap_set_throughput_bytes(zap_t* z, size_t bytes_per_iter) {
-    z->throughput_type = ZAP_THROUGHPUT_BYTES;
-    z->throughput_value = bytes_per_iter;
+typedef struct {
+    uint32_t name_len;
+    uint32_t reserved;
+    uint64_t sample_count;
+    double   mean;
+    double   median;
+    double   std_dev;
+} zap__hist_bench_t;
+
+static int zap__hist_key_cmp(const void* a, const void* b) {
+    uint64_t ha = ((const zap__hist_key_t*)a)->hash;
+    uint64_t hb = ((const zap__hist_key_t*)b)->hash;
+    return ha < hb ? -1 : ha > hb;
 }
 
-void zap_set_throughput_elements(zap_t* z, size_t elements_per_iter) {
-    z->throughput_type = ZAP_THROUGHPUT_ELEMENTS;
-    z->throughput_value = elements_per_iter;
+static void zap__hist_copy(char* dst, size_t size, const char* src) {
+    snprintf(dst, size, "%s", src ? src : "");  // The segment is zeroed, so padding stays 0
 }
 
-/* GLOBAL CONFIG */
-
-zap_config_t zap_g_config = {0};
+// Build one run segment in memory; NULL on allocation failure
+static unsigned char* zap__hist_build_run(const zap_env_t* env, const char* commit,
+                                          const zap_baseline_t* results, size_t* size_out) {
+    size_t count = results->count;
+    size_t size = sizeof(zap__hist_run_t) + count * sizeof(zap__hist_key_t);
+    size_t max_samples = 0;
+    for (size_t i = 0; i < count; i++) {
+        const zap_baseline_entry_t* e = &results->entries[i];
+        size += sizeof(zap__hist_bench_t) + ((strlen(e->name) + 1 + 7) & ~(size_t)7)
+              + e->sample_count * sizeof(double);
+        if (e->sample_count > max_samples) max_samples = e->sample_count;
+    }
 
-/* BASELINE MANAGEMENT IMPLEMENTATION */
+    unsigned char* seg = (unsigned char*)calloc(1, size);
+    double* scratch = (double*)malloc((max_samples > 0 ? max_samples : 1) * sizeof(double));
+    if (!seg || !scratch) {
+        free(seg);
+        free(scratch);
+        return NULL;
+    }
 
-void zap_baseline_init(zap_baseline_t* b) {
-    memset(b, 0, sizeof(*b));
-    b->capacity = 64;
-    b->entries = (zap_baseline_entry_t*)malloc(
-        b->capacity * sizeof(zap_baseline_entry_t));
+    zap__hist_run_t* r = (zap__hist_run_t*)seg;
+    memcpy(r->magic, ZAP__HIST_RUN_MAGIC, sizeof(ZAP__HIST_RUN_MAGIC));
+    r->size = size;
+    r->timestamp = (int64_t)time(NULL);
+    r->bench_count = count;
+    zap__hist_copy(r->commit, sizeof(r->commit), commit);
+    zap__hist_copy(r->cpu_model, sizeof(r->cpu_model), env->cpu_model);
+    zap__hist_copy(r->os_info, sizeof(r->os_info), env->os_info);
+    zap__hist_copy(r->compiler, sizeof(r->compiler), env->compiler);
+    r->cpu_cores = env->cpu_cores;
+    r->cpu_threads = env->cpu_threads;
+    r->base_mhz = env->base_mhz;
+
+    zap__hist_key_t* keys = (zap__hist_key_t*)(r + 1);
+    size_t off = sizeof(*r) + count * sizeof(zap__hist_key_t);
+    for (size_t i = 0; i < count; i++) {
+        const zap_baseline_entry_t* e = &results->entries[i];
+        size_t name_len = strlen(e->name);
+        keys[i].hash = zap__hash_name(e->name, name_len);
+        keys[i].offset = off;
+
+        zap__hist_bench_t* b = (zap__hist_bench_t*)(seg + off);
+        b->name_len = (uint32_t)name_len;
+        b->sample_count = e->sample_count;
+        b->mean = e->mean;
+        b->std_dev = e->std_dev;
+        b->median = e->mean;  // Text-only results have no samples to take it from
+        if (e->sample_count > 0) {
+            memcpy(scratch, e->samples, e->sample_count * sizeof(double));
+            b->median = zap__median_select(scratch, e->sample_count);
+        }
+        off += sizeof(*b);
+        memcpy(seg + off, e->name, name_len);  // calloc left the NUL and padding
+        off += (name_len + 1 + 7) & ~(size_t)7;
+        if (e->sample_count > 0) {
+            memcpy(seg + off, e->samples, e->sample_count * sizeof(double));
+            off += e->sample_count * sizeof(double);
+        }
+    }
+    qsort(keys, count, sizeof(*keys), zap__hist_key_cmp);
+    free(scratch);
+    *size_out = size;
+    return seg;
 }
 
-void zap_baseline_free(zap_baseline_t* b) {
-    free(b->entries);
-    b->entries = NULL;
-    b->count = 0;
-    b->capacity = 0;
+bool zap_history_append(const char* path, const zap_env_t* env, const char* commit,
+                        const zap_baseline_t* results) {
+    // Find where the last complete run ends; a torn tail is cut off
+    zap_history_t h;
+    size_t valid = 0;
+    bool exists = access(path, F_OK) == 0;
+    if (exists) {
+        if (!zap_history_open(&h, path)) return false;
+        valid = h.valid_size;
+        size_t file_size = h.map_size;
+        zap_history_close(&h);
+        if (valid < file_size && truncate(path, (off_t)valid) != 0) {
+            fprintf(stderr, "Error: Cannot truncate '%s'\n", path);
+            return false;
+        }
+    }
+
+    size_t size;
+    unsigned char* seg = zap__hist_build_run(env, commit, results, &size);
+    if (!seg) {
+        fprintf(stderr, "Error: cannot allocate the history record\n");
+        return false;
+    }
+
+    char tmp[512];
+    FILE* f = NULL;
+    if (!exists || valid == 0) {
+        // New file: write the header with the first run and rename it into place
+        f = zap__baseline_open_tmp(path, tmp, sizeof(tmp));
+        if (f) {
+            zap__hist_header_t hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            memcpy(hdr.magic, ZAP__HIST_MAGIC, sizeof(hdr.magic));
+            hdr.version = 1;
+            hdr.bom = ZAP__V2_BOM;
+            fwrite(&hdr, sizeof(hdr), 1, f);
+            fwrite(seg, 1, size, f);
+            free(seg);
+            return zap__baseline_commit_tmp(f, tmp, path);
+        }
+    } else {
+        f = fopen(path, "ab");
+        if (!f) fprintf(stderr, "Error: Cannot open '%s' for writing\n", path);
+    }
+    if (!f) {
+        free(seg);
+        return false;
+    }
+    bool ok = fwrite(seg, 1, size, f) == size;
+    if (fclose(f) != 0) ok = false;
+    free(seg);
+    if (!ok) fprintf(stderr, "Error: Cannot write '%s'\n", path);
+    return ok;
 }
 
-void zap_baseline_add(zap_baseline_t* b, const char* name,
-                            const zap_stats_t* stats) {
-    // Check if entry already exists - update it
-    for (size_t i = 0; i < b->count; i++) {
-        if (strcmp(b->entries[i].name, name) == 0) {
-            zap_baseline_entry_t* e = &b->entries[i];
-            e->mean = stats->mean;
-            e->std_dev = stats->std_dev;
-            e->ci_lower = stats->ci_lower;
-            e->ci_upper = stats->ci_upper;
-            return;
-        }
+// Strings in a run header are fixed-size fields; make sure they end inside them
+static bool zap__hist_terminated(const char* field, size_t size) {
+    return memchr(field, '\0', size) != NULL;
+}
+
+bool zap_history_open(zap_history_t* h, const char* path) {
+    memset(h, 0, sizeof(*h));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(zap__hist_header_t)) {
+        close(fd);
+        fprintf(stderr, "Error: Invalid history file '%s'\n", path);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map '%s'\n", path);
+        return false;
     }
 
-    // New entry - add it
-    if (b->count >= b->capacity) {
-        b->capacity *= 2;
-        b->entries = (zap_baseline_entry_t*)realloc(
-            b->entries, b->capacity * sizeof(zap_baseline_entry_t));
+    const unsigned char* base = (const unsigned char*)map;
+    const zap__hist_header_t* hdr = (const zap__hist_header_t*)map;
+    if (memcmp(hdr->magic, ZAP__HIST_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != 1 || hdr->bom != ZAP__V2_BOM) {
+        munmap(map, size);
+        fprintf(stderr, "Error: Invalid history file '%s'\n", path);
+        return false;
+    }
+    h->map = map;
+    h->map_size = size;
+
+    // Walk the run headers; the first one that doesn't fit ends the file
+    size_t off = sizeof(*hdr);
+    size_t capacity = 0;
+    while (size - off >= sizeof(zap__hist_run_t)) {
+        const zap__hist_run_t* r = (const zap__hist_run_t*)(base + off);
+        if (memcmp(r->magic, ZAP__HIST_RUN_MAGIC, sizeof(ZAP__HIST_RUN_MAGIC)) != 0 ||
+            r->size % 8 != 0 || r->size < sizeof(*r) || r->size > size - off ||
+            r->bench_count > (r->size - sizeof(*r)) / sizeof(zap__hist_key_t) ||
+            !zap__hist_terminated(r->commit, sizeof(r->commit)) ||
+            !zap__hist_terminated(r->cpu_model, sizeof(r->cpu_model)) ||
+            !zap__hist_terminated(r->os_info, sizeof(r->os_info)) ||
+            !zap__hist_terminated(r->compiler, sizeof(r->compiler))) {
+            break;
+        }
+        if (h->run_count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            zap_history_run_t* grown = (zap_history_run_t*)realloc(
+                h->runs, capacity * sizeof(zap_history_run_t));
+            if (!grown) {
+                zap_history_close(h);
+                return false;
+            }
+            h->runs = grown;
+        }
+        zap_history_run_t* run = &h->runs[h->run_count++];
+        run->timestamp = r->timestamp;
+        run->commit = r->commit;
+        run->cpu_model = r->cpu_model;
+        run->os_info = r->os_info;
+        run->compiler = r->compiler;
+        run->cpu_cores = r->cpu_cores;
+        run->cpu_threads = r->cpu_threads;
+        run->base_mhz = r->base_mhz;
+        run->bench_count = (size_t)r->bench_count;
+        run->segment = r;
+        run->segment_size = (size_t)r->size;
+        off += (size_t)r->size;
+    }
+    h->valid_size = off;
+    if (off < size) {
+        fprintf(stderr, "Warning: ignoring %zu bytes of an incomplete run at the end of '%s'\n",
+                size - off, path);
     }
+    return true;
+}
 
-    zap_baseline_entry_t* e = &b->entries[b->count++];
-    strncpy(e->name, name, sizeof(e->name) - 1);
-    e->name[sizeof(e->name) - 1] = '\0';
-    e->mean = stats->mean;
-    e->std_dev = stats->std_dev;
-    e->ci_lower = stats->ci_lower;
-    e->ci_upper = stats->ci_upper;
+void zap_history_close(zap_history_t* h) {
+    free(h->runs);
+    if (h->map) munmap(h->map, h->map_size);
+    memset(h, 0, sizeof(*h));
 }
 
-const zap_baseline_entry_t* zap_baseline_find(
-    const zap_baseline_t* b, const char* name) {
-    for (size_t i = 0; i < b->count; i++) {
-        if (strcmp(b->entries[i].name, name) == 0) {
-            return &b->entries[i];
+// Record for name in one run, or NULL; the record is bounds-checked here
+static const zap__hist_bench_t* zap__hist_find(const zap_history_run_t* run, const char* name,
+                                               size_t name_len, uint64_t hash) {
+    const unsigned char* seg = (const unsigned char*)run->segment;
+    const zap__hist_key_t* keys = (const zap__hist_key_t*)(seg + sizeof(zap__hist_run_t));
+    size_t lo = 0, hi = run->bench_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (keys[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+    for (; lo < run->bench_count && keys[lo].hash == hash; lo++) {
+        uint64_t off = keys[lo].offset;
+        if (off % 8 != 0 || off > run->segment_size ||
+            run->segment_size - off < sizeof(zap__hist_bench_t)) {
+            continue;
+        }
+        const zap__hist_bench_t* b = (const zap__hist_bench_t*)(seg + off);
+        size_t name_bytes = ((size_t)b->name_len + 1 + 7) & ~(size_t)7;
+        size_t avail = run->segment_size - off - sizeof(*b);
+        if (name_bytes > avail || b->sample_count > (avail - name_bytes) / sizeof(double)) {
+            continue;
         }
+        const char* stored = (const char*)(b + 1);
+        if (b->name_len == name_len && memcmp(stored, name, name_len) == 0) return b;
     }
     return NULL;
 }
 
-/*
- * Baseline file format (text):
- * Line 1: "zap-baseline v1"
- * Following lines: name|mean|std_dev|ci_lower|ci_upper
- *
- * Name format includes group prefix to avoid collisions:
- *   - Static/Runtime API: group_name/bench_name
- *   - Comparison API: group_name/label/param [impl_name]
- */
-bool zap_baseline_save(const zap_baseline_t* b, const char* path) {
-    // Create parent directory if it doesn't exist
-    char dir[256];
-    strncpy(dir, path, sizeof(dir) - 1);
-    dir[sizeof(dir) - 1] = '\0';
-    char* last_slash = strrchr(dir, '/');
-    if (last_slash) {
-        *last_slash = '\0';
-        mkdir(dir, 0755);  // Ignore error if already exists
+size_t zap_history_series(const zap_history_t* h, const char* name,
+                          zap_history_point_t* out, size_t max) {
+    size_t name_len = strlen(name);
+    uint64_t hash = zap__hash_name(name, name_len);
+    size_t found = 0;
+    for (size_t i = 0; i < h->run_count; i++) {
+        const zap__hist_bench_t* b = zap__hist_find(&h->runs[i], name, name_len, hash);
+        if (!b) continue;
+        if (found < max) {
+            zap_history_point_t* p = &out[found];
+            p->run = i;
+            p->mean = b->mean;
+            p->median = b->median;
+            p->sample_count = (size_t)b->sample_count;
+            p->samples = b->sample_count > 0
+                ? (const double*)((const char*)(b + 1) + ((b->name_len + 1 + 7) & ~(size_t)7))
+                : NULL;
+        }
+        found++;
     }
+    return found;
+}
 
-    FILE* f = fopen(path, "w");
-    if (!f) {
-        fprintf(stderr, "Error: Cannot open '%s' for writing\n", path);
-        return false;
+bool zap_git_commit(char* buf, size_t size) {
+    const char* env = getenv("ZAP_GIT_COMMIT");
+    if (env && *env) {
+        snprintf(buf, size, "%s", env);
+        return true;
     }
+    buf[0] = '\0';
+    FILE* p = popen("git rev-parse HEAD 2>/dev/null", "r");
+    if (!p) return false;
+    bool ok = fgets(buf, (int)size, p) != NULL;
+    if (pclose(p) != 0) ok = false;
+    buf[ok ? strcspn(buf, "\r\n") : 0] = '\0';
+    return ok && buf[0];
+}
 
-    fprintf(f, "zap-baseline v1\n");
-    for (size_t i = 0; i < b->count; i++) {
-        const zap_baseline_entry_t* e = &b->entries[i];
-        fprintf(f, "%s|%.17g|%.17g|%.17g|%.17g\n",
-                e->name, e->mean, e->std_dev, e->ci_lower, e->ci_upper);
-    }
+/* CHANGE POINTS */
 
-    fclose(f);
-    // Message is printed by zap_finalize if needed
-    return true;
+/*
+ * Binary segmentation: in a segment, the split is where the cumulative sum
+ * of deviations from the segment mean peaks (CUSUM). The peak is compared
+ * with the peaks of ZAP_CHANGE_PERMUTATIONS seeded shuffles of the segment;
+ * a shift that a shuffle rarely matches is real, and both halves are
+ * searched again. Each side keeps at least ZAP__CHANGE_MIN_RUN values, so
+ * one noisy run does not become a change.
+ */
+#define ZAP__CHANGE_MIN_RUN 3
+
+// Largest |CUSUM| and where it is, over splits leaving MIN_RUN on each side
+static double zap__cusum_peak(const double* x, size_t n, size_t* split) {
+    double mean = zap_mean(x, n);
+    double s = 0.0, peak = 0.0;
+    *split = 0;
+    for (size_t k = 1; k < n; k++) {
+        s += x[k - 1] - mean;
+        if (k < ZAP__CHANGE_MIN_RUN || n - k < ZAP__CHANGE_MIN_RUN) continue;
+        if (fabs(s) > peak) {
+            peak = fabs(s);
+            *split = k;
+        }
+    }
+    return peak;
 }
 
-bool zap_baseline_load(zap_baseline_t* b, const char* path) {
-    FILE* f = fopen(path, "r");
-    if (!f) {
-        return false;  // File doesn't exist - not an error for comparison
+static void zap__change_segment(const double* values, size_t lo, size_t hi, double* scratch,
+                                uint64_t* rng, zap_change_point_t* out, size_t* count,
+                                size_t max) {
+    size_t n = hi - lo;
+    if (n < 2 * ZAP__CHANGE_MIN_RUN || *count >= max) return;
+
+    size_t split;
+    double peak = zap__cusum_peak(values + lo, n, &split);
+    if (split == 0 || peak <= 0) return;
+
+    memcpy(scratch, values + lo, n * sizeof(double));
+    size_t as_large = 0;
+    for (int r = 0; r < ZAP_CHANGE_PERMUTATIONS; r++) {
+        for (size_t i = n - 1; i > 0; i--) {  // Fisher-Yates
+            size_t j = (size_t)(zap__rand_next(rng) % (i + 1));
+            double t = scratch[i];
+            scratch[i] = scratch[j];
+            scratch[j] = t;
+        }
+        size_t unused;
+        if (zap__cusum_peak(scratch, n, &unused) >= peak) as_large++;
     }
+    double p = (as_large + 1.0) / (ZAP_CHANGE_PERMUTATIONS + 1.0);
+
+    double before = zap_mean(values + lo, split);
+    double after = zap_mean(values + lo + split, n - split);
+    double pct = before != 0 ? (after - before) / before * 100.0 : 0.0;
+    if (p >= ZAP_SIGNIFICANCE_ALPHA || fabs(pct) < ZAP_CHANGE_MIN_PCT) return;
+
+    zap_change_point_t* c = &out[(*count)++];
+    c->index = lo + split;
+    c->before = before;
+    c->after = after;
+    c->change_pct = pct;
+    c->p_value = p;
+    zap__change_segment(values, lo, lo + split, scratch, rng, out, count, max);
+    zap__change_segment(values, lo + split, hi, scratch, rng, out, count, max);
+}
 
-    char line[512];
+static int zap__change_cmp(const void* a, const void* b) {
+    size_t ia = ((const zap_change_point_t*)a)->index;
+    size_t ib = ((const zap_change_point_t*)b)->index;
+    return ia < ib ? -1 : ia > ib;
+}
 
-    // Check header
-    if (!fgets(line, sizeof(line), f)) {
-        fclose(f);
-        return false;
-    }
-    if (strncmp(line, "zap-baseline v1", 15) != 0) {
-        fprintf(stderr, "Error: Invalid baseline file format\n");
-        fclose(f);
+size_t zap_change_points(const double* values, size_t n,
+                         zap_change_point_t* out, size_t max) {
+    if (n < 2 * ZAP__CHANGE_MIN_RUN || max == 0) return 0;
+    double* scratch = (double*)malloc(n * sizeof(double));
+    if (!scratch) return 0;
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;  // Fixed seed: same history, same verdict
+    size_t count = 0;
+    zap__change_segment(values, 0, n, scratch, &rng, out, &count, max);
+    free(scratch);
+    qsort(out, count, sizeof(*out), zap__change_cmp);
+    return count;
+}
+
+// --changes: change points of every benchmark in the history matching --filter
+static bool zap__report_changes(void) {
+    zap_history_t h;
+    if (!zap_history_open(&h, zap_g_config.history_path)) {
+        fprintf(stderr, "Error: cannot read history '%s'\n", zap_g_config.history_path);
         return false;
     }
 
-    // Read entries
-    while (fgets(line, sizeof(line), f)) {
-        zap_baseline_entry_t e = {0};
-        char* p = line;
-
-        // Parse name
-        char* sep = strchr(p, '|');
-        if (!sep) continue;
-        size_t name_len = (size_t)(sep - p);
-        if (name_len >= sizeof(e.name)) name_len = sizeof(e.name) - 1;
-        memcpy(e.name, p, name_len);
-        e.name[name_len] = '\0';
-        p = sep + 1;
-
-        // Parse values
-        if (sscanf(p, "%lf|%lf|%lf|%lf", &e.mean, &e.std_dev,
-                   &e.ci_lower, &e.ci_upper) != 4) {
-            continue;
+    // Benchmarks in order of first appearance
+    zap_baseline_t names;
+    zap_baseline_init(&names);
+    for (size_t i = 0; i < h.run_count; i++) {
+        const unsigned char* seg = (const unsigned char*)h.runs[i].segment;
+        const zap__hist_key_t* keys = (const zap__hist_key_t*)(seg + sizeof(zap__hist_run_t));
+        for (size_t k = 0; k < h.runs[i].bench_count; k++) {
+            uint64_t off = keys[k].offset;
+            if (off % 8 != 0 || off > h.runs[i].segment_size ||
+                h.runs[i].segment_size - off < sizeof(zap__hist_bench_t)) {
+                continue;
+            }
+            const zap__hist_bench_t* b = (const zap__hist_bench_t*)(seg + off);
+            if (b->name_len >= h.runs[i].segment_size - off - sizeof(*b)) continue;
+            zap__baseline_upsert(&names, (const char*)(b + 1), b->name_len, false);
         }
+    }
 
-        // Add to baseline
-        if (b->count >= b->capacity) {
-            b->capacity = b->capacity ? b->capacity * 2 : 64;
-            b->entries = (zap_baseline_entry_t*)realloc(
-                b->entries, b->capacity * sizeof(zap_baseline_entry_t));
+    if (!zap_g_config.json_output) {
+        printf("%s%sChange points%s in %s%s%s (%zu runs)\n\n", zap__c_bold(), zap__c_purple(),
+               zap__c_reset(), zap__c_cyan(), zap_g_config.history_path, zap__c_reset(),
+               h.run_count);
+    }
+    zap_history_point_t* points = (zap_history_point_t*)malloc(
+        (h.run_count > 0 ? h.run_count : 1) * sizeof(zap_history_point_t));
+    double* medians = (double*)malloc((h.run_count > 0 ? h.run_count : 1) * sizeof(double));
+    size_t slowdowns = 0;
+    for (size_t e = 0; points && medians && e < names.count; e++) {
+        const char* name = names.entries[e].name;
+        if (!zap_matches_filter(name, zap_g_config.filter)) continue;
+        size_t n = zap_history_series(&h, name, points, h.run_count);
+        for (size_t i = 0; i < n; i++) medians[i] = points[i].median;
+
+        zap_change_point_t cps[ZAP_MAX_CHANGE_POINTS];
+        size_t found = zap_change_points(medians, n, cps, ZAP_MAX_CHANGE_POINTS);
+        for (size_t c = 0; c < found; c++) {
+            const zap_history_run_t* run = &h.runs[points[cps[c].index].run];
+            bool slower = cps[c].change_pct > 0;
+            if (slower) slowdowns++;
+            if (zap_g_config.json_output) {
+                printf("{\"type\":\"change_point\",\"name\":\"%s\",\"commit\":\"%s\","
+                       "\"timestamp\":%lld,\"run\":%zu,\"before_ns\":%.6g,\"after_ns\":%.6g,"
+                       "\"change_pct\":%.4f,\"p_value\":%.6f}\n",
+                       name, run->commit, (long long)run->timestamp,
+                       points[cps[c].index].run, cps[c].before, cps[c].after,
+                       cps[c].change_pct, cps[c].p_value);
+                continue;
+            }
+            char before[32], after[32];
+            zap__format_time(cps[c].before, before, sizeof(before));
+            zap__format_time(cps[c].after, after, sizeof(after));
+            printf("%s%s%s: %s%s %.1f%%%s at %s%.12s%s (run %zu of %zu, p=%.3f)\n",
+                   zap__c_bold(), name, zap__c_reset(),
+                   slower ? zap__c_red() : zap__c_green(), slower ? "slower" : "faster",
+                   fabs(cps[c].change_pct), zap__c_reset(), zap__c_cyan(),
+                   run->commit[0] ? run->commit : "(no commit)", zap__c_reset(),
+                   points[cps[c].index].run + 1, h.run_count, cps[c].p_value);
+            printf("  %s -> %s\n", before, after);
         }
-        b->entries[b->count++] = e;
     }
-
-    fclose(f);
     if (!zap_g_config.json_output) {
-        printf("%sLoaded baseline:%s %s%s%s (%zu entries)\n\n",
-               zap__c_purple(), zap__c_reset(),
-               zap__c_cyan(), path, zap__c_reset(), b->count);
+        printf("%s%zu slowdown%s found%s\n", slowdowns ? zap__c_red() : zap__c_dim(),
+               slowdowns, slowdowns == 1 ? "" : "s", zap__c_reset());
     }
+    free(points);
+    free(medians);
+    zap_baseline_free(&names);
+    zap_history_close(&h);
     return true;
 }
 
@@ -1819,10 +8581,16 @@ bool zap_baseline_load(zap_baseline_t* b, const char* path) {
 
 zap_comparison_t zap_compare(const zap_baseline_entry_t* baseline,
                                          const zap_stats_t* current) {
+    return zap_compare_with(baseline, current, zap_g_config.stat_test);
+}
+
+zap_comparison_t zap_compare_with(const zap_baseline_entry_t* baseline,
+                                  const zap_stats_t* current, zap_stat_test_t test) {
     zap_comparison_t cmp = {0};
 
     cmp.old_mean = baseline->mean;
     cmp.new_mean = current->mean;
+    cmp.baseline = baseline;
 
     // Calculate percentage change (negative = improvement/faster)
     if (baseline->mean > 0) {
@@ -1838,6 +8606,29 @@ zap_comparison_t zap_compare(const zap_baseline_entry_t* baseline,
                         current->ci_lower > baseline->ci_upper);
 
     cmp.significant = !ci_overlap;
+    cmp.test = ZAP_TEST_CI;
+
+    /*
+     * With raw samples on both sides (binary baselines), use a proper
+     * two-sample test instead; text baselines fall back to CI overlap.
+     */
+    bool have_samples = baseline->samples && baseline->sample_count >= 2 &&
+                        current->samples && current->sample_count >= 2;
+    if (test != ZAP_TEST_CI && have_samples) {
+        const double* a = baseline->samples;
+        const double* b = current->samples;
+        size_t na = baseline->sample_count, nb = current->sample_count;
+        if (test == ZAP_TEST_WELCH) {
+            cmp.p_value = zap_welch_test(a, na, b, nb, &cmp.effect_size);
+        } else if (test == ZAP_TEST_MWU) {
+            cmp.p_value = zap_mann_whitney_test(a, na, b, nb, &cmp.effect_size);
+        } else {
+            cmp.p_value = zap_bootstrap_test(a, na, b, nb, ZAP_BOOTSTRAP_RESAMPLES,
+                                             &cmp.effect_size);
+        }
+        cmp.test = test;
+        cmp.significant = cmp.p_value < ZAP_SIGNIFICANCE_ALPHA;
+    }
 
     // Determine direction of change
     if (!cmp.significant || fabs(cmp.change_pct) < 1.0) {
@@ -1848,9 +8639,46 @@ zap_comparison_t zap_compare(const zap_baseline_entry_t* baseline,
         cmp.change = ZAP_REGRESSED;
     }
 
+    /*
+     * Gated metrics (allocations, ...) are near-deterministic, so any
+     * increase past a small absolute floor counts, including 0 -> 1 alloc.
+     * Higher-is-better custom counters regress when they drop instead.
+     */
+    for (size_t i = 0; i < current->metric_count; i++) {
+        const zap_metric_t* m = &current->metrics[i];
+        if (!(m->flags & ZAP_METRIC_GATED)) continue;
+        const zap_metric_t* old = zap_find_metric(baseline->metrics, baseline->metric_count, m->name);
+        if (!old) continue;
+
+        double pct;
+        if (m->flags & ZAP_METRIC_HIGHER) {
+            if (old->value <= 0 || m->value >= old->value) continue;
+            pct = (old->value - m->value) / old->value * 100.0;
+        } else {
+            double floor = (m->flags & ZAP_METRIC_BYTES) ? 1.0 : 0.01;
+            if (m->value <= old->value + floor) continue;
+            pct = old->value > 0 ? (m->value - old->value) / old->value * 100.0 : INFINITY;
+        }
+        if (pct < 1.0) continue;
+
+        if (!cmp.metric_regressed || pct > cmp.metric_change_pct) {
+            cmp.metric_regressed = true;
+            cmp.metric_change_pct = pct;
+            strncpy(cmp.metric_name, m->name, sizeof(cmp.metric_name) - 1);
+        }
+    }
+
     return cmp;
 }
 
+// Whether a comparison trips --fail-threshold (time or gated metric)
+static bool zap__exceeds_threshold(const zap_comparison_t* cmp) {
+    double threshold = zap_g_config.fail_threshold;
+    if (threshold <= 0.0) return false;
+    if (cmp->change == ZAP_REGRESSED && cmp->change_pct > threshold) return true;
+    return cmp->metric_regressed && cmp->metric_change_pct > threshold;
+}
+
 static double zap__speedup(double old_mean, double new_mean) {
     return (new_mean > 0) ? (old_mean / new_mean) : 1.0;
 }
@@ -1891,8 +8719,10 @@ void zap_report_comparison(const char* name, const zap_stats_t* stats,
     printf("%s%s%s:%s\n", zap__c_bold(), zap__c_magenta(), name, zap__c_reset());
 
     // Sample info line with median
-    printf("  %zu samples \303\227 %zu evals, median: %s%s%s\n",
-           stats->sample_count, stats->iterations,
+    char evals_buf[48];
+    zap__format_evals(stats, evals_buf, sizeof(evals_buf));
+    printf("  %zu samples \303\227 %s, median: %s%s%s\n",
+           stats->sample_count, evals_buf,
            zap__c_cyan(), median_buf, zap__c_reset());
 
     // Time (mean ± σ)
@@ -1903,6 +8733,10 @@ void zap_report_comparison(const char* name, const zap_stats_t* stats,
     // Range (min … max) using ellipsis character
     printf("  %sRange (min \342\200\246 max):%s  %s \342\200\246 %s\n",
            zap__c_dim(), zap__c_reset(), min_buf, max_buf);
+    zap__print_precision(stats, "  ");
+    zap__print_fit(stats, "  ");
+    zap__print_latency(stats, "  ");
+    zap__print_rate(stats, "  ");
 
     // Percentiles (only with --percentiles flag)
     if (zap_g_config.show_percentiles) {
@@ -1918,23 +8752,31 @@ void zap_report_comparison(const char* name, const zap_stats_t* stats,
 
     // Throughput if set
     if (stats->throughput_type != ZAP_THROUGHPUT_NONE && stats->throughput_value > 0) {
-        char tput_buf[32];
+        char tput_buf[32], peak_buf[64];
         zap__format_throughput(stats->mean, stats->throughput_value,
                                stats->throughput_type, tput_buf, sizeof(tput_buf));
-        printf("  %sThroughput:%s        %s%s%s\n",
+        zap__format_roofline(stats, peak_buf, sizeof(peak_buf));
+        printf("  %sThroughput:%s        %s%s%s%s\n",
                zap__c_dim(), zap__c_reset(),
-               zap__c_cyan(), tput_buf, zap__c_reset());
+               zap__c_cyan(), tput_buf, zap__c_reset(), peak_buf);
     }
 
+    // Hardware counters / memory, with change against the baseline
+    zap__print_metrics(stats, cmp->baseline, "  ");
+    zap__print_overhead(stats, "  ");
+    zap__print_loop_cost(stats, "  ");
+
     // Show comparison as speedup ratio (old_mean / new_mean)
     const char* change_color;
     const char* change_text;
     zap__change_style(cmp->change, &change_color, &change_text);
     double ratio = zap__speedup(cmp->old_mean, cmp->new_mean);
 
-    printf("  %sBaseline:%s          %s%.2fx %s%s (was %s)\n",
+    char test_buf[48];
+    zap__format_test(cmp, test_buf, sizeof(test_buf));
+    printf("  %sBaseline:%s          %s%.2fx %s%s (was %s%s)\n",
            zap__c_dim(), zap__c_reset(),
-           change_color, ratio, change_text, zap__c_reset(), old_mean_buf);
+           change_color, ratio, change_text, zap__c_reset(), old_mean_buf, test_buf);
 
     // Outliers if any
     size_t total_outliers = stats->outliers_low + stats->outliers_high;
@@ -1943,9 +8785,13 @@ void zap_report_comparison(const char* name, const zap_stats_t* stats,
                zap__c_dim(), zap__c_reset(),
                zap__c_yellow(), stats->outliers_low, stats->outliers_high, zap__c_reset());
     }
+    zap__print_freq(stats, "  ");
 
     // Histogram (only with --histogram flag)
-    if (zap_g_config.show_histogram && stats->samples && stats->sample_count > 1) {
+    if (zap_g_config.show_histogram && stats->latency) {
+        printf("\n");
+        zap__print_latency_histogram(stats);
+    } else if (zap_g_config.show_histogram && stats->samples && stats->sample_count > 1) {
         printf("\n");
         zap__print_histogram(stats->samples, stats->sample_count,
                                    stats->min, stats->max);
@@ -1960,6 +8806,9 @@ void zap_report_json(const char* name, const zap_stats_t* stats,
     zap_status_clear();
 
     printf("{\"name\":\"%s\"", name);
+    if (zap__json_group && zap__json_group[0]) {
+        printf(",\"group\":\"%s\"", zap__json_group);
+    }
     printf(",\"samples\":%zu", stats->sample_count);
     printf(",\"iterations\":%zu", stats->iterations);
     printf(",\"mean_ns\":%.6f", stats->mean);
@@ -1975,15 +8824,57 @@ void zap_report_json(const char* name, const zap_stats_t* stats,
     printf(",\"ci_upper_ns\":%.6f", stats->ci_upper);
     printf(",\"outliers_low\":%zu", stats->outliers_low);
     printf(",\"outliers_high\":%zu", stats->outliers_high);
+    printf(",\"overhead_ns\":%.6f", stats->overhead_ns);
+    printf(",\"stop_reason\":\"%s\"", zap__stop_reason_name(stats->stop_reason));
+    printf(",\"precision_pct\":%.4f", stats->precision_pct);
+    if (stats->cold_cache) {
+        printf(",\"cache\":\"cold\"");
+    }
+    if (stats->unroll > 0) {
+        printf(",\"unroll\":%u,\"loop_ns\":%.6f", stats->unroll, stats->loop_ns);
+    }
+    if (stats->sampling == ZAP_SAMPLING_LINEAR) {
+        printf(",\"sampling\":\"linear\"");
+        printf(",\"slope_ns\":%.6f", stats->slope);
+        printf(",\"intercept_ns\":%.6f", stats->intercept);
+        printf(",\"r_squared\":%.6f", stats->r_squared);
+    }
+    if (stats->latency_count > 0) {
+        printf(",\"latency\":{\"ops\":%llu", (unsigned long long)stats->latency_count);
+        printf(",\"p50_ns\":%.6f", stats->latency_p50);
+        printf(",\"p99_ns\":%.6f", stats->latency_p99);
+        printf(",\"p999_ns\":%.6f", stats->latency_p999);
+        printf(",\"p9999_ns\":%.6f", stats->latency_p9999);
+        printf(",\"max_ns\":%.6f}", stats->latency_max);
+    }
+    if (stats->target_rate > 0) {
+        printf(",\"rate\":{\"target_per_s\":%.2f,\"achieved_per_s\":%.2f}",
+               stats->target_rate, stats->achieved_rate);
+    }
+    if (stats->freq_source != ZAP_FREQ_NONE) {
+        printf(",\"frequency\":{\"source\":\"%s\",\"mean_ratio\":%.4f,\"min_ratio\":%.4f"
+               ",\"rejected\":%zu}", zap__freq_source_name(stats->freq_source),
+               stats->freq_mean, stats->freq_min, stats->freq_rejected);
+    }
 
     // Throughput if set
     if (stats->throughput_type != ZAP_THROUGHPUT_NONE && stats->throughput_value > 0) {
         double per_sec = (double)stats->throughput_value * 1e9 / stats->mean;
         printf(",\"throughput\":{");
-        printf("\"type\":\"%s\"",
-               stats->throughput_type == ZAP_THROUGHPUT_BYTES ? "bytes" : "elements");
+        printf("\"type\":\"%s\"", zap__throughput_name(stats->throughput_type));
         printf(",\"value_per_iter\":%zu", stats->throughput_value);
         printf(",\"per_second\":%.2f", per_sec);
+        zap__print_roofline_json(stats);
+        printf("}");
+    }
+
+    // Per-iteration metrics if collected
+    if (stats->metric_count > 0) {
+        printf(",\"metrics\":{");
+        for (size_t i = 0; i < stats->metric_count; i++) {
+            printf("%s\"%s\":%.6f", i > 0 ? "," : "",
+                   stats->metrics[i].name, stats->metrics[i].value);
+        }
         printf("}");
     }
 
@@ -1993,9 +8884,13 @@ void zap_report_json(const char* name, const zap_stats_t* stats,
         printf(",\"change_pct\":%.4f", fabs(cmp->change_pct));
         printf(",\"speedup\":%.4f", zap__speedup(cmp->old_mean, cmp->new_mean));
         printf(",\"significant\":%s", cmp->significant ? "true" : "false");
+        zap__print_test_json(cmp);
         printf(",\"status\":\"%s\"",
                cmp->change == ZAP_IMPROVED ? "improved" :
                cmp->change == ZAP_REGRESSED ? "regressed" : "unchanged");
+        if (cmp->metric_regressed) {
+            printf(",\"regressed_metric\":\"%s\"", cmp->metric_name);
+        }
         printf("}");
     }
 
@@ -2072,6 +8967,11 @@ bool zap_group_matches_tags(const zap_runtime_group_t* g) {
     return false;
 }
 
+size_t zap_shard_of(const char* key, size_t shard_count) {
+    if (shard_count <= 1) return 0;
+    return (size_t)(zap__hash_name(key, strlen(key)) % shard_count);
+}
+
 /* CLI ARGUMENT PARSING */
 
 // Parse time duration string like "2s", "500ms", "100us" into nanoseconds
@@ -2100,10 +9000,66 @@ static uint64_t zap__parse_duration(const char* str) {
     return (uint64_t)(value * 1e9);
 }
 
+// "200k/s", "1.5M", "50k,100k,200k/s" into cli_rates
+static bool zap__parse_rates(const char* str) {
+    zap_g_config.cli_rate_count = 0;
+    const char* p = str;
+    while (*p) {
+        char* end;
+        double rate = strtod(p, &end);
+        if (end == p) return false;
+        if (*end == 'k' || *end == 'K') {
+            rate *= 1e3;
+            end++;
+        } else if (*end == 'M') {
+            rate *= 1e6;
+            end++;
+        } else if (*end == 'G') {
+            rate *= 1e9;
+            end++;
+        }
+        if (strncmp(end, "/s", 2) == 0) end += 2;
+        if (rate <= 0 || (*end != ',' && *end != '\0')) return false;
+        if (zap_g_config.cli_rate_count >= ZAP_MAX_RATES) return false;
+        zap_g_config.cli_rates[zap_g_config.cli_rate_count++] = rate;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return zap_g_config.cli_rate_count > 0;
+}
+
+// --perf-ctl: perf record --control spec, fd:CTL[,ACK] or fifo:CTL[,ACK]
+static bool zap__parse_perf_ctl(const char* spec) {
+    zap_g_config.perf_ack_fd = -1;
+    if (strncmp(spec, "fd:", 3) == 0) {
+        char* end;
+        long ctl = strtol(spec + 3, &end, 10);
+        if (end == spec + 3 || ctl < 0) return false;
+        zap_g_config.perf_ctl_fd = (int)ctl;
+        if (*end == ',') {
+            const char* ack_str = end + 1;
+            long ack = strtol(ack_str, &end, 10);
+            if (end == ack_str || ack < 0) return false;
+            zap_g_config.perf_ack_fd = (int)ack;
+        }
+        return *end == '\0';
+    }
+    if (strncmp(spec, "fifo:", 5) == 0) {
+        char ctl[512];
+        snprintf(ctl, sizeof(ctl), "%s", spec + 5);
+        char* ack = strchr(ctl, ',');
+        if (ack) *ack++ = '\0';
+        zap_g_config.perf_ctl_fd = open(ctl, O_WRONLY);
+        if (zap_g_config.perf_ctl_fd < 0) return false;
+        if (ack && *ack) zap_g_config.perf_ack_fd = open(ack, O_RDONLY);
+        return true;
+    }
+    return false;
+}
+
 static bool zap__finalized = false;
 static int zap__exit_code = 0;
 
-static int zap_finalize(void) {
+int zap_finalize(void) {
     // Ensure idempotence - only run once
     if (zap__finalized) {
         return zap__exit_code;
@@ -2114,20 +9070,49 @@ static int zap_finalize(void) {
     if (zap_g_config.dry_run) {
         return 0;
     }
+    zap__jobs_drain();
+
+    // A shard saves only what it measured, next to the baseline it compared
+    // against, so --merge can combine the shards without stale entries
+    const zap_baseline_t* results = &zap_g_config.baseline;
+    const char* save_path = zap_g_config.baseline_path;
+    char shard_path[1024];
+    if (zap_g_config.shard_count > 0) {
+        snprintf(shard_path, sizeof(shard_path), "%s.shard-%zu-of-%zu",
+                 zap_g_config.baseline_path, zap_g_config.shard_index + 1,
+                 zap_g_config.shard_count);
+        results = &zap_g_config.shard_results;
+        save_path = shard_path;
+    }
 
     // Save baseline if requested
-    if (zap_g_config.save_baseline && zap_g_config.baseline.count > 0) {
-        if (zap_baseline_save(&zap_g_config.baseline,
-                                    zap_g_config.baseline_path)) {
-            // Only print message for explicit path, not auto-save
-            if (!zap_g_config.json_output && zap_g_config.explicit_path) {
+    if (zap_g_config.save_baseline && zap_baseline_size(results) > 0) {
+        // Keep the loaded file's format unless --baseline-format says otherwise
+        zap_baseline_format_t format = zap_g_config.cli_baseline_format_set
+            ? zap_g_config.cli_baseline_format : zap_g_config.baseline.format;
+        bool saved = format == ZAP_BASELINE_BINARY
+            ? zap_baseline_save_binary(results, save_path)
+            : zap_baseline_save(results, save_path);
+        if (saved) {
+            // Only print message for explicit path or a shard, not auto-save
+            if (!zap_g_config.json_output &&
+                (zap_g_config.explicit_path || zap_g_config.shard_count > 0)) {
                 printf("%sBaseline saved to:%s %s%s%s\n",
                        zap__c_purple(), zap__c_reset(),
-                       zap__c_cyan(), zap_g_config.baseline_path, zap__c_reset());
+                       zap__c_cyan(), save_path, zap__c_reset());
             }
         }
     }
 
+    // Append this run, raw samples included, to the history
+    if (zap_g_config.save_baseline && zap_g_config.history &&
+        zap_g_config.run_results.count > 0) {
+        char commit[48];
+        zap_git_commit(commit, sizeof(commit));
+        zap_history_append(zap_g_config.history_path, &zap_g_config.env, commit,
+                           &zap_g_config.run_results);
+    }
+
     // Check for regressions beyond threshold
     if (zap_g_config.has_regression) {
         if (!zap_g_config.json_output) {
@@ -2135,13 +9120,27 @@ static int zap_finalize(void) {
                     zap__c_red(), zap_g_config.fail_threshold, zap__c_reset());
         }
     }
+    if (zap_g_config.has_failure && !zap_g_config.json_output) {
+        fprintf(stderr, "%sError: One or more benchmarks failed%s\n",
+                zap__c_red(), zap__c_reset());
+    }
 
     // Cleanup
     if (zap_g_config.baseline.entries) {
         zap_baseline_free(&zap_g_config.baseline);
     }
+    if (zap_g_config.shard_results.entries) {
+        zap_baseline_free(&zap_g_config.shard_results);
+    }
+    if (zap_g_config.run_results.entries) {
+        zap_baseline_free(&zap_g_config.run_results);
+    }
+    free(zap__evict_buf);
+    zap__evict_buf = NULL;
+    zap__evict_size = 0;
+    zap__hw_close();
 
-    zap__exit_code = zap_g_config.has_regression ? 1 : 0;
+    zap__exit_code = zap_g_config.has_regression || zap_g_config.has_failure ? 1 : 0;
     return zap__exit_code;
 }
 
@@ -2156,6 +9155,8 @@ static void zap__print_help(const char* default_baseline) {
     printf("                          Without wildcards, matches substring\n");
     printf("  -t, --tag TAG           Only run benchmarks in groups with TAG\n");
     printf("                          Can be specified multiple times (OR logic)\n");
+    printf("  --shard I/N             Run only shard I of N (1-based, stable per name);\n");
+    printf("                          results are saved to <baseline>.shard-I-of-N\n");
     printf("  --json                  Output results as JSON (one object per line)\n");
     printf("  --fail-threshold PCT    Exit with code 1 if regression exceeds PCT%%\n");
     printf("  --baseline [FILE]       Use specific baseline file (default: %s)\n",
@@ -2163,18 +9164,63 @@ static void zap__print_help(const char* default_baseline) {
     printf("  --save-baseline [FILE]  Alias for --baseline\n");
     printf("  --compare [FILE]        Alias for --baseline\n");
     printf("  --no-save               Don't save results to baseline\n");
+    printf("  --baseline-format FMT   Write text (v1) or binary (v2, keeps raw samples)\n");
+    printf("                          (default: format of the loaded file)\n");
+    printf("  --stat-test TEST        Change test: ci (default), welch, mwu, bootstrap\n");
+    printf("                          (sample tests need a binary baseline)\n");
     printf("  --no-compare            Don't compare against baseline\n");
+    printf("  --merge FILE            Merge baselines or --json output into --baseline FILE\n");
+    printf("                          and exit (repeatable, later files win)\n");
+    printf("  --history-path FILE     Append saved runs with raw samples to FILE\n");
+    printf("                          (default: %s)\n", ZAP_HISTORY_PATH);
+    printf("  --no-history            Don't append this run to the history\n");
+    printf("  --changes               Report change points per benchmark in the history\n");
+    printf("                          (slowdowns with the commit they started at) and exit\n");
     printf("  --color=MODE            Color output: auto (default), always, never\n");
     printf("\nMeasurement options:\n");
     printf("  --samples N             Number of samples to collect (default: 100)\n");
     printf("  --warmup TIME           Warmup duration (default: 1s)\n");
     printf("  --time TIME             Measurement duration (default: 3s)\n");
     printf("  --min-iters N           Minimum iterations per sample\n");
+    printf("  --target-precision PCT  Stop early once the 95%% CI is within PCT%% of the mean\n");
+    printf("                          (--samples and --time remain upper bounds)\n");
+    printf("  --sampling MODE         flat (same evals per sample) or linear (k*d, OLS slope)\n");
+    printf("  --cache-mode MODE       warm (default), cold (evict before each sample) or both\n");
+    printf("  --isolate               Run each benchmark in a forked child process\n");
+    printf("  --jobs N                Run up to N isolated benchmarks at once, each pinned\n");
+    printf("                          to its own physical core (SMT siblings excluded)\n");
+    printf("  --rate R[,R...]         Open loop: start ZAP_ITER_LATENCY ops on a fixed\n");
+    printf("                          schedule (e.g. 200k/s) and time them from their\n");
+    printf("                          intended start; several rates sweep for the knee\n");
+    printf("  --timer KIND            Sample timer: clock (default) or tsc\n");
+    printf("  --overhead-correction   Subtract the per-batch timer overhead from samples\n");
     printf("                          TIME formats: 5s, 500ms, 100us, 1m\n");
+    printf("\nProfiling options:\n");
+    printf("  --profile PATTERN       Run matching loops for a fixed budget under a profiler\n");
+    printf("                          (no statistics, baseline or comparison)\n");
+    printf("  --profile-time TIME     Budget per profiled loop (default: 10s)\n");
+    printf("  --profile-iters N       Budget in iterations instead of time\n");
+    printf("  --perf-ctl SPEC         Enable perf record only while measuring; SPEC is what\n");
+    printf("                          was passed to perf record --control (fd:N,M or fifo:A,B)\n");
+    printf("\nEnvironment options:\n");
+    printf("  --pin-cpu N             Pin the process to CPU N (also ZAP_PIN_CPU=N, Linux)\n");
+    printf("  --realtime              Run under SCHED_FIFO (needs privileges)\n");
+    printf("  --nice N                Change the process nice value by N\n");
+    printf("  --strict-env            Refuse to run on a noisy machine (governor, turbo,\n");
+    printf("                          SMT sibling, load); default is to warn\n");
+    printf("  --freq-monitor          Tag each sample with the effective CPU frequency\n");
+    printf("  --min-freq-ratio R      Drop and rerun samples below R x nominal frequency\n");
+    printf("                          (default: %.2f, 0 = keep all; implies --freq-monitor)\n",
+           ZAP_DEFAULT_MIN_FREQ_RATIO);
     printf("\nOutput options:\n");
     printf("  --env                   Show environment info (CPU, OS, SIMD)\n");
+    printf("  --roofline              Show throughput as %% of the machine peak; peaks are\n");
+    printf("                          measured once per host and cached in %s\n", ZAP_MACHINE_PATH);
     printf("  --histogram             Show distribution histograms\n");
     printf("  --percentiles           Show p75/p90/p95/p99 percentiles\n");
+    printf("  --counters              Sample hardware counters per batch (Linux perf)\n");
+    printf("  --counter-event HEX     Add a raw perf event to --counters (repeatable)\n");
+    printf("  --no-alloc-tracking     Skip allocation counting (ZAP_TRACK_ALLOC builds)\n");
     printf("\nOther options:\n");
     printf("  --dry-run, --list       List benchmarks without running them\n");
     printf("  -h, --help              Show this help\n");
@@ -2196,11 +9242,25 @@ typedef enum {
     ZAP_OPT_STRING,
     ZAP_OPT_SIZE,
     ZAP_OPT_U64,
+    ZAP_OPT_INT,
     ZAP_OPT_DOUBLE,
     ZAP_OPT_DURATION,
     ZAP_OPT_PATH,     // optional string arg, sets explicit_path
     ZAP_OPT_TAG,      // special: multi-value tag
     ZAP_OPT_COLOR,    // special: --color=MODE
+    ZAP_OPT_EVENT,    // special: multi-value raw perf event
+    ZAP_OPT_TIMER,    // special: timer backend name
+    ZAP_OPT_SAMPLING, // special: sampling mode name
+    ZAP_OPT_CACHE_MODE, // special: warm, cold or both
+    ZAP_OPT_BASELINE_FORMAT, // special: text or binary
+    ZAP_OPT_STAT_TEST, // special: comparison test name
+    ZAP_OPT_SHARD,    // special: I/N
+    ZAP_OPT_RATE,     // special: comma-separated ops/s
+    ZAP_OPT_MERGE,    // special: multi-value merge input
+    ZAP_OPT_FREQ_RATIO, // special: --min-freq-ratio, implies --freq-monitor
+    ZAP_OPT_PROFILE,  // special: --profile PATTERN, sets the filter
+    ZAP_OPT_HISTORY_PATH, // special: --history-path FILE, enables the history
+    ZAP_OPT_PERF_CTL, // special: fd:CTL[,ACK] or fifo:CTL[,ACK]
     ZAP_OPT_HELP      // special: print help
 } zap__opt_type_t;
 
@@ -2218,6 +9278,72 @@ static bool zap__match_opt(const char* arg, const zap__opt_t* opt) {
     return false;
 }
 
+// Apply --pin-cpu, --realtime and --nice; failures only warn
+static void zap__apply_sched(void) {
+    if (zap_g_config.pin_cpu >= 0 && !zap__pin_thread(zap_g_config.pin_cpu)) {
+        fprintf(stderr, "Warning: cannot pin to cpu %d\n", zap_g_config.pin_cpu);
+    }
+    if (zap_g_config.realtime) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+            fprintf(stderr, "Warning: cannot switch to SCHED_FIFO: %s\n", strerror(err));
+        }
+    }
+    if (zap_g_config.nice != 0) {
+        errno = 0;
+        int current = getpriority(PRIO_PROCESS, 0);
+        if (errno != 0 || setpriority(PRIO_PROCESS, 0, current + zap_g_config.nice) != 0) {
+            fprintf(stderr, "Warning: cannot change nice value by %d: %s\n",
+                    zap_g_config.nice, strerror(errno));
+        }
+    }
+}
+
+// Warn about a noisy environment, or exit under --strict-env
+static void zap__check_noise(const zap_env_t* env) {
+    if (env->noise_count == 0) return;
+    bool strict = zap_g_config.strict_env;
+    if (!zap_g_config.json_output || strict) {
+        fprintf(stderr, "%s%s: noisy environment%s\n",
+                strict ? zap__c_red() : zap__c_yellow(),
+                strict ? "Error" : "Warning", zap__c_reset());
+        for (size_t i = 0; i < env->noise_count; i++) {
+            fprintf(stderr, "  - %s\n", env->noise[i]);
+        }
+    }
+    if (strict) {
+        fprintf(stderr, "Refusing to run with --strict-env\n");
+        exit(1);
+    }
+}
+
+// --merge: combine shard baselines and --json results into --baseline FILE
+static bool zap__merge_baselines(void) {
+    zap_baseline_t merged;
+    zap_baseline_init(&merged);
+    bool ok = true;
+    for (size_t i = 0; i < zap_g_config.merge_count; i++) {
+        ok = zap_baseline_merge_file(&merged, zap_g_config.merge_paths[i]) && ok;
+    }
+    if (ok) {
+        zap_baseline_format_t format = zap_g_config.cli_baseline_format_set
+            ? zap_g_config.cli_baseline_format : merged.format;
+        ok = format == ZAP_BASELINE_BINARY
+            ? zap_baseline_save_binary(&merged, zap_g_config.baseline_path)
+            : zap_baseline_save(&merged, zap_g_config.baseline_path);
+    }
+    if (ok && !zap_g_config.json_output) {
+        printf("%sMerged %zu files (%zu entries) into:%s %s%s%s\n",
+               zap__c_purple(), zap_g_config.merge_count, merged.count, zap__c_reset(),
+               zap__c_cyan(), zap_g_config.baseline_path, zap__c_reset());
+    }
+    zap_baseline_free(&merged);
+    return ok;
+}
+
 void zap_parse_args(int argc, char** argv) {
     const char* default_baseline = ".zap/baseline";
 
@@ -2229,6 +9355,7 @@ void zap_parse_args(int argc, char** argv) {
     zap_g_config.compare = true;
     zap_g_config.json_output = false;
     zap_g_config.has_regression = false;
+    zap_g_config.has_failure = false;
     zap_g_config.color_mode = (zap_color_mode_t)ZAP_DEFAULT_COLOR_MODE;
     zap_g_config.dry_run = false;
     zap_g_config.show_env = ZAP_DEFAULT_SHOW_ENV;
@@ -2238,7 +9365,46 @@ void zap_parse_args(int argc, char** argv) {
     zap_g_config.cli_warmup_ns = 0;
     zap_g_config.cli_time_ns = 0;
     zap_g_config.cli_min_iters = ZAP_DEFAULT_MIN_ITERS;
+    zap_g_config.cli_target_precision = 0.0;
+    zap_g_config.cli_sampling_set = false;
+    zap_g_config.cli_cache_mode_set = false;
+    zap_g_config.cli_rate_count = 0;
+    zap_g_config.cli_baseline_format_set = false;
+    zap_g_config.stat_test = (zap_stat_test_t)ZAP_DEFAULT_STAT_TEST;
     zap_g_config.cli_tag_count = 0;
+    zap_g_config.timer = (zap_timer_kind_t)ZAP_DEFAULT_TIMER;
+    zap_g_config.overhead_correction = ZAP_DEFAULT_OVERHEAD_CORRECTION;
+    zap_g_config.hw_counters = ZAP_DEFAULT_HW_COUNTERS;
+    zap_g_config.cli_raw_event_count = 0;
+    zap_g_config.track_alloc = zap__alloc_supported();
+    zap_g_config.pin_cpu = ZAP_DEFAULT_PIN_CPU;
+    zap_g_config.realtime = false;
+    zap_g_config.nice = 0;
+    zap_g_config.strict_env = false;
+    zap_g_config.freq_monitor = ZAP_DEFAULT_FREQ_MONITOR;
+    zap_g_config.min_freq_ratio = ZAP_DEFAULT_MIN_FREQ_RATIO;
+    zap_g_config.roofline = false;
+    zap_g_config.machine_valid = false;
+    zap_g_config.isolate = false;
+    zap_g_config.jobs = 0;
+    zap_g_config.shard_index = 0;
+    zap_g_config.shard_count = 0;
+    zap_g_config.merge_count = 0;
+    zap_g_config.history = ZAP_DEFAULT_HISTORY;
+    zap_g_config.history_path = ZAP_HISTORY_PATH;
+    zap_g_config.show_changes = false;
+    zap_g_config.profile = false;
+    zap_g_config.profile_time_ns = ZAP_DEFAULT_PROFILE_TIME_NS;
+    zap_g_config.profile_iters = 0;
+    zap_g_config.perf_ctl = false;
+    zap_g_config.perf_ctl_fd = -1;
+    zap_g_config.perf_ack_fd = -1;
+
+    // Environment variable comes before the command line, which wins
+    const char* pin_env = getenv("ZAP_PIN_CPU");
+    if (pin_env && *pin_env) {
+        zap_g_config.pin_cpu = atoi(pin_env);
+    }
 
     // Option table
     const zap__opt_t opts[] = {
@@ -2249,102 +9415,335 @@ void zap_parse_args(int argc, char** argv) {
         {"--compare",        NULL, ZAP_OPT_PATH,     &zap_g_config.baseline_path,    NULL},
         {"--save-baseline",  NULL, ZAP_OPT_PATH,     &zap_g_config.baseline_path,    NULL},
         {"--no-save",        NULL, ZAP_OPT_FLAG,     &zap_g_config.save_baseline,    NULL},
+        {"--baseline-format", NULL, ZAP_OPT_BASELINE_FORMAT, NULL,                   "format (text, binary)"},
+        {"--stat-test",      NULL, ZAP_OPT_STAT_TEST, NULL,                          "test (ci, welch, mwu, bootstrap)"},
         {"--no-compare",     NULL, ZAP_OPT_FLAG,     &zap_g_config.compare,          NULL},
         {"--samples",        NULL, ZAP_OPT_SIZE,     &zap_g_config.cli_samples,      "number"},
         {"--warmup",         NULL, ZAP_OPT_DURATION, &zap_g_config.cli_warmup_ns,    "duration"},
         {"--time",           NULL, ZAP_OPT_DURATION, &zap_g_config.cli_time_ns,      "duration"},
         {"--min-iters",      NULL, ZAP_OPT_U64,      &zap_g_config.cli_min_iters,    "number"},
+        {"--target-precision", NULL, ZAP_OPT_DOUBLE, &zap_g_config.cli_target_precision, "percentage"},
+        {"--timer",          NULL, ZAP_OPT_TIMER,    NULL,                           "timer name (clock, tsc)"},
+        {"--sampling",       NULL, ZAP_OPT_SAMPLING, NULL,                           "sampling mode (flat, linear)"},
+        {"--cache-mode",     NULL, ZAP_OPT_CACHE_MODE, NULL,                         "cache mode (warm, cold, both)"},
+        {"--overhead-correction", NULL, ZAP_OPT_FLAG, &zap_g_config.overhead_correction, NULL},
+        {"--no-overhead-correction", NULL, ZAP_OPT_FLAG, &zap_g_config.overhead_correction, NULL},
         {"--dry-run",        NULL, ZAP_OPT_FLAG,     &zap_g_config.dry_run,          NULL},
         {"--list",           NULL, ZAP_OPT_FLAG,     &zap_g_config.dry_run,          NULL},
         {"--env",            NULL, ZAP_OPT_FLAG,     &zap_g_config.show_env,         NULL},
         {"--histogram",      NULL, ZAP_OPT_FLAG,     &zap_g_config.show_histogram,   NULL},
         {"--percentiles",    NULL, ZAP_OPT_FLAG,     &zap_g_config.show_percentiles, NULL},
+        {"--counters",       NULL, ZAP_OPT_FLAG,     &zap_g_config.hw_counters,      NULL},
+        {"--counter-event",  NULL, ZAP_OPT_EVENT,    NULL,                           "event code"},
+        {"--no-alloc-tracking", NULL, ZAP_OPT_FLAG,  &zap_g_config.track_alloc,      NULL},
+        {"--pin-cpu",        NULL, ZAP_OPT_INT,      &zap_g_config.pin_cpu,          "CPU number"},
+        {"--realtime",       NULL, ZAP_OPT_FLAG,     &zap_g_config.realtime,         NULL},
+        {"--nice",           NULL, ZAP_OPT_INT,      &zap_g_config.nice,             "nice increment"},
+        {"--strict-env",     NULL, ZAP_OPT_FLAG,     &zap_g_config.strict_env,       NULL},
+        {"--freq-monitor",   NULL, ZAP_OPT_FLAG,     &zap_g_config.freq_monitor,     NULL},
+        {"--min-freq-ratio", NULL, ZAP_OPT_FREQ_RATIO, NULL,                         "ratio"},
+        {"--roofline",       NULL, ZAP_OPT_FLAG,     &zap_g_config.roofline,         NULL},
+        {"--isolate",        NULL, ZAP_OPT_FLAG,     &zap_g_config.isolate,          NULL},
+        {"--jobs",           "-j", ZAP_OPT_SIZE,     &zap_g_config.jobs,             "number"},
+        {"--shard",          NULL, ZAP_OPT_SHARD,    NULL,                           "shard (I/N)"},
+        {"--rate",           NULL, ZAP_OPT_RATE,     NULL,                           "rate (e.g. 200k/s)"},
+        {"--merge",          NULL, ZAP_OPT_MERGE,    NULL,                           "file"},
+        {"--no-history",     NULL, ZAP_OPT_FLAG,     &zap_g_config.history,          NULL},
+        {"--history-path",   NULL, ZAP_OPT_HISTORY_PATH, NULL,                       "file"},
+        {"--changes",        NULL, ZAP_OPT_FLAG,     &zap_g_config.show_changes,     NULL},
+        {"--profile",        NULL, ZAP_OPT_PROFILE,  NULL,                           "pattern"},
+        {"--profile-time",   NULL, ZAP_OPT_DURATION, &zap_g_config.profile_time_ns,  "duration"},
+        {"--profile-iters",  NULL, ZAP_OPT_U64,      &zap_g_config.profile_iters,    "number"},
+        {"--perf-ctl",       NULL, ZAP_OPT_PERF_CTL, NULL,                           "control spec (fd:CTL[,ACK] or fifo:CTL[,ACK])"},
         {"--tag",            "-t", ZAP_OPT_TAG,      NULL,                           "tag name"},
         {"--color",          NULL, ZAP_OPT_COLOR,    NULL,                           NULL},
         {"--help",           "-h", ZAP_OPT_HELP,     NULL,                           NULL},
         {NULL, NULL, 0, NULL, NULL}
     };
 
-    for (int i = 1; i < argc; i++) {
-        bool matched = false;
+    for (int i = 1; i < argc; i++) {
+        bool matched = false;
+
+        for (const zap__opt_t* opt = opts; opt->name; opt++) {
+            if (!zap__match_opt(argv[i], opt)) continue;
+            matched = true;
+
+            switch (opt->type) {
+            case ZAP_OPT_FLAG:
+                // --no-save and --no-compare set to false, others set to true
+                *(bool*)opt->dest = (strncmp(opt->name, "--no-", 5) != 0);
+                break;
+
+            case ZAP_OPT_STRING:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                *(const char**)opt->dest = argv[++i];
+                break;
+
+            case ZAP_OPT_SIZE:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                *(size_t*)opt->dest = (size_t)atoi(argv[++i]);
+                break;
+
+            case ZAP_OPT_U64:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                *(uint64_t*)opt->dest = (uint64_t)atoll(argv[++i]);
+                break;
+
+            case ZAP_OPT_INT:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                *(int*)opt->dest = atoi(argv[++i]);
+                break;
+
+            case ZAP_OPT_DOUBLE:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                *(double*)opt->dest = atof(argv[++i]);
+                break;
+
+            case ZAP_OPT_DURATION:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s (e.g., 2s, 500ms)\n", opt->name, opt->err);
+                    exit(1);
+                }
+                *(uint64_t*)opt->dest = zap__parse_duration(argv[++i]);
+                break;
+
+            case ZAP_OPT_PATH:
+                // --baseline, --compare, --save-baseline: enable feature + optional path
+                if (strcmp(opt->name, "--save-baseline") == 0)
+                    zap_g_config.save_baseline = true;
+                else
+                    zap_g_config.compare = true;
+                if (i + 1 < argc && argv[i + 1][0] != '-') {
+                    *(const char**)opt->dest = argv[++i];
+                    zap_g_config.explicit_path = true;
+                }
+                break;
+
+            case ZAP_OPT_TAG:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                if (zap_g_config.cli_tag_count < ZAP_MAX_CLI_TAGS) {
+                    strncpy(zap_g_config.cli_tags[zap_g_config.cli_tag_count],
+                            argv[++i], sizeof(zap_g_config.cli_tags[0]) - 1);
+                    zap_g_config.cli_tag_count++;
+                } else {
+                    fprintf(stderr, "Warning: Too many tags (max %d)\n", ZAP_MAX_CLI_TAGS);
+                    i++;
+                }
+                break;
+
+            case ZAP_OPT_EVENT:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                // Raw events are part of the counter group, so imply --counters
+                zap_g_config.hw_counters = true;
+                if (zap_g_config.cli_raw_event_count < ZAP_MAX_HW_COUNTERS - 4) {
+                    zap_g_config.cli_raw_events[zap_g_config.cli_raw_event_count++] =
+                        (uint64_t)strtoull(argv[++i], NULL, 0);
+                } else {
+                    fprintf(stderr, "Warning: Too many raw events (max %d)\n",
+                            ZAP_MAX_HW_COUNTERS - 4);
+                    i++;
+                }
+                break;
 
-        for (const zap__opt_t* opt = opts; opt->name; opt++) {
-            if (!zap__match_opt(argv[i], opt)) continue;
-            matched = true;
+            case ZAP_OPT_FREQ_RATIO:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                // A threshold only means something while monitoring
+                zap_g_config.freq_monitor = true;
+                zap_g_config.min_freq_ratio = atof(argv[++i]);
+                break;
 
-            switch (opt->type) {
-            case ZAP_OPT_FLAG:
-                // --no-save and --no-compare set to false, others set to true
-                *(bool*)opt->dest = (strncmp(opt->name, "--no-", 5) != 0);
+            case ZAP_OPT_TIMER: {
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                const char* kind = argv[++i];
+                if (strcmp(kind, "clock") == 0)
+                    zap_g_config.timer = ZAP_TIMER_CLOCK;
+                else if (strcmp(kind, "tsc") == 0)
+                    zap_g_config.timer = ZAP_TIMER_TSC;
+                else {
+                    fprintf(stderr, "Error: --timer must be clock or tsc\n");
+                    exit(1);
+                }
                 break;
+            }
 
-            case ZAP_OPT_STRING:
+            case ZAP_OPT_SAMPLING: {
                 if (i + 1 >= argc) {
                     fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
                     exit(1);
                 }
-                *(const char**)opt->dest = argv[++i];
+                const char* mode = argv[++i];
+                if (strcmp(mode, "flat") == 0)
+                    zap_g_config.cli_sampling = ZAP_SAMPLING_FLAT;
+                else if (strcmp(mode, "linear") == 0)
+                    zap_g_config.cli_sampling = ZAP_SAMPLING_LINEAR;
+                else {
+                    fprintf(stderr, "Error: --sampling must be flat or linear\n");
+                    exit(1);
+                }
+                zap_g_config.cli_sampling_set = true;
                 break;
+            }
 
-            case ZAP_OPT_SIZE:
+            case ZAP_OPT_CACHE_MODE: {
                 if (i + 1 >= argc) {
                     fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
                     exit(1);
                 }
-                *(size_t*)opt->dest = (size_t)atoi(argv[++i]);
+                const char* mode = argv[++i];
+                if (strcmp(mode, "warm") == 0)
+                    zap_g_config.cli_cache_mode = ZAP_CACHE_WARM;
+                else if (strcmp(mode, "cold") == 0)
+                    zap_g_config.cli_cache_mode = ZAP_CACHE_COLD;
+                else if (strcmp(mode, "both") == 0)
+                    zap_g_config.cli_cache_mode = ZAP_CACHE_BOTH;
+                else {
+                    fprintf(stderr, "Error: --cache-mode must be warm, cold or both\n");
+                    exit(1);
+                }
+                zap_g_config.cli_cache_mode_set = true;
                 break;
+            }
 
-            case ZAP_OPT_U64:
+            case ZAP_OPT_BASELINE_FORMAT: {
                 if (i + 1 >= argc) {
                     fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
                     exit(1);
                 }
-                *(uint64_t*)opt->dest = (uint64_t)atoll(argv[++i]);
+                const char* format = argv[++i];
+                if (strcmp(format, "text") == 0 || strcmp(format, "v1") == 0)
+                    zap_g_config.cli_baseline_format = ZAP_BASELINE_TEXT;
+                else if (strcmp(format, "binary") == 0 || strcmp(format, "v2") == 0)
+                    zap_g_config.cli_baseline_format = ZAP_BASELINE_BINARY;
+                else {
+                    fprintf(stderr, "Error: --baseline-format must be text or binary\n");
+                    exit(1);
+                }
+                zap_g_config.cli_baseline_format_set = true;
                 break;
+            }
 
-            case ZAP_OPT_DOUBLE:
+            case ZAP_OPT_STAT_TEST: {
                 if (i + 1 >= argc) {
                     fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
                     exit(1);
                 }
-                *(double*)opt->dest = atof(argv[++i]);
+                const char* test = argv[++i];
+                if (strcmp(test, "ci") == 0)
+                    zap_g_config.stat_test = ZAP_TEST_CI;
+                else if (strcmp(test, "welch") == 0)
+                    zap_g_config.stat_test = ZAP_TEST_WELCH;
+                else if (strcmp(test, "mwu") == 0)
+                    zap_g_config.stat_test = ZAP_TEST_MWU;
+                else if (strcmp(test, "bootstrap") == 0)
+                    zap_g_config.stat_test = ZAP_TEST_BOOTSTRAP;
+                else {
+                    fprintf(stderr, "Error: --stat-test must be ci, welch, mwu or bootstrap\n");
+                    exit(1);
+                }
                 break;
+            }
 
-            case ZAP_OPT_DURATION:
+            case ZAP_OPT_SHARD: {
                 if (i + 1 >= argc) {
-                    fprintf(stderr, "Error: %s requires a %s (e.g., 2s, 500ms)\n", opt->name, opt->err);
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
                     exit(1);
                 }
-                *(uint64_t*)opt->dest = zap__parse_duration(argv[++i]);
+                unsigned long index = 0, count = 0;
+                char extra;
+                if (sscanf(argv[++i], "%lu/%lu%c", &index, &count, &extra) != 2 ||
+                    count == 0 || index == 0 || index > count) {
+                    fprintf(stderr, "Error: --shard must be I/N with 1 <= I <= N\n");
+                    exit(1);
+                }
+                zap_g_config.shard_index = (size_t)index - 1;
+                zap_g_config.shard_count = (size_t)count;
                 break;
+            }
 
-            case ZAP_OPT_PATH:
-                // --baseline, --compare, --save-baseline: enable feature + optional path
-                if (strcmp(opt->name, "--save-baseline") == 0)
-                    zap_g_config.save_baseline = true;
-                else
-                    zap_g_config.compare = true;
-                if (i + 1 < argc && argv[i + 1][0] != '-') {
-                    *(const char**)opt->dest = argv[++i];
-                    zap_g_config.explicit_path = true;
+            case ZAP_OPT_RATE:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                if (!zap__parse_rates(argv[++i])) {
+                    fprintf(stderr, "Error: --rate must be RATE[,RATE...], e.g. 200k/s "
+                                    "or 50k,100k,200k/s\n");
+                    exit(1);
                 }
                 break;
 
-            case ZAP_OPT_TAG:
+            case ZAP_OPT_MERGE:
                 if (i + 1 >= argc) {
                     fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
                     exit(1);
                 }
-                if (zap_g_config.cli_tag_count < ZAP_MAX_CLI_TAGS) {
-                    strncpy(zap_g_config.cli_tags[zap_g_config.cli_tag_count],
-                            argv[++i], sizeof(zap_g_config.cli_tags[0]) - 1);
-                    zap_g_config.cli_tag_count++;
+                if (zap_g_config.merge_count < ZAP_MAX_MERGE_FILES) {
+                    zap_g_config.merge_paths[zap_g_config.merge_count++] = argv[++i];
                 } else {
-                    fprintf(stderr, "Warning: Too many tags (max %d)\n", ZAP_MAX_CLI_TAGS);
+                    fprintf(stderr, "Warning: Too many merge inputs (max %d)\n",
+                            ZAP_MAX_MERGE_FILES);
                     i++;
                 }
                 break;
 
+            case ZAP_OPT_HISTORY_PATH:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                zap_g_config.history_path = argv[++i];
+                zap_g_config.history = true;
+                break;
+
+            case ZAP_OPT_PROFILE:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                zap_g_config.filter = argv[++i];
+                zap_g_config.profile = true;
+                break;
+
+            case ZAP_OPT_PERF_CTL:
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a %s\n", opt->name, opt->err);
+                    exit(1);
+                }
+                if (!zap__parse_perf_ctl(argv[++i])) {
+                    fprintf(stderr, "Error: --perf-ctl must be fd:CTL[,ACK] or fifo:CTL[,ACK] "
+                                    "(as given to perf record --control)\n");
+                    exit(1);
+                }
+                zap_g_config.perf_ctl = true;
+                break;
+
             case ZAP_OPT_COLOR: {
                 const char* mode = NULL;
                 if (strlen(argv[i]) > 7 && argv[i][7] == '=') {
@@ -2377,6 +9776,36 @@ void zap_parse_args(int argc, char** argv) {
         (void)matched; // ignore unknown args for now
     }
 
+    // Merging runs nothing
+    if (zap_g_config.merge_count > 0) {
+        exit(zap__merge_baselines() ? 0 : 1);
+    }
+
+    // Neither does reading the history
+    if (zap_g_config.show_changes) {
+        exit(zap__report_changes() ? 0 : 1);
+    }
+
+    // Parallel jobs are always isolated
+    if (zap_g_config.jobs > 0) {
+        zap_g_config.isolate = true;
+    }
+
+    // A profile runs in this process and keeps no results
+    if (zap_g_config.profile) {
+        zap_g_config.save_baseline = false;
+        zap_g_config.compare = false;
+        zap_g_config.isolate = false;
+        zap_g_config.jobs = 0;
+        zap_g_config.shard_count = 0;
+        zap_g_config.cli_rate_count = 0;
+    }
+
+    // perf exiting first must end the markers, not the run (see zap__perf_ctl_send)
+    if (zap_g_config.perf_ctl) {
+        signal(SIGPIPE, SIG_IGN);
+    }
+
     // Skip baseline loading in dry run mode
     if (zap_g_config.dry_run) {
         if (!zap_g_config.json_output) {
@@ -2388,6 +9817,12 @@ void zap_parse_args(int argc, char** argv) {
 
     // Initialize baseline storage
     zap_baseline_init(&zap_g_config.baseline);
+    if (zap_g_config.shard_count > 0) {
+        zap_baseline_init(&zap_g_config.shard_results);
+    }
+    if (zap_g_config.history) {
+        zap_baseline_init(&zap_g_config.run_results);
+    }
 
     // Try to load existing baseline for comparison
     if (zap_g_config.compare) {
@@ -2402,11 +9837,32 @@ void zap_parse_args(int argc, char** argv) {
                        zap__c_yellow(), zap_g_config.baseline_path, zap__c_reset());
                 zap_g_config.compare = false;
             }
+        } else if (!zap_g_config.json_output) {
+            printf("%sLoaded baseline:%s %s%s%s (%zu entries)\n\n",
+                   zap__c_purple(), zap__c_reset(),
+                   zap__c_cyan(), zap_g_config.baseline_path, zap__c_reset(),
+                   zap_baseline_size(&zap_g_config.baseline));
+            if (zap_g_config.stat_test != ZAP_TEST_CI &&
+                zap_g_config.baseline.format != ZAP_BASELINE_BINARY) {
+                fprintf(stderr, "%sWarning: text baselines have no raw samples; --stat-test %s "
+                        "falls back to CI overlap (save with --baseline-format binary)%s\n",
+                        zap__c_yellow(), zap__stat_test_name(zap_g_config.stat_test),
+                        zap__c_reset());
+            }
         }
     }
 
+    // Scheduling requests first, so detection sees their effect
+    if (!zap_g_config.dry_run) {
+        zap__apply_sched();
+    }
+
     // Detect and print environment info
     zap_env_detect(&zap_g_config.env);
+    zap_timer_init(zap_g_config.timer);
+#if defined(ZAP_TRACK_ALLOC) && !defined(ZAP_HAS_ALLOC_HOOK)
+    fprintf(stderr, "Warning: ZAP_TRACK_ALLOC needs glibc, allocation tracking disabled\n");
+#endif
     if (zap_g_config.json_output) {
         // JSON always includes environment
         zap_env_print_json(&zap_g_config.env);
@@ -2414,6 +9870,33 @@ void zap_parse_args(int argc, char** argv) {
         // Text only shows env with --env flag
         zap_env_print(&zap_g_config.env);
     }
+    if (!zap_g_config.dry_run) {
+        zap__check_noise(&zap_g_config.env);
+    }
+    if (zap_g_config.roofline && !zap_g_config.dry_run) {
+        zap__machine_prepare();
+        if (zap_g_config.machine_valid) {
+            if (zap_g_config.json_output) {
+                zap__machine_print_json(&zap_g_config.machine);
+            } else {
+                zap__machine_print(&zap_g_config.machine);
+            }
+        }
+    }
+
+    // Say where to attach before the first warmup starts
+    if (zap_g_config.profile && !zap_g_config.json_output) {
+        char budget[32];
+        if (zap_g_config.profile_iters > 0) {
+            snprintf(budget, sizeof(budget), "%llu iterations",
+                     (unsigned long long)zap_g_config.profile_iters);
+        } else {
+            zap__format_time((double)zap_g_config.profile_time_ns, budget, sizeof(budget));
+        }
+        fprintf(stderr, "%sProfiling%s pid %ld: each match of '%s' runs for %s%s\n\n",
+                zap__c_purple(), zap__c_reset(), (long)getpid(), zap_g_config.filter, budget,
+                zap_g_config.perf_ctl ? ", perf enabled only while measuring" : "");
+    }
 
     // Register auto-finalize - saves baseline and prints warnings at exit
     atexit(zap__finalize_atexit);
@@ -2435,12 +9918,16 @@ zap_compare_group_t* zap_compare_group(const char* name) {
     g->config.warmup_time_ns = ZAP_DEFAULT_WARMUP_TIME_NS;
     g->config.measurement_time_ns = ZAP_DEFAULT_MEASUREMENT_TIME_NS;
     g->config.sample_count = ZAP_DEFAULT_SAMPLE_COUNT;
+    g->config.target_precision = ZAP_DEFAULT_TARGET_PRECISION;
+    g->config.sampling_mode = (zap_sampling_mode_t)ZAP_DEFAULT_SAMPLING_MODE;
+    g->config.cache_mode = (zap_cache_mode_t)ZAP_DEFAULT_CACHE_MODE;
     g->baseline_idx = 0;  // First implementation is baseline by default
     g->header_printed = false;
     g->tag_count = 0;
 
     // Print header for comparison group (unless filtering/dry-run)
-    if (!zap_g_config.filter && !zap_g_config.dry_run && zap_g_config.cli_tag_count == 0) {
+    if (!zap_g_config.filter && !zap_g_config.dry_run && zap_g_config.cli_tag_count == 0 &&
+        zap_g_config.shard_count == 0) {
         if (!zap_g_config.json_output) {
             printf("%s%sRunning comparison group:%s %s%s%s\n\n",
                    zap__c_bold(), zap__c_purple(), zap__c_reset(),
@@ -2454,6 +9941,11 @@ zap_compare_group_t* zap_compare_group(const char* name) {
 
 void zap_compare_set_baseline(zap_compare_group_t* g, size_t idx) {
     g->baseline_idx = idx;
+    g->baseline_set = true;
+}
+
+void zap_compare_interleave(zap_compare_group_t* g, bool interleave) {
+    g->interleave = interleave;
 }
 
 void zap_compare_tag(zap_compare_group_t* g, const char* tag) {
@@ -2481,8 +9973,14 @@ static bool zap__compare_group_matches_tags(const zap_compare_group_t* g) {
 zap_compare_ctx_t* zap_compare_begin(zap_compare_group_t* g,
                                      zap_benchmark_id_t id,
                                      void* input, size_t input_size) {
+    zap__jobs_drain();  // Implementations run in this process
     zap_compare_ctx_t* ctx = &zap__compare_ctx;
+    // Keep the results buffer across benchmarks; it only grows
+    zap_impl_result_t* results = ctx->results;
+    size_t capacity = ctx->impl_capacity;
     memset(ctx, 0, sizeof(*ctx));
+    ctx->results = results;
+    ctx->impl_capacity = capacity;
 
     ctx->group = g;
     ctx->id = id;
@@ -2496,7 +9994,8 @@ zap_compare_ctx_t* zap_compare_begin(zap_compare_group_t* g,
     snprintf(full_name, sizeof(full_name), "%s/%s", id.label, id.param_str);
 
     // Check filter
-    if (!zap_matches_filter(full_name, zap_g_config.filter)) {
+    if (!zap_matches_filter(full_name, zap_g_config.filter) ||
+        !zap__in_shard(g->name, full_name)) {
         ctx->skipped = true;
         return ctx;
     }
@@ -2534,22 +10033,147 @@ zap_compare_ctx_t* zap_compare_begin(zap_compare_group_t* g,
     return ctx;
 }
 
-void zap_compare_impl(zap_compare_ctx_t* ctx, const char* name, zap_bench_fn fn) {
-    if (ctx->skipped) return;
-    if (ctx->impl_count >= ZAP_MAX_IMPLS) return;
+const char* zap_isa_name(zap_isa_t isa) {
+    switch (isa) {
+        case ZAP_ISA_SCALAR:  return "scalar";
+        case ZAP_ISA_SSE2:    return "sse2";
+        case ZAP_ISA_SSE42:   return "sse4.2";
+        case ZAP_ISA_AVX:     return "avx";
+        case ZAP_ISA_AVX2:    return "avx2";
+        case ZAP_ISA_AVX512F: return "avx512f";
+        case ZAP_ISA_NEON:    return "neon";
+    }
+    return "unknown";
+}
 
-    zap_compare_group_t* g = ctx->group;
+/*
+ * CPUID says what the core implements; __builtin_cpu_supports also checks
+ * that the OS saves the wider registers (XGETBV), so a VM or kernel that
+ * disables AVX-512 does not turn into SIGILL.
+ */
+bool zap_env_has_isa(const zap_env_t* env, zap_isa_t isa) {
+    switch (isa) {
+        case ZAP_ISA_SCALAR: return true;
+        case ZAP_ISA_NEON:   return env->has_neon;
+        default: break;
+    }
+#if defined(ZAP_X86) && (defined(__GNUC__) || defined(__clang__))
+    switch (isa) {
+        case ZAP_ISA_SSE2:    return env->has_sse2 && __builtin_cpu_supports("sse2");
+        case ZAP_ISA_SSE42:   return env->has_sse42 && __builtin_cpu_supports("sse4.2");
+        case ZAP_ISA_AVX:     return env->has_avx && __builtin_cpu_supports("avx");
+        case ZAP_ISA_AVX2:    return env->has_avx2 && __builtin_cpu_supports("avx2");
+        case ZAP_ISA_AVX512F: return env->has_avx512f && __builtin_cpu_supports("avx512f");
+        default:              return false;
+    }
+#else
+    switch (isa) {
+        case ZAP_ISA_SSE2:    return env->has_sse2;
+        case ZAP_ISA_SSE42:   return env->has_sse42;
+        case ZAP_ISA_AVX:     return env->has_avx;
+        case ZAP_ISA_AVX2:    return env->has_avx2;
+        case ZAP_ISA_AVX512F: return env->has_avx512f;
+        default:              return false;
+    }
+#endif
+}
+
+// Next result slot, growing the array; NULL if out of memory
+static zap_impl_result_t* zap__compare_slot(zap_compare_ctx_t* ctx, const char* name) {
+    if (ctx->impl_count == ctx->impl_capacity) {
+        size_t capacity = ctx->impl_capacity ? ctx->impl_capacity * 2 : 8;
+        zap_impl_result_t* grown = (zap_impl_result_t*)realloc(
+            ctx->results, capacity * sizeof(zap_impl_result_t));
+        if (!grown) {
+            fprintf(stderr, "Error: cannot allocate results for '%s'\n", name);
+            return NULL;
+        }
+        ctx->results = grown;
+        ctx->impl_capacity = capacity;
+    }
     zap_impl_result_t* result = &ctx->results[ctx->impl_count];
+    memset(result, 0, sizeof(*result));
 
     // Store implementation name
     strncpy(result->name, name, sizeof(result->name) - 1);
     result->name[sizeof(result->name) - 1] = '\0';
+    return result;
+}
+
+void zap_compare_impl_isa(zap_compare_ctx_t* ctx, const char* name, zap_isa_t isa,
+                          zap_bench_fn fn) {
+    if (ctx->skipped) return;
+    ctx->has_isa = true;
+
+    // Environment detection normally runs in zap_parse_args()
+    if (zap_g_config.env.cpu_model[0] == '\0') {
+        zap_env_detect(&zap_g_config.env);
+    }
+    if (zap_env_has_isa(&zap_g_config.env, isa)) {
+        zap_compare_impl(ctx, name, fn);
+        if (ctx->impl_count > 0) {
+            ctx->results[ctx->impl_count - 1].isa = isa;
+            ctx->results[ctx->impl_count - 1].isa_variant = true;
+        }
+        return;
+    }
+    if (zap_g_config.profile) return;  // Nothing to list without a table
+
+    zap_impl_result_t* result = zap__compare_slot(ctx, name);
+    if (!result) return;
+    result->isa = isa;
+    result->isa_variant = true;
+    result->skipped = true;
+    ctx->impl_count++;
+}
+
+// Stats of a finished implementation; the result keeps the samples until zap_compare_end
+static void zap__compare_store(zap_impl_result_t* result, zap_t* z) {
+    // Warn if time limit was reached
+    if (!zap_g_config.json_output && z->stop_reason == ZAP_STOP_TIME &&
+        z->sample_count < z->config.sample_count) {
+        printf("%sWarning: time limit reached, collected %zu/%zu samples%s\n",
+               zap__c_yellow(), z->sample_count, z->config.sample_count, zap__c_reset());
+    }
+
+    result->stats = zap__finish_stats(z);
+    result->valid = true;
+    z->samples = NULL;
+    result->stats.latency = NULL;  // Freed with z; the percentiles stay
+    zap_cleanup(z);
+}
 
+void zap_compare_impl(zap_compare_ctx_t* ctx, const char* name, zap_bench_fn fn) {
+    if (ctx->skipped) return;
+
+    zap_compare_group_t* g = ctx->group;
     // Build full benchmark name: "label/param [impl_name]"
     char bench_name[384];
     snprintf(bench_name, sizeof(bench_name), "%s/%s [%s]",
              ctx->id.label, ctx->id.param_str, name);
 
+    // Profiled implementations run one after another and leave no results,
+    // so zap_compare_end has nothing to compare
+    if (zap_g_config.profile) {
+        zap_t z;
+        zap__init_with_config(&z, bench_name, &g->config);
+        z.param = ctx->input;
+        z.param_size = ctx->input_size;
+        zap__run_profiled(&z, fn, g->name, bench_name);
+        zap_cleanup(&z);
+        return;
+    }
+
+    zap_impl_result_t* result = zap__compare_slot(ctx, name);
+    if (!result) return;
+
+    // Interleaved implementations all run together in zap_compare_end
+    if (g->interleave) {
+        result->fn = fn;
+        ctx->impl_count++;
+        return;
+    }
+
     // Initialize benchmark state
     zap_t z;
     zap__init_with_config(&z, bench_name, &g->config);
@@ -2559,22 +10183,226 @@ void zap_compare_impl(zap_compare_ctx_t* ctx, const char* name, zap_bench_fn fn)
     // Run the benchmark
     fn(&z);
 
-    // Warn if time limit was reached
-    if (!zap_g_config.json_output && z.sample_count < z.config.sample_count) {
-        printf("%sWarning: time limit reached, collected %zu/%zu samples%s\n",
-               zap__c_yellow(), z.sample_count, z.config.sample_count, zap__c_reset());
+    zap__compare_store(result, &z);
+    ctx->impl_count++;
+}
+
+/* INTERLEAVED COMPARISONS */
+
+/*
+ * Each implementation runs on its own thread with its own zap_t, but only
+ * the one holding the turn runs; the rest wait in zap__loop_advance() at the
+ * start of their next measured batch. Warmups run whole, one implementation
+ * after another. Measurement then goes in rounds: every implementation still
+ * running gets one sample per round, in a fresh random order, so sample k of
+ * each was taken within the same round. A round in which a routine still
+ * running left no sample (--freq-monitor rejected it) is dropped for all of
+ * them, so that stays true. Time spent waiting is not charged to a routine's
+ * measurement budget, so the run takes as long as running them back to back.
+ */
+
+#define ZAP__NO_TURN ((size_t)-1)
+
+typedef struct zap__interleave {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    size_t          turn;  // Slot allowed to run, ZAP__NO_TURN while the scheduler picks
+} zap__interleave_t;
+
+typedef struct {
+    zap__interleave_t* il;
+    zap_t              z;
+    zap_bench_fn       fn;
+    size_t             result_idx;
+    char               name[384];
+    pthread_t          thread;
+    bool               started;
+    bool               done;   // Under il->lock
+    size_t             round_samples;  // sample_count when the current round began
+} zap__interleave_slot_t;
+
+// Take back the last sample, running mean and variance included
+static void zap__drop_last_sample(zap_t* c) {
+    if (c->sample_count == 0) return;
+    double x = c->samples[--c->sample_count];
+    if (c->sample_count == 0) {
+        c->run_mean = 0.0;
+        c->run_m2 = 0.0;
+        return;
     }
+    double mean = c->run_mean;
+    c->run_mean = (mean * (double)(c->sample_count + 1) - x) / (double)c->sample_count;
+    c->run_m2 -= (x - c->run_mean) * (x - mean);
+    if (c->run_m2 < 0) c->run_m2 = 0.0;
+}
 
-    // Compute stats
-    result->stats = zap_compute_stats(z.samples, z.sample_count);
-    result->stats.iterations = z.iterations;
-    result->stats.throughput_type = z.throughput_type;
-    result->stats.throughput_value = z.throughput_value;
-    result->valid = true;
+static void zap__interleave_yield(zap_t* c) {
+    zap__interleave_t* il = c->interleave;
+    uint64_t t0 = zap__timer_begin();
+    pthread_mutex_lock(&il->lock);
+    il->turn = ZAP__NO_TURN;
+    pthread_cond_broadcast(&il->cond);
+    while (il->turn != c->interleave_slot) pthread_cond_wait(&il->cond, &il->lock);
+    pthread_mutex_unlock(&il->lock);
+    if (c->start_time != 0) c->start_time += zap__timer_begin() - t0;
+}
 
-    ctx->impl_count++;
+static void* zap__interleave_main(void* arg) {
+    zap__interleave_slot_t* s = (zap__interleave_slot_t*)arg;
+    zap__interleave_t* il = s->il;
+    pthread_mutex_lock(&il->lock);
+    while (il->turn != s->z.interleave_slot) pthread_cond_wait(&il->cond, &il->lock);
+    pthread_mutex_unlock(&il->lock);
+
+    s->fn(&s->z);
+
+    pthread_mutex_lock(&il->lock);
+    s->done = true;
+    il->turn = ZAP__NO_TURN;
+    pthread_cond_broadcast(&il->cond);
+    pthread_mutex_unlock(&il->lock);
+    return NULL;
+}
+
+// Let slot run until it yields at its next batch or returns
+static void zap__interleave_grant(zap__interleave_t* il, size_t slot) {
+    pthread_mutex_lock(&il->lock);
+    il->turn = slot;
+    pthread_cond_broadcast(&il->cond);
+    while (il->turn != ZAP__NO_TURN) pthread_cond_wait(&il->cond, &il->lock);
+    pthread_mutex_unlock(&il->lock);
+}
+
+static void zap__compare_interleaved(zap_compare_ctx_t* ctx) {
+    size_t n = 0;
+    for (size_t i = 0; i < ctx->impl_count; i++) {
+        if (ctx->results[i].fn && !ctx->results[i].skipped) n++;
+    }
+    if (n == 0) return;
+
+    zap__interleave_slot_t* slots =
+        (zap__interleave_slot_t*)calloc(n, sizeof(zap__interleave_slot_t));
+    size_t* order = (size_t*)malloc(n * sizeof(size_t));
+    if (!slots || !order) {
+        fprintf(stderr, "Error: cannot allocate interleaved runs for '%s'\n", ctx->id.label);
+        free(slots);
+        free(order);
+        return;
+    }
+
+    zap__interleave_t il;
+    pthread_mutex_init(&il.lock, NULL);
+    pthread_cond_init(&il.cond, NULL);
+    il.turn = ZAP__NO_TURN;
+
+    size_t k = 0;
+    for (size_t i = 0; i < ctx->impl_count; i++) {
+        zap_impl_result_t* r = &ctx->results[i];
+        if (!r->fn || r->skipped) continue;
+        zap__interleave_slot_t* s = &slots[k];
+        snprintf(s->name, sizeof(s->name), "%s/%s [%s]",
+                 ctx->id.label, ctx->id.param_str, r->name);
+        zap__init_with_config(&s->z, s->name, &ctx->group->config);
+        s->z.param = ctx->input;
+        s->z.param_size = ctx->input_size;
+        s->z.interleave = &il;
+        s->z.interleave_slot = k;
+        s->il = &il;
+        s->fn = r->fn;
+        s->result_idx = i;
+        s->started = pthread_create(&s->thread, NULL, zap__interleave_main, s) == 0;
+        if (!s->started) {
+            fprintf(stderr, "Warning: cannot start a thread for '%s', running it alone\n",
+                    s->name);
+            s->done = true;
+        }
+        k++;
+    }
+
+    // Warm up in registration order; each hands back at its first measured batch
+    for (size_t i = 0; i < n; i++) {
+        if (slots[i].started) zap__interleave_grant(&il, i);
+    }
+
+    // One sample per implementation per round, shuffled each round
+    uint64_t rng = zap_now_ns() | 1;
+    for (;;) {
+        size_t active = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (!slots[i].done) order[active++] = i;
+        }
+        if (active == 0) break;
+        for (size_t i = active; i > 1; i--) {
+            rng ^= rng << 13;  // xorshift64
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            size_t j = (size_t)(rng % i);
+            size_t t = order[i - 1];
+            order[i - 1] = order[j];
+            order[j] = t;
+        }
+        for (size_t i = 0; i < active; i++) {
+            slots[order[i]].round_samples = slots[order[i]].z.sample_count;
+        }
+        for (size_t i = 0; i < active; i++) zap__interleave_grant(&il, order[i]);
+
+        // A routine that is still running but added nothing had its sample rejected
+        bool hole = false;
+        for (size_t i = 0; i < active; i++) {
+            const zap__interleave_slot_t* s = &slots[order[i]];
+            if (!s->done && s->z.sample_count == s->round_samples) hole = true;
+        }
+        for (size_t i = 0; hole && i < active; i++) {
+            zap__interleave_slot_t* s = &slots[order[i]];
+            if (s->z.sample_count > s->round_samples) zap__drop_last_sample(&s->z);
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        zap__interleave_slot_t* s = &slots[i];
+        if (s->started) {
+            pthread_join(s->thread, NULL);
+        } else {
+            s->z.interleave = NULL;
+            s->fn(&s->z);
+        }
+        s->z.interleave = NULL;
+        zap__compare_store(&ctx->results[s->result_idx], &s->z);
+    }
+
+    pthread_cond_destroy(&il.cond);
+    pthread_mutex_destroy(&il.lock);
+    free(slots);
+    free(order);
+}
 
-    zap_cleanup(&z);
+/*
+ * Speedup of b over a from interleaved samples: sample k of each came from
+ * the same round, so the log ratio of a pair cancels drift common to both.
+ * Returns the geometric mean with a 95% CI; false with fewer than 2 pairs.
+ */
+static bool zap__paired_speedup(const zap_stats_t* a, const zap_stats_t* b,
+                                double* speedup, double* lo, double* hi) {
+    if (!a->samples || !b->samples) return false;
+    size_t n = a->sample_count < b->sample_count ? a->sample_count : b->sample_count;
+    double sum = 0.0, sum_sq = 0.0;
+    size_t pairs = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (a->samples[i] <= 0 || b->samples[i] <= 0) continue;
+        double d = log(a->samples[i] / b->samples[i]);
+        sum += d;
+        sum_sq += d * d;
+        pairs++;
+    }
+    if (pairs < 2) return false;
+
+    double mean = sum / (double)pairs;
+    double var = (sum_sq - sum * mean) / (double)(pairs - 1);
+    double half = zap__t_value(pairs) * sqrt(var > 0 ? var / (double)pairs : 0.0);
+    *speedup = exp(mean);
+    *lo = exp(mean - half);
+    *hi = exp(mean + half);
+    return true;
 }
 
 void zap_compare_end(zap_compare_ctx_t* ctx) {
@@ -2582,10 +10410,21 @@ void zap_compare_end(zap_compare_ctx_t* ctx) {
     if (ctx->impl_count == 0) return;
 
     zap_compare_group_t* g = ctx->group;
+    if (g->interleave) zap__compare_interleaved(ctx);
     size_t baseline_idx = g->baseline_idx;
     if (baseline_idx >= ctx->impl_count) {
         baseline_idx = 0;
     }
+    if (ctx->has_isa && !g->baseline_set) {
+        // ISA variants are measured against the scalar reference
+        for (size_t i = 0; i < ctx->impl_count; i++) {
+            const zap_impl_result_t* r = &ctx->results[i];
+            if (r->valid && r->isa_variant && r->isa == ZAP_ISA_SCALAR) {
+                baseline_idx = i;
+                break;
+            }
+        }
+    }
 
     // Build comparison name
     char cmp_name[256];
@@ -2598,70 +10437,105 @@ void zap_compare_end(zap_compare_ctx_t* ctx) {
         // JSON output for comparison
         printf("{\"type\":\"comparison\",\"name\":\"%s\"", cmp_name);
         printf(",\"baseline_idx\":%zu", baseline_idx);
+        if (g->interleave) printf(",\"interleaved\":true");
         printf(",\"implementations\":[");
 
         for (size_t i = 0; i < ctx->impl_count; i++) {
             zap_impl_result_t* r = &ctx->results[i];
-            if (!r->valid) continue;
-
             if (i > 0) printf(",");
+            if (r->skipped) {
+                printf("{\"name\":\"%s\",\"isa\":\"%s\",\"skipped\":true}",
+                       r->name, zap_isa_name(r->isa));
+                continue;
+            }
+            if (!r->valid) {
+                printf("{\"name\":\"%s\",\"valid\":false}", r->name);
+                continue;
+            }
+
             printf("{\"name\":\"%s\"", r->name);
+            if (r->isa_variant) printf(",\"isa\":\"%s\"", zap_isa_name(r->isa));
             printf(",\"mean_ns\":%.6f", r->stats.mean);
             printf(",\"median_ns\":%.6f", r->stats.median);
             printf(",\"std_dev_ns\":%.6f", r->stats.std_dev);
             printf(",\"samples\":%zu", r->stats.sample_count);
             printf(",\"iterations\":%zu", r->stats.iterations);
+            printf(",\"stop_reason\":\"%s\"", zap__stop_reason_name(r->stats.stop_reason));
+            if (r->stats.sampling == ZAP_SAMPLING_LINEAR) {
+                printf(",\"r_squared\":%.6f", r->stats.r_squared);
+            }
 
             // Throughput if set
             if (r->stats.throughput_type != ZAP_THROUGHPUT_NONE && r->stats.throughput_value > 0) {
                 double per_sec = (double)r->stats.throughput_value * 1e9 / r->stats.mean;
-                printf(",\"throughput\":{\"type\":\"%s\",\"per_second\":%.2f}",
-                       r->stats.throughput_type == ZAP_THROUGHPUT_BYTES ? "bytes" : "elements",
-                       per_sec);
+                printf(",\"throughput\":{\"type\":\"%s\",\"per_second\":%.2f",
+                       zap__throughput_name(r->stats.throughput_type), per_sec);
+                zap__print_roofline_json(&r->stats);
+                printf("}");
+            }
+
+            if (r->stats.metric_count > 0) {
+                printf(",\"metrics\":{");
+                for (size_t m = 0; m < r->stats.metric_count; m++) {
+                    printf("%s\"%s\":%.6f", m > 0 ? "," : "",
+                           r->stats.metrics[m].name, r->stats.metrics[m].value);
+                }
+                printf("}");
             }
 
             // Calculate speedup vs baseline
             if (i != baseline_idx && ctx->results[baseline_idx].valid) {
                 double speedup = ctx->results[baseline_idx].stats.mean / r->stats.mean;
-                printf(",\"vs_baseline\":{\"speedup\":%.4f}", speedup);
+                double lo, hi;
+                if (g->interleave && zap__paired_speedup(&ctx->results[baseline_idx].stats,
+                                                         &r->stats, &speedup, &lo, &hi)) {
+                    printf(",\"vs_baseline\":{\"speedup\":%.4f,\"paired\":true"
+                           ",\"ci_lower\":%.4f,\"ci_upper\":%.4f}", speedup, lo, hi);
+                } else {
+                    printf(",\"vs_baseline\":{\"speedup\":%.4f}", speedup);
+                }
             }
 
             // Compare with previous run baseline (include group name to avoid collisions)
-            char full_bench_name[384];
+            char full_bench_name[512];
             snprintf(full_bench_name, sizeof(full_bench_name), "%s/%s/%s [%s]",
                      g->name, ctx->id.label, ctx->id.param_str, r->name);
             const zap_baseline_entry_t* prev = zap_baseline_find(&zap_g_config.baseline, full_bench_name);
             if (prev && zap_g_config.compare) {
                 zap_comparison_t cmp = zap_compare(prev, &r->stats);
-                printf(",\"vs_previous\":{\"old_mean_ns\":%.6f,\"change_pct\":%.4f,\"speedup\":%.4f,\"status\":\"%s\"}",
+                printf(",\"vs_previous\":{\"old_mean_ns\":%.6f,\"change_pct\":%.4f,\"speedup\":%.4f,\"status\":\"%s\"",
                        cmp.old_mean, fabs(cmp.change_pct), zap__speedup(cmp.old_mean, cmp.new_mean),
                        cmp.change == ZAP_IMPROVED ? "improved" :
                        cmp.change == ZAP_REGRESSED ? "regressed" : "unchanged");
+                zap__print_test_json(&cmp);
+                printf("}");
 
                 // Track regression
-                if (zap_g_config.fail_threshold > 0.0 &&
-                    cmp.change == ZAP_REGRESSED &&
-                    cmp.change_pct > zap_g_config.fail_threshold) {
+                if (zap__exceeds_threshold(&cmp)) {
                     zap_g_config.has_regression = true;
                 }
             }
 
             printf("}");
 
-            // Save to baseline
-            if (zap_g_config.save_baseline) {
-                zap_baseline_add(&zap_g_config.baseline, full_bench_name, &r->stats);
-            }
+            zap__save_result(full_bench_name, &r->stats);
         }
 
         printf("]}\n");
         fflush(stdout);
     } else {
         // Text output for comparison
-        printf("%s%s%s comparison:\n", zap__c_bold(), zap__c_magenta(), cmp_name);
+        printf("%s%s%s comparison%s:\n", zap__c_bold(), zap__c_magenta(), cmp_name,
+               g->interleave ? " (interleaved)" : "");
 
         for (size_t i = 0; i < ctx->impl_count; i++) {
             zap_impl_result_t* r = &ctx->results[i];
+            if (r->skipped) {
+                printf("  %s%s%s: %sskipped (%s not supported)%s\n\n",
+                       zap__c_cyan(), r->name, zap__c_reset(),
+                       zap__c_yellow(), zap_isa_name(r->isa), zap__c_reset());
+                continue;
+            }
             if (!r->valid) continue;
 
             char median_buf[32], mean_buf[32], std_buf[32];
@@ -2677,8 +10551,10 @@ void zap_compare_end(zap_compare_ctx_t* ctx) {
             printf("  %s%s%s:\n", zap__c_cyan(), r->name, zap__c_reset());
 
             // Sample info
-            printf("    %zu samples \303\227 %zu evals, median: %s%s%s\n",
-                   r->stats.sample_count, r->stats.iterations,
+            char evals_buf[48];
+            zap__format_evals(&r->stats, evals_buf, sizeof(evals_buf));
+            printf("    %zu samples \303\227 %s, median: %s%s%s\n",
+                   r->stats.sample_count, evals_buf,
                    zap__c_cyan(), median_buf, zap__c_reset());
 
             // Time (mean ± σ)
@@ -2689,45 +10565,63 @@ void zap_compare_end(zap_compare_ctx_t* ctx) {
             // Range (min … max)
             printf("    %sRange (min \342\200\246 max):%s  %s \342\200\246 %s\n",
                    zap__c_dim(), zap__c_reset(), min_buf, max_buf);
+            zap__print_precision(&r->stats, "    ");
+            zap__print_fit(&r->stats, "    ");
+            zap__print_latency(&r->stats, "    ");
 
             // Throughput if set
             if (r->stats.throughput_type != ZAP_THROUGHPUT_NONE && r->stats.throughput_value > 0) {
-                char tput_buf[32];
+                char tput_buf[32], peak_buf[64];
                 zap__format_throughput(r->stats.mean, r->stats.throughput_value,
                                        r->stats.throughput_type, tput_buf, sizeof(tput_buf));
-                printf("    %sThroughput:%s        %s%s%s\n",
+                zap__format_roofline(&r->stats, peak_buf, sizeof(peak_buf));
+                printf("    %sThroughput:%s        %s%s%s%s\n",
                        zap__c_dim(), zap__c_reset(),
-                       zap__c_cyan(), tput_buf, zap__c_reset());
+                       zap__c_cyan(), tput_buf, zap__c_reset(), peak_buf);
             }
 
-            // Speedup vs all other implementations
+            // Hardware counters if collected
+            zap__print_metrics(&r->stats, NULL, "    ");
+
+            // Speedup vs all other implementations, or only the reference for
+            // ISA variants (a full matrix of those is unreadable)
             for (size_t j = 0; j < ctx->impl_count; j++) {
                 if (j == i || !ctx->results[j].valid) continue;
+                if (ctx->has_isa && j != baseline_idx) continue;
 
                 double speedup = ctx->results[j].stats.mean / r->stats.mean;
                 const char* other_name = ctx->results[j].name;
 
+                // Interleaved: from per-round pairs, with an interval
+                double lo = 0.0, hi = 0.0;
+                char paired_buf[64] = "";
+                if (g->interleave && zap__paired_speedup(&ctx->results[j].stats, &r->stats,
+                                                         &speedup, &lo, &hi)) {
+                    snprintf(paired_buf, sizeof(paired_buf), " %s(paired, 95%% CI %.2fx..%.2fx)%s",
+                             zap__c_dim(), lo, hi, zap__c_reset());
+                }
+
                 // Calculate padding for alignment
                 int name_len = (int)strlen(other_name);
                 int padding = 12 - name_len;
                 if (padding < 1) padding = 1;
 
                 if (speedup >= 1.0) {
-                    printf("    %svs %s:%s%*s%s%.2fx faster%s\n",
+                    printf("    %svs %s:%s%*s%s%.2fx faster%s%s\n",
                            zap__c_dim(), other_name, zap__c_reset(),
                            padding, "",
-                           zap__c_green(), speedup, zap__c_reset());
+                           zap__c_green(), speedup, zap__c_reset(), paired_buf);
                 } else {
                     double pct_slower = (1.0 / speedup - 1.0) * 100.0;
-                    printf("    %svs %s:%s%*s%s%.2fx (%.0f%% slower)%s\n",
+                    printf("    %svs %s:%s%*s%s%.2fx (%.0f%% slower)%s%s\n",
                            zap__c_dim(), other_name, zap__c_reset(),
                            padding, "",
-                           zap__c_red(), speedup, pct_slower, zap__c_reset());
+                           zap__c_red(), speedup, pct_slower, zap__c_reset(), paired_buf);
                 }
             }
 
             // Compare with previous run (include group name to avoid collisions)
-            char full_bench_name[384];
+            char full_bench_name[512];
             snprintf(full_bench_name, sizeof(full_bench_name), "%s/%s/%s [%s]",
                      g->name, ctx->id.label, ctx->id.param_str, r->name);
             const zap_baseline_entry_t* prev = zap_baseline_find(&zap_g_config.baseline, full_bench_name);
@@ -2741,27 +10635,29 @@ void zap_compare_end(zap_compare_ctx_t* ctx) {
                 const char* change_text;
                 zap__change_style(cmp.change, &change_color, &change_text);
 
-                printf("    %svs previous:%s      %s%.2fx %s%s (was %s)\n",
+                char test_buf[48];
+                zap__format_test(&cmp, test_buf, sizeof(test_buf));
+                printf("    %svs previous:%s      %s%.2fx %s%s (was %s%s)\n",
                        zap__c_dim(), zap__c_reset(),
                        change_color, zap__speedup(cmp.old_mean, cmp.new_mean),
-                       change_text, zap__c_reset(), old_mean_buf);
+                       change_text, zap__c_reset(), old_mean_buf, test_buf);
 
                 // Track regression
-                if (zap_g_config.fail_threshold > 0.0 &&
-                    cmp.change == ZAP_REGRESSED &&
-                    cmp.change_pct > zap_g_config.fail_threshold) {
+                if (zap__exceeds_threshold(&cmp)) {
                     zap_g_config.has_regression = true;
                 }
             }
 
-            // Save to baseline
-            if (zap_g_config.save_baseline) {
-                zap_baseline_add(&zap_g_config.baseline, full_bench_name, &r->stats);
-            }
+            zap__save_result(full_bench_name, &r->stats);
 
             printf("\n");
         }
     }
+
+    for (size_t i = 0; i < ctx->impl_count; i++) {
+        free(ctx->results[i].stats.samples);
+        ctx->results[i].stats.samples = NULL;
+    }
 }
 
 void zap_compare_group_finish(zap_compare_group_t* g) {
@@ -2769,6 +10665,10 @@ void zap_compare_group_finish(zap_compare_group_t* g) {
         printf("\n");
     }
     memset(g, 0, sizeof(*g));
+    free(zap__compare_ctx.results);
+    zap__compare_ctx.results = NULL;
+    zap__compare_ctx.impl_capacity = 0;
+    zap__compare_ctx.impl_count = 0;
 }
 
 #endif /* ZAP_IMPLEMENTATION */